@@ -42,6 +42,7 @@
 #define GALLIVM_DEBUG_PERF          (1 << 3)
 #define GALLIVM_DEBUG_GC            (1 << 4)
 #define GALLIVM_DEBUG_DUMP_BC       (1 << 5)
+#define GALLIVM_DEBUG_CACHE_STATS   (1 << 6)
 
 #define GALLIVM_PERF_BRILINEAR       (1 << 0)
 #define GALLIVM_PERF_RHO_APPROX      (1 << 1)
@@ -44,15 +44,19 @@ struct lp_type;
 struct lp_build_context;
 
 
-#define LP_BUILD_FORMAT_CACHE_DEBUG 0
 /*
  * Block cache
  *
- * Optional block cache to be used when unpacking big pixel blocks.
+ * Optional cache of decoded blocks, used when unpacking big pixel blocks
+ * (s3tc, bptc) which are too expensive to decode for every texel.
+ * It is set associative, with round-robin replacement within a set.
  * Must be a power of 2
  */
 
 #define LP_BUILD_FORMAT_CACHE_SIZE 128
+#define LP_BUILD_FORMAT_CACHE_WAYS 4
+#define LP_BUILD_FORMAT_CACHE_SETS \
+   (LP_BUILD_FORMAT_CACHE_SIZE / LP_BUILD_FORMAT_CACHE_WAYS)
 
 /*
  * Note: cache_data needs 16 byte alignment.
@@ -61,20 +65,20 @@ struct lp_build_format_cache
 {
    alignas(16) uint32_t cache_data[LP_BUILD_FORMAT_CACHE_SIZE][4][4];
    uint64_t cache_tags[LP_BUILD_FORMAT_CACHE_SIZE];
-#if LP_BUILD_FORMAT_CACHE_DEBUG
+   /* next way to replace in each set */
+   uint32_t cache_victim[LP_BUILD_FORMAT_CACHE_SETS];
+   /* only counted with GALLIVM_DEBUG_CACHE_STATS */
    uint64_t cache_access_total;
    uint64_t cache_access_miss;
-#endif
 };
 
 
 enum cache_member {
    LP_BUILD_FORMAT_CACHE_MEMBER_DATA = 0,
    LP_BUILD_FORMAT_CACHE_MEMBER_TAGS,
-#if LP_BUILD_FORMAT_CACHE_DEBUG
+   LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM,
    LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL,
    LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS,
-#endif
    LP_BUILD_FORMAT_CACHE_MEMBER_COUNT
 };
 
@@ -88,6 +92,19 @@ lp_build_format_cache_member_type(struct gallivm_state *gallivm, enum cache_memb
 LLVMTypeRef
 lp_build_format_cache_elem_type(struct gallivm_state *gallivm, enum cache_member member);
 
+bool
+lp_build_format_cache_supported(const struct util_format_description *format_desc);
+
+LLVMValueRef
+lp_build_fetch_cached_texels(struct gallivm_state *gallivm,
+                             const struct util_format_description *format_desc,
+                             unsigned n,
+                             LLVMValueRef base_ptr,
+                             LLVMValueRef offset,
+                             LLVMValueRef i,
+                             LLVMValueRef j,
+                             LLVMValueRef cache);
+
 /*
  * AoS
  */
@@ -194,6 +211,12 @@ lp_build_fetch_s3tc_rgba_aos(struct gallivm_state *gallivm,
                              LLVMValueRef j,
                              LLVMValueRef cache);
 
+void
+lp_build_s3tc_decode_block(struct gallivm_state *gallivm,
+                           const struct util_format_description *format_desc,
+                           LLVMValueRef ptr_addr,
+                           LLVMValueRef col[4]);
+
 /*
  * RGTC
  */
@@ -0,0 +1,482 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Cache of decoded blocks for compressed formats.
+ *
+ * Decoding a texel of most compressed formats means decoding (a good part
+ * of) its whole block, and neighbouring texels are very likely to be
+ * fetched next, so decoded 4x4 blocks are kept in a small per-thread
+ * cache (struct lp_build_format_cache).
+ *
+ * The cache is set associative: the block address picks a set, whose ways
+ * are all compared against the address, and on a miss the block replaces
+ * the ways of its set in turn.
+ */
+
+
+#include "util/format/u_format.h"
+#include "util/u_math.h"
+#include "util/u_pointer.h"
+
+#include "lp_bld_const.h"
+#include "lp_bld_debug.h"
+#include "lp_bld_flow.h"
+#include "lp_bld_format.h"
+#include "lp_bld_init.h"
+#include "lp_bld_intr.h"
+#include "lp_bld_misc.h"
+#include "lp_bld_struct.h"
+#include "lp_bld_swizzle.h"
+#include "lp_bld_type.h"
+
+
+/**
+ * Whether the format's blocks are decoded through the block cache when
+ * one is available.
+ *
+ * Not etc1: a texel of it decodes on its own, so decoding the whole block
+ * on a miss costs more than the hits save unless almost every fetch hits.
+ */
+bool
+lp_build_format_cache_supported(const struct util_format_description *format_desc)
+{
+   switch (format_desc->layout) {
+   case UTIL_FORMAT_LAYOUT_S3TC:
+      return true;
+   case UTIL_FORMAT_LAYOUT_BPTC:
+      /* The float variants don't fit in 8 bits per channel. */
+      return format_desc->format == PIPE_FORMAT_BPTC_RGBA_UNORM ||
+             format_desc->format == PIPE_FORMAT_BPTC_SRGBA;
+   default:
+      return false;
+   }
+}
+
+
+static LLVMValueRef
+cache_member_ptr(struct gallivm_state *gallivm,
+                 LLVMValueRef cache,
+                 enum cache_member member,
+                 LLVMValueRef index)
+{
+   LLVMValueRef indices[3];
+
+   indices[0] = lp_build_const_int32(gallivm, 0);
+   indices[1] = lp_build_const_int32(gallivm, member);
+   indices[2] = index;
+
+   return LLVMBuildGEP2(gallivm->builder, lp_build_format_cache_type(gallivm),
+                        cache, indices, ARRAY_SIZE(indices), "cache_gep");
+}
+
+
+static LLVMValueRef
+lookup_cache_member(struct gallivm_state *gallivm,
+                    LLVMValueRef cache,
+                    enum cache_member member,
+                    LLVMValueRef index,
+                    const char *name)
+{
+   LLVMValueRef member_ptr = cache_member_ptr(gallivm, cache, member, index);
+
+   return LLVMBuildLoad2(gallivm->builder,
+                         lp_build_format_cache_elem_type(gallivm, member),
+                         member_ptr, name);
+}
+
+
+static void
+update_cache_access(struct gallivm_state *gallivm,
+                    LLVMValueRef ptr,
+                    unsigned count,
+                    unsigned index)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i64t = LLVMInt64TypeInContext(gallivm->context);
+   LLVMValueRef member_ptr, cache_access;
+
+   assert(index == LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL ||
+          index == LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
+   LLVMTypeRef cache_type = lp_build_format_cache_type(gallivm);
+   member_ptr = lp_build_struct_get_ptr2(gallivm, cache_type, ptr, index, "");
+   cache_access = LLVMBuildLoad2(builder, i64t, member_ptr, "cache_access");
+   cache_access = LLVMBuildAdd(builder, cache_access,
+                               LLVMConstInt(i64t, count, 0), "");
+   LLVMBuildStore(builder, cache_access, member_ptr);
+}
+
+
+/**
+ * Index of texel (i, j) within a cached block.
+ *
+ * The s3tc decode produces blocks column by column, everything else is
+ * unpacked row by row.
+ */
+static LLVMValueRef
+cached_texel_index(struct gallivm_state *gallivm,
+                   const struct util_format_description *format_desc,
+                   struct lp_type type,
+                   LLVMValueRef i,
+                   LLVMValueRef j)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef major = i, minor = j;
+
+   if (format_desc->layout != UTIL_FORMAT_LAYOUT_S3TC) {
+      major = j;
+      minor = i;
+   }
+
+   major = LLVMBuildShl(builder, major, lp_build_const_int_vec(gallivm, type, 2), "");
+   return LLVMBuildAdd(builder, major, minor, "");
+}
+
+
+static void
+generate_update_cache_one_block(struct gallivm_state *gallivm,
+                                LLVMValueRef function,
+                                const struct util_format_description *format_desc)
+{
+   LLVMBasicBlockRef block;
+   LLVMBuilderRef old_builder;
+   LLVMValueRef ptr_addr;
+   LLVMValueRef slot;
+   LLVMValueRef cache;
+   LLVMValueRef data_index, tag_value;
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMTypeRef pi8t = LLVMPointerType(i8t, 0);
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+
+   ptr_addr = LLVMGetParam(function, 0);
+   slot     = LLVMGetParam(function, 1);
+   cache    = LLVMGetParam(function, 2);
+
+   lp_build_name(ptr_addr, "ptr_addr"  );
+   lp_build_name(slot,     "slot"      );
+   lp_build_name(cache,    "cache_addr");
+
+   /*
+    * Function body
+    */
+
+   old_builder = gallivm->builder;
+   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
+   gallivm->builder = LLVMCreateBuilderInContext(gallivm->context);
+   LLVMPositionBuilderAtEnd(gallivm->builder, block);
+
+   data_index = LLVMBuildMul(gallivm->builder, slot,
+                             lp_build_const_int32(gallivm, 16), "");
+
+   if (format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) {
+      LLVMTypeRef type_ptr4x32 = LLVMPointerType(LLVMVectorType(i32t, 4), 0);
+      LLVMValueRef col[4];
+
+      lp_build_s3tc_decode_block(gallivm, format_desc, ptr_addr, col);
+
+      for (unsigned count = 0; count < 4; count++) {
+         LLVMValueRef ptr;
+
+         ptr = cache_member_ptr(gallivm, cache,
+                                LP_BUILD_FORMAT_CACHE_MEMBER_DATA, data_index);
+         ptr = LLVMBuildBitCast(gallivm->builder, ptr, type_ptr4x32, "");
+         LLVMBuildStore(gallivm->builder, col[count], ptr);
+         data_index = LLVMBuildAdd(gallivm->builder, data_index,
+                                   lp_build_const_int32(gallivm, 4), "");
+      }
+   } else {
+      /*
+       * There is no vectorized decode for these, so unpack the whole block
+       * straight into the cache with the util_format code, instead of
+       * calling fetch_rgba_8unorm() for every texel.
+       */
+      const struct util_format_unpack_description *unpack =
+         util_format_unpack_description(format_desc->format);
+      LLVMTypeRef arg_types[6];
+      LLVMValueRef args[6];
+      LLVMValueRef function_ptr;
+
+      assert(unpack->unpack_rgba_8unorm_rect);
+
+      /*
+       * Function to call looks like:
+       *   unpack(uint8_t *dst, unsigned dst_stride,
+       *          const uint8_t *src, unsigned src_stride,
+       *          unsigned width, unsigned height)
+       */
+      arg_types[0] = pi8t;
+      arg_types[1] = i32t;
+      arg_types[2] = pi8t;
+      arg_types[3] = i32t;
+      arg_types[4] = i32t;
+      arg_types[5] = i32t;
+      LLVMTypeRef function_type =
+         LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                          arg_types, ARRAY_SIZE(arg_types), 0);
+
+      if (gallivm->cache)
+         gallivm->cache->dont_cache = true;
+      function_ptr = lp_build_const_func_pointer_from_type(gallivm,
+                        func_to_pointer((func_pointer) unpack->unpack_rgba_8unorm_rect),
+                        function_type, format_desc->short_name);
+
+      args[0] = cache_member_ptr(gallivm, cache,
+                                 LP_BUILD_FORMAT_CACHE_MEMBER_DATA, data_index);
+      args[0] = LLVMBuildBitCast(gallivm->builder, args[0], pi8t, "");
+      args[1] = lp_build_const_int32(gallivm, 4 * sizeof(uint32_t));
+      args[2] = ptr_addr;
+      /* a single row of blocks */
+      args[3] = lp_build_const_int32(gallivm, 0);
+      args[4] = lp_build_const_int32(gallivm, format_desc->block.width);
+      args[5] = lp_build_const_int32(gallivm, format_desc->block.height);
+
+      LLVMBuildCall2(gallivm->builder, function_type, function_ptr,
+                     args, ARRAY_SIZE(args), "");
+   }
+
+   tag_value = LLVMBuildPtrToInt(gallivm->builder, ptr_addr,
+                                 LLVMInt64TypeInContext(gallivm->context), "");
+   LLVMBuildStore(gallivm->builder, tag_value,
+                  cache_member_ptr(gallivm, cache,
+                                   LP_BUILD_FORMAT_CACHE_MEMBER_TAGS, slot));
+
+   LLVMBuildRetVoid(gallivm->builder);
+
+   LLVMDisposeBuilder(gallivm->builder);
+   gallivm->builder = old_builder;
+
+   gallivm_verify_function(gallivm, function);
+}
+
+
+static void
+update_cached_block(struct gallivm_state *gallivm,
+                    const struct util_format_description *format_desc,
+                    LLVMValueRef ptr_addr,
+                    LLVMValueRef slot,
+                    LLVMValueRef cache)
+
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMModuleRef module = gallivm->module;
+   char name[256];
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMTypeRef pi8t = LLVMPointerType(i8t, 0);
+   LLVMValueRef function, inst;
+   LLVMBasicBlockRef bb;
+   LLVMValueRef args[3];
+
+   snprintf(name, sizeof name, "%s_update_cache_one_block",
+            format_desc->short_name);
+   function = LLVMGetNamedFunction(module, name);
+
+   LLVMTypeRef ret_type = LLVMVoidTypeInContext(gallivm->context);
+   LLVMTypeRef arg_types[3];
+   arg_types[0] = pi8t;
+   arg_types[1] = LLVMInt32TypeInContext(gallivm->context);
+   arg_types[2] = LLVMTypeOf(cache); // XXX: put right type here
+   LLVMTypeRef function_type = LLVMFunctionType(ret_type, arg_types, ARRAY_SIZE(arg_types), 0);
+
+   if (!function) {
+      function = LLVMAddFunction(module, name, function_type);
+
+      for (unsigned arg = 0; arg < ARRAY_SIZE(arg_types); ++arg)
+         if (LLVMGetTypeKind(arg_types[arg]) == LLVMPointerTypeKind)
+            lp_add_function_attr(function, arg + 1, LP_FUNC_ATTR_NOALIAS);
+
+      LLVMSetFunctionCallConv(function, LLVMFastCallConv);
+      LLVMSetVisibility(function, LLVMHiddenVisibility);
+      generate_update_cache_one_block(gallivm, function, format_desc);
+   }
+
+   args[0] = ptr_addr;
+   args[1] = slot;
+   args[2] = cache;
+
+   LLVMBuildCall2(builder, function_type, function, args, ARRAY_SIZE(args), "");
+   bb = LLVMGetInsertBlock(builder);
+   inst = LLVMGetLastInstruction(bb);
+   LLVMSetInstructionCallConv(inst, LLVMFastCallConv);
+}
+
+
+/**
+ * Look up a single texel, decoding its block into the cache on a miss.
+ *
+ * @param addr  i64 address of the block, which also serves as the tag
+ * @param set  i32 set the block maps to
+ * @param texel  i32 index of the texel within the block
+ * @return  the i32 RGBA8 texel
+ */
+static LLVMValueRef
+fetch_cached_texel(struct gallivm_state *gallivm,
+                   const struct util_format_description *format_desc,
+                   LLVMValueRef cache,
+                   LLVMValueRef addr,
+                   LLVMValueRef set,
+                   LLVMValueRef texel)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMValueRef first_way, victim, slot, hit, index;
+   struct lp_build_if_state if_ctx;
+
+   first_way = LLVMBuildShl(builder, set,
+                            lp_build_const_int32(gallivm,
+                               util_logbase2(LP_BUILD_FORMAT_CACHE_WAYS)), "");
+   victim = lookup_cache_member(gallivm, cache,
+                                LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM, set,
+                                "victim");
+
+   /*
+    * Compare all the ways of the set. Unless one matches, the block goes
+    * into the victim way.
+    */
+   slot = LLVMBuildAdd(builder, first_way, victim, "");
+   hit = LLVMConstInt(LLVMInt1TypeInContext(gallivm->context), 0, 0);
+   for (unsigned way = 0; way < LP_BUILD_FORMAT_CACHE_WAYS; way++) {
+      LLVMValueRef way_slot, tag, match;
+
+      way_slot = LLVMBuildAdd(builder, first_way,
+                              lp_build_const_int32(gallivm, way), "");
+      tag = lookup_cache_member(gallivm, cache,
+                                LP_BUILD_FORMAT_CACHE_MEMBER_TAGS, way_slot,
+                                "tag_data");
+      match = LLVMBuildICmp(builder, LLVMIntEQ, tag, addr, "");
+      slot = LLVMBuildSelect(builder, match, way_slot, slot, "");
+      hit = LLVMBuildOr(builder, hit, match, "");
+   }
+
+   lp_build_if(&if_ctx, gallivm, LLVMBuildNot(builder, hit, ""));
+   {
+      LLVMValueRef ptr_addr, next;
+
+      ptr_addr = LLVMBuildIntToPtr(builder, addr, LLVMPointerType(i8t, 0), "");
+      update_cached_block(gallivm, format_desc, ptr_addr, slot, cache);
+
+      next = LLVMBuildAdd(builder, victim, lp_build_const_int32(gallivm, 1), "");
+      next = LLVMBuildAnd(builder, next,
+                          lp_build_const_int32(gallivm,
+                                               LP_BUILD_FORMAT_CACHE_WAYS - 1), "");
+      LLVMBuildStore(builder, next,
+                     cache_member_ptr(gallivm, cache,
+                                      LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM, set));
+      if (gallivm_debug & GALLIVM_DEBUG_CACHE_STATS)
+         update_cache_access(gallivm, cache, 1,
+                             LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
+   }
+   lp_build_endif(&if_ctx);
+
+   index = LLVMBuildMul(builder, slot, lp_build_const_int32(gallivm, 16), "");
+   index = LLVMBuildAdd(builder, index, texel, "");
+   return lookup_cache_member(gallivm, cache, LP_BUILD_FORMAT_CACHE_MEMBER_DATA,
+                              index, "cache_data");
+}
+
+
+/**
+ * Fetch texels through the block cache.
+ *
+ * @param n  number of pixels processed (1 or a multiple of 4)
+ * @param base_ptr  base pointer
+ * @param offset <n x i32> vector with the relative offsets of the blocks
+ * @param i  is a <n x i32> vector with the x subpixel coordinate (0..3)
+ * @param j  is a <n x i32> vector with the y subpixel coordinate (0..3)
+ * @param cache  pointer to a lp_build_format_cache structure
+ * @return  a <4*n x i8> vector with the pixel RGBA values in AoS
+ */
+LLVMValueRef
+lp_build_fetch_cached_texels(struct gallivm_state *gallivm,
+                             const struct util_format_description *format_desc,
+                             unsigned n,
+                             LLVMValueRef base_ptr,
+                             LLVMValueRef offset,
+                             LLVMValueRef i,
+                             LLVMValueRef j,
+                             LLVMValueRef cache)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned low_bit, log2size;
+   LLVMValueRef color, addr, ptr_addrtrunc, tmp;
+   LLVMValueRef texel_index, set_index;
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef i64t = LLVMInt64TypeInContext(gallivm->context);
+   struct lp_type type;
+   struct lp_build_context bld32;
+
+   assert(lp_build_format_cache_supported(format_desc));
+   assert(format_desc->block.width == 4);
+   assert(format_desc->block.height == 4);
+   assert((n == 1) || (n % 4 == 0));
+
+   memset(&type, 0, sizeof type);
+   type.width = 32;
+   type.length = n;
+
+   lp_build_context_init(&bld32, gallivm, type);
+
+   /*
+    * compute the set - the hash function could be better but it needs to
+    *                   be simple
+    * per-element:
+    *    compare offset with the offsets stored at the tags of the set
+    *    if none is equal extract block, store block, update tag
+    *    extract color from cache
+    *    assemble colors
+    */
+
+   low_bit = util_logbase2(format_desc->block.bits / 8);
+   log2size = util_logbase2(LP_BUILD_FORMAT_CACHE_SETS);
+   addr = LLVMBuildPtrToInt(builder, base_ptr, i64t, "");
+   ptr_addrtrunc = LLVMBuildPtrToInt(builder, base_ptr, i32t, "");
+   ptr_addrtrunc = lp_build_broadcast_scalar(&bld32, ptr_addrtrunc);
+   /* For the hash function, first mask off the unused lowest bits. Then just
+      do some xor with address bits - only use lower 32bits */
+   ptr_addrtrunc = LLVMBuildAdd(builder, offset, ptr_addrtrunc, "");
+   ptr_addrtrunc = LLVMBuildLShr(builder, ptr_addrtrunc,
+                                 lp_build_const_int_vec(gallivm, type, low_bit), "");
+   set_index = ptr_addrtrunc;
+   ptr_addrtrunc = LLVMBuildLShr(builder, ptr_addrtrunc,
+                                 lp_build_const_int_vec(gallivm, type, 2*log2size), "");
+   set_index = LLVMBuildXor(builder, ptr_addrtrunc, set_index, "");
+   tmp = LLVMBuildLShr(builder, set_index,
+                       lp_build_const_int_vec(gallivm, type, log2size), "");
+   set_index = LLVMBuildXor(builder, set_index, tmp, "");
+   set_index = LLVMBuildAnd(builder, set_index,
+                            lp_build_const_int_vec(gallivm, type,
+                                                   LP_BUILD_FORMAT_CACHE_SETS - 1), "");
+
+   texel_index = cached_texel_index(gallivm, format_desc, type, i, j);
+
+   if (n > 1) {
+      color = bld32.undef;
+      for (unsigned count = 0; count < n; count++) {
+         LLVMValueRef index, colorx, addrx, setx, texelx;
+
+         index = lp_build_const_int32(gallivm, count);
+         addrx = LLVMBuildExtractElement(builder, offset, index, "");
+         addrx = LLVMBuildZExt(builder, addrx, i64t, "");
+         addrx = LLVMBuildAdd(builder, addrx, addr, "");
+         setx = LLVMBuildExtractElement(builder, set_index, index, "");
+         texelx = LLVMBuildExtractElement(builder, texel_index, index, "");
+
+         colorx = fetch_cached_texel(gallivm, format_desc, cache,
+                                     addrx, setx, texelx);
+
+         color = LLVMBuildInsertElement(builder, color, colorx, index, "");
+      }
+   }
+   else {
+      tmp = LLVMBuildZExt(builder, offset, i64t, "");
+      addr = LLVMBuildAdd(builder, tmp, addr, "");
+      color = fetch_cached_texel(gallivm, format_desc, cache,
+                                 addr, set_index, texel_index);
+   }
+   if (gallivm_debug & GALLIVM_DEBUG_CACHE_STATS)
+      update_cache_access(gallivm, cache, n,
+                          LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL);
+   return LLVMBuildBitCast(builder, color, LLVMVectorType(i8t, n * 4), "");
+}
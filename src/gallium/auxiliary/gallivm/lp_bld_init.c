@@ -63,23 +63,29 @@ enum LLVM_CodeGenOpt_Level {
 };
 
 
+/**
+ * Whether the module gets the full set of optimization passes and codegen
+ * optimizations, or just the bare minimum.
+ */
+static bool
+gallivm_optimize(const struct gallivm_state *gallivm)
+{
+   return !gallivm->no_opt && !(gallivm_perf & GALLIVM_PERF_NO_OPT);
+}
+
+
 /**
  * Create the LLVM (optimization) pass manager and install
  * relevant optimization passes.
+ * This is deferred until the module is compiled, as gallivm_state::no_opt
+ * may be set at any point before that.
  * \return  TRUE for success, FALSE for failure
  */
 static bool
 create_pass_manager(struct gallivm_state *gallivm)
 {
-   {
-      char *td_str;
-      // New ones from the Module.
-      td_str = LLVMCopyStringRepOfTargetData(gallivm->target);
-      LLVMSetDataLayout(gallivm->module, td_str);
-      free(td_str);
-   }
-
-   return lp_passmgr_create(gallivm->module, &gallivm->passmgr);
+   return lp_passmgr_create(gallivm->module, gallivm_optimize(gallivm),
+                            &gallivm->passmgr);
 }
 
 /**
@@ -147,7 +153,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if (!gallivm_optimize(gallivm)) {
          optlevel = None;
       }
       else {
@@ -281,8 +287,13 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
       }
    }
 
-   if (!create_pass_manager(gallivm))
-      goto fail;
+   {
+      char *td_str;
+      // New ones from the Module.
+      td_str = LLVMCopyStringRepOfTargetData(gallivm->target);
+      LLVMSetDataLayout(gallivm->module, td_str);
+      free(td_str);
+   }
 
    lp_build_coro_declare_malloc_hooks(gallivm);
    return true;
@@ -392,18 +403,23 @@ gallivm_compile_module(struct gallivm_state *gallivm)
       LLVMWriteBitcodeToFile(gallivm->module, filename);
       debug_printf("%s written\n", filename);
       debug_printf("Invoke as \"opt %s %s | llc -O%d %s%s\"\n",
-                   gallivm_perf & GALLIVM_PERF_NO_OPT ? "-mem2reg" :
+                   !gallivm_optimize(gallivm) ? "-mem2reg" :
                    "-sroa -early-cse -simplifycfg -reassociate "
                    "-mem2reg -constprop -instcombine -gvn",
-                   filename, gallivm_perf & GALLIVM_PERF_NO_OPT ? 0 : 2,
+                   filename, gallivm_optimize(gallivm) ? 2 : 0,
                    "[-mcpu=<-mcpu option>] ",
                    "[-mattr=<-mattr option(s)>]");
    }
 
+   if (!create_pass_manager(gallivm)) {
+      assert(0);
+   }
+
    lp_passmgr_run(gallivm->passmgr,
                   gallivm->module,
                   LLVMGetExecutionEngineTargetMachine(gallivm->engine),
-                  gallivm->module_name);
+                  gallivm->module_name,
+                  gallivm_optimize(gallivm));
 
    /* Setting the module's DataLayout to an empty string will cause the
     * ExecutionEngine to copy to the DataLayout string from its target machine
@@ -67,6 +67,10 @@ struct gallivm_state
    LLVMBuilderRef builder;
    struct lp_cached_code *cache;
    unsigned compiled;
+   /** Skip the optimization passes when compiling, for a faster compile of
+    * slower code.  Only honoured by MCJIT, ORCJIT optimizes every module
+    * the same way. */
+   bool no_opt;
    LLVMValueRef coro_malloc_hook;
    LLVMValueRef coro_free_hook;
    LLVMValueRef debug_printf_hook;
@@ -54,6 +54,7 @@ static const struct debug_named_value lp_bld_debug_flags[] = {
    { "asm",    GALLIVM_DEBUG_ASM, NULL },
    { "perf",   GALLIVM_DEBUG_PERF, NULL },
    { "gc",     GALLIVM_DEBUG_GC, NULL },
+   { "cache_stats", GALLIVM_DEBUG_CACHE_STATS, "count texture block cache hits and misses" },
 /* Don't allow setting DUMP_BC for release builds, since writing the files may be an issue with setuid. */
 #if MESA_DEBUG
    { "dumpbc", GALLIVM_DEBUG_DUMP_BC, NULL },
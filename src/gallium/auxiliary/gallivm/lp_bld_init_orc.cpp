@@ -306,12 +306,14 @@ void lpjit_exit()
 
 LLVMErrorRef module_transform(void *Ctx, LLVMModuleRef mod) {
    struct lp_passmgr *mgr;
+   bool optimize = !(gallivm_perf & GALLIVM_PERF_NO_OPT);
 
-   lp_passmgr_create(mod, &mgr);
+   lp_passmgr_create(mod, optimize, &mgr);
 
    lp_passmgr_run(mgr, mod,
                   LPJit::get_instance()->tm,
-                  get_module_name(mod));
+                  get_module_name(mod),
+                  optimize);
 
    lp_passmgr_dispose(mgr);
    return LLVMErrorSuccess;
@@ -41,11 +41,13 @@ struct lp_passmgr;
  * mgr can be returned as NULL for modern pass mgr handling
  * so use a bool to denote success/fail.
  */
-bool lp_passmgr_create(LLVMModuleRef module, struct lp_passmgr **mgr);
+bool lp_passmgr_create(LLVMModuleRef module, bool optimize,
+                       struct lp_passmgr **mgr);
 void lp_passmgr_run(struct lp_passmgr *mgr,
                     LLVMModuleRef module,
                     LLVMTargetMachineRef tm,
-                    const char *module_name);
+                    const char *module_name,
+                    bool optimize);
 void lp_passmgr_dispose(struct lp_passmgr *mgr);
 
 #ifdef __cplusplus
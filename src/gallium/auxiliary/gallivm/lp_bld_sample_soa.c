@@ -4196,10 +4196,10 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
    if (layer && op_type == LP_SAMPLER_OP_LODQ)
       layer = 0;
 
-   if (dynamic_state->cache_ptr) {
+   if (dynamic_state->cache_ptr && thread_data_type) {
       const struct util_format_description *format_desc;
       format_desc = util_format_description(static_texture_state->format);
-      if (format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) {
+      if (lp_build_format_cache_supported(format_desc)) {
          need_cache = true;
       }
    }
@@ -4321,10 +4321,10 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
       layer = 0;
 
    bool need_cache = false;
-   if (dynamic_state->cache_ptr) {
+   if (dynamic_state->cache_ptr && params->thread_data_type) {
       const struct util_format_description *format_desc;
       format_desc = util_format_description(static_texture_state->format);
-      if (format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) {
+      if (lp_build_format_cache_supported(format_desc)) {
          need_cache = true;
       }
    }
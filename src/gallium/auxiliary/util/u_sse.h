@@ -42,9 +42,16 @@
 #include "util/u_debug.h"
 
 #if DETECT_ARCH_SSE
-
 #include <emmintrin.h>
+#define UTIL_SSE2_INTRINSICS 1
+#elif DETECT_ARCH_AARCH64
+#include "util/u_sse_neon.h"
+#define UTIL_SSE2_INTRINSICS 1
+#else
+#define UTIL_SSE2_INTRINSICS 0
+#endif
 
+#if UTIL_SSE2_INTRINSICS
 
 union m128i {
    __m128i m;
@@ -585,6 +592,6 @@ util_sse2_stretch_row_8unorm(__m128i * restrict dst,
 
 
 
-#endif /* DETECT_ARCH_SSE */
+#endif /* UTIL_SSE2_INTRINSICS */
 
 #endif /* U_SSE_H_ */
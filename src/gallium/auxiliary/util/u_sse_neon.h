@@ -0,0 +1,380 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * SSE2 integer intrinsics on top of NEON.
+ *
+ * Only the subset used by u_sse.h and llvmpipe's linear rasterization
+ * paths is provided.  Every function reproduces the exact SSE2 result,
+ * including wrap-around, saturation and out of range shift counts, so
+ * that code written against SSE2 produces bit identical results on
+ * AArch64.
+ */
+
+#ifndef U_SSE_NEON_H_
+#define U_SSE_NEON_H_
+
+#include "util/detect.h"
+#include "util/compiler.h"
+#include "util/macros.h"
+
+#if DETECT_ARCH_AARCH64
+
+#include <arm_neon.h>
+
+typedef int32x4_t __m128i;
+
+#define _MM_SHUFFLE(z, y, x, w) (((z) << 6) | ((y) << 4) | ((x) << 2) | (w))
+
+#define NEON_S8(a)  vreinterpretq_s8_s32(a)
+#define NEON_U8(a)  vreinterpretq_u8_s32(a)
+#define NEON_S16(a) vreinterpretq_s16_s32(a)
+#define NEON_U16(a) vreinterpretq_u16_s32(a)
+#define NEON_U32(a) vreinterpretq_u32_s32(a)
+#define NEON_S64(a) vreinterpretq_s64_s32(a)
+#define NEON_U64(a) vreinterpretq_u64_s32(a)
+
+
+/*
+ * Initialization, loads and stores
+ */
+
+static ALWAYS_INLINE __m128i
+_mm_setzero_si128(void)
+{
+   return vdupq_n_s32(0);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_set1_epi32(int i)
+{
+   return vdupq_n_s32(i);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_set1_epi16(short s)
+{
+   return vreinterpretq_s32_s16(vdupq_n_s16(s));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_setr_epi32(int i0, int i1, int i2, int i3)
+{
+   const int32_t v[4] = { i0, i1, i2, i3 };
+   return vld1q_s32(v);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_set_epi32(int i3, int i2, int i1, int i0)
+{
+   return _mm_setr_epi32(i0, i1, i2, i3);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_setr_epi16(short s0, short s1, short s2, short s3,
+               short s4, short s5, short s6, short s7)
+{
+   const int16_t v[8] = { s0, s1, s2, s3, s4, s5, s6, s7 };
+   return vreinterpretq_s32_s16(vld1q_s16(v));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_cvtsi32_si128(int a)
+{
+   return vsetq_lane_s32(a, vdupq_n_s32(0), 0);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_load_si128(const __m128i *p)
+{
+   return vld1q_s32((const int32_t *)p);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_loadu_si128(const __m128i *p)
+{
+   return vld1q_s32((const int32_t *)p);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_loadl_epi64(const __m128i *p)
+{
+   return vcombine_s32(vld1_s32((const int32_t *)p), vdup_n_s32(0));
+}
+
+static ALWAYS_INLINE void
+_mm_store_si128(__m128i *p, __m128i a)
+{
+   vst1q_s32((int32_t *)p, a);
+}
+
+static ALWAYS_INLINE void
+_mm_storeu_si128(__m128i *p, __m128i a)
+{
+   vst1q_s32((int32_t *)p, a);
+}
+
+
+/*
+ * Logical operations
+ */
+
+static ALWAYS_INLINE __m128i
+_mm_and_si128(__m128i a, __m128i b)
+{
+   return vandq_s32(a, b);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_andnot_si128(__m128i a, __m128i b)
+{
+   return vbicq_s32(b, a);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_or_si128(__m128i a, __m128i b)
+{
+   return vorrq_s32(a, b);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_cmpeq_epi32(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_u32(vceqq_s32(a, b));
+}
+
+
+/*
+ * Arithmetic
+ */
+
+static ALWAYS_INLINE __m128i
+_mm_add_epi8(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s8(vaddq_s8(NEON_S8(a), NEON_S8(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_add_epi16(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s16(vaddq_s16(NEON_S16(a), NEON_S16(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_sub_epi16(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s16(vsubq_s16(NEON_S16(a), NEON_S16(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_add_epi32(__m128i a, __m128i b)
+{
+   return vaddq_s32(a, b);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_sub_epi64(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s64(vsubq_s64(NEON_S64(a), NEON_S64(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_mullo_epi16(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s16(vmulq_s16(NEON_S16(a), NEON_S16(b)));
+}
+
+/* 32 bit products of the even and odd 16 bit elements, added in pairs */
+static ALWAYS_INLINE __m128i
+_mm_madd_epi16(__m128i a, __m128i b)
+{
+   int32x4_t lo = vmull_s16(vget_low_s16(NEON_S16(a)),
+                            vget_low_s16(NEON_S16(b)));
+   int32x4_t hi = vmull_high_s16(NEON_S16(a), NEON_S16(b));
+   return vpaddq_s32(lo, hi);
+}
+
+/* 64 bit products of the unsigned 32 bit elements 0 and 2 */
+static ALWAYS_INLINE __m128i
+_mm_mul_epu32(__m128i a, __m128i b)
+{
+   uint32x2_t a02 = vmovn_u64(NEON_U64(a));
+   uint32x2_t b02 = vmovn_u64(NEON_U64(b));
+   return vreinterpretq_s32_u64(vmull_u32(a02, b02));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_min_epi16(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s16(vminq_s16(NEON_S16(a), NEON_S16(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_max_epi16(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s16(vmaxq_s16(NEON_S16(a), NEON_S16(b)));
+}
+
+
+/*
+ * Shifts.  SSE2 zeroes the result when the count exceeds the element
+ * size, or fills it with the sign for arithmetic shifts, while NEON
+ * register shifts only look at the bottom byte of the count.
+ */
+
+static ALWAYS_INLINE __m128i
+_mm_slli_epi32(__m128i a, int imm)
+{
+   if ((unsigned)imm > 31)
+      return vdupq_n_s32(0);
+   return vreinterpretq_s32_u32(vshlq_u32(NEON_U32(a), vdupq_n_s32(imm)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_srli_epi32(__m128i a, int imm)
+{
+   if ((unsigned)imm > 31)
+      return vdupq_n_s32(0);
+   return vreinterpretq_s32_u32(vshlq_u32(NEON_U32(a), vdupq_n_s32(-imm)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_srai_epi32(__m128i a, int imm)
+{
+   return vshlq_s32(a, vdupq_n_s32(-(int)MIN2((unsigned)imm, 31)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_srli_epi16(__m128i a, int imm)
+{
+   if ((unsigned)imm > 15)
+      return vdupq_n_s32(0);
+   return vreinterpretq_s32_u16(vshlq_u16(NEON_U16(a), vdupq_n_s16(-imm)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_srai_epi16(__m128i a, int imm)
+{
+   int16x8_t count = vdupq_n_s16(-(int)MIN2((unsigned)imm, 15));
+   return vreinterpretq_s32_s16(vshlq_s16(NEON_S16(a), count));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_slli_epi64(__m128i a, int imm)
+{
+   if ((unsigned)imm > 63)
+      return vdupq_n_s32(0);
+   return vreinterpretq_s32_u64(vshlq_u64(NEON_U64(a), vdupq_n_s64(imm)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_srli_epi64(__m128i a, int imm)
+{
+   if ((unsigned)imm > 63)
+      return vdupq_n_s32(0);
+   return vreinterpretq_s32_u64(vshlq_u64(NEON_U64(a), vdupq_n_s64(-imm)));
+}
+
+
+/*
+ * Packing, unpacking and shuffles
+ */
+
+static ALWAYS_INLINE __m128i
+_mm_packus_epi16(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_u8(vcombine_u8(vqmovun_s16(NEON_S16(a)),
+                                           vqmovun_s16(NEON_S16(b))));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_unpacklo_epi8(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s8(vzip1q_s8(NEON_S8(a), NEON_S8(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_unpackhi_epi8(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s8(vzip2q_s8(NEON_S8(a), NEON_S8(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_unpacklo_epi32(__m128i a, __m128i b)
+{
+   return vzip1q_s32(a, b);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_unpackhi_epi32(__m128i a, __m128i b)
+{
+   return vzip2q_s32(a, b);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_unpacklo_epi64(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s64(vzip1q_s64(NEON_S64(a), NEON_S64(b)));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_unpackhi_epi64(__m128i a, __m128i b)
+{
+   return vreinterpretq_s32_s64(vzip2q_s64(NEON_S64(a), NEON_S64(b)));
+}
+
+/* The shuffle immediates are always constant in practice, so after
+ * inlining the compiler turns these into lane moves.
+ */
+static ALWAYS_INLINE __m128i
+_mm_shuffle_epi32(__m128i a, int imm)
+{
+   int32_t v[4], r[4];
+
+   vst1q_s32(v, a);
+   r[0] = v[(imm >> 0) & 3];
+   r[1] = v[(imm >> 2) & 3];
+   r[2] = v[(imm >> 4) & 3];
+   r[3] = v[(imm >> 6) & 3];
+   return vld1q_s32(r);
+}
+
+static ALWAYS_INLINE __m128i
+_mm_shufflelo_epi16(__m128i a, int imm)
+{
+   int16_t v[8], r[8];
+
+   vst1q_s16(v, NEON_S16(a));
+   r[0] = v[(imm >> 0) & 3];
+   r[1] = v[(imm >> 2) & 3];
+   r[2] = v[(imm >> 4) & 3];
+   r[3] = v[(imm >> 6) & 3];
+   r[4] = v[4];
+   r[5] = v[5];
+   r[6] = v[6];
+   r[7] = v[7];
+   return vreinterpretq_s32_s16(vld1q_s16(r));
+}
+
+static ALWAYS_INLINE __m128i
+_mm_shufflehi_epi16(__m128i a, int imm)
+{
+   int16_t v[8], r[8];
+
+   vst1q_s16(v, NEON_S16(a));
+   r[0] = v[0];
+   r[1] = v[1];
+   r[2] = v[2];
+   r[3] = v[3];
+   r[4] = v[4 + ((imm >> 0) & 3)];
+   r[5] = v[4 + ((imm >> 2) & 3)];
+   r[6] = v[4 + ((imm >> 4) & 3)];
+   r[7] = v[4 + ((imm >> 6) & 3)];
+   return vreinterpretq_s32_s16(vld1q_s16(r));
+}
+
+#endif /* DETECT_ARCH_AARCH64 */
+
+#endif /* U_SSE_NEON_H_ */
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+
+"""Compare first-use frame times with and without LP_ASYNC_JIT.
+
+LP_ASYNC_JIT is read once per process, so lp_test_jit runs once per mode,
+several times each, with the shader disk cache disabled so that every
+shader is really compiled.  Prints the median, 99th percentile and
+maximum frame time and the hitch count of every run, and fails if the
+two modes render a different image once all optimized variants are in.
+
+Run it on a build with -Dbuild-tests=true, e.g. from the source tree:
+
+  src/gallium/drivers/llvmpipe/lp_bench_async_jit.py \\
+      build/src/gallium/drivers/llvmpipe/lp_test_jit
+"""
+
+import argparse
+import csv
+import os
+import subprocess
+import sys
+import tempfile
+
+
+MODES = {
+    'sync': {},
+    'async': {'LP_ASYNC_JIT': 'true'},
+}
+
+
+def run(test, extra_env):
+    env = dict(os.environ, MESA_SHADER_CACHE_DISABLE='true', **extra_env)
+    if 'LP_ASYNC_JIT' not in extra_env:
+        env.pop('LP_ASYNC_JIT', None)
+
+    with tempfile.NamedTemporaryFile(mode='r', suffix='.tsv') as out:
+        # -b 0 runs test_all() at full size, which adds every shader.
+        subprocess.run([test, '-b', '-o', out.name, '0'], env=env,
+                       check=True)
+        return list(csv.DictReader(out, delimiter='\t'))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('test', help='path to the lp_test_jit binary')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='runs per mode (default: 3)')
+    args = parser.parse_args()
+
+    checksums = set()
+    failed = False
+
+    print(f'{"mode":>6}{"median ms":>12}{"p99 ms":>12}{"max ms":>12}'
+          f'{"hitches":>10}')
+    for mode, env in MODES.items():
+        for _ in range(args.runs):
+            for row in run(args.test, env):
+                print(f'{mode:>6}{float(row["median_ms"]):>12.2f}'
+                      f'{float(row["p99_ms"]):>12.2f}'
+                      f'{float(row["max_ms"]):>12.2f}'
+                      f'{row["hitches"]:>10}')
+                if row['result'] != 'pass':
+                    print(f'{mode}: FAIL', file=sys.stderr)
+                    failed = True
+                checksums.add(row['checksum'])
+
+    if len(checksums) > 1:
+        print('sync and async rendered different images', file=sys.stderr)
+        failed = True
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+
+"""Measure how llvmpipe frame times scale with the thread count.
+
+Runs lp_test_tile for thread counts from 1 up to the number of CPUs,
+including counts above the old limit of 32 threads, and on hosts with
+more than one NUMA node once with the rasterizer threads bound to their
+nodes and once with LP_PERF=no_numa.  Prints ms per frame, the speedup
+over one thread and the parallel efficiency for every resolution, and
+fails if any run rendered a different image.
+
+Run it on a build with -Dbuild-tests=true, e.g. from the source tree:
+
+  src/gallium/drivers/llvmpipe/lp_bench_threads.py \\
+      build/src/gallium/drivers/llvmpipe/lp_test_tile
+"""
+
+import argparse
+import glob
+import os
+import sys
+
+from lp_bench_tile_size import default_threads, run
+
+
+def numa_nodes():
+    return len(glob.glob('/sys/devices/system/node/node[0-9]*'))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('test', help='path to the lp_test_tile binary')
+    parser.add_argument('--threads', type=int, nargs='+',
+                        default=default_threads(),
+                        help='thread counts to run (default: powers of '
+                             'two up to the number of CPUs)')
+    parser.add_argument('--tile-size', default='auto',
+                        choices=['auto', '32', '64', '128'],
+                        help='tile size to run with (default: auto)')
+    args = parser.parse_args()
+
+    modes = {'numa': {}}
+    if numa_nodes() > 1:
+        modes['no_numa'] = {'LP_PERF': 'no_numa'}
+
+    # (width, height) -> mode -> threads -> ns per frame
+    results = {}
+    checksums = {}
+    failed = False
+
+    for mode, env in modes.items():
+        for threads in args.threads:
+            for row in run(args.test, args.tile_size, threads, env):
+                res = (int(row['width']), int(row['height']))
+                results.setdefault(res, {}).setdefault(mode, {})
+                results[res][mode][threads] = float(row['ns_per_frame'])
+
+                if row['result'] != 'pass':
+                    print(f'{res[0]}x{res[1]}, {threads} threads, {mode}: '
+                          f'FAIL', file=sys.stderr)
+                    failed = True
+                expected = checksums.setdefault(res, row['checksum'])
+                if row['checksum'] != expected:
+                    print(f'{res[0]}x{res[1]}, {threads} threads, {mode}: '
+                          f'image differs', file=sys.stderr)
+                    failed = True
+
+    print(f'{os.cpu_count()} CPUs, {numa_nodes()} NUMA nodes')
+    print()
+
+    for (width, height), by_mode in sorted(results.items()):
+        print(f'{width}x{height}, ms per frame (speedup, efficiency)')
+        print('threads' + ''.join(f'{m:>26}' for m in modes))
+        for threads in args.threads:
+            line = f'{threads:>7}'
+            for mode in modes:
+                by_threads = by_mode[mode]
+                ns = by_threads[threads]
+                base = by_threads.get(1)
+                cell = f'{ns / 1e6:.2f}'
+                if base:
+                    cell += (f' ({base / ns:.1f}x, '
+                             f'{100 * base / ns / threads:.0f}%)')
+                line += f'{cell:>26}'
+            print(line)
+        print()
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+
+"""Sweep lp_test_tile over tile sizes and thread counts.
+
+LP_TILE_SIZE and LP_NUM_THREADS are read once per process, so each
+combination gets its own run of the test.  Prints the frame time of every
+resolution, tile size and thread count, with the speedup over the tile
+size llvmpipe picks by itself, and fails if any combination rendered a
+different image.
+
+Run it on a build with -Dbuild-tests=true, e.g. from the source tree:
+
+  src/gallium/drivers/llvmpipe/lp_bench_tile_size.py \\
+      build/src/gallium/drivers/llvmpipe/lp_test_tile
+"""
+
+import argparse
+import csv
+import os
+import subprocess
+import sys
+import tempfile
+
+
+TILE_SIZES = ['auto', '32', '64', '128']
+
+
+def default_threads():
+    count = os.cpu_count() or 1
+    threads = [1]
+    while threads[-1] * 2 <= count:
+        threads.append(threads[-1] * 2)
+    if threads[-1] != count:
+        threads.append(count)
+    return threads
+
+
+def run(test, tile_size, threads, extra_env=None):
+    env = dict(os.environ, **(extra_env or {}))
+    env['LP_NUM_THREADS'] = str(threads)
+    if tile_size == 'auto':
+        env.pop('LP_TILE_SIZE', None)
+    else:
+        env['LP_TILE_SIZE'] = tile_size
+
+    with tempfile.NamedTemporaryFile(mode='r', suffix='.tsv') as out:
+        # -b 0 runs test_all() at full size: every resolution, ten frames
+        # each.
+        subprocess.run([test, '-b', '-o', out.name, '0'], env=env,
+                       check=True)
+        return list(csv.DictReader(out, delimiter='\t'))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('test', help='path to the lp_test_tile binary')
+    parser.add_argument('--threads', type=int, nargs='+',
+                        default=default_threads(),
+                        help='thread counts to run (default: powers of '
+                             'two up to the number of CPUs)')
+    parser.add_argument('--tile-sizes', nargs='+', default=TILE_SIZES,
+                        choices=TILE_SIZES,
+                        help='tile sizes to run (default: all)')
+    args = parser.parse_args()
+
+    # (width, height) -> threads -> tile size -> ns per frame
+    results = {}
+    checksums = {}
+    failed = False
+
+    for threads in args.threads:
+        for tile_size in args.tile_sizes:
+            for row in run(args.test, tile_size, threads):
+                res = (int(row['width']), int(row['height']))
+                results.setdefault(res, {}).setdefault(threads, {})
+                results[res][threads][tile_size] = float(row['ns_per_frame'])
+
+                if row['result'] != 'pass':
+                    print(f'{res[0]}x{res[1]}, {threads} threads, tile size '
+                          f'{tile_size}: FAIL', file=sys.stderr)
+                    failed = True
+                expected = checksums.setdefault(res, row['checksum'])
+                if row['checksum'] != expected:
+                    print(f'{res[0]}x{res[1]}, {threads} threads, tile size '
+                          f'{tile_size}: image differs', file=sys.stderr)
+                    failed = True
+
+    for (width, height), by_threads in sorted(results.items()):
+        print(f'{width}x{height}, ms per frame (speedup over auto)')
+        print('threads' + ''.join(f'{t:>18}' for t in args.tile_sizes))
+        for threads, by_tile in sorted(by_threads.items()):
+            line = f'{threads:>7}'
+            for tile_size in args.tile_sizes:
+                ns = by_tile[tile_size]
+                cell = f'{ns / 1e6:.2f}'
+                if 'auto' in by_tile and tile_size != 'auto':
+                    cell += f' ({by_tile["auto"] / ns:.2f}x)'
+                line += f'{cell:>18}'
+            print(line)
+        print()
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -38,6 +38,8 @@
 #include "util/u_memory.h"
 #include "util/list.h"
 #include "util/u_upload_mgr.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 #include "lp_clear.h"
 #include "lp_context.h"
 #include "lp_flush.h"
@@ -49,6 +51,9 @@
 #include "lp_screen.h"
 #include "lp_fence.h"
 
+DEBUG_GET_ONCE_BOOL_OPTION(async_jit, "LP_ASYNC_JIT", false)
+
+
 static void
 llvmpipe_destroy(struct pipe_context *pipe)
 {
@@ -105,6 +110,9 @@ llvmpipe_destroy(struct pipe_context *pipe)
 
    lp_delete_setup_variants(llvmpipe);
 
+   if (util_queue_is_initialized(&llvmpipe->compile_queue))
+      util_queue_destroy(&llvmpipe->compile_queue);
+
    llvmpipe_sampler_matrix_destroy(llvmpipe);
 
    lp_context_destroy(&llvmpipe->context);
@@ -268,6 +276,16 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    if (!llvmpipe->context.ref)
       goto fail;
 
+   /* Without a compile queue, fragment shaders are only compiled on the
+    * draw thread.
+    */
+   if (debug_get_option_async_jit()) {
+      util_queue_init(&llvmpipe->compile_queue, "lpjit", 64,
+                      DIV_ROUND_UP(util_get_cpu_caps()->nr_cpus, 4),
+                      UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                      UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL);
+   }
+
    /*
     * Create drawing context and plug our rendering stage into it.
     */
@@ -165,6 +165,11 @@ struct llvmpipe_context {
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
 
+   /** Compiles optimized fragment shader variants, if LP_ASYNC_JIT is set */
+   struct util_queue compile_queue;
+   /** The bound fragment shader variant, if its optimized copy is pending */
+   struct lp_fragment_shader_variant *fs_pending;
+
    bool permit_linear_rasterizer;
    bool single_vp;
 
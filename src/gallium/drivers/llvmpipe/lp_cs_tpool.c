@@ -28,10 +28,142 @@
  * based on threadpool.c but modified heavily to be compute shader tuned.
  */
 
+#include "util/u_atomic.h"
 #include "util/u_thread.h"
 #include "util/u_memory.h"
+#include "util/os_time.h"
 #include "lp_cs_tpool.h"
 
+/* Chunks aim to take about this long.  Long enough that claiming one is
+ * noise, short enough that there are plenty left to balance with.
+ */
+#define LP_CS_CHUNK_NS 20000
+
+static unsigned
+chunk_size(const struct lp_cs_tpool_task *task)
+{
+   unsigned cost = p_atomic_read(&task->iter_cost_ns);
+
+   /* Single iterations until there is an estimate. */
+   if (!cost)
+      return 1;
+
+   return MAX2(LP_CS_CHUNK_NS / cost, 1);
+}
+
+/**
+ * Claim up to \p max iterations of a slice, from the front for its owner
+ * or from the back for a thief.  Thieves get at most half of what is left.
+ */
+static bool
+slice_claim(struct lp_cs_tpool_slice *slice, unsigned max, bool steal,
+            unsigned *first, unsigned *count)
+{
+   uint64_t old = p_atomic_read(&slice->range);
+
+   while (1) {
+      unsigned start = (uint32_t)old;
+      unsigned end = old >> 32;
+      uint64_t range;
+      unsigned n;
+
+      if (start >= end)
+         return false;
+
+      if (steal) {
+         n = MIN2(max, DIV_ROUND_UP(end - start, 2));
+         range = start | (uint64_t)(end - n) << 32;
+         *first = end - n;
+      } else {
+         n = MIN2(max, end - start);
+         range = (start + n) | (uint64_t)end << 32;
+         *first = start;
+      }
+
+      uint64_t prev = p_atomic_cmpxchg(&slice->range, old, range);
+      if (prev == old) {
+         *count = n;
+         return true;
+      }
+      old = prev;
+   }
+}
+
+static void
+run_iters(struct lp_cs_tpool_task *task, unsigned first, unsigned count,
+          struct lp_cs_local_mem *lmem)
+{
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < count; i++)
+      task->work(task->data, first + i, lmem);
+
+   /* Racing updates only lose a sample. */
+   uint64_t cost = (os_time_get_nano() - start) / count;
+   unsigned avg = p_atomic_read(&task->iter_cost_ns);
+   if (avg)
+      cost = (3 * (uint64_t)avg + cost) / 4;
+   p_atomic_set(&task->iter_cost_ns, (unsigned)CLAMP(cost, 1, UINT32_MAX));
+}
+
+/**
+ * Run iterations of \p task until there are none left to claim, and
+ * return how many were run.  Worker \p self drains its own slice, then
+ * moves half of another slice into it.  The thread waiting for the task
+ * passes -1 and steals a chunk at a time.
+ */
+static unsigned
+run_task(struct lp_cs_tpool_task *task, int self,
+         struct lp_cs_local_mem *lmem)
+{
+   unsigned done = 0;
+   unsigned first, count;
+   bool found = true;
+
+   while (found) {
+      if (self >= 0 &&
+          slice_claim(&task->slices[self], chunk_size(task), false,
+                      &first, &count)) {
+         run_iters(task, first, count, lmem);
+         done += count;
+         continue;
+      }
+
+      found = false;
+      for (unsigned i = 1; i <= task->num_slices && !found; i++) {
+         struct lp_cs_tpool_slice *victim =
+            &task->slices[(self + i) % task->num_slices];
+
+         if (self >= 0) {
+            found = slice_claim(victim, UINT_MAX, true, &first, &count);
+            /* Nobody else writes to an empty slice. */
+            if (found)
+               p_atomic_set(&task->slices[self].range,
+                            first | (uint64_t)(first + count) << 32);
+         } else {
+            found = slice_claim(victim, chunk_size(task), true,
+                                &first, &count);
+            if (found) {
+               run_iters(task, first, count, lmem);
+               done += count;
+            }
+         }
+      }
+   }
+
+   return done;
+}
+
+/* Called with the pool mutex held. */
+static void
+task_retire(struct lp_cs_tpool_task *task)
+{
+   if (task->queued) {
+      list_del(&task->list);
+      task->queued = false;
+   }
+}
+
 static int
 lp_cs_tpool_worker(void *data)
 {
@@ -41,9 +173,10 @@ lp_cs_tpool_worker(void *data)
    memset(&lmem, 0, sizeof(lmem));
    mtx_lock(&pool->m);
 
+   const unsigned self = pool->num_started++;
+
    while (!pool->shutdown) {
       struct lp_cs_tpool_task *task;
-      unsigned iter_per_thread;
 
       while (list_is_empty(&pool->workqueue) && !pool->shutdown)
          cnd_wait(&pool->new_work, &pool->m);
@@ -53,29 +186,19 @@ lp_cs_tpool_worker(void *data)
 
       task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
                               list);
-
-      unsigned this_iter = task->iter_start;
-
-      iter_per_thread = task->iter_per_thread;
-
-      if (task->iter_remainder &&
-          task->iter_start + task->iter_remainder == task->iter_total) {
-         task->iter_remainder--;
-         iter_per_thread = 1;
-      }
-
-      task->iter_start += iter_per_thread;
-
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
-
+      task->num_active++;
       mtx_unlock(&pool->m);
-      for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
+
+      unsigned done = run_task(task, self % task->num_slices, &lmem);
 
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
+      /* Nothing left to claim, so let the other workers move on to the
+       * next task while the last chunks of this one finish.
+       */
+      task_retire(task);
+      task->iter_finished += done;
+      task->num_active--;
+      if (task->iter_finished == task->iter_total && !task->num_active)
          cnd_broadcast(&task->finish);
    }
    mtx_unlock(&pool->m);
@@ -95,7 +218,11 @@ lp_cs_tpool_create(unsigned num_threads)
    cnd_init(&pool->new_work);
 
    list_inithead(&pool->workqueue);
-   assert (num_threads <= LP_MAX_THREADS);
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof(*pool->threads));
+      if (!pool->threads)
+         num_threads = 0;
+   }
    for (unsigned i = 0; i < num_threads; i++) {
       if (thrd_success != u_thread_create(pool->threads + i, lp_cs_tpool_worker, pool)) {
          num_threads = i;  /* previous thread is max */
@@ -123,6 +250,7 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -142,7 +270,9 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
       FREE(lmem.local_mem_ptr);
       return NULL;
    }
-   task = CALLOC_STRUCT(lp_cs_tpool_task);
+   task = align_calloc(sizeof(*task) +
+                       pool->num_threads * sizeof(task->slices[0]),
+                       CACHE_LINE_SIZE);
    if (!task) {
       return NULL;
    }
@@ -150,17 +280,28 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    task->work = work;
    task->data = data;
    task->iter_total = num_iters;
+   task->num_slices = pool->num_threads;
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
+   for (unsigned i = 0; i < task->num_slices; i++) {
+      uint64_t start = (uint64_t)num_iters * i / task->num_slices;
+      uint64_t end = (uint64_t)num_iters * (i + 1) / task->num_slices;
+      task->slices[i].range = start | end << 32;
+   }
 
    cnd_init(&task->finish);
 
    mtx_lock(&pool->m);
 
    list_addtail(&task->list, &pool->workqueue);
-
-   cnd_broadcast(&pool->new_work);
+   task->queued = true;
+
+   /* Small grids don't need every worker woken up. */
+   if (num_iters >= pool->num_threads) {
+      cnd_broadcast(&pool->new_work);
+   } else {
+      for (unsigned i = 0; i < num_iters; i++)
+         cnd_signal(&pool->new_work);
+   }
    mtx_unlock(&pool->m);
    return task;
 }
@@ -174,12 +315,22 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
    if (!pool || !task)
       return;
 
+   /* Help out rather than sleep, which also gets small grids done before
+    * the workers have even woken up.
+    */
+   struct lp_cs_local_mem lmem;
+   memset(&lmem, 0, sizeof(lmem));
+   unsigned done = run_task(task, -1, &lmem);
+   FREE(lmem.local_mem_ptr);
+
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
+   task->iter_finished += done;
+   while (task->iter_finished < task->iter_total || task->num_active)
       cnd_wait(&task->finish, &pool->m);
+   task_retire(task);
    mtx_unlock(&pool->m);
 
    cnd_destroy(&task->finish);
-   FREE(task);
+   align_free(task);
    *task_handle = NULL;
 }
@@ -30,12 +30,19 @@
  * structs with just unique indexes in them.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
+ *
+ * Each task's iterations are split into one slice per worker.  Workers
+ * claim chunks from the front of their own slice and, once it is empty,
+ * steal half of what is left in another one.  Chunks are sized from the
+ * running cost per iteration, so that cheap kernels don't pay for a claim
+ * per iteration and expensive ones still spread out.
  */
 #ifndef LP_CS_QUEUE
 #define LP_CS_QUEUE
 
 #include "util/compiler.h"
 
+#include "util/u_memory.h"
 #include "util/u_thread.h"
 #include "util/list.h"
 
@@ -45,8 +52,9 @@ struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
 
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
    unsigned num_threads;
+   unsigned num_started;
    struct list_head workqueue;
    bool shutdown;
 };
@@ -58,16 +66,26 @@ struct lp_cs_local_mem {
 
 typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
 
+/* The iterations of a task left to one worker. */
+struct lp_cs_tpool_slice {
+   /* Next and end iteration, packed as next | end << 32 so that the owner
+    * and thieves can move either end with a single compare-and-swap.
+    */
+   alignas(CACHE_LINE_SIZE) uint64_t range;
+};
+
 struct lp_cs_tpool_task {
    lp_cs_tpool_task_func work;
    void *data;
    struct list_head list;
+   bool queued;
    cnd_t finish;
    unsigned iter_total;
-   unsigned iter_start;
    unsigned iter_finished;
-   unsigned iter_per_thread;
-   unsigned iter_remainder;
+   unsigned num_active;  /* workers still looking at the task */
+   unsigned iter_cost_ns;  /* running average, zero until measured */
+   unsigned num_slices;
+   struct lp_cs_tpool_slice slices[];
 };
 
 struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
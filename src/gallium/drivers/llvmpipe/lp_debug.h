@@ -52,6 +52,7 @@
 #define DEBUG_SHOW_DEPTH    0x400000
 #define DEBUG_ACCURATE_A0   0x800000 /* verbose */
 #define DEBUG_MESH         0x1000000
+#define DEBUG_TEX_CACHE    0x2000000
 
 /* Performance flags.  These are active even on release builds.
  */
@@ -65,6 +66,8 @@
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
 #define PERF_NO_RAST_LINEAR 0x100  	/* disable linear rast */
 #define PERF_NO_SHADE       0x200  	/* disable fragment shaders */
+#define PERF_NO_PARALLEL_SETUP 0x400	/* set up triangles on the context thread only */
+#define PERF_NO_NUMA        0x800  	/* don't bind rasterizer threads to NUMA nodes */
 
 
 extern int LP_PERF;
@@ -35,10 +35,18 @@
 
 /**
  * Tile size (width and height). This needs to be a power of two.
+ *
+ * Each scene picks its tile size between 1 << LP_MIN_TILE_ORDER and
+ * 1 << LP_MAX_TILE_ORDER.  TILE_SIZE is the default, and the size of the
+ * blocks the rasterizer walks bigger tiles in.
  */
 #define TILE_ORDER 6
 #define TILE_SIZE (1 << TILE_ORDER)
 
+#define LP_MIN_TILE_ORDER 5
+#define LP_MAX_TILE_ORDER 7
+#define LP_MAX_TILE_SIZE (1 << LP_MAX_TILE_ORDER)
+
 
 /**
  * Max texture sizes
@@ -66,7 +74,12 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 32
+/**
+ * Upper bound for LP_NUM_THREADS.  Per-thread state is allocated for the
+ * number of threads actually used, so this only guards against nonsense.
+ * lp_bench_threads.py measures how far the threads actually scale.
+ */
+#define LP_MAX_THREADS 1024
 
 
 /**
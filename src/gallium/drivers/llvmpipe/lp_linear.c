@@ -41,7 +41,7 @@
 #include "lp_linear_priv.h"
 
 
-#if DETECT_ARCH_SSE
+#if UTIL_SSE2_INTRINSICS
 
 
 /* For debugging (LP_DEBUG=linear), shade areas of run-time fallback
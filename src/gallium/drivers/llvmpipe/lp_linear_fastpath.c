@@ -51,7 +51,7 @@
  */
 
 
-#if DETECT_ARCH_SSE
+#if UTIL_SSE2_INTRINSICS
 
 /* Linear shader which implements the BLIT_RGBA shader with the
  * additional constraints imposed by lp_setup_is_blit().
@@ -41,7 +41,7 @@
 #include "lp_linear_priv.h"
 
 
-#if DETECT_ARCH_SSE
+#if UTIL_SSE2_INTRINSICS
 
 #define FIXED15_ONE 0x7fff
 
@@ -228,7 +228,7 @@ lp_linear_init_interp(struct lp_linear_interp *interp,
    return true;
 }
 
-#else //DETECT_ARCH_SSE
+#else //UTIL_SSE2_INTRINSICS
 
 bool
 lp_linear_init_interp(struct lp_linear_interp *interp,
@@ -243,4 +243,4 @@ lp_linear_init_interp(struct lp_linear_interp *interp,
    return false;
 }
 
-#endif //DETECT_ARCH_SSE
+#endif //UTIL_SSE2_INTRINSICS
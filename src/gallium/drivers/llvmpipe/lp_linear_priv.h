@@ -2,6 +2,8 @@
 #ifndef LP_LINEAR_PRIV_H
 #define LP_LINEAR_PRIV_H
 
+#include "util/u_sse.h"
+
 struct lp_linear_elem;
 
 typedef const uint32_t *(*lp_linear_func)(struct lp_linear_elem *base);
@@ -52,7 +54,7 @@ struct lp_linear_sampler {
 struct lp_linear_interp {
    struct lp_linear_elem base;
 
-#if DETECT_ARCH_SSE
+#if UTIL_SSE2_INTRINSICS
    __m128i a0;
    __m128i dadx;
    __m128i dady;
@@ -39,7 +39,7 @@
 #include "lp_state_fs.h"
 #include "lp_linear_priv.h"
 
-#if DETECT_ARCH_SSE
+#if UTIL_SSE2_INTRINSICS
 
 #define FIXED16_SHIFT  16
 #define FIXED16_ONE    (1<<16)
@@ -926,7 +926,7 @@ lp_linear_check_sampler(const struct lp_sampler_static_state *sampler,
    return true;
 }
 
-#else  // DETECT_ARCH_SSE
+#else  // UTIL_SSE2_INTRINSICS
 
 bool
 lp_linear_check_sampler(const struct lp_sampler_static_state *sampler,
@@ -935,4 +935,4 @@ lp_linear_check_sampler(const struct lp_sampler_static_state *sampler,
    return false;
 }
 
-#endif  // DETECT_ARCH_SSE
+#endif  // UTIL_SSE2_INTRINSICS
@@ -33,6 +33,7 @@
 #include "util/u_pack_color.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_memset.h"
 #include "util/os_time.h"
 
@@ -104,12 +105,10 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
    LP_DBG(DEBUG_RAST, "%s %d,%d\n", __func__, x, y);
 
    task->bin = bin;
-   task->x = x * TILE_SIZE;
-   task->y = y * TILE_SIZE;
-   task->width = TILE_SIZE + x * TILE_SIZE > scene->fb.width ?
-                    scene->fb.width - x * TILE_SIZE : TILE_SIZE;
-   task->height = TILE_SIZE + y * TILE_SIZE > scene->fb.height ?
-                    scene->fb.height - y * TILE_SIZE : TILE_SIZE;
+   task->x = x << scene->tile_order;
+   task->y = y << scene->tile_order;
+   task->width = MIN2(scene->tile_size, scene->fb.width - task->x);
+   task->height = MIN2(scene->tile_size, scene->fb.height - task->y);
 
    task->thread_data.vis_counter = 0;
    task->thread_data.ps_invocations = 0;
@@ -317,7 +316,7 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
 
    const struct lp_fragment_shader_variant *variant = state->variant;
 
-   /* render the whole 64x64 tile in 4x4 chunks */
+   /* render the whole tile in 4x4 chunks */
    for (unsigned y = 0; y < task->height; y += 4){
       for (unsigned x = 0; x < task->width; x += 4) {
          /* color buffer */
@@ -420,8 +419,8 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    assert(state);
 
    /* Sanity checks */
-   assert(x < scene->tiles_x * TILE_SIZE);
-   assert(y < scene->tiles_y * TILE_SIZE);
+   assert(x < scene->tiles_x << scene->tile_order);
+   assert(y < scene->tiles_y << scene->tile_order);
    assert(x % TILE_VECTOR_WIDTH == 0);
    assert(y % TILE_VECTOR_HEIGHT == 0);
 
@@ -461,7 +460,7 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
     */
-   if ((x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height) {
+   if (x - task->x < task->width && y - task->y < task->height) {
       /* Propagate non-interpolated raster state. */
       task->thread_data.raster_state.viewport_index = inputs->viewport_index;
       task->thread_data.raster_state.view_index = inputs->view_index;
@@ -1020,20 +1019,6 @@ rasterize_bin(struct lp_rasterizer_task *task,
 }
 
 
-/* An empty bin is one that just loads the contents of the tile and
- * stores them again unchanged.  This typically happens when bins have
- * been flushed for some reason in the middle of a frame, or when
- * incremental updates are being made to a render target.
- *
- * Try to avoid doing pointless work in this case.
- */
-static bool
-is_empty_bin(const struct cmd_bin *bin)
-{
-   return bin->head == NULL;
-}
-
-
 /**
  * Rasterize/execute all bins within a scene.
  * Called per thread.
@@ -1045,39 +1030,38 @@ rasterize_scene(struct lp_rasterizer_task *task,
    task->scene = scene;
 
    /* Clear the cache tags. This should not always be necessary but
-    * simpler for now.
+    * simpler for now.  The victims must start out as valid ways, too.
     */
 #if LP_USE_TEXTURE_CACHE
    memset(task->thread_data.cache->cache_tags, 0,
           sizeof(task->thread_data.cache->cache_tags));
-#if LP_BUILD_FORMAT_CACHE_DEBUG
+   memset(task->thread_data.cache->cache_victim, 0,
+          sizeof(task->thread_data.cache->cache_victim));
    task->thread_data.cache->cache_access_total = 0;
    task->thread_data.cache->cache_access_miss = 0;
-#endif
 #endif
 
    if (!task->rast->no_rast) {
-      /* loop over scene bins, rasterize each */
+      /* loop over non-empty scene bins, rasterize each */
       struct cmd_bin *bin;
       int i, j;
 
       assert(scene);
-      while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-         if (!is_empty_bin(bin))
-            rasterize_bin(task, bin, i, j);
-      }
+      while ((bin = lp_scene_bin_iter_next(scene, &i, &j)))
+         rasterize_bin(task, bin, i, j);
    }
 
-#if LP_BUILD_FORMAT_CACHE_DEBUG
+#if LP_USE_TEXTURE_CACHE
    {
       uint64_t total, miss;
       total = task->thread_data.cache->cache_access_total;
       miss = task->thread_data.cache->cache_access_miss;
       if (total) {
-         debug_printf("thread %d cache access %llu miss %llu hit rate %f\n",
-                 task->thread_index, (long long unsigned)total,
-                 (long long unsigned)miss,
-                 (float)(total - miss)/(float)total);
+         LP_DBG(DEBUG_TEX_CACHE,
+                "thread %d cache access %llu miss %llu hit rate %f\n",
+                task->thread_index, (long long unsigned)total,
+                (long long unsigned)miss,
+                (float)(total - miss)/(float)total);
       }
    }
 #endif
@@ -1173,6 +1157,18 @@ thread_function(void *init_data)
    unsigned fpstate = util_fpstate_get();
    util_fpstate_set_denorms_to_zero(fpstate);
 
+   /* Reallocate the texel cache once bound, so that its pages are first
+    * touched, and thus placed, on the thread's own node.
+    */
+   if (task->numa_node >= 0 && util_thread_bind_numa_node(task->numa_node)) {
+      struct lp_build_format_cache *cache =
+         align_malloc(sizeof(struct lp_build_format_cache), 16);
+      if (cache) {
+         align_free(task->thread_data.cache);
+         task->thread_data.cache = cache;
+      }
+   }
+
    while (1) {
       /* wait for work */
       if (debug)
@@ -1231,6 +1227,18 @@ thread_function(void *init_data)
 static void
 create_rast_threads(struct lp_rasterizer *rast)
 {
+   const unsigned num_numa_nodes = util_get_cpu_caps()->num_numa_nodes;
+
+   /* Spread the threads over the NUMA nodes in contiguous runs.  This is
+    * decided up front, as num_threads shrinks if a thread fails to spawn.
+    */
+   for (unsigned i = 0; i < rast->num_threads; i++) {
+      if (num_numa_nodes > 1 && !(LP_PERF & PERF_NO_NUMA))
+         rast->tasks[i].numa_node = i * num_numa_nodes / rast->num_threads;
+      else
+         rast->tasks[i].numa_node = -1;
+   }
+
    /* NOTE: if num_threads is zero, we won't use any threads */
    for (unsigned i = 0; i < rast->num_threads; i++) {
       util_semaphore_init(&rast->tasks[i].work_ready, 0);
@@ -1265,6 +1273,18 @@ lp_rast_create(unsigned num_threads)
       goto no_full_scenes;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(*rast->tasks));
+   if (!rast->tasks) {
+      goto no_tasks;
+   }
+
+   if (num_threads) {
+      rast->threads = CALLOC(num_threads, sizeof(*rast->threads));
+      if (!rast->threads) {
+         goto no_thread_data_cache;
+      }
+   }
+
    for (unsigned i = 0; i < MAX2(1, num_threads); i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
@@ -1292,12 +1312,15 @@ lp_rast_create(unsigned num_threads)
    return rast;
 
 no_thread_data_cache:
-   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (unsigned i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
    }
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
+no_tasks:
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
    FREE(rast);
@@ -1359,6 +1382,8 @@ lp_rast_destroy(struct lp_rasterizer *rast)
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
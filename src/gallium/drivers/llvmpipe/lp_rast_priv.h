@@ -97,6 +97,9 @@ struct lp_rasterizer_task
    /** "my" index */
    unsigned thread_index;
 
+   /** NUMA node the thread binds itself to, or -1 */
+   int numa_node;
+
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
@@ -111,7 +114,7 @@ struct lp_rasterizer_task
 /**
  * This is the state required while rasterizing tiles.
  * Note that this contains per-thread information too.
- * The tile size is TILE_SIZE x TILE_SIZE pixels.
+ * The tile size is chosen per scene, see lp_scene::tile_size.
  */
 struct lp_rasterizer
 {
@@ -124,11 +127,11 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each rasterization thread, at least one */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
@@ -151,7 +154,7 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
 
 
 /**
- * Get the pointer to a 4x4 color block (within a 64x64 tile).
+ * Get the pointer to a 4x4 color block (within the current tile).
  * \param x, y location of 4x4 block in window coords
  */
 static inline uint8_t *
@@ -159,8 +162,8 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
                                 unsigned buf, unsigned x, unsigned y,
                                 unsigned layer)
 {
-   assert(x < task->scene->tiles_x * TILE_SIZE);
-   assert(y < task->scene->tiles_y * TILE_SIZE);
+   assert(x < task->scene->tiles_x << task->scene->tile_order);
+   assert(y < task->scene->tiles_y << task->scene->tile_order);
    assert((x % TILE_VECTOR_WIDTH) == 0);
    assert((y % TILE_VECTOR_HEIGHT) == 0);
    assert(buf < task->scene->fb.nr_cbufs);
@@ -171,8 +174,8 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
     * it's just extra work - the mul/add would be exactly the same anyway.
     * Fortunately the extra work (modulo) here is very cheap at least...
     */
-   unsigned px = x % TILE_SIZE;
-   unsigned py = y % TILE_SIZE;
+   unsigned px = x - task->x;
+   unsigned py = y - task->y;
 
    unsigned pixel_offset = px * task->scene->cbufs[buf].format_bytes +
                            py * task->scene->cbufs[buf].stride;
@@ -189,21 +192,21 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
 
 
 /**
- * Get the pointer to a 4x4 depth block (within a 64x64 tile).
+ * Get the pointer to a 4x4 depth block (within the current tile).
  * \param x, y location of 4x4 block in window coords
  */
 static inline uint8_t *
 lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
                                 unsigned x, unsigned y, unsigned layer)
 {
-   assert(x < task->scene->tiles_x * TILE_SIZE);
-   assert(y < task->scene->tiles_y * TILE_SIZE);
+   assert(x < task->scene->tiles_x << task->scene->tile_order);
+   assert(y < task->scene->tiles_y << task->scene->tile_order);
    assert((x % TILE_VECTOR_WIDTH) == 0);
    assert((y % TILE_VECTOR_HEIGHT) == 0);
    assert(task->depth_tile);
 
-   unsigned px = x % TILE_SIZE;
-   unsigned py = y % TILE_SIZE;
+   unsigned px = x - task->x;
+   unsigned py = y - task->y;
 
    unsigned pixel_offset = px * task->scene->zsbuf.format_bytes +
                            py * task->scene->zsbuf.stride;
@@ -266,7 +269,7 @@ lp_rast_shade_quads_all(struct lp_rasterizer_task *task,
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
     */
-   if ((x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height) {
+   if (x - task->x < task->width && y - task->y < task->height) {
       /* Propagate non-interpolated raster state. */
       task->thread_data.raster_state.viewport_index = inputs->viewport_index;
       task->thread_data.raster_state.view_index = inputs->view_index;
@@ -462,7 +465,8 @@ lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg);
 
 void
-lp_debug_bin(const struct cmd_bin *bin, int x, int y);
+lp_debug_bin(const struct lp_scene *scene,
+             const struct cmd_bin *bin, int x, int y);
 
 void
 lp_linear_rasterize_bin(struct lp_rasterizer_task *task,
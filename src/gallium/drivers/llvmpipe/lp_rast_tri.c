@@ -62,6 +62,25 @@ block_full_16(struct lp_rasterizer_task *task,
          block_full_4(task, tri, x + ix, y + iy);
 }
 
+
+/**
+ * Mask of the 16x16 subblocks of a 64x64 block which lie outside a tile
+ * of 1 << tile_order pixels, when tiles are smaller than that.
+ */
+static inline unsigned
+lp_rast_block_outside_mask(unsigned tile_order)
+{
+   if (tile_order >= TILE_ORDER)
+      return 0;
+
+   const unsigned n = 1 << (tile_order - 4);
+   unsigned inside = 0;
+   for (unsigned i = 0; i < n; i++)
+      inside |= ((1 << n) - 1) << (i * 4);
+
+   return 0xffff & ~inside;
+}
+
 static inline unsigned
 build_mask_linear(int32_t c, int32_t dcdx, int32_t dcdy)
 {
@@ -189,104 +189,89 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
 
 
 /**
- * Scan the tile in chunks and figure out which pixels to rasterize
- * for this triangle.
+ * Evaluate a 64x64 block of pixels to determine which 16x16 subblocks are
+ * in/out of the triangle's bounds.
+ * \param outmask  subblocks to skip as they are not part of the tile
  */
-void
-TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
-                      const union lp_rast_cmd_arg arg)
+static void
+TAG(do_block_64)(struct lp_rasterizer_task *task,
+                 const struct lp_rast_triangle *tri,
+                 const struct lp_rast_plane *plane,
+                 int x, int y,
+                 const int64_t *c,
+                 unsigned outmask)
 {
-   const struct lp_rast_triangle *tri = arg.triangle.tri;
-   unsigned plane_mask = arg.triangle.plane_mask;
-   const struct lp_rast_plane *tri_plane = GET_PLANES(tri);
-   const int x = task->x, y = task->y;
-   struct lp_rast_plane plane[NR_PLANES];
-   int64_t c[NR_PLANES];
-   unsigned outmask, inmask, partmask, partial_mask;
-   unsigned j = 0;
-
-   if (tri->inputs.disable) {
-      /* This triangle was partially binned and has been disabled */
-      return;
-   }
-
-   outmask = 0;                 /* outside one or more trivial reject planes */
-   partmask = 0;                /* outside one or more trivial accept planes */
-
-   while (plane_mask) {
-      int i = ffs(plane_mask) - 1;
-      plane[j] = tri_plane[i];
-      plane_mask &= ~(1 << i);
-      c[j] = plane[j].c + IMUL64(plane[j].dcdy, y) - IMUL64(plane[j].dcdx, x);
+   /* outmask: outside one or more trivial reject planes,
+    * partmask: outside one or more trivial accept planes
+    */
+   unsigned partmask = outmask;
+   unsigned inmask, partial_mask;
 
-      {
+   for (unsigned j = 0; j < NR_PLANES; j++) {
 #ifdef RASTER_64
-         /*
-          * Strip off lower FIXED_ORDER bits. Note that those bits from
-          * dcdx, dcdy, eo are always 0 (by definition).
-          * c values, however, are not. This means that for every
-          * addition of the form c + n*dcdx the lower FIXED_ORDER bits will
-          * NOT change. And those bits are not relevant to the sign bit (which
-          * is only what we need!) that is,
-          * sign(c + n*dcdx) == sign((c >> FIXED_ORDER) + n*(dcdx >> FIXED_ORDER))
-          * This means we can get away with using 32bit math for the most part.
-          * Only tricky part is the -1 adjustment for cdiff.
-          */
-         int32_t dcdx = -plane[j].dcdx >> FIXED_ORDER;
-         int32_t dcdy = plane[j].dcdy >> FIXED_ORDER;
-         const int32_t cox = plane[j].eo >> FIXED_ORDER;
-         const int32_t ei = (dcdy + dcdx - cox) << 4;
-         const int32_t cox_s = cox << 4;
-         const int32_t co = (int32_t)(c[j] >> (int64_t)FIXED_ORDER) + cox_s;
-         int32_t cdiff;
-         /*
-          * Plausibility check to ensure the 32bit math works.
-          * Note that within a tile, the max we can move the edge function
-          * is essentially dcdx * TILE_SIZE + dcdy * TILE_SIZE.
-          * TILE_SIZE is 64, dcdx/dcdy are nominally 21 bit (for 8192 max size
-          * and 8 subpixel bits), I'd be happy with 2 bits more too (1 for
-          * increasing fb size to 16384, the required d3d11 value, another one
-          * because I'm not quite sure we can't be _just_ above the max value
-          * here). This gives us 30 bits max - hence if c would exceed that here
-          * that means the plane is either trivial reject for the whole tile
-          * (in which case the tri will not get binned), or trivial accept for
-          * the whole tile (in which case plane_mask will not include it).
-          */
+      /*
+       * Strip off lower FIXED_ORDER bits. Note that those bits from
+       * dcdx, dcdy, eo are always 0 (by definition).
+       * c values, however, are not. This means that for every
+       * addition of the form c + n*dcdx the lower FIXED_ORDER bits will
+       * NOT change. And those bits are not relevant to the sign bit (which
+       * is only what we need!) that is,
+       * sign(c + n*dcdx) == sign((c >> FIXED_ORDER) + n*(dcdx >> FIXED_ORDER))
+       * This means we can get away with using 32bit math for the most part.
+       * Only tricky part is the -1 adjustment for cdiff.
+       */
+      int32_t dcdx = -plane[j].dcdx >> FIXED_ORDER;
+      int32_t dcdy = plane[j].dcdy >> FIXED_ORDER;
+      const int32_t cox = plane[j].eo >> FIXED_ORDER;
+      const int32_t ei = (dcdy + dcdx - cox) << 4;
+      const int32_t cox_s = cox << 4;
+      const int32_t co = (int32_t)(c[j] >> (int64_t)FIXED_ORDER) + cox_s;
+      int32_t cdiff;
+      /*
+       * Plausibility check to ensure the 32bit math works.
+       * Note that within a block, the max we can move the edge function
+       * is essentially dcdx * 64 + dcdy * 64.
+       * dcdx/dcdy are nominally 21 bit (for 8192 max size
+       * and 8 subpixel bits), I'd be happy with 2 bits more too (1 for
+       * increasing fb size to 16384, the required d3d11 value, another one
+       * because I'm not quite sure we can't be _just_ above the max value
+       * here). This gives us 30 bits max - hence if c would exceed that here
+       * that means the plane is either trivial reject for the whole block
+       * (in which case the tri will not get binned), or trivial accept for
+       * the whole block (in which case plane_mask will not include it).
+       */
 #if 0
-         assert((c[j] >> (int64_t)FIXED_ORDER) > (int32_t)0xb0000000 &&
-                (c[j] >> (int64_t)FIXED_ORDER) < (int32_t)0x3fffffff);
+      assert((c[j] >> (int64_t)FIXED_ORDER) > (int32_t)0xb0000000 &&
+             (c[j] >> (int64_t)FIXED_ORDER) < (int32_t)0x3fffffff);
 #endif
-         /*
-          * Note the fixup part is constant throughout the tile - thus could
-          * just calculate this and avoid _all_ 64bit math in rasterization
-          * (except exactly this fixup calc).
-          * In fact theoretically could move that even to setup, albeit that
-          * seems tricky (pre-bin certainly can have values larger than 32bit,
-          * and would need to communicate that fixup value through).
-          * And if we want to support msaa, we'd probably don't want to do the
-          * downscaling in setup in any case...
-          */
-         cdiff = ei - cox_s + ((int32_t)((c[j] - 1) >> (int64_t)FIXED_ORDER) -
-                               (int32_t)(c[j] >> (int64_t)FIXED_ORDER));
-         dcdx <<= 4;
-         dcdy <<= 4;
+      /*
+       * Note the fixup part is constant throughout the tile - thus could
+       * just calculate this and avoid _all_ 64bit math in rasterization
+       * (except exactly this fixup calc).
+       * In fact theoretically could move that even to setup, albeit that
+       * seems tricky (pre-bin certainly can have values larger than 32bit,
+       * and would need to communicate that fixup value through).
+       * And if we want to support msaa, we'd probably don't want to do the
+       * downscaling in setup in any case...
+       */
+      cdiff = ei - cox_s + ((int32_t)((c[j] - 1) >> (int64_t)FIXED_ORDER) -
+                            (int32_t)(c[j] >> (int64_t)FIXED_ORDER));
+      dcdx <<= 4;
+      dcdy <<= 4;
 #else
-         const int32_t dcdx = -plane[j].dcdx << 4;
-         const int32_t dcdy = plane[j].dcdy << 4;
-         const int32_t cox = plane[j].eo << 4;
-         const int32_t ei = plane[j].dcdy - plane[j].dcdx - (int32_t)plane[j].eo;
-         const int32_t cio = (ei << 4) - 1;
-         int32_t co, cdiff;
-         co = c[j] + cox;
-         cdiff = cio - cox;
+      const int32_t dcdx = -plane[j].dcdx << 4;
+      const int32_t dcdy = plane[j].dcdy << 4;
+      const int32_t cox = plane[j].eo << 4;
+      const int32_t ei = plane[j].dcdy - plane[j].dcdx - (int32_t)plane[j].eo;
+      const int32_t cio = (ei << 4) - 1;
+      int32_t co, cdiff;
+      co = c[j] + cox;
+      cdiff = cio - cox;
 #endif
-         BUILD_MASKS(co, cdiff,
-                     dcdx, dcdy,
-                     &outmask,   /* sign bits from c[i][0..15] + cox */
-                     &partmask); /* sign bits from c[i][0..15] + cio */
-      }
-
-      j++;
+      BUILD_MASKS(co, cdiff,
+                  dcdx, dcdy,
+                  &outmask,   /* sign bits from c[i][0..15] + cox */
+                  &partmask); /* sign bits from c[i][0..15] + cio */
    }
 
    if (outmask == 0xffff)
@@ -315,7 +300,7 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       int py = y + iy;
       int64_t cx[NR_PLANES];
 
-      for (j = 0; j < NR_PLANES; j++)
+      for (unsigned j = 0; j < NR_PLANES; j++)
          cx[j] = (c[j]
                   - IMUL64(plane[j].dcdx, ix)
                   + IMUL64(plane[j].dcdy, iy));
@@ -343,6 +328,57 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Scan the tile in chunks and figure out which pixels to rasterize
+ * for this triangle.
+ */
+void
+TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
+                      const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_triangle *tri = arg.triangle.tri;
+   unsigned plane_mask = arg.triangle.plane_mask;
+   const struct lp_rast_plane *tri_plane = GET_PLANES(tri);
+   const int x = task->x, y = task->y;
+   const unsigned tile_size = task->scene->tile_size;
+   struct lp_rast_plane plane[NR_PLANES];
+   int64_t c[NR_PLANES];
+   unsigned outmask;
+   unsigned j = 0;
+
+   if (tri->inputs.disable) {
+      /* This triangle was partially binned and has been disabled */
+      return;
+   }
+
+   while (plane_mask) {
+      int i = ffs(plane_mask) - 1;
+      plane[j] = tri_plane[i];
+      plane_mask &= ~(1 << i);
+      c[j] = plane[j].c + IMUL64(plane[j].dcdy, y) - IMUL64(plane[j].dcdx, x);
+      j++;
+   }
+
+   /* Tiles are walked in 64x64 blocks, of which smaller tiles only cover
+    * the top left 16x16 subblocks.
+    */
+   outmask = lp_rast_block_outside_mask(task->scene->tile_order);
+
+   for (unsigned iy = 0; iy < tile_size && iy < task->height; iy += TILE_SIZE) {
+      for (unsigned ix = 0; ix < tile_size && ix < task->width; ix += TILE_SIZE) {
+         int64_t cx[NR_PLANES];
+
+         for (j = 0; j < NR_PLANES; j++)
+            cx[j] = (c[j]
+                     - IMUL64(plane[j].dcdx, ix)
+                     + IMUL64(plane[j].dcdy, iy));
+
+         TAG(do_block_64)(task, tri, plane, x + ix, y + iy, cx, outmask);
+      }
+   }
+}
+
+
 #if DETECT_ARCH_SSE && defined(TRI_16)
 /* XXX: special case this when intersection is not required.
  *      - tile completely within bbox,
@@ -360,13 +396,13 @@ TRI_16(struct lp_rasterizer_task *task,
    int y = (mask >> 8);
    unsigned outmask = 0;    /* outside one or more trivial reject planes */
 
-   if (x + 12 >= 64) {
-      int i = ((x + 12) - 64) / 4;
+   if (x + 12 >= task->scene->tile_size) {
+      int i = ((x + 12) - task->scene->tile_size) / 4;
       outmask |= right_mask_tab[i];
    }
 
-   if (y + 12 >= 64) {
-      int i = ((y + 12) - 64) / 4;
+   if (y + 12 >= task->scene->tile_size) {
+      int i = ((y + 12) - task->scene->tile_size) / 4;
       outmask |= bottom_mask_tab[i];
    }
 
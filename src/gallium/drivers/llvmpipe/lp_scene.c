@@ -28,6 +28,9 @@
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 #include "util/reallocarray.h"
 #include "util/u_inlines.h"
 #include "util/format/u_format.h"
@@ -103,6 +106,7 @@ lp_scene_destroy(struct lp_scene *scene)
    lp_scene_end_rasterization(scene);
    mtx_destroy(&scene->mutex);
    free(scene->tiles);
+   free(scene->active_bins);
    assert(scene->data.head == &scene->data.first);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
@@ -547,60 +551,210 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 }
 
 
-/** advance curr_x,y to the next bin */
-static bool
-next_bin(struct lp_scene *scene)
+/** gather the even bits of a Morton code */
+static unsigned
+morton_compact(unsigned v)
+{
+   v &= 0x55555555;
+   v = (v | (v >> 1)) & 0x33333333;
+   v = (v | (v >> 2)) & 0x0f0f0f0f;
+   v = (v | (v >> 4)) & 0x00ff00ff;
+   v = (v | (v >> 8)) & 0x0000ffff;
+   return v;
+}
+
+
+/**
+ * Return all tiles of the scene in Z-order, so that bins which are
+ * handed out close in time are also close on screen and threads working
+ * on neighbouring bins share more of the texture and framebuffer cache
+ * lines than plain row-major order would.  Orders are kept per tile grid
+ * in the setup context, so scenes alternating between framebuffers (a
+ * shadow map and the window, say) don't rebuild them every time.
+ * Only called from the rasterizer's begin, so never concurrently for
+ * one setup context.
+ */
+static const unsigned *
+get_bin_order(struct lp_scene *scene)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
+   struct lp_setup_context *setup = scene->setup;
+   const unsigned dim = util_next_power_of_two(MAX2(scene->tiles_x,
+                                                    scene->tiles_y));
+   struct lp_bin_order *entry;
+   unsigned n = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(setup->bin_orders); i++) {
+      entry = &setup->bin_orders[i];
+      if (entry->order &&
+          entry->tiles_x == scene->tiles_x &&
+          entry->tiles_y == scene->tiles_y &&
+          entry->tile_order == scene->tile_order)
+         return entry->order;
+   }
+
+   /* Replace the oldest one. */
+   entry = &setup->bin_orders[setup->next_bin_order];
+   setup->next_bin_order = (setup->next_bin_order + 1) %
+                           ARRAY_SIZE(setup->bin_orders);
+
+   free(entry->order);
+   entry->order = malloc(scene->tiles_x * scene->tiles_y * sizeof(unsigned));
+   if (!entry->order)
+      return NULL;
+
+   for (unsigned code = 0; code < dim * dim; code++) {
+      const unsigned x = morton_compact(code);
+      const unsigned y = morton_compact(code >> 1);
+
+      if (x < scene->tiles_x && y < scene->tiles_y)
+         entry->order[n++] = y * scene->tiles_x + x;
    }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return false;
+   assert(n == scene->tiles_x * scene->tiles_y);
+
+   entry->tiles_x = scene->tiles_x;
+   entry->tiles_y = scene->tiles_y;
+   entry->tile_order = scene->tile_order;
+   return entry->order;
+}
+
+
+/**
+ * Free the bin orders cached by get_bin_order().
+ */
+void
+lp_scene_free_bin_orders(struct lp_setup_context *setup)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(setup->bin_orders); i++) {
+      free(setup->bin_orders[i].order);
+      setup->bin_orders[i].order = NULL;
    }
-   return true;
 }
 
 
+/**
+ * Prepare for handing out bins to the rasterizer threads.
+ * Called once per scene, before the threads start, so that
+ * lp_scene_bin_iter_next() only has to claim the next active bin.
+ */
 void
 lp_scene_bin_iter_begin(struct lp_scene *scene)
 {
-   scene->curr_x = scene->curr_y = -1;
+   const unsigned num_tiles = scene->tiles_x * scene->tiles_y;
+   const unsigned *order = get_bin_order(scene);
+   unsigned n = 0;
+
+   /* Empty bins are common when a scene was flushed early or only part
+    * of the framebuffer is touched, skip them here rather than in every
+    * thread.
+    */
+   for (unsigned i = 0; i < num_tiles; i++) {
+      const unsigned idx = order ? order[i] : i;
+      if (scene->tiles[idx].head)
+         scene->active_bins[n++] = idx;
+   }
+
+   scene->num_active_bins = n;
+   scene->next_active_bin = 0;
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
+ * Return pointer to next bin to be rendered, or NULL once all non-empty
+ * bins have been handed out.
  * Multiple rendering threads will call this function to get a chunk
  * of work (a bin) to work on.
  */
 struct cmd_bin *
 lp_scene_bin_iter_next(struct lp_scene *scene , int *x, int *y)
 {
-   struct cmd_bin *bin = NULL;
+   const unsigned i = p_atomic_inc_return(&scene->next_active_bin) - 1;
+   unsigned idx;
 
-   mtx_lock(&scene->mutex);
+   if (i >= scene->num_active_bins)
+      return NULL;
+
+   idx = scene->active_bins[i];
+   *x = idx % scene->tiles_x;
+   *y = idx / scene->tiles_x;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   } else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
+   return &scene->tiles[idx];
+}
+
+
+DEBUG_GET_ONCE_NUM_OPTION(tile_size, "LP_TILE_SIZE", 0)
+
+
+static unsigned
+num_tiles(const struct pipe_framebuffer_state *fb, unsigned tile_order)
+{
+   return DIV_ROUND_UP(fb->width, 1 << tile_order) *
+          DIV_ROUND_UP(fb->height, 1 << tile_order);
+}
+
+
+/**
+ * Pick the tile size for a scene.
+ *
+ * Bigger tiles mean fewer bins to visit and fewer triangles binned more
+ * than once, smaller tiles keep a tile's color and depth in cache and
+ * give the threads more bins to balance between.  The default is kept
+ * unless the framebuffer, the thread count or the cache size clearly
+ * favour a different size.
+ */
+static unsigned
+lp_scene_choose_tile_order(const struct lp_scene *scene,
+                           const struct pipe_framebuffer_state *fb)
+{
+   const unsigned num_threads = MAX2(1, scene->setup->num_threads);
+   const unsigned samples = util_framebuffer_get_num_samples(fb);
+   const unsigned forced = debug_get_option_tile_size();
+   unsigned cache_size = util_get_cpu_caps()->L2_cache_size;
+   unsigned pixel_bytes = 0;
+
+   if (forced) {
+      for (unsigned order = LP_MIN_TILE_ORDER;
+           order <= LP_MAX_TILE_ORDER; order++) {
+         if (forced == 1 << order &&
+             (order == TILE_ORDER || !scene->permit_linear_rasterizer) &&
+             num_tiles(fb, order) <= TILES_X * TILES_Y)
+            return order;
+      }
    }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+   /* The linear paths work on spans of up to TILE_SIZE pixels. */
+   if (scene->permit_linear_rasterizer)
+      return TILE_ORDER;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   for (unsigned i = 0; i < fb->nr_cbufs; i++) {
+      if (fb->cbufs[i])
+         pixel_bytes += util_format_get_blocksize(fb->cbufs[i]->format);
+   }
+   if (fb->zsbuf)
+      pixel_bytes += util_format_get_blocksize(fb->zsbuf->format);
+   pixel_bytes = MAX2(pixel_bytes, 4) * samples;
+
+   /* Less than most CPUs have, when we can't tell. */
+   if (!cache_size)
+      cache_size = 256 * 1024;
+
+   /* Big targets on big caches: the whole tile still fits in a quarter of
+    * the cache, leaving the rest to textures, and every thread has plenty
+    * of tiles to pick from.
+    */
+   if ((pixel_bytes << (2 * LP_MAX_TILE_ORDER)) <= cache_size / 4 &&
+       num_tiles(fb, LP_MAX_TILE_ORDER) >= 8 * num_threads)
+      return LP_MAX_TILE_ORDER;
+
+   /* Small targets on many threads, or tiles falling out of small caches
+    * (fat pixels or little cores), as long as the bin count stays in
+    * bounds.
+    */
+   if ((num_tiles(fb, TILE_ORDER) < 2 * num_threads ||
+        (pixel_bytes << (2 * TILE_ORDER)) > cache_size / 2) &&
+       num_tiles(fb, LP_MIN_TILE_ORDER) <= TILES_X * TILES_Y)
+      return LP_MIN_TILE_ORDER;
+
+   return TILE_ORDER;
 }
 
 
@@ -612,10 +766,11 @@ lp_scene_begin_binning(struct lp_scene *scene,
 
    util_copy_framebuffer_state(&scene->fb, fb);
 
-   scene->tiles_x = align(fb->width, TILE_SIZE) / TILE_SIZE;
-   scene->tiles_y = align(fb->height, TILE_SIZE) / TILE_SIZE;
-   assert(scene->tiles_x <= TILES_X);
-   assert(scene->tiles_y <= TILES_Y);
+   scene->tile_order = lp_scene_choose_tile_order(scene, fb);
+   scene->tile_size = 1 << scene->tile_order;
+   scene->tiles_x = align(fb->width, scene->tile_size) >> scene->tile_order;
+   scene->tiles_y = align(fb->height, scene->tile_size) >> scene->tile_order;
+   assert(scene->tiles_x * scene->tiles_y <= TILES_X * TILES_Y);
 
    unsigned num_required_tiles = scene->tiles_x * scene->tiles_y;
    if (scene->num_alloced_tiles < num_required_tiles) {
@@ -624,6 +779,15 @@ lp_scene_begin_binning(struct lp_scene *scene,
       if (!scene->tiles)
          return;
       memset(scene->tiles, 0, sizeof(struct cmd_bin) * num_required_tiles);
+
+      free(scene->active_bins);
+      scene->active_bins = malloc(num_required_tiles * sizeof(unsigned));
+      if (!scene->active_bins) {
+         free(scene->tiles);
+         scene->tiles = NULL;
+         scene->num_alloced_tiles = 0;
+         return;
+      }
       scene->num_alloced_tiles = num_required_tiles;
    }
 
@@ -44,6 +44,9 @@ struct lp_rast_state;
 
 /* We're limited to 2K by 2K for 32bit fixed point rasterization.
  * Will need a 64-bit version for larger framebuffers.
+ *
+ * This is the bin count of the largest framebuffer at the default tile
+ * size, which scenes with smaller tiles must not exceed either.
  */
 #define TILES_X (LP_MAX_WIDTH / TILE_SIZE)
 #define TILES_Y (LP_MAX_HEIGHT / TILE_SIZE)
@@ -101,6 +104,18 @@ struct cmd_bin {
 };
 
 
+/**
+ * Z-order of all tiles of a tiles_x * tiles_y grid, cached in the setup
+ * context, see lp_scene_bin_iter_begin().
+ */
+#define LP_BIN_ORDER_CACHE_SIZE 4
+
+struct lp_bin_order {
+   unsigned tiles_x, tiles_y, tile_order;
+   unsigned *order;
+};
+
+
 /**
  * This stores bulk data which is used for all memory allocations
  * within a scene.
@@ -189,17 +204,29 @@ struct lp_scene {
    bool alloc_failed;
    bool permit_linear_rasterizer;
 
+   /** Tile size of this scene, see lp_scene_choose_tile_order() */
+   unsigned tile_order;
+   unsigned tile_size;
+
    /**
     * Number of active tiles in each dimension.
     * This basically the framebuffer size divided by tile size
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
    mtx_t mutex;
 
    unsigned num_alloced_tiles;
    struct cmd_bin *tiles;
+
+   /**
+    * Bin dispatch.  active_bins holds the non-empty tiles in Z-order.
+    * Rasterizer threads claim bins by atomically incrementing
+    * next_active_bin.
+    */
+   unsigned *active_bins;
+   unsigned num_active_bins;
+   unsigned next_active_bin;
    struct data_block_list data;
 };
 
@@ -398,6 +425,9 @@ lp_scene_get_num_bins(const struct lp_scene *scene)
 void
 lp_scene_bin_iter_begin(struct lp_scene *scene);
 
+void
+lp_scene_free_bin_orders(struct lp_setup_context *setup);
+
 struct cmd_bin *
 lp_scene_bin_iter_next(struct lp_scene *scene, int *x, int *y);
 
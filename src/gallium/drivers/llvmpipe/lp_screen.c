@@ -38,6 +38,7 @@
 #include "draw/draw_context.h"
 #include "gallivm/lp_bld_type.h"
 #include "gallivm/lp_bld_nir.h"
+#include "gallivm/lp_bld_debug.h"
 #include "util/disk_cache.h"
 #include "util/hex.h"
 #include "util/os_misc.h"
@@ -86,6 +87,7 @@ static const struct debug_named_value lp_debug_flags[] = {
    { "cs", DEBUG_CS, NULL },
    { "accurate_a0", DEBUG_ACCURATE_A0 },
    { "mesh", DEBUG_MESH },
+   { "tex_cache", DEBUG_TEX_CACHE, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -101,6 +103,8 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
    { "no_rast_linear", PERF_NO_RAST_LINEAR, NULL },
    { "no_shade",       PERF_NO_SHADE, NULL },
+   { "no_parallel_setup", PERF_NO_PARALLEL_SETUP, NULL },
+   { "no_numa",        PERF_NO_NUMA, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -1000,6 +1004,7 @@ lp_disk_cache_create(struct llvmpipe_screen *screen)
 {
    struct mesa_sha1 ctx;
    unsigned gallivm_perf = gallivm_get_perf_flags();
+   unsigned cache_stats = gallivm_debug & GALLIVM_DEBUG_CACHE_STATS;
    unsigned char sha1[20];
    char cache_id[20 * 2 + 1];
    _mesa_sha1_init(&ctx);
@@ -1009,6 +1014,7 @@ lp_disk_cache_create(struct llvmpipe_screen *screen)
       return;
 
    _mesa_sha1_update(&ctx, &gallivm_perf, sizeof(gallivm_perf));
+   _mesa_sha1_update(&ctx, &cache_stats, sizeof(cache_stats));
    update_cache_sha1_cpu(&ctx);
    _mesa_sha1_final(&ctx, sha1);
    mesa_bytes_to_hex(cache_id, sha1, 20);
@@ -1107,6 +1113,10 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
 
    lp_build_init(); /* get lp_native_vector_width initialised */
 
+   /* Shaders count texture block cache hits for the rasterizer to print. */
+   if (LP_DEBUG & DEBUG_TEX_CACHE)
+      gallivm_debug |= GALLIVM_DEBUG_CACHE_STATS;
+
    lp_disk_cache_create(screen);
    screen->late_init_done = true;
 out:
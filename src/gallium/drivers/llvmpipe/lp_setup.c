@@ -41,6 +41,7 @@
 #include "util/u_pack_color.h"
 #include "util/u_cpu_detect.h"
 #include "util/u_viewport.h"
+#include "util/u_sse.h"
 #include "draw/draw_pipe.h"
 #include "util/os_time.h"
 #include "lp_context.h"
@@ -383,6 +384,8 @@ void
 lp_setup_flush(struct lp_setup_context *setup,
                const char *reason)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    set_scene_state(setup, SETUP_FLUSHED, reason);
 }
 
@@ -393,6 +396,8 @@ lp_setup_bind_framebuffer(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    /* Flush any old scene.
     */
    set_scene_state(setup, SETUP_FLUSHED, __func__);
@@ -542,6 +547,8 @@ lp_setup_clear(struct lp_setup_context *setup,
                unsigned stencil,
                unsigned flags)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    /*
     * Note any of these (max 9) clears could fail (but at most there should
     * be just one failure!). This avoids doing the previous succeeded
@@ -580,6 +587,8 @@ lp_setup_bind_rasterizer(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    setup->ccw_is_frontface = rast->front_ccw;
    setup->cullmode = rast->cull_face;
    setup->triangle = first_triangle;
@@ -612,6 +621,8 @@ lp_setup_set_setup_variant(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    setup->setup.variant = variant;
 }
 
@@ -622,6 +633,8 @@ lp_setup_set_fs_variant(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s %p\n", __func__, variant);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    setup->fs.current.variant = variant;
    setup->dirty |= LP_SETUP_NEW_FS;
 }
@@ -634,6 +647,8 @@ lp_setup_set_fs_constants(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s %p\n", __func__, (void *) buffers);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(num <= ARRAY_SIZE(setup->constants));
 
    unsigned i;
@@ -656,6 +671,8 @@ lp_setup_set_fs_ssbos(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s %p\n", __func__, (void *) buffers);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(num <= ARRAY_SIZE(setup->ssbos));
 
    unsigned i;
@@ -679,6 +696,8 @@ lp_setup_set_fs_images(struct lp_setup_context *setup,
 
    LP_DBG(DEBUG_SETUP, "%s %p\n", __func__, (void *) images);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(num <= ARRAY_SIZE(setup->images));
 
    for (i = 0; i < num; ++i) {
@@ -706,6 +725,8 @@ lp_setup_set_alpha_ref_value(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s %f\n", __func__, alpha_ref_value);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    if (setup->fs.current.jit_context.alpha_ref_value != alpha_ref_value) {
       setup->fs.current.jit_context.alpha_ref_value = alpha_ref_value;
       setup->dirty |= LP_SETUP_NEW_FS;
@@ -719,6 +740,8 @@ lp_setup_set_stencil_ref_values(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s %d %d\n", __func__, refs[0], refs[1]);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    if (setup->fs.current.jit_context.stencil_ref_front != refs[0] ||
        setup->fs.current.jit_context.stencil_ref_back != refs[1]) {
       setup->fs.current.jit_context.stencil_ref_front = refs[0];
@@ -734,6 +757,8 @@ lp_setup_set_blend_color(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(blend_color);
 
    if (memcmp(&setup->blend_color.current,
@@ -750,6 +775,8 @@ lp_setup_set_scissors(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(scissors);
 
    for (unsigned i = 0; i < PIPE_MAX_VIEWPORTS; ++i) {
@@ -766,6 +793,8 @@ void
 lp_setup_set_sample_mask(struct lp_setup_context *setup,
                          uint32_t sample_mask)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    if (setup->fs.current.jit_context.sample_mask != sample_mask) {
       setup->fs.current.jit_context.sample_mask = sample_mask;
       setup->dirty |= LP_SETUP_NEW_FS;
@@ -777,6 +806,8 @@ void
 lp_setup_set_rasterizer_discard(struct lp_setup_context *setup,
                                 bool rasterizer_discard)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    if (setup->rasterizer_discard != rasterizer_discard) {
       setup->rasterizer_discard = rasterizer_discard;
       setup->line = first_line;
@@ -791,6 +822,8 @@ void
 lp_setup_set_vertex_info(struct lp_setup_context *setup,
                          struct vertex_info *vertex_info)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    /* XXX: just silently holding onto the pointer:
     */
    setup->vertex_info = vertex_info;
@@ -801,14 +834,18 @@ void
 lp_setup_set_linear_mode(struct lp_setup_context *setup,
                          bool mode)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    /* The linear rasterizer requires sse2 both at compile and runtime,
     * in particular for the code in lp_rast_linear_fallback.c.  This
     * is more than ten-year-old technology, so it's a reasonable
-    * baseline.
+    * baseline.  On AArch64 the same code runs on NEON, which is
+    * always present.
     */
-#if DETECT_ARCH_SSE
+#if UTIL_SSE2_INTRINSICS
    setup->permit_linear_rasterizer = (mode &&
-                                      util_get_cpu_caps()->has_sse2);
+                                      (!DETECT_ARCH_SSE ||
+                                       util_get_cpu_caps()->has_sse2));
 #else
    setup->permit_linear_rasterizer = false;
 #endif
@@ -827,6 +864,8 @@ lp_setup_set_viewports(struct lp_setup_context *setup,
 
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(num_viewports <= PIPE_MAX_VIEWPORTS);
    assert(viewports);
 
@@ -879,6 +918,8 @@ lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(num <= PIPE_MAX_SHADER_SAMPLER_VIEWS);
 
    const unsigned max_tex_num = MAX2(num, setup->fs.current_tex_num);
@@ -923,6 +964,8 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   lp_setup_finish_parallel_triangles(setup);
+
    assert(num <= PIPE_MAX_SAMPLERS);
 
    for (unsigned i = 0; i < PIPE_MAX_SAMPLERS; i++) {
@@ -1211,6 +1254,11 @@ lp_setup_update_state(struct lp_setup_context *setup,
     */
    {
       struct llvmpipe_context *lp = llvmpipe_context(setup->pipe);
+
+      /* Triangles still being set up in parallel use the old state. */
+      if (lp->dirty || setup->dirty)
+         lp_setup_finish_parallel_triangles(setup);
+
       if (lp->dirty) {
          llvmpipe_update_derived(lp);
       }
@@ -1280,6 +1328,7 @@ lp_setup_update_state(struct lp_setup_context *setup,
 void
 lp_setup_destroy(struct lp_setup_context *setup)
 {
+   lp_setup_destroy_parallel_triangles(setup);
    lp_setup_reset(setup);
 
    util_unreference_framebuffer_state(&setup->fb);
@@ -1315,6 +1364,7 @@ lp_setup_destroy(struct lp_setup_context *setup)
 
    LP_DBG(DEBUG_SETUP, "number of scenes used: %d\n", setup->num_active_scenes);
    slab_destroy(&setup->scene_slab);
+   lp_scene_free_bin_orders(setup);
 
    FREE(setup);
 }
@@ -1347,6 +1397,8 @@ lp_setup_create(struct pipe_context *pipe,
    setup->pipe = pipe;
 
    setup->num_threads = screen->num_threads;
+   setup->parallel_setup = screen->num_threads > 1 &&
+                           !(LP_PERF & PERF_NO_PARALLEL_SETUP);
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1399,6 +1451,8 @@ void
 lp_setup_begin_query(struct lp_setup_context *setup,
                      struct llvmpipe_query *pq)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    set_scene_state(setup, SETUP_ACTIVE, "begin_query");
 
    if (!(pq->type == PIPE_QUERY_OCCLUSION_COUNTER ||
@@ -1444,6 +1498,8 @@ lp_setup_begin_query(struct lp_setup_context *setup,
 void
 lp_setup_end_query(struct lp_setup_context *setup, struct llvmpipe_query *pq)
 {
+   lp_setup_finish_parallel_triangles(setup);
+
    set_scene_state(setup, SETUP_ACTIVE, "end_query");
 
    assert(setup->scene);
@@ -53,6 +53,7 @@
 #define LP_SETUP_NEW_SSBOS       0x20
 
 struct lp_setup_variant;
+struct lp_setup_parallel_segment;
 
 
 /** Max number of scenes */
@@ -84,6 +85,14 @@ struct lp_setup_context
    uint vertex_buffer_size;
    void *vertex_buffer;
 
+   /* Triangle lists in flight on the thread pool, see lp_setup_tri.c */
+   bool parallel_setup;
+   bool parallel_binning;
+   bool vertex_buffer_busy;
+   unsigned parallel_first;
+   unsigned parallel_count;
+   struct lp_setup_parallel_segment *parallel_segments;
+
    /* Final pipeline stage for draw module.  Draw module should
     * create/install this itself now.
     */
@@ -96,6 +105,9 @@ struct lp_setup_context
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
+   struct lp_bin_order bin_orders[LP_BIN_ORDER_CACHE_SIZE];
+   unsigned next_bin_order;
+
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned active_binned_queries;
 
@@ -291,6 +303,26 @@ lp_setup_analyse_triangles(struct lp_setup_context *setup,
                            int stride,
                            int nr);
 
+bool
+lp_setup_use_parallel_triangles(const struct lp_setup_context *setup,
+                                unsigned nr);
+
+bool
+lp_setup_parallel_triangles(struct lp_setup_context *setup,
+                            const void *vertex_buffer,
+                            unsigned stride,
+                            const uint16_t *indices,
+                            unsigned nr);
+
+void
+lp_setup_finish_parallel_triangles(struct lp_setup_context *setup);
+
+void
+lp_setup_retire_vertex_buffer(struct lp_setup_context *setup);
+
+void
+lp_setup_destroy_parallel_triangles(struct lp_setup_context *setup);
+
 bool
 lp_setup_bin_triangle(struct lp_setup_context *setup,
                       struct lp_rast_triangle *tri,
@@ -54,6 +54,9 @@ altivec.h inclusion in -std=c++98..11 causes bool to be redefined
 #include "lp_state_fs.h"
 #include "lp_state_setup.h"
 #include "lp_context.h"
+#include "lp_cs_tpool.h"
+#include "lp_debug.h"
+#include "lp_screen.h"
 
 #include <inttypes.h>
 
@@ -277,7 +280,8 @@ do_triangle_ccw(struct lp_setup_context *setup,
                 const float (*v0)[4],
                 const float (*v1)[4],
                 const float (*v2)[4],
-                bool frontfacing)
+                bool frontfacing,
+                const float (*coefs)[4])
 {
    struct lp_scene *scene = setup->scene;
 
@@ -451,14 +455,19 @@ do_triangle_ccw(struct lp_setup_context *setup,
       }
    }
 
-   /* Setup parameter interpolants:
+   /* Setup parameter interpolants, unless lp_setup_parallel_triangles()
+    * already did:
     */
-   setup->setup.variant->jit_function(v0, v1, v2,
-                                      frontfacing,
-                                      GET_A0(&tri->inputs),
-                                      GET_DADX(&tri->inputs),
-                                      GET_DADY(&tri->inputs),
-                                      &setup->setup.variant->key);
+   if (coefs) {
+      memcpy(GET_A0(&tri->inputs), coefs, 3 * tri->inputs.stride);
+   } else {
+      setup->setup.variant->jit_function(v0, v1, v2,
+                                         frontfacing,
+                                         GET_A0(&tri->inputs),
+                                         GET_DADX(&tri->inputs),
+                                         GET_DADY(&tri->inputs),
+                                         &setup->setup.variant->key);
+   }
 
    tri->inputs.frontfacing = frontfacing;
    tri->inputs.disable = false;
@@ -787,6 +796,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                       unsigned viewport_index)
 {
    struct lp_scene *scene = setup->scene;
+   const unsigned tile_order = scene->tile_order;
+   const int tile_size = scene->tile_size;
    unsigned cmd;
 
    /* What is the largest power-of-two boundary this triangle crosses:
@@ -819,21 +830,21 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
 
    /* Determine which tile(s) intersect the triangle's bounding box
     */
-   if (dx < TILE_SIZE) {
-      const int ix0 = bbox->x0 / TILE_SIZE;
-      const int iy0 = bbox->y0 / TILE_SIZE;
-      unsigned px = bbox->x0 & 63 & ~3;
-      unsigned py = bbox->y0 & 63 & ~3;
+   if (dx < tile_size) {
+      const int ix0 = bbox->x0 >> tile_order;
+      const int iy0 = bbox->y0 >> tile_order;
+      unsigned px = bbox->x0 & (tile_size - 1) & ~3;
+      unsigned py = bbox->y0 & (tile_size - 1) & ~3;
 
-      assert(iy0 == bbox->y1 / TILE_SIZE &&
-             ix0 == bbox->x1 / TILE_SIZE);
+      assert(iy0 == bbox->y1 >> tile_order &&
+             ix0 == bbox->x1 >> tile_order);
 
       if (nr_planes == 3) {
          if (sz < 4) {
             /* Triangle is contained in a single 4x4 stamp:
              */
-            assert(px + 4 <= TILE_SIZE);
-            assert(py + 4 <= TILE_SIZE);
+            assert(px + 4 <= tile_size);
+            assert(py + 4 <= tile_size);
             if (setup->multisample)
                cmd = LP_RAST_OP_MS_TRIANGLE_3_4;
             else
@@ -852,11 +863,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
              * dimensions if the triangle is 16 pixels in one dimension but 4
              * in the other. So budge the 16x16 back inside the tile.
              */
-            px = MIN2(px, TILE_SIZE - 16);
-            py = MIN2(py, TILE_SIZE - 16);
+            px = MIN2(px, tile_size - 16);
+            py = MIN2(py, tile_size - 16);
 
-            assert(px + 16 <= TILE_SIZE);
-            assert(py + 16 <= TILE_SIZE);
+            assert(px + 16 <= tile_size);
+            assert(py + 16 <= tile_size);
 
             if (setup->multisample)
                cmd = LP_RAST_OP_MS_TRIANGLE_3_16;
@@ -867,11 +878,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                                                lp_rast_arg_triangle_contained(tri, px, py));
          }
       } else if (nr_planes == 4 && sz < 16) {
-         px = MIN2(px, TILE_SIZE - 16);
-         py = MIN2(py, TILE_SIZE - 16);
+         px = MIN2(px, tile_size - 16);
+         py = MIN2(py, tile_size - 16);
 
-         assert(px + 16 <= TILE_SIZE);
-         assert(py + 16 <= TILE_SIZE);
+         assert(px + 16 <= tile_size);
+         assert(py + 16 <= tile_size);
 
          if (setup->multisample)
             cmd = LP_RAST_OP_MS_TRIANGLE_4_16;
@@ -901,23 +912,23 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
       int64_t xstep[MAX_PLANES];
       int64_t ystep[MAX_PLANES];
 
-      const int ix0 = trimmed_box.x0 / TILE_SIZE;
-      const int iy0 = trimmed_box.y0 / TILE_SIZE;
-      const int ix1 = trimmed_box.x1 / TILE_SIZE;
-      const int iy1 = trimmed_box.y1 / TILE_SIZE;
+      const int ix0 = trimmed_box.x0 >> tile_order;
+      const int iy0 = trimmed_box.y0 >> tile_order;
+      const int ix1 = trimmed_box.x1 >> tile_order;
+      const int iy1 = trimmed_box.y1 >> tile_order;
 
       for (int i = 0; i < nr_planes; i++) {
          c[i] = (plane[i].c +
-                 IMUL64(plane[i].dcdy, iy0) * TILE_SIZE -
-                 IMUL64(plane[i].dcdx, ix0) * TILE_SIZE);
+                 IMUL64(plane[i].dcdy, iy0) * tile_size -
+                 IMUL64(plane[i].dcdx, ix0) * tile_size);
 
          ei[i] = (plane[i].dcdy -
                   plane[i].dcdx -
-                  (int64_t)plane[i].eo) << TILE_ORDER;
+                  (int64_t)plane[i].eo) << tile_order;
 
-         eo[i] = (int64_t)plane[i].eo << TILE_ORDER;
-         xstep[i] = -(((int64_t)plane[i].dcdx) << TILE_ORDER);
-         ystep[i] = ((int64_t)plane[i].dcdy) << TILE_ORDER;
+         eo[i] = (int64_t)plane[i].eo << tile_order;
+         xstep[i] = -(((int64_t)plane[i].dcdx) << tile_order);
+         ystep[i] = ((int64_t)plane[i].dcdy) << tile_order;
       }
 
       tri->inputs.is_blit = lp_setup_is_blit(setup, &tri->inputs);
@@ -1006,7 +1017,8 @@ retry_triangle_ccw(struct lp_setup_context *setup,
                    const float (*v0)[4],
                    const float (*v1)[4],
                    const float (*v2)[4],
-                   bool front)
+                   bool front,
+                   const float (*coefs)[4])
 {
    if (0)
       lp_setup_print_triangle(setup, v0, v1, v2);
@@ -1017,11 +1029,11 @@ retry_triangle_ccw(struct lp_setup_context *setup,
       return;
    }
 
-   if (!do_triangle_ccw(setup, position, v0, v1, v2, front)) {
+   if (!do_triangle_ccw(setup, position, v0, v1, v2, front, coefs)) {
       if (!lp_setup_flush_and_restart(setup))
          return;
 
-      if (!do_triangle_ccw(setup, position, v0, v1, v2, front))
+      if (!do_triangle_ccw(setup, position, v0, v1, v2, front, coefs))
          return;
    }
 }
@@ -1034,13 +1046,12 @@ retry_triangle_ccw(struct lp_setup_context *setup,
  * to what is done in the jit setup prog.
  */
 static inline int8_t
-calc_fixed_position(struct lp_setup_context *setup,
-                    struct fixed_position* position,
-                    const float (*v0)[4],
-                    const float (*v1)[4],
-                    const float (*v2)[4])
+calc_fixed_position_offset(float pixel_offset,
+                           struct fixed_position* position,
+                           const float (*v0)[4],
+                           const float (*v1)[4],
+                           const float (*v2)[4])
 {
-   float pixel_offset = setup->multisample ? 0.0 : setup->pixel_offset;
    /*
     * The rounding may not be quite the same with DETECT_ARCH_SSE
     * (util_iround right now only does nearest/even on x87,
@@ -1101,6 +1112,18 @@ calc_fixed_position(struct lp_setup_context *setup,
 }
 
 
+static inline int8_t
+calc_fixed_position(const struct lp_setup_context *setup,
+                    struct fixed_position* position,
+                    const float (*v0)[4],
+                    const float (*v1)[4],
+                    const float (*v2)[4])
+{
+   float pixel_offset = setup->multisample ? 0.0 : setup->pixel_offset;
+   return calc_fixed_position_offset(pixel_offset, position, v0, v1, v2);
+}
+
+
 /**
  * Rotate a triangle, flipping its clockwise direction,
  * Swaps values for xy[0] and xy[1]
@@ -1169,11 +1192,11 @@ triangle_cw(struct lp_setup_context *setup,
       if (setup->flatshade_first) {
          rotate_fixed_position_12(&position);
          retry_triangle_ccw(setup, &position, v0, v2, v1,
-                            !setup->ccw_is_frontface);
+                            !setup->ccw_is_frontface, NULL);
       } else {
          rotate_fixed_position_01(&position);
          retry_triangle_ccw(setup, &position, v1, v0, v2,
-                            !setup->ccw_is_frontface);
+                            !setup->ccw_is_frontface, NULL);
       }
    }
 }
@@ -1195,7 +1218,8 @@ triangle_ccw(struct lp_setup_context *setup,
    int8_t area_sign = calc_fixed_position(setup, &position, v0, v1, v2);
 
    if (area_sign > 0)
-      retry_triangle_ccw(setup, &position, v0, v1, v2, setup->ccw_is_frontface);
+      retry_triangle_ccw(setup, &position, v0, v1, v2,
+                         setup->ccw_is_frontface, NULL);
 }
 
 
@@ -1228,16 +1252,16 @@ triangle_both(struct lp_setup_context *setup,
 
    if (area_sign > 0) {
       retry_triangle_ccw(setup, &position, v0, v1, v2,
-                         setup->ccw_is_frontface);
+                         setup->ccw_is_frontface, NULL);
    } else if (area_sign < 0) {
       if (setup->flatshade_first) {
          rotate_fixed_position_12(&position);
          retry_triangle_ccw(setup, &position, v0, v2, v1,
-                            !setup->ccw_is_frontface);
+                            !setup->ccw_is_frontface, NULL);
       } else {
          rotate_fixed_position_01(&position);
          retry_triangle_ccw(setup, &position, v1, v0, v2,
-                            !setup->ccw_is_frontface);
+                            !setup->ccw_is_frontface, NULL);
       }
    }
 }
@@ -1274,3 +1298,358 @@ lp_setup_choose_triangle(struct lp_setup_context *setup)
       break;
    }
 }
+
+
+
+
+/*
+ * Parallel triangle setup.
+ *
+ * Large triangle lists are split into ranges which are set up on the
+ * compute thread pool: fixed point positions, culling and the
+ * interpolant setup jit function, which together are most of the per
+ * triangle cost.  The context thread then bins the surviving triangles
+ * in submission order, so API ordering is preserved without having to
+ * merge per-thread bins.
+ *
+ * The draw module hands over a draw in segments of at most 1024 vertices.
+ * Rather than waiting for each segment before returning to it, up to
+ * LP_SETUP_PARALLEL_DEPTH segments are kept in flight while the draw
+ * module shades the next ones, and are binned when the ring is full, or
+ * before anything else is binned or any setup state changes.  The jobs
+ * only read the state they were queued with, and the vertex buffers they
+ * read are kept alive by the segments until they are binned.
+ */
+#define LP_SETUP_PARALLEL_RANGE     32
+#define LP_SETUP_PARALLEL_MIN_TRIS  128
+#define LP_SETUP_PARALLEL_DEPTH     4
+
+struct lp_setup_prepared_tri {
+   alignas(16) struct fixed_position position;
+   const float (*v0)[4];
+   const float (*v1)[4];
+   const float (*v2)[4];
+   bool draw;
+   bool frontfacing;
+};
+
+struct lp_setup_parallel_job {
+   const struct lp_setup_variant *variant;
+   const void *vertex_buffer;
+   const uint16_t *indices;
+   unsigned stride;
+   unsigned num_tris;
+   unsigned coef_size;
+   float pixel_offset;
+   unsigned cullmode;
+   bool ccw_is_frontface;
+   bool flatshade_first;
+   struct lp_setup_prepared_tri *tris;
+   uint8_t *coefs;
+};
+
+struct lp_setup_parallel_segment {
+   struct lp_setup_parallel_job job;
+   struct lp_cs_tpool_task *task;
+
+   unsigned tris_size;
+   void *tris;
+   unsigned coefs_size;
+   void *coefs;
+   unsigned indices_size;
+   void *indices;
+
+   /* A vertex buffer retired by lp_setup_retire_vertex_buffer() while this
+    * segment was the newest one, or a spare once it has been binned.
+    */
+   unsigned vertex_buffer_size;
+   void *vertex_buffer;
+};
+
+
+static inline const float (*
+parallel_vert(const struct lp_setup_parallel_job *job, unsigned i))[4]
+{
+   const unsigned index = job->indices ? job->indices[i] : i;
+   return (const float (*)[4])
+      ((const uint8_t *)job->vertex_buffer + index * job->stride);
+}
+
+
+static void
+prepare_triangles(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   const struct lp_setup_parallel_job *job = data;
+   const struct lp_setup_variant *variant = job->variant;
+   const unsigned input_array_sz = job->coef_size / 3;
+   const unsigned start = iter_idx * LP_SETUP_PARALLEL_RANGE;
+   const unsigned end = MIN2(start + LP_SETUP_PARALLEL_RANGE, job->num_tris);
+
+   /* Faces of triangles with positive / negative area */
+   const unsigned ccw_face = job->ccw_is_frontface ? PIPE_FACE_FRONT
+                                                   : PIPE_FACE_BACK;
+   const unsigned cw_face = ccw_face ^ PIPE_FACE_FRONT_AND_BACK;
+
+   for (unsigned i = start; i < end; i++) {
+      struct lp_setup_prepared_tri *prep = &job->tris[i];
+      const float (*v0)[4] = parallel_vert(job, i * 3 + 0);
+      const float (*v1)[4] = parallel_vert(job, i * 3 + 1);
+      const float (*v2)[4] = parallel_vert(job, i * 3 + 2);
+
+      int8_t area_sign = calc_fixed_position_offset(job->pixel_offset,
+                                                    &prep->position,
+                                                    v0, v1, v2);
+
+      /* Same as triangle_both(), triangle_ccw() and triangle_cw() */
+      if (area_sign > 0 && !(job->cullmode & ccw_face)) {
+         prep->v0 = v0;
+         prep->v1 = v1;
+         prep->v2 = v2;
+         prep->frontfacing = job->ccw_is_frontface;
+      } else if (area_sign < 0 && !(job->cullmode & cw_face)) {
+         if (job->flatshade_first) {
+            rotate_fixed_position_12(&prep->position);
+            prep->v0 = v0;
+            prep->v1 = v2;
+            prep->v2 = v1;
+         } else {
+            rotate_fixed_position_01(&prep->position);
+            prep->v0 = v1;
+            prep->v1 = v0;
+            prep->v2 = v2;
+         }
+         prep->frontfacing = !job->ccw_is_frontface;
+      } else {
+         prep->draw = false;
+         continue;
+      }
+      prep->draw = true;
+
+      uint8_t *coefs = job->coefs + i * job->coef_size;
+      variant->jit_function(prep->v0, prep->v1, prep->v2,
+                            prep->frontfacing,
+                            (float (*)[4])coefs,
+                            (float (*)[4])(coefs + input_array_sz),
+                            (float (*)[4])(coefs + 2 * input_array_sz),
+                            &variant->key);
+   }
+}
+
+
+static bool
+grow_scratch(void **ptr, unsigned *size, unsigned required)
+{
+   if (*size >= required)
+      return true;
+
+   align_free(*ptr);
+   *ptr = align_malloc(required, 16);
+   *size = *ptr ? required : 0;
+   return *ptr != NULL;
+}
+
+
+/**
+ * Wait for the oldest segment in flight and bin its triangles.
+ */
+static void
+bin_oldest_segment(struct lp_setup_context *setup)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   struct lp_setup_parallel_segment *seg =
+      &setup->parallel_segments[setup->parallel_first];
+   const struct lp_setup_parallel_job *job = &seg->job;
+
+   lp_cs_tpool_wait_for_task(screen->cs_tpool, &seg->task);
+
+   /* Binning may flush the scene and update the state, which must not
+    * bin the segments queued after this one ahead of it.
+    */
+   setup->parallel_binning = true;
+   for (unsigned i = 0; i < job->num_tris; i++) {
+      struct lp_setup_prepared_tri *prep = &job->tris[i];
+
+      if (prep->draw) {
+         retry_triangle_ccw(setup, &prep->position,
+                            prep->v0, prep->v1, prep->v2, prep->frontfacing,
+                            (const float (*)[4])(job->coefs +
+                                                 i * job->coef_size));
+      }
+   }
+   setup->parallel_binning = false;
+
+   setup->parallel_first = (setup->parallel_first + 1) %
+                           LP_SETUP_PARALLEL_DEPTH;
+   setup->parallel_count--;
+}
+
+
+/**
+ * Bin every triangle list still being set up on the thread pool.  Called
+ * before anything else is binned and before any setup state changes.
+ */
+void
+lp_setup_finish_parallel_triangles(struct lp_setup_context *setup)
+{
+   if (setup->parallel_binning)
+      return;
+
+   while (setup->parallel_count)
+      bin_oldest_segment(setup);
+
+   setup->vertex_buffer_busy = false;
+}
+
+
+/**
+ * Called before the vertex buffer is refilled: if segments in flight
+ * still read it, hand it to the newest of them, which is binned last, and
+ * take that segment's spare buffer instead.
+ */
+void
+lp_setup_retire_vertex_buffer(struct lp_setup_context *setup)
+{
+   if (setup->vertex_buffer_busy && setup->parallel_count) {
+      struct lp_setup_parallel_segment *seg =
+         &setup->parallel_segments[(setup->parallel_first +
+                                    setup->parallel_count - 1) %
+                                   LP_SETUP_PARALLEL_DEPTH];
+      void *buffer = seg->vertex_buffer;
+      unsigned size = seg->vertex_buffer_size;
+
+      seg->vertex_buffer = setup->vertex_buffer;
+      seg->vertex_buffer_size = setup->vertex_buffer_size;
+      setup->vertex_buffer = buffer;
+      setup->vertex_buffer_size = size;
+   }
+
+   setup->vertex_buffer_busy = false;
+}
+
+
+void
+lp_setup_destroy_parallel_triangles(struct lp_setup_context *setup)
+{
+   lp_setup_finish_parallel_triangles(setup);
+
+   if (!setup->parallel_segments)
+      return;
+
+   for (unsigned i = 0; i < LP_SETUP_PARALLEL_DEPTH; i++) {
+      struct lp_setup_parallel_segment *seg = &setup->parallel_segments[i];
+
+      align_free(seg->tris);
+      align_free(seg->coefs);
+      align_free(seg->indices);
+      align_free(seg->vertex_buffer);
+   }
+   FREE(setup->parallel_segments);
+   setup->parallel_segments = NULL;
+}
+
+
+/**
+ * Whether a triangle list of nr vertices goes to
+ * lp_setup_parallel_triangles().  Linear-rasterizer contexts keep the
+ * serial path, where rect() and lp_setup_analyse_triangles() can turn
+ * triangle pairs into rectangles.
+ */
+bool
+lp_setup_use_parallel_triangles(const struct lp_setup_context *setup,
+                                unsigned nr)
+{
+   /* The accurate a0 rotation in do_triangle_ccw() changes the vertex
+    * order after the interpolants would have been set up here.
+    */
+   return setup->parallel_setup &&
+          setup->prim == MESA_PRIM_TRIANGLES &&
+          nr / 3 >= LP_SETUP_PARALLEL_MIN_TRIS &&
+          !setup->permit_linear_rasterizer &&
+          !setup->rasterizer_discard &&
+          setup->cullmode != PIPE_FACE_FRONT_AND_BACK &&
+          !(LP_DEBUG & DEBUG_ACCURATE_A0);
+}
+
+
+/**
+ * Queue a triangle list for setup on the compute thread pool.  It is
+ * binned by a later call, or by lp_setup_finish_parallel_triangles().
+ * \param indices  the element list, or NULL for sequential vertices
+ * \return false if the list should be set up serially instead
+ */
+bool
+lp_setup_parallel_triangles(struct lp_setup_context *setup,
+                            const void *vertex_buffer,
+                            unsigned stride,
+                            const uint16_t *indices,
+                            unsigned nr)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   struct llvmpipe_context *lp_context = llvmpipe_context(setup->pipe);
+   const struct lp_setup_variant *variant = setup->setup.variant;
+   const unsigned num_tris = nr / 3;
+   const unsigned coef_size =
+      3 * (variant->key.num_inputs + 1) * sizeof(float[4]);
+
+   if (!setup->parallel_segments) {
+      setup->parallel_segments =
+         CALLOC(LP_SETUP_PARALLEL_DEPTH,
+                sizeof(struct lp_setup_parallel_segment));
+      if (!setup->parallel_segments)
+         return false;
+   }
+
+   if (setup->parallel_count == LP_SETUP_PARALLEL_DEPTH)
+      bin_oldest_segment(setup);
+
+   struct lp_setup_parallel_segment *seg =
+      &setup->parallel_segments[(setup->parallel_first +
+                                 setup->parallel_count) %
+                                LP_SETUP_PARALLEL_DEPTH];
+
+   if (!grow_scratch(&seg->tris, &seg->tris_size,
+                     num_tris * sizeof(struct lp_setup_prepared_tri)) ||
+       !grow_scratch(&seg->coefs, &seg->coefs_size, num_tris * coef_size) ||
+       (indices && !grow_scratch(&seg->indices, &seg->indices_size,
+                                 nr * sizeof(uint16_t)))) {
+      lp_setup_finish_parallel_triangles(setup);
+      return false;
+   }
+
+   /* The draw module reuses its index storage for the next segment. */
+   if (indices)
+      memcpy(seg->indices, indices, nr * sizeof(uint16_t));
+
+   seg->job = (struct lp_setup_parallel_job) {
+      .variant = variant,
+      .vertex_buffer = vertex_buffer,
+      .indices = indices ? seg->indices : NULL,
+      .stride = stride,
+      .num_tris = num_tris,
+      .coef_size = coef_size,
+      .pixel_offset = setup->multisample ? 0.0f : setup->pixel_offset,
+      .cullmode = setup->cullmode,
+      .ccw_is_frontface = setup->ccw_is_frontface,
+      .flatshade_first = setup->flatshade_first,
+      .tris = seg->tris,
+      .coefs = seg->coefs,
+   };
+
+   seg->task = lp_cs_tpool_queue_task(screen->cs_tpool, prepare_triangles,
+                                      &seg->job,
+                                      DIV_ROUND_UP(num_tris,
+                                                   LP_SETUP_PARALLEL_RANGE));
+   if (!seg->task) {
+      lp_setup_finish_parallel_triangles(setup);
+      return false;
+   }
+
+   setup->parallel_count++;
+   setup->vertex_buffer_busy = true;
+
+   if (lp_context->active_statistics_queries) {
+      lp_context->pipeline_statistics.c_primitives += num_tris;
+   }
+
+   return true;
+}
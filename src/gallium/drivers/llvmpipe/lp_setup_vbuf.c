@@ -85,6 +85,9 @@ lp_setup_allocate_vertices(struct vbuf_render *vbr,
    struct lp_setup_context *setup = lp_setup_context(vbr);
    unsigned size = vertex_size * nr_vertices;
 
+   /* Don't overwrite vertices triangles in flight are set up from. */
+   lp_setup_retire_vertex_buffer(setup);
+
    if (setup->vertex_buffer_size < size) {
       align_free(setup->vertex_buffer);
       setup->vertex_buffer = align_malloc(size, 16);
@@ -184,6 +187,13 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const uint16_t *indices, uint nr
 
    const bool uses_constant_interp =
       setup->setup.variant->key.uses_constant_interp;
+   const bool parallel = lp_setup_use_parallel_triangles(setup, nr);
+
+   /* Anything set up serially is binned right away, after the triangle
+    * lists still in flight.
+    */
+   if (!parallel)
+      lp_setup_finish_parallel_triangles(setup);
 
    switch (setup->prim) {
    case MESA_PRIM_POINTS:
@@ -223,7 +233,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const uint16_t *indices, uint nr
       break;
 
    case MESA_PRIM_TRIANGLES:
-      if (nr % 6 == 0 && !uses_constant_interp) {
+      if (nr % 6 == 0 && !uses_constant_interp && !parallel) {
          for (i = 5; i < nr; i += 6) {
             rect(setup,
                  get_vert(vertex_buffer, indices[i-5], stride),
@@ -233,6 +243,10 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const uint16_t *indices, uint nr
                  get_vert(vertex_buffer, indices[i-1], stride),
                  get_vert(vertex_buffer, indices[i-0], stride));
          }
+      } else if (parallel &&
+                 lp_setup_parallel_triangles(setup, vertex_buffer, stride,
+                                             indices, nr)) {
+         /* queued on the thread pool, binned later in order */
       } else {
          for (i = 2; i < nr; i += 3) {
             setup->triangle(setup,
@@ -392,6 +406,13 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
 
    const bool uses_constant_interp =
       setup->setup.variant->key.uses_constant_interp;
+   const bool parallel = lp_setup_use_parallel_triangles(setup, nr);
+
+   /* Anything set up serially is binned right away, after the triangle
+    * lists still in flight.
+    */
+   if (!parallel)
+      lp_setup_finish_parallel_triangles(setup);
 
    switch (setup->prim) {
    case MESA_PRIM_POINTS:
@@ -431,7 +452,7 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       break;
 
    case MESA_PRIM_TRIANGLES:
-      if (nr % 6 == 0 && !uses_constant_interp) {
+      if (nr % 6 == 0 && !uses_constant_interp && !parallel) {
          for (i = 5; i < nr; i += 6) {
             rect(setup,
                  get_vert(vertex_buffer, i-5, stride),
@@ -441,11 +462,15 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
                  get_vert(vertex_buffer, i-1, stride),
                  get_vert(vertex_buffer, i-0, stride));
          }
-      } else if (!uses_constant_interp &&
+      } else if (!uses_constant_interp && !parallel &&
                lp_setup_analyse_triangles(setup, vertex_buffer, stride, nr)) {
          /* If lp_setup_analyse_triangles() returned true, it also
           * emitted (setup) the rect or triangles.
           */
+      } else if (parallel &&
+                 lp_setup_parallel_triangles(setup, vertex_buffer, stride,
+                                             NULL, nr)) {
+         /* queued on the thread pool, binned later in order */
       } else {
          for (i = 2; i < nr; i += 3) {
             setup->triangle(setup,
@@ -639,6 +664,7 @@ static void
 lp_setup_vbuf_destroy(struct vbuf_render *vbr)
 {
    struct lp_setup_context *setup = lp_setup_context(vbr);
+   lp_setup_finish_parallel_triangles(setup);
    if (setup->vertex_buffer) {
       align_free(setup->vertex_buffer);
       setup->vertex_buffer = NULL;
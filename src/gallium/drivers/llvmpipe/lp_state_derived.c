@@ -298,6 +298,13 @@ llvmpipe_update_derived(struct llvmpipe_context *llvmpipe)
                           LP_NEW_VS))
       compute_vertex_info(llvmpipe);
 
+   /* Pick up the optimized copy of the bound fragment shader variant once
+    * it is done compiling, see LP_ASYNC_JIT.
+    */
+   if (llvmpipe->fs_pending &&
+       util_queue_fence_is_signalled(&llvmpipe->fs_pending->compile_job->fence))
+      llvmpipe->dirty |= LP_NEW_FS;
+
    if (llvmpipe->dirty & (LP_NEW_FS |
                           LP_NEW_FRAMEBUFFER |
                           LP_NEW_BLEND |
@@ -61,6 +61,7 @@
 #include "pipe/p_defines.h"
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
 #include "util/u_pointer.h"
 #include "util/format/u_format.h"
 #include "util/u_dump.h"
@@ -636,6 +637,7 @@ fs_fb_fetch(const struct lp_build_fs_iface *iface,
 static void
 generate_fs_loop(struct gallivm_state *gallivm,
                  struct lp_fragment_shader *shader,
+                 struct nir_shader *nir,
                  const struct lp_fragment_shader_variant_key *key,
                  LLVMBuilderRef builder,
                  struct lp_type type,
@@ -671,7 +673,6 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef z_out = NULL, s_out = NULL;
    struct lp_build_for_loop_state loop_state, sample_loop_state = {0};
    struct lp_build_mask_context mask;
-   struct nir_shader *nir = shader->base.ir.nir;
    const bool dual_source_blend = key->blend.rt[0].blend_enable &&
                                   util_blend_state_is_dual(&key->blend, 0);
    const bool post_depth_coverage = nir->info.fs.post_depth_coverage;
@@ -3094,13 +3095,13 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
 static void
 generate_fragment(struct llvmpipe_context *lp,
                   struct lp_fragment_shader *shader,
+                  struct nir_shader *nir,
                   struct lp_fragment_shader_variant *variant,
                   unsigned partial_mask)
 {
    assert(partial_mask == RAST_WHOLE ||
           partial_mask == RAST_EDGE_TEST);
 
-   struct nir_shader *nir = shader->base.ir.nir;
    struct gallivm_state *gallivm = variant->gallivm;
    struct lp_fragment_shader_variant_key *key = &variant->key;
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
@@ -3407,7 +3408,7 @@ generate_fragment(struct llvmpipe_context *lp,
       }
 
       generate_fs_loop(gallivm,
-                       shader, key,
+                       shader, nir, key,
                        builder,
                        fs_type,
                        variant->jit_context_type,
@@ -3698,6 +3699,7 @@ lp_debug_fs_variant(struct lp_fragment_shader_variant *variant)
 
 static void
 lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
+                       struct nir_shader *nir,
                        unsigned char ir_sha1_cache_key[20])
 {
    struct blob blob = { 0 };
@@ -3705,7 +3707,7 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
    void *ir_binary;
 
    blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
+   nir_serialize(&blob, nir, true);
    ir_binary = blob.data;
    ir_size = blob.size;
 
@@ -3722,13 +3724,21 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * The IR is built from \p nir in the LLVM context \p context, so that
+ * this can run off the draw thread on private copies of both.  With
+ * \p quick, a variant which isn't in the disk cache is compiled without
+ * optimizations and without the specialized whole-block and linear
+ * functions, trading shader speed for compile time.
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
                  struct lp_fragment_shader *shader,
-                 const struct lp_fragment_shader_variant_key *key)
+                 const struct lp_fragment_shader_variant_key *key,
+                 struct nir_shader *nir,
+                 lp_context_ref *context,
+                 bool quick)
 {
-   struct nir_shader *nir = shader->base.ir.nir;
    struct lp_fragment_shader_variant *variant =
       MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
@@ -3745,26 +3755,31 @@ generate_variant(struct llvmpipe_context *lp,
    struct lp_cached_code cached = { 0 };
    unsigned char ir_sha1_cache_key[20];
    bool needs_caching = false;
-   if (shader->base.ir.nir) {
-      lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
+   if (nir) {
+      lp_fs_get_ir_cache_key(variant, nir, ir_sha1_cache_key);
 
       lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
-      if (!cached.data_size)
+      /* Unoptimized code must not end up in the cache. */
+      if (cached.data_size)
+         quick = false;
+      else if (!quick)
          needs_caching = true;
    }
 
+   variant->no = p_atomic_inc_return(&shader->variants_created) - 1;
+
    char module_name[64];
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-            shader->no, shader->variants_created);
-   variant->gallivm = gallivm_create(module_name, &lp->context, &cached);
+            shader->no, variant->no);
+   variant->gallivm = gallivm_create(module_name, context, &cached);
    if (!variant->gallivm) {
       FREE(variant);
       return NULL;
    }
 
+   variant->gallivm->no_opt = quick;
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
-   variant->no = shader->variants_created++;
 
    /*
     * Determine whether we are touching all channels in the color buffer.
@@ -3875,12 +3890,12 @@ generate_variant(struct llvmpipe_context *lp,
    lp_jit_init_types(variant);
 
    if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+      generate_fragment(lp, shader, nir, variant, RAST_EDGE_TEST);
 
    if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
+      if (variant->opaque && !quick) {
          /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
+         generate_fragment(lp, shader, nir, variant, RAST_WHOLE);
       }
    }
 
@@ -3898,13 +3913,13 @@ generate_variant(struct llvmpipe_context *lp,
       }
 
       /* If the original fastpath doesn't cover this variant, try the new
-       * code:
+       * code.  Quick variants leave it to lp_rast_linear_fallback().
        */
-      if (variant->jit_linear == NULL) {
+      if (variant->jit_linear == NULL && !quick) {
          if (shader->kind == LP_FS_KIND_BLIT_RGBA ||
              shader->kind == LP_FS_KIND_BLIT_RGB1 ||
              shader->kind == LP_FS_KIND_LLVM_LINEAR) {
-            llvmpipe_fs_variant_linear_llvm(lp, shader, variant);
+            llvmpipe_fs_variant_linear_llvm(lp, shader, nir, variant);
          }
       }
    } else {
@@ -3970,6 +3985,81 @@ generate_variant(struct llvmpipe_context *lp,
 }
 
 
+/**
+ * Compile the optimized copy of a variant, on the compile queue.  This gets
+ * its own LLVM context, as those can't be shared between threads.
+ */
+static void
+fs_compile_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_compile_job *job = data;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   lp_context_ref context;
+
+   lp_context_create(&context);
+   if (!context.ref)
+      return;
+
+   job->optimized = generate_variant(job->lp, variant->shader, &variant->key,
+                                     job->nir, &context, false);
+
+   lp_context_destroy(&context);
+   ralloc_free(job->nir);
+   job->nir = NULL;
+}
+
+
+/**
+ * Queue the compile of the optimized copy of a variant which was compiled
+ * without optimizations.  Takes ownership of \p nir.
+ */
+static void
+fs_compile_job_queue(struct llvmpipe_context *lp,
+                     struct lp_fragment_shader_variant *variant,
+                     struct nir_shader *nir)
+{
+   struct lp_fs_compile_job *job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job) {
+      ralloc_free(nir);
+      return;
+   }
+
+   job->lp = lp;
+   job->variant = variant;
+   job->nir = nir;
+   util_queue_fence_init(&job->fence);
+   variant->compile_job = job;
+
+   util_queue_add_job(&lp->compile_queue, job, &job->fence,
+                      fs_compile_job_execute, NULL, 0);
+}
+
+
+/**
+ * Cancel or wait for a compile job and free it, along with its result if
+ * that wasn't taken.
+ */
+static void
+fs_compile_job_destroy(struct llvmpipe_context *lp,
+                       struct lp_fs_compile_job *job)
+{
+   /* A job queued by another context sharing the shader is just waited
+    * for.
+    */
+   if (util_queue_is_initialized(&lp->compile_queue))
+      util_queue_drop_job(&lp->compile_queue, &job->fence);
+   else
+      util_queue_fence_wait(&job->fence);
+
+   if (job->optimized)
+      lp_fs_variant_reference(lp, &job->optimized, NULL);
+
+   ralloc_free(job->nir);
+   util_queue_fence_destroy(&job->fence);
+   FREE(job);
+}
+
+
 static void *
 llvmpipe_create_fs_state(struct pipe_context *pipe,
                          const struct pipe_shader_state *templ)
@@ -4117,6 +4207,27 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
    list_del(&variant->list_item_global.list);
    lp->nr_fs_variants--;
    lp->nr_fs_instrs -= variant->nr_instrs;
+
+   if (lp->fs_pending == variant)
+      lp->fs_pending = NULL;
+}
+
+
+/**
+ * Add shader variant to the head of the shader's and the context's variant
+ * lists.
+ */
+static void
+llvmpipe_add_shader_variant(struct llvmpipe_context *lp,
+                            struct lp_fragment_shader_variant *variant)
+{
+   list_add(&variant->list_item_local.list,
+            &variant->shader->variants.list);
+   variant->shader->variants_cached++;
+
+   list_add(&variant->list_item_global.list, &lp->fs_variants_list.list);
+   lp->nr_fs_variants++;
+   lp->nr_fs_instrs += variant->nr_instrs;
 }
 
 
@@ -4124,6 +4235,8 @@ void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant)
 {
+   if (variant->compile_job)
+      fs_compile_job_destroy(lp, variant->compile_job);
    gallivm_destroy(variant->gallivm);
    lp_fs_reference(lp, &variant->shader, NULL);
    if (variant->function_name[RAST_EDGE_TEST])
@@ -4716,10 +4829,17 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
 
       /*
-       * Generate the new variant.
+       * Generate the new variant.  With LP_ASYNC_JIT this is a quick
+       * compile, and the optimized copy is built on the compile queue from
+       * a copy of the NIR taken before this compile modifies it.
        */
+      struct nir_shader *nir = NULL;
+      if (util_queue_is_initialized(&lp->compile_queue))
+         nir = nir_shader_clone(NULL, shader->base.ir.nir);
+
       int64_t t0 = os_time_get();
-      variant = generate_variant(lp, shader, key);
+      variant = generate_variant(lp, shader, key, shader->base.ir.nir,
+                                 &lp->context, nir != NULL);
       int64_t t1 = os_time_get();
       int64_t dt = t1 - t0;
       LP_COUNT_ADD(llvm_compile_time, dt);
@@ -4727,14 +4847,37 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
 
       /* Put the new variant into the list */
       if (variant) {
-         list_add(&variant->list_item_local.list, &shader->variants.list);
-         list_add(&variant->list_item_global.list, &lp->fs_variants_list.list);
-         lp->nr_fs_variants++;
-         lp->nr_fs_instrs += variant->nr_instrs;
-         shader->variants_cached++;
+         llvmpipe_add_shader_variant(lp, variant);
+
+         if (nir && variant->gallivm->no_opt) {
+            fs_compile_job_queue(lp, variant, nir);
+            nir = NULL;
+         }
       }
+
+      ralloc_free(nir);
    }
 
+   /* Swap in the optimized copy once it is done. */
+   if (variant && variant->compile_job &&
+       util_queue_fence_is_signalled(&variant->compile_job->fence)) {
+      struct lp_fragment_shader_variant *optimized =
+         variant->compile_job->optimized;
+
+      variant->compile_job->optimized = NULL;
+      fs_compile_job_destroy(lp, variant->compile_job);
+      variant->compile_job = NULL;
+
+      if (optimized) {
+         llvmpipe_remove_shader_variant(lp, variant);
+         lp_fs_variant_reference(lp, &variant, NULL);
+         llvmpipe_add_shader_variant(lp, optimized);
+         variant = optimized;
+      }
+   }
+
+   lp->fs_pending = variant && variant->compile_job ? variant : NULL;
+
    /* Bind this variant */
    lp_setup_set_fs_variant(lp->setup, variant);
 }
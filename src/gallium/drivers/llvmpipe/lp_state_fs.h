@@ -38,9 +38,11 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct lp_fragment_shader;
+struct nir_shader;
 
 
 /** Indexes into jit_function[] array */
@@ -193,11 +195,35 @@ struct lp_fragment_shader_variant
    /* For debugging/profiling purposes */
    unsigned no;
 
+   /* Set while the optimized copy of this variant is being compiled in the
+    * background, see LP_ASYNC_JIT.
+    */
+   struct lp_fs_compile_job *compile_job;
+
    /* key is variable-sized, must be last */
    struct lp_fragment_shader_variant_key key;
 };
 
 
+/**
+ * Background compile of the optimized copy of a variant which was first
+ * compiled without optimizations.
+ */
+struct lp_fs_compile_job
+{
+   struct llvmpipe_context *lp;
+   struct lp_fragment_shader_variant *variant;
+
+   /* Private copy of the shader's NIR, as building the IR modifies it */
+   struct nir_shader *nir;
+
+   /* The result, NULL until the fence is signalled or if compiling failed */
+   struct lp_fragment_shader_variant *optimized;
+
+   struct util_queue_fence fence;
+};
+
+
 /** Subclass of pipe_shader_state */
 struct lp_fragment_shader
 {
@@ -236,6 +262,7 @@ llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant);
 void
 llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader *shader,
+                                struct nir_shader *nir,
                                 struct lp_fragment_shader_variant *variant);
 
 void
@@ -37,10 +37,7 @@
 #include "lp_debug.h"
 
 
-#if DETECT_ARCH_SSE
-
-#include <emmintrin.h>
-
+#if UTIL_SSE2_INTRINSICS
 
 static void
 no_op(const struct lp_jit_context *context,
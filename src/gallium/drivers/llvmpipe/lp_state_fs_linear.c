@@ -41,10 +41,7 @@
 #include "lp_linear_priv.h"
 
 
-#if DETECT_ARCH_SSE
-
-#include <emmintrin.h>
-
+#if UTIL_SSE2_INTRINSICS
 
 struct nearest_sampler {
    alignas(16) uint32_t out[64];
@@ -661,7 +658,7 @@ llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
          variant->jit_linear_blit = blit_rgba_blit;
          variant->jit_linear = blit_rgba;
       } else if (is_one_inv_src_alpha_blend(variant) &&
-                 util_get_cpu_caps()->has_sse2) {
+                 (!DETECT_ARCH_SSE || util_get_cpu_caps()->has_sse2)) {
          variant->jit_linear = blit_rgba_blend_premul;
       }
       return;
@@ -686,7 +683,7 @@ llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
 void
 llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
 {
-   /* don't bother if there is no SSE */
+   /* don't bother if there is no SSE or NEON */
 }
 #endif
 
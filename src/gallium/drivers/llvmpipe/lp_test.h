@@ -136,4 +136,19 @@ void
 dump_vec(FILE *fp, struct lp_type type, const void *src);
 
 
+/**
+ * Set by -b.  The tests that double as benchmarks run at their full sizes
+ * then, and at sizes small enough for every meson test run otherwise.
+ */
+extern bool test_benchmark;
+
+
+/**
+ * Busy loop of \p n iterations, the stand-in for real work in the tests
+ * that only exercise how work is handed out to threads.
+ */
+void
+test_spin(unsigned n);
+
+
 #endif /* !LP_TEST_H */
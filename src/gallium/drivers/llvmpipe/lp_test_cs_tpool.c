@@ -0,0 +1,208 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Tests for the compute thread pool (lp_cs_tpool.c).  Every iteration of
+ * every task must run exactly once, whatever the grid size and however
+ * uneven the cost per iteration, including with several tasks queued
+ * before the first one is waited for.
+ *
+ * The time per dispatch in the output file is what the work stealing in
+ * the pool is meant to bring down for the imbalanced case.  Without -b
+ * every case runs a tenth of its dispatches.
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_memory.h"
+
+#include "lp_cs_tpool.h"
+#include "lp_test.h"
+
+
+#define MAX_JOBS 8
+
+/*
+ * Work per iteration is counted in test_spin() iterations.  The first
+ * num_expensive iterations of a job cost expensive_work, the rest
+ * cheap_work.
+ */
+static const struct tpool_case {
+   const char *name;
+   unsigned num_dispatches;
+   unsigned num_jobs;         /* queued before waiting for the first */
+   unsigned num_iters;
+   bool random_iters;         /* 1 to num_iters, picked per dispatch */
+   unsigned cheap_work;
+   unsigned expensive_work;
+   unsigned num_expensive;
+} cases[] = {
+   { "small",      1000, 1,        64,      true,  1000 },
+   { "large",      1,    1,        1 << 20, false, 10 },
+   { "imbalanced", 4,    1,        4096,    false, 100, 100000, 256 },
+   { "overlapped", 100,  MAX_JOBS, 256,     true,  1000 },
+};
+
+struct tpool_job {
+   unsigned *counts;
+   unsigned num_iters;
+   unsigned cheap_work;
+   unsigned expensive_work;
+   unsigned num_expensive;
+};
+
+
+static void
+job_fn(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct tpool_job *job = data;
+
+   test_spin(iter_idx < job->num_expensive ? job->expensive_work
+                                           : job->cheap_work);
+   p_atomic_inc(&job->counts[iter_idx]);
+}
+
+
+static bool
+check_job(const struct tpool_case *c, const struct tpool_job *job)
+{
+   for (unsigned i = 0; i < job->num_iters; i++) {
+      if (job->counts[i] != 1) {
+         printf("%s: iteration %u of %u ran %u times\n",
+                c->name, i, job->num_iters, job->counts[i]);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+static bool
+test_case(struct lp_cs_tpool *pool, unsigned verbose, FILE *fp,
+          const struct tpool_case *c)
+{
+   struct tpool_job jobs[MAX_JOBS];
+   struct lp_cs_tpool_task *tasks[MAX_JOBS];
+   const unsigned num_dispatches =
+      test_benchmark ? c->num_dispatches : DIV_ROUND_UP(c->num_dispatches, 10);
+   const unsigned num_jobs = c->num_jobs;
+   uint64_t total_iters = 0;
+   bool success = true;
+
+   for (unsigned j = 0; j < num_jobs; j++) {
+      jobs[j] = (struct tpool_job) {
+         .counts = CALLOC(c->num_iters, sizeof(unsigned)),
+         .num_iters = c->num_iters,
+         .cheap_work = c->cheap_work,
+         .expensive_work = c->expensive_work,
+         .num_expensive = c->num_expensive,
+      };
+      success &= jobs[j].counts != NULL;
+   }
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned d = 0; d < num_dispatches && success; d++) {
+      for (unsigned j = 0; j < num_jobs; j++) {
+         if (c->random_iters)
+            jobs[j].num_iters = 1 + rand() % c->num_iters;
+         memset(jobs[j].counts, 0, jobs[j].num_iters * sizeof(unsigned));
+         tasks[j] = lp_cs_tpool_queue_task(pool, job_fn, &jobs[j],
+                                           jobs[j].num_iters);
+      }
+
+      for (unsigned j = 0; j < num_jobs; j++) {
+         lp_cs_tpool_wait_for_task(pool, &tasks[j]);
+         success &= check_job(c, &jobs[j]);
+         total_iters += jobs[j].num_iters;
+      }
+   }
+
+   int64_t elapsed = os_time_get_nano() - start;
+
+   for (unsigned j = 0; j < num_jobs; j++)
+      FREE(jobs[j].counts);
+
+   if (verbose >= 1)
+      printf("%s: %s\n", c->name, success ? "PASS" : "FAIL");
+
+   if (fp) {
+      fprintf(fp, "%s\t%s\t%u\t%u\t%" PRIu64 "\t%f\n",
+              success ? "pass" : "fail", c->name, pool->num_threads,
+              num_dispatches * num_jobs, total_iters,
+              (double)elapsed / (num_dispatches * num_jobs));
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+static struct lp_cs_tpool *
+create_pool(void)
+{
+   /* At least two workers, so that there is something to steal from. */
+   return lp_cs_tpool_create(MAX2(util_get_cpu_caps()->nr_cpus, 2));
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "case\t"
+           "threads\t"
+           "dispatches\t"
+           "iterations\t"
+           "ns_per_dispatch\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   struct lp_cs_tpool *pool = create_pool();
+   bool success = true;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(cases); i++)
+      success &= test_case(pool, verbose, fp, &cases[i]);
+
+   lp_cs_tpool_destroy(pool);
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   struct lp_cs_tpool *pool = create_pool();
+   bool success = true;
+
+   for (unsigned long i = 0; i < n; i++)
+      success &= test_case(pool, verbose, fp,
+                           &cases[rand() % ARRAY_SIZE(cases)]);
+
+   lp_cs_tpool_destroy(pool);
+   return success;
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
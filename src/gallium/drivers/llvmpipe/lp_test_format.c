@@ -179,6 +179,10 @@ test_format_float(unsigned verbose, FILE *fp,
          /* To ensure it's 16-byte aligned */
          memcpy(packed, test->packed, sizeof packed);
 
+         /* Don't hit blocks cached from a previous test case */
+         if (use_cache)
+            memset(cache_ptr, 0, sizeof *cache_ptr);
+
          for (i = 0; i < desc->block.height; ++i) {
             for (j = 0; j < desc->block.width; ++j) {
                bool match = true;
@@ -281,6 +285,10 @@ test_format_unorm8(unsigned verbose, FILE *fp,
          /* Could skip this and use unaligned lp_build_fetch_rgba_aos */
          memcpy(packed, test->packed, sizeof packed);
 
+         /* Don't hit blocks cached from a previous test case */
+         if (use_cache)
+            memset(cache_ptr, 0, sizeof *cache_ptr);
+
          for (i = 0; i < desc->block.height; ++i) {
             for (j = 0; j < desc->block.width; ++j) {
                bool match;
@@ -338,6 +346,87 @@ test_format_unorm8(unsigned verbose, FILE *fp,
 }
 
 
+/**
+ * Fetch texels from many more blocks than fit in the block cache, in
+ * random order, so that hits, misses and evictions all happen, and check
+ * them against the util_format unpack code the cache is filled with.
+ */
+UTIL_ALIGN_STACK
+static bool
+test_format_cached(unsigned verbose, FILE *fp,
+                   const struct util_format_description *desc)
+{
+   const unsigned num_blocks = 4 * LP_BUILD_FORMAT_CACHE_SIZE;
+   const unsigned block_size = desc->block.bits / 8;
+   lp_context_ref context;
+   struct gallivm_state *gallivm;
+   LLVMValueRef fetch = NULL;
+   char fetch_name[MAX_NAME];
+   fetch_ptr_t fetch_ptr;
+   uint8_t *packed;
+   uint8_t expected[4][4][4];
+   uint8_t unpacked[4];
+   bool success = true;
+
+   lp_context_create(&context);
+   gallivm = gallivm_create("test_module_cached", &context, NULL);
+
+   fetch = add_fetch_rgba_test(gallivm, verbose, desc,
+                               lp_unorm8_vec4_type(), true, fetch_name);
+
+   gallivm_compile_module(gallivm);
+
+   fetch_ptr = (fetch_ptr_t) gallivm_jit_function(gallivm, fetch, fetch_name);
+
+   gallivm_free_ir(gallivm);
+
+   printf("Testing %s (cached) ...\n", desc->name);
+
+   packed = align_malloc(num_blocks * block_size, 16);
+   for (unsigned k = 0; k < num_blocks * block_size; ++k)
+      packed[k] = rand();
+
+   memset(cache_ptr, 0, sizeof *cache_ptr);
+
+   for (unsigned n = 0; n < 16 * num_blocks && success; ++n) {
+      /* Favour a few blocks, so that some of them stay cached */
+      unsigned b = rand() % (n % 2 ? num_blocks : 8);
+      unsigned i = rand() % desc->block.height;
+      unsigned j = rand() % desc->block.width;
+      const uint8_t *block = packed + b * block_size;
+
+      util_format_unpack_rgba_8unorm_rect(desc->format, expected,
+                                          sizeof expected[0], block, 0,
+                                          desc->block.width,
+                                          desc->block.height);
+
+      memset(unpacked, 0, sizeof unpacked);
+
+      fetch_ptr(unpacked, block, j, i, cache_ptr);
+
+      if (memcmp(unpacked, expected[i][j], sizeof unpacked) != 0) {
+         printf("FAILED\n");
+         printf("  Block %u, unpacked (%u,%u): %02x %02x %02x %02x obtained\n",
+                b, j, i,
+                unpacked[0], unpacked[1], unpacked[2], unpacked[3]);
+         printf("                  %02x %02x %02x %02x expected\n",
+                expected[i][j][0], expected[i][j][1],
+                expected[i][j][2], expected[i][j][3]);
+
+         success = false;
+      }
+   }
+
+   align_free(packed);
+
+   gallivm_destroy(gallivm);
+   lp_context_destroy(&context);
+
+   if (fp)
+      write_tsv_row(fp, desc, success);
+
+   return success;
+}
 
 
 static bool
@@ -355,6 +444,14 @@ test_one(unsigned verbose, FILE *fp,
      success = false;
    }
 
+   /* s3tc decodes approximately, and srgb isn't cached in AoS */
+   if (use_cache &&
+       format_desc->layout != UTIL_FORMAT_LAYOUT_S3TC &&
+       format_desc->colorspace != UTIL_FORMAT_COLORSPACE_SRGB &&
+       !test_format_cached(verbose, fp, format_desc)) {
+     success = false;
+   }
+
    return success;
 }
 
@@ -395,7 +492,7 @@ test_all(unsigned verbose, FILE *fp)
             continue;
 
          /* only test twice with formats which can use cache */
-         if (format_desc->layout != UTIL_FORMAT_LAYOUT_S3TC && use_cache) {
+         if (!lp_build_format_cache_supported(format_desc) && use_cache) {
             continue;
          }
 
@@ -0,0 +1,407 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Frame time benchmark for first use of fragment shaders (LP_ASYNC_JIT).
+ *
+ * Every frame draws one horizontal band per fragment shader seen so far,
+ * and a shader that has never been drawn with before is added every few
+ * frames, the way new materials show up in a game.  Without LP_ASYNC_JIT
+ * the frames that add a shader wait for its optimized variant to be
+ * compiled, with it they only wait for the quick unoptimized one.
+ *
+ * The median, 99th percentile and maximum frame time and the number of
+ * hitches, frames taking more than four times the median, are written to
+ * the output file.  LP_ASYNC_JIT is read once per process, so
+ * lp_bench_async_jit.py runs this test with and without it and compares
+ * the two.  Set MESA_SHADER_CACHE_DISABLE, as the script does, or the
+ * variants come out of the disk cache from the second run on.
+ *
+ * After the last frame the compile queue is drained and one more frame is
+ * drawn, with every band using its optimized variant; its checksum has to
+ * match between the two modes.  All 32 shaders are added with -b, which
+ * the script passes, and only the first 8 without.
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cso_cache/cso_context.h"
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "sw/null/null_sw_winsys.h"
+#include "tgsi/tgsi_ureg.h"
+#include "util/os_time.h"
+#include "util/u_debug.h"
+#include "util/u_draw_quad.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_simple_shaders.h"
+
+#include "lp_context.h"
+#include "lp_public.h"
+#include "lp_test.h"
+
+
+#define WIDTH 512
+#define HEIGHT 512
+#define NUM_SHADERS 32
+#define FRAMES_PER_SHADER 8
+#define SHADER_LENGTH 48
+#define HITCH_FACTOR 4
+
+struct jit_test {
+   struct pipe_screen *screen;
+   struct pipe_resource *vbuf;
+};
+
+
+/*
+ * One full width band per shader, two triangles each.
+ */
+static void
+make_vertices(float (*verts)[2][4])
+{
+   static const float corners[6][2] = {
+      { 0, 0 }, { 1, 0 }, { 0, 1 },
+      { 1, 0 }, { 1, 1 }, { 0, 1 },
+   };
+
+   for (unsigned s = 0; s < NUM_SHADERS; s++) {
+      for (unsigned v = 0; v < 6; v++) {
+         float *pos = verts[s * 6 + v][0], *color = verts[s * 6 + v][1];
+
+         pos[0] = corners[v][0] * 2.0f - 1.0f;
+         pos[1] = (s + corners[v][1]) * 2.0f / NUM_SHADERS - 1.0f;
+         pos[2] = 0.0f;
+         pos[3] = 1.0f;
+
+         color[0] = corners[v][0];
+         color[1] = corners[v][1];
+         color[2] = (float)s / NUM_SHADERS;
+         color[3] = 1.0f;
+      }
+   }
+}
+
+
+/*
+ * A chain of multiply-adds with immediates that differ per shader, long
+ * enough that compiling it takes a while.
+ */
+static void *
+make_fragment_shader(struct pipe_context *pipe, unsigned index)
+{
+   struct ureg_program *ureg = ureg_create(PIPE_SHADER_FRAGMENT);
+   struct ureg_src color;
+   struct ureg_dst out, tmp;
+
+   if (!ureg)
+      return NULL;
+
+   color = ureg_DECL_fs_input(ureg, TGSI_SEMANTIC_COLOR, 0,
+                              TGSI_INTERPOLATE_PERSPECTIVE);
+   out = ureg_DECL_output(ureg, TGSI_SEMANTIC_COLOR, 0);
+   tmp = ureg_DECL_temporary(ureg);
+
+   ureg_MOV(ureg, tmp, color);
+   for (unsigned i = 0; i < SHADER_LENGTH; i++) {
+      const float scale = 1.0f - (float)((index + i) % 7) / 64.0f;
+      const float bias = (float)((index * 3 + i) % 5) / 256.0f;
+
+      ureg_MAD(ureg, tmp, ureg_src(tmp),
+               ureg_imm4f(ureg, scale, 1.0f - bias, scale, 1.0f),
+               ureg_imm4f(ureg, bias, bias / 2.0f, 0.0f, 0.0f));
+   }
+   ureg_MOV(ureg, out, ureg_src(tmp));
+   ureg_END(ureg);
+
+   return ureg_create_shader_and_destroy(ureg, pipe);
+}
+
+
+static int
+compare_time(const void *a, const void *b)
+{
+   const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+   return x < y ? -1 : x > y;
+}
+
+
+static int64_t
+draw_frame(struct jit_test *test, struct pipe_context *pipe,
+           struct cso_context *cso, void **shaders, unsigned num_bands)
+{
+   const union pipe_color_union clear_color = { .f = { 0, 0, 0, 1 } };
+   struct pipe_fence_handle *fence = NULL;
+   int64_t start = os_time_get_nano();
+
+   pipe->clear(pipe, PIPE_CLEAR_COLOR, NULL, &clear_color, 0, 0);
+   for (unsigned s = 0; s < num_bands; s++) {
+      cso_set_fragment_shader_handle(cso, shaders[s]);
+      util_draw_vertex_buffer(pipe, cso, test->vbuf,
+                              s * 6 * sizeof(float[2][4]), false,
+                              MESA_PRIM_TRIANGLES, 6, 2);
+   }
+   pipe->flush(pipe, &fence, 0);
+   test->screen->fence_finish(test->screen, NULL, fence, OS_TIMEOUT_INFINITE);
+   test->screen->fence_reference(test->screen, &fence, NULL);
+
+   return os_time_get_nano() - start;
+}
+
+
+static uint32_t
+checksum_image(struct pipe_context *pipe, struct pipe_resource *target)
+{
+   struct pipe_transfer *transfer;
+   uint32_t sum = 2166136261u;
+
+   /* FNV-1a over the pixels. */
+   const uint8_t *map = pipe_texture_map(pipe, target, 0, 0, PIPE_MAP_READ,
+                                         0, 0, WIDTH, HEIGHT, &transfer);
+   for (unsigned y = 0; y < HEIGHT; y++) {
+      const uint8_t *row = map + y * transfer->stride;
+      for (unsigned x = 0; x < WIDTH * 4; x++)
+         sum = (sum ^ row[x]) * 16777619u;
+   }
+   pipe_texture_unmap(pipe, transfer);
+
+   return sum;
+}
+
+
+static bool
+test_case(struct jit_test *test, unsigned verbose, FILE *fp,
+          unsigned num_shaders)
+{
+   struct pipe_screen *screen = test->screen;
+   const bool async = debug_get_bool_option("LP_ASYNC_JIT", false);
+   const unsigned num_frames = num_shaders * FRAMES_PER_SHADER;
+   struct pipe_context *pipe;
+   struct cso_context *cso;
+   struct pipe_resource *target, tmpl = {
+      .target = PIPE_TEXTURE_2D,
+      .format = PIPE_FORMAT_B8G8R8A8_UNORM,
+      .width0 = WIDTH,
+      .height0 = HEIGHT,
+      .depth0 = 1,
+      .array_size = 1,
+      .bind = PIPE_BIND_RENDER_TARGET,
+   };
+   struct pipe_surface surf_tmpl = { .format = PIPE_FORMAT_B8G8R8A8_UNORM };
+   struct pipe_framebuffer_state fb = {
+      .width = WIDTH,
+      .height = HEIGHT,
+      .nr_cbufs = 1,
+   };
+   struct pipe_blend_state blend = { 0 };
+   struct pipe_depth_stencil_alpha_state dsa = { 0 };
+   struct pipe_rasterizer_state rast = {
+      .cull_face = PIPE_FACE_NONE,
+      .half_pixel_center = 1,
+      .bottom_edge_rule = 1,
+      .depth_clip_near = 1,
+      .depth_clip_far = 1,
+   };
+   struct pipe_viewport_state viewport = {
+      .scale = { WIDTH / 2.0f, HEIGHT / 2.0f, 0.5f },
+      .translate = { WIDTH / 2.0f, HEIGHT / 2.0f, 0.5f },
+      .swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X,
+      .swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y,
+      .swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z,
+      .swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W,
+   };
+   struct cso_velems_state velem = { .count = 2 };
+   const enum tgsi_semantic semantic_names[] =
+      { TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+   const unsigned semantic_indexes[] = { 0, 0 };
+   void *shaders[NUM_SHADERS] = { 0 };
+   int64_t *frame_times, max_time = 0;
+   unsigned hitches = 0;
+   uint32_t checksum = 0;
+   bool success = true;
+   void *vs;
+
+   pipe = screen->context_create(screen, NULL, 0);
+   frame_times = CALLOC(num_frames, sizeof(*frame_times));
+   if (!pipe || !frame_times) {
+      if (pipe)
+         pipe->destroy(pipe);
+      FREE(frame_times);
+      return false;
+   }
+
+   cso = cso_create_context(pipe, 0);
+   target = screen->resource_create(screen, &tmpl);
+   fb.cbufs[0] = pipe->create_surface(pipe, target, &surf_tmpl);
+
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   for (unsigned i = 0; i < 2; i++) {
+      velem.velems[i].src_offset = i * 4 * sizeof(float);
+      velem.velems[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+      velem.velems[i].src_stride = 2 * 4 * sizeof(float);
+   }
+   vs = util_make_vertex_passthrough_shader(pipe, 2, semantic_names,
+                                            semantic_indexes, false);
+   for (unsigned s = 0; s < num_shaders; s++) {
+      shaders[s] = make_fragment_shader(pipe, s);
+      success &= shaders[s] != NULL;
+   }
+
+   cso_set_framebuffer(cso, &fb);
+   cso_set_blend(cso, &blend);
+   cso_set_depth_stencil_alpha(cso, &dsa);
+   cso_set_rasterizer(cso, &rast);
+   cso_set_viewport(cso, &viewport);
+   cso_set_vertex_shader_handle(cso, vs);
+   cso_set_vertex_elements(cso, &velem);
+
+   for (unsigned f = 0; success && f < num_frames; f++) {
+      frame_times[f] = draw_frame(test, pipe, cso, shaders,
+                                  f / FRAMES_PER_SHADER + 1);
+      max_time = MAX2(max_time, frame_times[f]);
+   }
+
+   if (success) {
+      if (util_queue_is_initialized(&llvmpipe_context(pipe)->compile_queue))
+         util_queue_finish(&llvmpipe_context(pipe)->compile_queue);
+      draw_frame(test, pipe, cso, shaders, num_shaders);
+      checksum = checksum_image(pipe, target);
+   }
+
+   qsort(frame_times, num_frames, sizeof(*frame_times), compare_time);
+   const int64_t median = frame_times[num_frames / 2];
+   const int64_t p99 = frame_times[num_frames * 99 / 100];
+   for (unsigned f = 0; f < num_frames; f++)
+      hitches += frame_times[f] > HITCH_FACTOR * median;
+
+   cso_destroy_context(cso);
+   pipe->delete_vs_state(pipe, vs);
+   for (unsigned s = 0; s < num_shaders; s++) {
+      if (shaders[s])
+         pipe->delete_fs_state(pipe, shaders[s]);
+   }
+   pipe_surface_reference(&fb.cbufs[0], NULL);
+   pipe_resource_reference(&target, NULL);
+   pipe->destroy(pipe);
+   FREE(frame_times);
+
+   if (verbose >= 1)
+      printf("%s, %u shaders: %s\n", async ? "async" : "sync", num_shaders,
+             success ? "PASS" : "FAIL");
+
+   if (fp) {
+      fprintf(fp, "%s\t%s\t%u\t%u\t%f\t%f\t%f\t%u\t%08x\n",
+              success ? "pass" : "fail", async ? "async" : "sync",
+              num_shaders, num_frames, median / 1e6, p99 / 1e6,
+              max_time / 1e6, hitches, checksum);
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+static bool
+init_test(struct jit_test *test)
+{
+   const unsigned size = NUM_SHADERS * 6 * sizeof(float[2][4]);
+   struct pipe_context *pipe;
+   float (*verts)[2][4];
+
+   test->screen = llvmpipe_create_screen(null_sw_create());
+   if (!test->screen)
+      return false;
+
+   test->vbuf = pipe_buffer_create(test->screen, PIPE_BIND_VERTEX_BUFFER,
+                                   PIPE_USAGE_DEFAULT, size);
+   pipe = test->screen->context_create(test->screen, NULL, 0);
+   verts = MALLOC(size);
+   if (!test->vbuf || !pipe || !verts) {
+      if (pipe)
+         pipe->destroy(pipe);
+      FREE(verts);
+      return false;
+   }
+
+   make_vertices(verts);
+   pipe_buffer_write(pipe, test->vbuf, 0, size, verts);
+   pipe->destroy(pipe);
+   FREE(verts);
+
+   return true;
+}
+
+
+static void
+fini_test(struct jit_test *test)
+{
+   pipe_resource_reference(&test->vbuf, NULL);
+   if (test->screen)
+      test->screen->destroy(test->screen);
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "jit\t"
+           "shaders\t"
+           "frames\t"
+           "median_ms\t"
+           "p99_ms\t"
+           "max_ms\t"
+           "hitches\t"
+           "checksum\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   struct jit_test test = { 0 };
+   bool success = init_test(&test);
+
+   if (success)
+      success = test_case(&test, verbose, fp,
+                          test_benchmark ? NUM_SHADERS : 8);
+
+   fini_test(&test);
+   return success;
+}
+
+
+/* Adds up to \p n shaders instead of all of them. */
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   struct jit_test test = { 0 };
+   bool success = init_test(&test);
+
+   if (success && n)
+      success = test_case(&test, verbose, fp, MIN2(n, NUM_SHADERS));
+
+   fini_test(&test);
+   return success;
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
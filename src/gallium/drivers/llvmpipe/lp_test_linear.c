@@ -0,0 +1,311 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Unit tests for the SIMD kernels behind llvmpipe's linear rasterization
+ * paths (util/u_sse.h).  These run on SSE2 on x86 and on NEON on
+ * AArch64, through the SSE2 emulation in u_sse_neon.h, and must match
+ * the scalar reference below bit for bit on random pixels with the
+ * all-zero, all-one and opaque extremes mixed in.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util/os_time.h"
+#include "util/u_sse.h"
+
+#include "lp_test.h"
+
+
+#if UTIL_SSE2_INTRINSICS
+
+#define NUM_PIXELS 1024
+
+enum linear_kernel {
+   KERNEL_BLEND_PREMUL,
+   KERNEL_BLEND_SRCALPHA,
+   KERNEL_BLEND_PREMUL_SRC,
+   KERNEL_LERP_UNORM8,
+   KERNEL_STRETCH_ROW,
+   NUM_KERNELS
+};
+
+static const char *kernel_names[NUM_KERNELS] = {
+   [KERNEL_BLEND_PREMUL] = "blend_premul",
+   [KERNEL_BLEND_SRCALPHA] = "blend_srcalpha",
+   [KERNEL_BLEND_PREMUL_SRC] = "blend_premul_src",
+   [KERNEL_LERP_UNORM8] = "lerp_unorm8",
+   [KERNEL_STRETCH_ROW] = "stretch_row",
+};
+
+
+/*
+ * Scalar reference implementations, one channel at a time.
+ */
+
+static uint8_t
+ref_lerp(uint8_t a, uint8_t b, unsigned weight)
+{
+   return a + ((uint16_t)((b - a) * weight) >> 8);
+}
+
+static uint8_t
+ref_premul_blend(uint8_t s, uint8_t d, uint8_t sa)
+{
+   return MIN2(s + d - ((d * sa) >> 8), 255);
+}
+
+static uint32_t
+ref_pixel(enum linear_kernel kernel, uint32_t src, uint32_t dst,
+          uint32_t weight, unsigned cst_alpha)
+{
+   uint32_t res = 0;
+
+   for (unsigned c = 0; c < 4; c++) {
+      uint8_t s = src >> (c * 8);
+      uint8_t d = dst >> (c * 8);
+      uint8_t w = weight >> (c * 8);
+      uint8_t sa = src >> 24;
+      uint8_t r;
+
+      switch (kernel) {
+      case KERNEL_BLEND_PREMUL:
+         r = ref_premul_blend(s, d, sa);
+         break;
+      case KERNEL_BLEND_SRCALPHA:
+         r = ref_lerp(d, s, sa);
+         break;
+      case KERNEL_BLEND_PREMUL_SRC:
+         s = (s * cst_alpha) >> 8;
+         sa = (sa * cst_alpha) >> 8;
+         r = ref_premul_blend(s, d, sa);
+         break;
+      case KERNEL_LERP_UNORM8:
+         r = ref_lerp(s, d, w);
+         break;
+      default:
+         unreachable("not a per pixel kernel");
+      }
+
+      res |= (uint32_t)r << (c * 8);
+   }
+
+   return res;
+}
+
+static void
+ref_stretch_row(uint32_t *dst, unsigned width, const uint32_t *src,
+                int32_t src_x, int32_t src_xstep)
+{
+   for (unsigned i = 0; i < width; i++) {
+      const uint32_t *texel = &src[(uint16_t)(src_x >> 16)];
+      const unsigned weight = (src_x & 0xffff) >> 8;
+      uint32_t res = 0;
+
+      for (unsigned c = 0; c < 4; c++) {
+         uint8_t r = ref_lerp(texel[0] >> (c * 8), texel[1] >> (c * 8),
+                              weight);
+         res |= (uint32_t)r << (c * 8);
+      }
+
+      dst[i] = res;
+      src_x += src_xstep;
+   }
+}
+
+
+/*
+ * The SIMD kernels, four pixels at a time.
+ */
+
+static void
+run_kernel(enum linear_kernel kernel, uint32_t *res, const uint32_t *src,
+           const uint32_t *dst, const uint32_t *weight, unsigned cst_alpha,
+           int32_t src_x, int32_t src_xstep)
+{
+   if (kernel == KERNEL_STRETCH_ROW) {
+      util_sse2_stretch_row_8unorm((__m128i *)res, NUM_PIXELS, src,
+                                   src_x, src_xstep);
+      return;
+   }
+
+   for (unsigned i = 0; i < NUM_PIXELS; i += 4) {
+      __m128i s = _mm_load_si128((const __m128i *)&src[i]);
+      __m128i d = _mm_load_si128((const __m128i *)&dst[i]);
+      __m128i r;
+
+      switch (kernel) {
+      case KERNEL_BLEND_PREMUL:
+         r = util_sse2_blend_premul_4(s, d);
+         break;
+      case KERNEL_BLEND_SRCALPHA:
+         r = util_sse2_blend_srcalpha_4(s, d);
+         break;
+      case KERNEL_BLEND_PREMUL_SRC:
+         r = util_sse2_blend_premul_src_4(s, d, cst_alpha);
+         break;
+      case KERNEL_LERP_UNORM8:
+         r = util_sse2_lerp_unorm8(s, d, _mm_load_si128((const __m128i *)&weight[i]));
+         break;
+      default:
+         unreachable("unknown kernel");
+      }
+
+      _mm_store_si128((__m128i *)&res[i], r);
+   }
+}
+
+
+static uint32_t
+random_pixel(void)
+{
+   uint32_t p = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+   /* Make sure the extremes show up often. */
+   switch (rand() % 8) {
+   case 0:
+      return 0;
+   case 1:
+      return ~0u;
+   case 2:
+      return p | 0xff000000;
+   case 3:
+      return p & 0x00ffffff;
+   default:
+      return p;
+   }
+}
+
+
+static bool
+test_kernel(unsigned verbose, FILE *fp, enum linear_kernel kernel)
+{
+   /* The stretch kernel reads one texel past the last one sampled. */
+   alignas(16) uint32_t src[2 * NUM_PIXELS + 1];
+   alignas(16) uint32_t dst[NUM_PIXELS];
+   alignas(16) uint32_t weight[NUM_PIXELS];
+   alignas(16) uint32_t res[NUM_PIXELS];
+   uint32_t ref[NUM_PIXELS];
+   const unsigned cst_alpha = rand() & 0xff;
+   /* Up to a 2x minification, starting anywhere in the first texel. */
+   const int32_t src_x = rand() & 0xffff;
+   const int32_t src_xstep = 1 + rand() % 0x1ffff;
+   bool success = true;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(src); i++)
+      src[i] = random_pixel();
+   for (unsigned i = 0; i < NUM_PIXELS; i++) {
+      dst[i] = random_pixel();
+      weight[i] = random_pixel();
+   }
+
+   if (kernel == KERNEL_STRETCH_ROW) {
+      ref_stretch_row(ref, NUM_PIXELS, src, src_x, src_xstep);
+   } else {
+      for (unsigned i = 0; i < NUM_PIXELS; i++)
+         ref[i] = ref_pixel(kernel, src[i], dst[i], weight[i], cst_alpha);
+   }
+
+   int64_t start = os_time_get_nano();
+   run_kernel(kernel, res, src, dst, weight, cst_alpha, src_x, src_xstep);
+   int64_t elapsed = os_time_get_nano() - start;
+
+   for (unsigned i = 0; i < NUM_PIXELS; i++) {
+      if (res[i] != ref[i]) {
+         if (verbose || success) {
+            printf("%s: pixel %u: src 0x%08x dst 0x%08x weight 0x%08x "
+                   "alpha %u: got 0x%08x, expected 0x%08x\n",
+                   kernel_names[kernel], i, src[i], dst[i], weight[i],
+                   cst_alpha, res[i], ref[i]);
+         }
+         success = false;
+      }
+   }
+
+   if (verbose >= 1)
+      printf("%s: %s\n", kernel_names[kernel], success ? "PASS" : "FAIL");
+
+   if (fp) {
+      fprintf(fp, "%s\t%s\t%f\n", success ? "pass" : "fail",
+              kernel_names[kernel], (double)elapsed / NUM_PIXELS);
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "kernel\t"
+           "ns_per_pixel\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   bool success = true;
+
+   for (unsigned i = 0; i < 16; i++) {
+      for (unsigned kernel = 0; kernel < NUM_KERNELS; kernel++)
+         success &= test_kernel(verbose, fp, kernel);
+   }
+
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   bool success = true;
+
+   for (unsigned long i = 0; i < n; i++)
+      success &= test_kernel(verbose, fp, rand() % NUM_KERNELS);
+
+   return success;
+}
+
+#else /* !UTIL_SSE2_INTRINSICS */
+
+void
+write_tsv_header(FILE *fp)
+{
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   printf("no SSE2 or NEON, linear kernels not built\n");
+   return true;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+#endif /* UTIL_SSE2_INTRINSICS */
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
@@ -363,6 +363,19 @@ dump_vec(FILE *fp, struct lp_type type, const void *src)
 }
 
 
+bool test_benchmark = false;
+
+
+void
+test_spin(unsigned n)
+{
+   volatile unsigned x = 0;
+
+   for (unsigned i = 0; i < n; i++)
+      x += i;
+}
+
+
 int
 main(int argc, char **argv)
 {
@@ -385,6 +398,8 @@ main(int argc, char **argv)
          ++verbose;
       else if (strcmp(argv[i], "-s") == 0)
          single = true;
+      else if (strcmp(argv[i], "-b") == 0)
+         test_benchmark = true;
       else if (strcmp(argv[i], "-o") == 0)
          fp = fopen(argv[++i], "wt");
       else
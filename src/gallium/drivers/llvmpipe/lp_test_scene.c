@@ -0,0 +1,302 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Tests for handing out scene bins to the rasterizer threads
+ * (lp_scene_bin_iter_begin/next).  Every non-empty bin must be claimed by
+ * exactly one thread, and empty bins by none, for 1 to 64 threads.
+ *
+ * The same scene is also handed out one tile at a time under the scene
+ * mutex, the way it was done before bins were claimed with an atomic
+ * counter, so that the time per scene of the two can be compared.  Each
+ * case hands out the scene 200 times with -b and 10 times without.
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "c11/threads.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_memory.h"
+#include "util/u_thread.h"
+
+#include "lp_scene.h"
+#include "lp_setup_context.h"
+#include "lp_test.h"
+
+
+#define MAX_TEST_THREADS 64
+
+struct scene_test;
+
+struct scene_method {
+   const char *name;
+   void (*begin)(struct scene_test *test);
+   struct cmd_bin *(*next)(struct scene_test *test, int *x, int *y);
+};
+
+struct scene_test {
+   struct lp_scene *scene;
+   const struct scene_method *method;
+   unsigned *claims;
+   unsigned next_tile;     /* for the locked method */
+   bool done;
+   util_barrier barrier;
+};
+
+
+static void
+atomic_iter_begin(struct scene_test *test)
+{
+   lp_scene_bin_iter_begin(test->scene);
+}
+
+
+static struct cmd_bin *
+atomic_iter_next(struct scene_test *test, int *x, int *y)
+{
+   return lp_scene_bin_iter_next(test->scene, x, y);
+}
+
+
+static void
+locked_iter_begin(struct scene_test *test)
+{
+   test->next_tile = 0;
+}
+
+
+static struct cmd_bin *
+locked_iter_next(struct scene_test *test, int *x, int *y)
+{
+   struct lp_scene *scene = test->scene;
+   struct cmd_bin *bin = NULL;
+
+   mtx_lock(&scene->mutex);
+   if (test->next_tile < scene->tiles_x * scene->tiles_y) {
+      *x = test->next_tile % scene->tiles_x;
+      *y = test->next_tile / scene->tiles_x;
+      bin = lp_scene_get_bin(scene, *x, *y);
+      test->next_tile++;
+   }
+   mtx_unlock(&scene->mutex);
+
+   return bin;
+}
+
+
+static const struct scene_method methods[] = {
+   { "atomic", atomic_iter_begin, atomic_iter_next },
+   { "locked", locked_iter_begin, locked_iter_next },
+};
+
+
+static int
+thread_fn(void *data)
+{
+   struct scene_test *test = data;
+   struct lp_scene *scene = test->scene;
+
+   for (;;) {
+      struct cmd_bin *bin;
+      int x, y;
+
+      util_barrier_wait(&test->barrier);
+      if (test->done)
+         break;
+
+      for (;;) {
+         bin = test->method->next(test, &x, &y);
+         if (!bin)
+            break;
+
+         /* The rasterizer skips empty bins the same way. */
+         if (!bin->head)
+            continue;
+
+         p_atomic_inc(&test->claims[y * scene->tiles_x + x]);
+         for (struct cmd_block *block = bin->head; block; block = block->next)
+            test_spin(block->count * 500);
+      }
+
+      util_barrier_wait(&test->barrier);
+   }
+
+   return 0;
+}
+
+
+/**
+ * Bin a scene where about three quarters of the tiles hold between 1 and
+ * 32 commands.  The commands are never executed.
+ */
+static bool
+bin_scene(struct lp_scene *scene)
+{
+   const union lp_rast_cmd_arg arg = { 0 };
+
+   for (unsigned y = 0; y < scene->tiles_y; y++) {
+      for (unsigned x = 0; x < scene->tiles_x; x++) {
+         if (rand() % 4 == 0)
+            continue;
+
+         for (unsigned n = 1 + rand() % 32; n; n--) {
+            if (!lp_scene_bin_command(scene, x, y,
+                                      LP_RAST_OP_CLEAR_COLOR, arg))
+               return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+
+static bool
+check_claims(const struct scene_test *test, unsigned num_threads)
+{
+   struct lp_scene *scene = test->scene;
+
+   for (unsigned y = 0; y < scene->tiles_y; y++) {
+      for (unsigned x = 0; x < scene->tiles_x; x++) {
+         const unsigned idx = y * scene->tiles_x + x;
+         const unsigned expected = scene->tiles[idx].head ? 1 : 0;
+
+         if (test->claims[idx] != expected) {
+            printf("%s: %u threads: bin %u,%u claimed %u times\n",
+                   test->method->name, num_threads, x, y,
+                   test->claims[idx]);
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+
+static bool
+test_case(unsigned verbose, FILE *fp,
+          const struct scene_method *method, unsigned num_threads)
+{
+   struct lp_setup_context setup;
+   struct pipe_framebuffer_state fb = {
+      .width = 1920,
+      .height = 1080,
+   };
+   const unsigned num_scenes = test_benchmark ? 200 : 10;
+   struct scene_test test = { .method = method };
+   thrd_t threads[MAX_TEST_THREADS];
+   unsigned num_tiles;
+   bool success = true;
+
+   memset(&setup, 0, sizeof(setup));
+   setup.num_threads = num_threads;
+   slab_create(&setup.scene_slab, sizeof(struct lp_scene), 1);
+
+   test.scene = lp_scene_create(&setup);
+   lp_scene_begin_binning(test.scene, &fb);
+   num_tiles = test.scene->tiles_x * test.scene->tiles_y;
+   test.claims = CALLOC(num_tiles, sizeof(unsigned));
+   success = test.scene->tiles && test.claims && bin_scene(test.scene);
+   lp_scene_end_binning(test.scene);
+
+   util_barrier_init(&test.barrier, num_threads + 1);
+   for (unsigned t = 0; t < num_threads; t++)
+      thrd_create(&threads[t], thread_fn, &test);
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned s = 0; s < num_scenes && success; s++) {
+      memset(test.claims, 0, num_tiles * sizeof(unsigned));
+      method->begin(&test);
+
+      util_barrier_wait(&test.barrier);
+      util_barrier_wait(&test.barrier);
+
+      success &= check_claims(&test, num_threads);
+   }
+
+   int64_t elapsed = os_time_get_nano() - start;
+
+   test.done = true;
+   util_barrier_wait(&test.barrier);
+   for (unsigned t = 0; t < num_threads; t++)
+      thrd_join(threads[t], NULL);
+   util_barrier_destroy(&test.barrier);
+
+   FREE(test.claims);
+   lp_scene_destroy(test.scene);
+   slab_destroy(&setup.scene_slab);
+   lp_scene_free_bin_orders(&setup);
+
+   if (verbose >= 1)
+      printf("%s, %u threads: %s\n", method->name, num_threads,
+             success ? "PASS" : "FAIL");
+
+   if (fp) {
+      fprintf(fp, "%s\t%s\t%u\t%u\t%f\n",
+              success ? "pass" : "fail", method->name, num_threads,
+              num_tiles, (double)elapsed / num_scenes);
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "method\t"
+           "threads\t"
+           "tiles\t"
+           "ns_per_scene\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   bool success = true;
+
+   for (unsigned threads = 1; threads <= MAX_TEST_THREADS; threads *= 2) {
+      for (unsigned m = 0; m < ARRAY_SIZE(methods); m++)
+         success &= test_case(verbose, fp, &methods[m], threads);
+   }
+
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   bool success = true;
+
+   for (unsigned long i = 0; i < n; i++) {
+      success &= test_case(verbose, fp,
+                           &methods[rand() % ARRAY_SIZE(methods)],
+                           1 + rand() % MAX_TEST_THREADS);
+   }
+
+   return success;
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
@@ -0,0 +1,365 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Tests for triangle setup on the thread pool (lp_setup_parallel_triangles).
+ * The same small, randomly placed triangles are drawn through a context
+ * with parallel setup and through one with LP_PERF=no_parallel_setup, in
+ * draws of between 32 and 16384 triangles, and the rendered images must
+ * be identical.
+ *
+ * Both contexts are timed from the first draw to the fence, so the time
+ * per triangle in the output file is the triangle throughput of setup
+ * with and without the thread pool at each draw size.  That is for 131072
+ * triangles with -b, 16384 without.
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cso_cache/cso_context.h"
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "sw/null/null_sw_winsys.h"
+#include "util/os_time.h"
+#include "util/u_draw_quad.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_simple_shaders.h"
+
+#include "lp_debug.h"
+#include "lp_public.h"
+#include "lp_test.h"
+
+
+#define WIDTH 1024
+#define HEIGHT 1024
+
+/* Whether setup runs on the thread pool is decided per context. */
+static const struct setup_mode {
+   const char *name;
+   int perf_flags;
+} modes[] = {
+   { "serial", PERF_NO_PARALLEL_SETUP },
+   { "parallel", 0 },
+};
+
+static const unsigned tris_per_draw[] = {
+   32, 128, 1024, 16384,
+};
+
+struct setup_test {
+   struct pipe_screen *screen;
+   struct pipe_resource *vbuf;
+   unsigned num_tris;
+};
+
+
+/*
+ * Triangles of up to 16 pixels across, two sided, with a random color
+ * per vertex so that the interpolants matter.
+ */
+static void
+make_vertices(float (*verts)[2][4], unsigned num_tris)
+{
+   uint32_t seed = 1;
+
+   for (unsigned i = 0; i < num_tris * 3; i++) {
+      float *pos = verts[i][0], *color = verts[i][1];
+
+      if (i % 3 == 0) {
+         seed = seed * 1103515245 + 12345;
+         pos[0] = (float)(seed >> 16 & 0x7fff) / 0x4000 - 1.0f;
+         seed = seed * 1103515245 + 12345;
+         pos[1] = (float)(seed >> 16 & 0x7fff) / 0x4000 - 1.0f;
+      } else {
+         seed = seed * 1103515245 + 12345;
+         pos[0] = verts[i - i % 3][0][0] +
+                  (float)((int)(seed >> 16 & 0x1f) - 16) / WIDTH;
+         seed = seed * 1103515245 + 12345;
+         pos[1] = verts[i - i % 3][0][1] +
+                  (float)((int)(seed >> 16 & 0x1f) - 16) / HEIGHT;
+      }
+      pos[2] = 0.0f;
+      pos[3] = 1.0f;
+
+      for (unsigned c = 0; c < 3; c++) {
+         seed = seed * 1103515245 + 12345;
+         color[c] = (float)(seed >> 16 & 0xff) / 255.0f;
+      }
+      color[3] = 1.0f;
+   }
+}
+
+
+/**
+ * Draw all triangles in draws of \p per_draw and read the image back.
+ * \return the time it took in nanoseconds, or 0 on failure
+ */
+static int64_t
+draw_triangles(struct setup_test *test, const struct setup_mode *mode,
+               unsigned per_draw, uint32_t *pixels)
+{
+   struct pipe_screen *screen = test->screen;
+   const int saved_perf = LP_PERF;
+   struct pipe_context *pipe;
+   struct cso_context *cso;
+   struct pipe_resource *target, tmpl = {
+      .target = PIPE_TEXTURE_2D,
+      .format = PIPE_FORMAT_B8G8R8A8_UNORM,
+      .width0 = WIDTH,
+      .height0 = HEIGHT,
+      .depth0 = 1,
+      .array_size = 1,
+      .bind = PIPE_BIND_RENDER_TARGET,
+   };
+   struct pipe_surface surf_tmpl = { .format = PIPE_FORMAT_B8G8R8A8_UNORM };
+   struct pipe_framebuffer_state fb = {
+      .width = WIDTH,
+      .height = HEIGHT,
+      .nr_cbufs = 1,
+   };
+   struct pipe_blend_state blend = { 0 };
+   struct pipe_depth_stencil_alpha_state dsa = { 0 };
+   struct pipe_rasterizer_state rast = {
+      .cull_face = PIPE_FACE_NONE,
+      .half_pixel_center = 1,
+      .bottom_edge_rule = 1,
+      .depth_clip_near = 1,
+      .depth_clip_far = 1,
+   };
+   struct pipe_viewport_state viewport = {
+      .scale = { WIDTH / 2.0f, HEIGHT / 2.0f, 0.5f },
+      .translate = { WIDTH / 2.0f, HEIGHT / 2.0f, 0.5f },
+      .swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X,
+      .swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y,
+      .swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z,
+      .swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W,
+   };
+   struct cso_velems_state velem = { .count = 2 };
+   const enum tgsi_semantic semantic_names[] =
+      { TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+   const unsigned semantic_indexes[] = { 0, 0 };
+   const union pipe_color_union clear_color = { .f = { 0, 0, 0, 1 } };
+   struct pipe_fence_handle *fence = NULL;
+   struct pipe_transfer *transfer;
+   int64_t start, elapsed;
+   void *vs, *fs;
+
+   LP_PERF |= mode->perf_flags;
+   pipe = screen->context_create(screen, NULL, 0);
+   LP_PERF = saved_perf;
+   if (!pipe)
+      return 0;
+
+   cso = cso_create_context(pipe, 0);
+   target = screen->resource_create(screen, &tmpl);
+   fb.cbufs[0] = pipe->create_surface(pipe, target, &surf_tmpl);
+
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   for (unsigned i = 0; i < 2; i++) {
+      velem.velems[i].src_offset = i * 4 * sizeof(float);
+      velem.velems[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+      velem.velems[i].src_stride = 2 * 4 * sizeof(float);
+   }
+   vs = util_make_vertex_passthrough_shader(pipe, 2, semantic_names,
+                                            semantic_indexes, false);
+   fs = util_make_fragment_passthrough_shader(pipe, TGSI_SEMANTIC_COLOR,
+                                              TGSI_INTERPOLATE_PERSPECTIVE,
+                                              true);
+
+   cso_set_framebuffer(cso, &fb);
+   cso_set_blend(cso, &blend);
+   cso_set_depth_stencil_alpha(cso, &dsa);
+   cso_set_rasterizer(cso, &rast);
+   cso_set_viewport(cso, &viewport);
+   cso_set_fragment_shader_handle(cso, fs);
+   cso_set_vertex_shader_handle(cso, vs);
+   cso_set_vertex_elements(cso, &velem);
+
+   pipe->clear(pipe, PIPE_CLEAR_COLOR, NULL, &clear_color, 0, 0);
+   pipe->flush(pipe, &fence, 0);
+   screen->fence_finish(screen, NULL, fence, OS_TIMEOUT_INFINITE);
+   screen->fence_reference(screen, &fence, NULL);
+
+   start = os_time_get_nano();
+
+   for (unsigned first = 0; first < test->num_tris; first += per_draw) {
+      util_draw_vertex_buffer(pipe, cso, test->vbuf,
+                              first * 3 * sizeof(float[2][4]), false,
+                              MESA_PRIM_TRIANGLES,
+                              MIN2(per_draw, test->num_tris - first) * 3,
+                              2);
+   }
+
+   pipe->flush(pipe, &fence, 0);
+   screen->fence_finish(screen, NULL, fence, OS_TIMEOUT_INFINITE);
+   screen->fence_reference(screen, &fence, NULL);
+
+   elapsed = os_time_get_nano() - start;
+
+   const uint8_t *map = pipe_texture_map(pipe, target, 0, 0, PIPE_MAP_READ,
+                                         0, 0, WIDTH, HEIGHT, &transfer);
+   for (unsigned y = 0; y < HEIGHT; y++)
+      memcpy(&pixels[y * WIDTH], map + y * transfer->stride, WIDTH * 4);
+   pipe_texture_unmap(pipe, transfer);
+
+   cso_destroy_context(cso);
+   pipe->delete_vs_state(pipe, vs);
+   pipe->delete_fs_state(pipe, fs);
+   pipe_surface_reference(&fb.cbufs[0], NULL);
+   pipe_resource_reference(&target, NULL);
+   pipe->destroy(pipe);
+
+   return MAX2(elapsed, 1);
+}
+
+
+static bool
+test_case(struct setup_test *test, unsigned verbose, FILE *fp,
+          unsigned per_draw)
+{
+   uint32_t *pixels[ARRAY_SIZE(modes)];
+   int64_t elapsed[ARRAY_SIZE(modes)];
+   bool success = true;
+
+   for (unsigned m = 0; m < ARRAY_SIZE(modes); m++) {
+      pixels[m] = MALLOC(WIDTH * HEIGHT * sizeof(uint32_t));
+      elapsed[m] = pixels[m] ? draw_triangles(test, &modes[m], per_draw,
+                                              pixels[m])
+                             : 0;
+      success &= elapsed[m] != 0;
+   }
+
+   /* Serial setup renders the reference image. */
+   for (unsigned m = 1; success && m < ARRAY_SIZE(modes); m++) {
+      for (unsigned i = 0; success && i < WIDTH * HEIGHT; i++) {
+         if (pixels[m][i] != pixels[0][i]) {
+            printf("%s, %u triangles per draw: pixel %u,%u is %08x, "
+                   "expected %08x\n", modes[m].name, per_draw,
+                   i % WIDTH, i / WIDTH, pixels[m][i], pixels[0][i]);
+            success = false;
+         }
+      }
+   }
+
+   for (unsigned m = 0; m < ARRAY_SIZE(modes); m++)
+      FREE(pixels[m]);
+
+   if (verbose >= 1)
+      printf("%u triangles per draw: %s\n", per_draw,
+             success ? "PASS" : "FAIL");
+
+   if (fp) {
+      for (unsigned m = 0; m < ARRAY_SIZE(modes); m++) {
+         fprintf(fp, "%s\t%s\t%u\t%u\t%f\n",
+                 success ? "pass" : "fail", modes[m].name, per_draw,
+                 test->num_tris, (double)elapsed[m] / test->num_tris);
+      }
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+static bool
+init_test(struct setup_test *test)
+{
+   struct pipe_context *pipe;
+   float (*verts)[2][4];
+   unsigned size;
+
+   test->num_tris = test_benchmark ? 1 << 17 : 1 << 14;
+   size = test->num_tris * 3 * sizeof(float[2][4]);
+
+   test->screen = llvmpipe_create_screen(null_sw_create());
+   if (!test->screen)
+      return false;
+
+   test->vbuf = pipe_buffer_create(test->screen, PIPE_BIND_VERTEX_BUFFER,
+                                   PIPE_USAGE_DEFAULT, size);
+   pipe = test->screen->context_create(test->screen, NULL, 0);
+   verts = MALLOC(size);
+   if (!test->vbuf || !pipe || !verts) {
+      if (pipe)
+         pipe->destroy(pipe);
+      FREE(verts);
+      return false;
+   }
+
+   make_vertices(verts, test->num_tris);
+   pipe_buffer_write(pipe, test->vbuf, 0, size, verts);
+   pipe->destroy(pipe);
+   FREE(verts);
+
+   return true;
+}
+
+
+static void
+fini_test(struct setup_test *test)
+{
+   pipe_resource_reference(&test->vbuf, NULL);
+   if (test->screen)
+      test->screen->destroy(test->screen);
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "mode\t"
+           "tris_per_draw\t"
+           "tris\t"
+           "ns_per_tri\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   struct setup_test test = { 0 };
+   bool success = init_test(&test);
+
+   for (unsigned i = 0; success && i < ARRAY_SIZE(tris_per_draw); i++)
+      success &= test_case(&test, verbose, fp, tris_per_draw[i]);
+
+   fini_test(&test);
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   struct setup_test test = { 0 };
+   bool success = init_test(&test);
+
+   for (unsigned long i = 0; success && i < n; i++) {
+      success &= test_case(&test, verbose, fp,
+                           tris_per_draw[rand() % ARRAY_SIZE(tris_per_draw)]);
+   }
+
+   fini_test(&test);
+   return success;
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
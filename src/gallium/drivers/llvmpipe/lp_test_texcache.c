@@ -0,0 +1,363 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * A/B benchmark for the decoded block cache (lp_bld_format_cached.c).
+ *
+ * Texels of every compressed format the cache supports are fetched from a
+ * 256x256 texture of random blocks through the same JIT fetch function
+ * built with and without the cache, in the orders a fragment shader
+ * typically reads them: row by row, magnified 4x, in 2x2 quads along a
+ * rotated axis, and at random.  Both fetches must return the same texels,
+ * except for s3tc whose uncached path decodes approximately.
+ *
+ * A third variant counts hits and misses with GALLIVM_DEBUG_CACHE_STATS,
+ * as LP_DEBUG=tex_cache does in llvmpipe, and its hit rate is written next
+ * to the time per texel of the other two, so that a pattern that does not
+ * get faster can be told apart from one the cache does not help.  Each
+ * pattern is 262144 fetches with -b and 16384 without.
+ */
+
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util/os_time.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_pointer.h"
+#include "util/format/u_format.h"
+
+#include "gallivm/lp_bld.h"
+#include "gallivm/lp_bld_debug.h"
+#include "gallivm/lp_bld_format.h"
+#include "gallivm/lp_bld_init.h"
+
+#include "lp_test.h"
+
+
+#define TEX_SIZE 256
+
+enum fetch_method {
+   METHOD_UNCACHED,
+   METHOD_CACHED,
+   METHOD_STATS,       /* cached, counting hits and misses */
+   NUM_METHODS
+};
+
+static const enum pipe_format formats[] = {
+   PIPE_FORMAT_DXT1_RGB,
+   PIPE_FORMAT_DXT1_RGBA,
+   PIPE_FORMAT_DXT5_RGBA,
+   PIPE_FORMAT_BPTC_RGBA_UNORM,
+};
+
+typedef void
+(*fetch_ptr_t)(void *unpacked, const void *packed,
+               unsigned i, unsigned j, struct lp_build_format_cache *cache);
+
+struct texel {
+   uint16_t x, y;
+};
+
+
+static LLVMValueRef
+add_fetch(struct gallivm_state *gallivm,
+          const struct util_format_description *desc,
+          bool use_cache, const char *name)
+{
+   LLVMContextRef context = gallivm->context;
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct lp_type type = lp_unorm8_vec4_type();
+   LLVMValueRef offset = LLVMConstNull(LLVMInt32TypeInContext(context));
+   LLVMTypeRef args[5];
+   LLVMValueRef func, rgba;
+
+   args[0] = LLVMPointerType(lp_build_vec_type(gallivm, type), 0);
+   args[1] = LLVMPointerType(LLVMInt8TypeInContext(context), 0);
+   args[3] = args[2] = LLVMInt32TypeInContext(context);
+   args[4] = LLVMPointerType(lp_build_format_cache_type(gallivm), 0);
+
+   func = LLVMAddFunction(gallivm->module, name,
+                          LLVMFunctionType(LLVMVoidTypeInContext(context),
+                                           args, ARRAY_SIZE(args), 0));
+   LLVMSetFunctionCallConv(func, LLVMCCallConv);
+
+   LLVMPositionBuilderAtEnd(builder,
+                            LLVMAppendBasicBlockInContext(context, func,
+                                                          "entry"));
+
+   rgba = lp_build_fetch_rgba_aos(gallivm, desc, type, true,
+                                  LLVMGetParam(func, 1), offset,
+                                  LLVMGetParam(func, 2),
+                                  LLVMGetParam(func, 3),
+                                  use_cache ? LLVMGetParam(func, 4) : NULL);
+   LLVMBuildStore(builder, rgba, LLVMGetParam(func, 0));
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, func);
+
+   return func;
+}
+
+
+/* Row by row. */
+static void
+rows_texel(unsigned n, unsigned *x, unsigned *y)
+{
+   *x = n % TEX_SIZE;
+   *y = n / TEX_SIZE;
+}
+
+
+/* Row by row, every texel 16 times. */
+static void
+magnified_texel(unsigned n, unsigned *x, unsigned *y)
+{
+   *x = (n % (4 * TEX_SIZE)) / 4;
+   *y = (n / (4 * TEX_SIZE)) / 4;
+}
+
+
+/* 2x2 quads along rows of 512 pixels, sampled through a 30 degree rotation. */
+static void
+quads_texel(unsigned n, unsigned *x, unsigned *y)
+{
+   const float c = cosf(M_PI / 6), s = sinf(M_PI / 6);
+   const unsigned quad = n / 4;
+   const float px = (quad % 256) * 2 + (n & 1);
+   const float py = (quad / 256) * 2 + ((n >> 1) & 1);
+
+   *x = (int)(px * c - py * s) & (TEX_SIZE - 1);
+   *y = (int)(px * s + py * c) & (TEX_SIZE - 1);
+}
+
+
+static void
+random_texel(unsigned n, unsigned *x, unsigned *y)
+{
+   *x = rand() % TEX_SIZE;
+   *y = rand() % TEX_SIZE;
+}
+
+
+static const struct fetch_pattern {
+   const char *name;
+   void (*texel)(unsigned n, unsigned *x, unsigned *y);
+} patterns[] = {
+   { "rows", rows_texel },
+   { "magnified", magnified_texel },
+   { "quads", quads_texel },
+   { "random", random_texel },
+};
+
+
+static void
+make_texels(const struct fetch_pattern *pattern, struct texel *texels,
+            unsigned num_fetches)
+{
+   for (unsigned n = 0; n < num_fetches; n++) {
+      unsigned x, y;
+
+      pattern->texel(n, &x, &y);
+      texels[n].x = x;
+      texels[n].y = y % TEX_SIZE;
+   }
+}
+
+
+/**
+ * Fetch all \p texels, returning the time it took in nanoseconds.
+ */
+UTIL_ALIGN_STACK
+static int64_t
+fetch_texels(const struct util_format_description *desc, fetch_ptr_t fetch,
+             const uint8_t *packed, const struct texel *texels,
+             unsigned num_fetches, struct lp_build_format_cache *cache,
+             uint8_t (*out)[4])
+{
+   const unsigned block_size = desc->block.bits / 8;
+   const unsigned blocks_x = TEX_SIZE / desc->block.width;
+   int64_t start;
+
+   memset(cache, 0, sizeof *cache);
+
+   start = os_time_get_nano();
+   for (unsigned n = 0; n < num_fetches; n++) {
+      const unsigned bx = texels[n].x / desc->block.width;
+      const unsigned by = texels[n].y / desc->block.height;
+
+      fetch(out[n], packed + (by * blocks_x + bx) * block_size,
+            texels[n].x % desc->block.width,
+            texels[n].y % desc->block.height, cache);
+   }
+
+   return os_time_get_nano() - start;
+}
+
+
+static bool
+test_format(unsigned verbose, FILE *fp,
+            const struct util_format_description *desc,
+            struct lp_build_format_cache *cache)
+{
+   const unsigned num_blocks = (TEX_SIZE / desc->block.width) *
+                               (TEX_SIZE / desc->block.height);
+   const unsigned packed_size = num_blocks * desc->block.bits / 8;
+   const unsigned num_fetches = test_benchmark ? 1 << 18 : 1 << 14;
+   const unsigned saved_debug = gallivm_debug;
+   lp_context_ref context;
+   struct gallivm_state *gallivm;
+   LLVMValueRef funcs[NUM_METHODS];
+   fetch_ptr_t fetch[NUM_METHODS];
+   char names[NUM_METHODS][64];
+   uint8_t *packed;
+   uint8_t (*out[2])[4];
+   struct texel *texels;
+   bool success = true;
+
+   lp_context_create(&context);
+   gallivm = gallivm_create("test_module_texcache", &context, NULL);
+
+   for (unsigned m = 0; m < NUM_METHODS; m++) {
+      snprintf(names[m], sizeof names[m], "fetch_%s_%u", desc->short_name, m);
+      if (m == METHOD_STATS)
+         gallivm_debug |= GALLIVM_DEBUG_CACHE_STATS;
+      else
+         gallivm_debug &= ~GALLIVM_DEBUG_CACHE_STATS;
+      funcs[m] = add_fetch(gallivm, desc, m != METHOD_UNCACHED, names[m]);
+   }
+   gallivm_debug = saved_debug;
+
+   gallivm_compile_module(gallivm);
+   for (unsigned m = 0; m < NUM_METHODS; m++)
+      fetch[m] = (fetch_ptr_t)gallivm_jit_function(gallivm, funcs[m], names[m]);
+   gallivm_free_ir(gallivm);
+
+   packed = align_malloc(packed_size, 16);
+   texels = MALLOC(num_fetches * sizeof(*texels));
+   out[0] = MALLOC(num_fetches * sizeof(*out[0]));
+   out[1] = MALLOC(num_fetches * sizeof(*out[1]));
+   if (!packed || !texels || !out[0] || !out[1])
+      success = false;
+
+   for (unsigned k = 0; success && k < packed_size; k++)
+      packed[k] = rand();
+
+   for (unsigned p = 0; success && p < ARRAY_SIZE(patterns); p++) {
+      int64_t elapsed[2];
+      double hit_rate = 0.0;
+
+      make_texels(&patterns[p], texels, num_fetches);
+
+      elapsed[0] = fetch_texels(desc, fetch[METHOD_UNCACHED], packed, texels,
+                                num_fetches, cache, out[0]);
+      elapsed[1] = fetch_texels(desc, fetch[METHOD_CACHED], packed, texels,
+                                num_fetches, cache, out[1]);
+
+      if (desc->layout != UTIL_FORMAT_LAYOUT_S3TC &&
+          memcmp(out[0], out[1], num_fetches * sizeof(*out[0])) != 0) {
+         printf("%s, %s: cached texels differ\n", desc->short_name,
+                patterns[p].name);
+         success = false;
+      }
+
+      fetch_texels(desc, fetch[METHOD_STATS], packed, texels, num_fetches,
+                   cache, out[1]);
+      if (cache->cache_access_total) {
+         hit_rate = (double)(cache->cache_access_total -
+                             cache->cache_access_miss) /
+                    cache->cache_access_total;
+      }
+
+      if (verbose >= 1) {
+         printf("%s, %s: %s\n", desc->short_name, patterns[p].name,
+                success ? "PASS" : "FAIL");
+      }
+
+      if (fp) {
+         fprintf(fp, "%s\t%s\t%s\t%u\t%f\t%f\t%f\t%f\n",
+                 success ? "pass" : "fail", desc->short_name,
+                 patterns[p].name, num_fetches,
+                 (double)elapsed[0] / num_fetches,
+                 (double)elapsed[1] / num_fetches,
+                 (double)elapsed[0] / MAX2(elapsed[1], 1), hit_rate);
+         fflush(fp);
+      }
+   }
+
+   FREE(out[1]);
+   FREE(out[0]);
+   FREE(texels);
+   align_free(packed);
+
+   gallivm_destroy(gallivm);
+   lp_context_destroy(&context);
+
+   return success;
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "format\t"
+           "pattern\t"
+           "fetches\t"
+           "ns_per_texel_uncached\t"
+           "ns_per_texel_cached\t"
+           "speedup\t"
+           "hit_rate\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   struct lp_build_format_cache *cache;
+   bool success = true;
+
+   cache = align_malloc(sizeof(*cache), 16);
+   if (!cache)
+      return false;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(formats); i++) {
+      const struct util_format_description *desc =
+         util_format_description(formats[i]);
+
+      /* Same as lp_test_format, the uncached path may need these. */
+      if (!util_format_fetch_rgba_func(formats[i]) ||
+          !lp_build_format_cache_supported(desc))
+         continue;
+
+      success &= test_format(verbose, fp, desc, cache);
+   }
+
+   align_free(cache);
+
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
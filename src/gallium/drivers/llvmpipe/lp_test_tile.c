@@ -0,0 +1,352 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Frame time benchmark for the scene tile size (LP_TILE_SIZE).
+ *
+ * Renders the same frame of overlapping triangles at 640x480, 1920x1080
+ * and 3840x2160.  The tile size and thread count come from LP_TILE_SIZE
+ * and LP_NUM_THREADS, which are only read once per process, so the sweep
+ * over both is done by lp_bench_tile_size.py running this test once per
+ * combination.  Every frame must come out the same, and a checksum of
+ * the image is written next to the frame time so that the script can
+ * check that all tile sizes and thread counts render the same image.
+ * The frame time is averaged over ten frames with -b, which the script
+ * passes; without it only two frames are drawn, enough to compare them.
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cso_cache/cso_context.h"
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "sw/null/null_sw_winsys.h"
+#include "util/os_time.h"
+#include "util/u_debug.h"
+#include "util/u_draw_quad.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_simple_shaders.h"
+
+#include "lp_public.h"
+#include "lp_screen.h"
+#include "lp_test.h"
+
+
+#define NUM_TRIS 16384
+#define NUM_FRAMES 10
+
+static const struct {
+   unsigned width, height;
+} resolutions[] = {
+   { 640, 480 },
+   { 1920, 1080 },
+   { 3840, 2160 },
+};
+
+struct tile_test {
+   struct pipe_screen *screen;
+   struct pipe_resource *vbuf;
+};
+
+
+/*
+ * Triangles of up to a sixteenth of the screen across, so that most of
+ * them span several tiles at any tile size and every pixel is covered a
+ * few times.  Sizes are in NDC so the frame looks the same at every
+ * resolution.
+ */
+static void
+make_vertices(float (*verts)[2][4])
+{
+   uint32_t seed = 1;
+
+   for (unsigned i = 0; i < NUM_TRIS * 3; i++) {
+      float *pos = verts[i][0], *color = verts[i][1];
+
+      seed = seed * 1103515245 + 12345;
+      pos[0] = (float)(seed >> 16 & 0x7fff) / 0x4000 - 1.0f;
+      seed = seed * 1103515245 + 12345;
+      pos[1] = (float)(seed >> 16 & 0x7fff) / 0x4000 - 1.0f;
+      if (i % 3) {
+         pos[0] = verts[i - i % 3][0][0] + (pos[0] / 8.0f);
+         pos[1] = verts[i - i % 3][0][1] + (pos[1] / 8.0f);
+      }
+      pos[2] = 0.0f;
+      pos[3] = 1.0f;
+
+      for (unsigned c = 0; c < 3; c++) {
+         seed = seed * 1103515245 + 12345;
+         color[c] = (float)(seed >> 16 & 0xff) / 255.0f;
+      }
+      color[3] = 1.0f;
+   }
+}
+
+
+/**
+ * Render \p num_frames frames at the given size.
+ * \return the average time per frame in nanoseconds, or 0 on failure
+ */
+static int64_t
+draw_frames(struct tile_test *test, unsigned width, unsigned height,
+            unsigned num_frames, uint32_t *checksum, bool *stable)
+{
+   struct pipe_screen *screen = test->screen;
+   struct pipe_context *pipe;
+   struct cso_context *cso;
+   struct pipe_resource *target, tmpl = {
+      .target = PIPE_TEXTURE_2D,
+      .format = PIPE_FORMAT_B8G8R8A8_UNORM,
+      .width0 = width,
+      .height0 = height,
+      .depth0 = 1,
+      .array_size = 1,
+      .bind = PIPE_BIND_RENDER_TARGET,
+   };
+   struct pipe_surface surf_tmpl = { .format = PIPE_FORMAT_B8G8R8A8_UNORM };
+   struct pipe_framebuffer_state fb = {
+      .width = width,
+      .height = height,
+      .nr_cbufs = 1,
+   };
+   struct pipe_blend_state blend = { 0 };
+   struct pipe_depth_stencil_alpha_state dsa = { 0 };
+   struct pipe_rasterizer_state rast = {
+      .cull_face = PIPE_FACE_NONE,
+      .half_pixel_center = 1,
+      .bottom_edge_rule = 1,
+      .depth_clip_near = 1,
+      .depth_clip_far = 1,
+   };
+   struct pipe_viewport_state viewport = {
+      .scale = { width / 2.0f, height / 2.0f, 0.5f },
+      .translate = { width / 2.0f, height / 2.0f, 0.5f },
+      .swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X,
+      .swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y,
+      .swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z,
+      .swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W,
+   };
+   struct cso_velems_state velem = { .count = 2 };
+   const enum tgsi_semantic semantic_names[] =
+      { TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+   const unsigned semantic_indexes[] = { 0, 0 };
+   const union pipe_color_union clear_color = { .f = { 0, 0, 0, 1 } };
+   struct pipe_fence_handle *fence = NULL;
+   int64_t start, elapsed = 0;
+   void *vs, *fs;
+
+   pipe = screen->context_create(screen, NULL, 0);
+   if (!pipe)
+      return 0;
+
+   cso = cso_create_context(pipe, 0);
+   target = screen->resource_create(screen, &tmpl);
+   fb.cbufs[0] = pipe->create_surface(pipe, target, &surf_tmpl);
+
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   for (unsigned i = 0; i < 2; i++) {
+      velem.velems[i].src_offset = i * 4 * sizeof(float);
+      velem.velems[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+      velem.velems[i].src_stride = 2 * 4 * sizeof(float);
+   }
+   vs = util_make_vertex_passthrough_shader(pipe, 2, semantic_names,
+                                            semantic_indexes, false);
+   fs = util_make_fragment_passthrough_shader(pipe, TGSI_SEMANTIC_COLOR,
+                                              TGSI_INTERPOLATE_PERSPECTIVE,
+                                              true);
+
+   cso_set_framebuffer(cso, &fb);
+   cso_set_blend(cso, &blend);
+   cso_set_depth_stencil_alpha(cso, &dsa);
+   cso_set_rasterizer(cso, &rast);
+   cso_set_viewport(cso, &viewport);
+   cso_set_fragment_shader_handle(cso, fs);
+   cso_set_vertex_shader_handle(cso, vs);
+   cso_set_vertex_elements(cso, &velem);
+
+   *stable = true;
+
+   for (unsigned f = 0; f < num_frames; f++) {
+      struct pipe_transfer *transfer;
+      uint32_t sum = 2166136261u;
+
+      start = os_time_get_nano();
+
+      pipe->clear(pipe, PIPE_CLEAR_COLOR, NULL, &clear_color, 0, 0);
+      util_draw_vertex_buffer(pipe, cso, test->vbuf, 0, false,
+                              MESA_PRIM_TRIANGLES, NUM_TRIS * 3, 2);
+      pipe->flush(pipe, &fence, 0);
+      screen->fence_finish(screen, NULL, fence, OS_TIMEOUT_INFINITE);
+      screen->fence_reference(screen, &fence, NULL);
+
+      elapsed += os_time_get_nano() - start;
+
+      /* FNV-1a over the pixels. */
+      const uint8_t *map = pipe_texture_map(pipe, target, 0, 0,
+                                            PIPE_MAP_READ, 0, 0,
+                                            width, height, &transfer);
+      for (unsigned y = 0; y < height; y++) {
+         const uint8_t *row = map + y * transfer->stride;
+         for (unsigned x = 0; x < width * 4; x++)
+            sum = (sum ^ row[x]) * 16777619u;
+      }
+      pipe_texture_unmap(pipe, transfer);
+
+      if (f && sum != *checksum)
+         *stable = false;
+      *checksum = sum;
+   }
+
+   cso_destroy_context(cso);
+   pipe->delete_vs_state(pipe, vs);
+   pipe->delete_fs_state(pipe, fs);
+   pipe_surface_reference(&fb.cbufs[0], NULL);
+   pipe_resource_reference(&target, NULL);
+   pipe->destroy(pipe);
+
+   return MAX2(elapsed / num_frames, 1);
+}
+
+
+static bool
+test_case(struct tile_test *test, unsigned verbose, FILE *fp,
+          unsigned width, unsigned height, unsigned num_frames)
+{
+   const unsigned tile_size = debug_get_num_option("LP_TILE_SIZE", 0);
+   const unsigned num_threads = llvmpipe_screen(test->screen)->num_threads;
+   uint32_t checksum = 0;
+   bool stable;
+   int64_t elapsed;
+   bool success;
+
+   elapsed = draw_frames(test, width, height, num_frames,
+                         &checksum, &stable);
+   success = elapsed != 0 && stable;
+
+   if (verbose >= 1)
+      printf("%ux%u, %u threads: %s\n", width, height, num_threads,
+             success ? "PASS" : "FAIL");
+
+   if (fp) {
+      char tile_name[16] = "auto";
+
+      if (tile_size)
+         snprintf(tile_name, sizeof(tile_name), "%u", tile_size);
+
+      fprintf(fp, "%s\t%u\t%u\t%u\t%s\t%08x\t%f\n",
+              success ? "pass" : "fail", width, height, num_threads,
+              tile_name, checksum, (double)elapsed);
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+static bool
+init_test(struct tile_test *test)
+{
+   const unsigned size = NUM_TRIS * 3 * sizeof(float[2][4]);
+   struct pipe_context *pipe;
+   float (*verts)[2][4];
+
+   test->screen = llvmpipe_create_screen(null_sw_create());
+   if (!test->screen)
+      return false;
+
+   test->vbuf = pipe_buffer_create(test->screen, PIPE_BIND_VERTEX_BUFFER,
+                                   PIPE_USAGE_DEFAULT, size);
+   pipe = test->screen->context_create(test->screen, NULL, 0);
+   verts = MALLOC(size);
+   if (!test->vbuf || !pipe || !verts) {
+      if (pipe)
+         pipe->destroy(pipe);
+      FREE(verts);
+      return false;
+   }
+
+   make_vertices(verts);
+   pipe_buffer_write(pipe, test->vbuf, 0, size, verts);
+   pipe->destroy(pipe);
+   FREE(verts);
+
+   return true;
+}
+
+
+static void
+fini_test(struct tile_test *test)
+{
+   pipe_resource_reference(&test->vbuf, NULL);
+   if (test->screen)
+      test->screen->destroy(test->screen);
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "width\t"
+           "height\t"
+           "threads\t"
+           "tile_size\t"
+           "checksum\t"
+           "ns_per_frame\n");
+
+   fflush(fp);
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   struct tile_test test = { 0 };
+   bool success = init_test(&test);
+
+   for (unsigned i = 0; success && i < ARRAY_SIZE(resolutions); i++) {
+      success &= test_case(&test, verbose, fp, resolutions[i].width,
+                           resolutions[i].height,
+                           test_benchmark ? NUM_FRAMES : 2);
+   }
+
+   fini_test(&test);
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   struct tile_test test = { 0 };
+   bool success = init_test(&test);
+
+   /* One frame per case, this also serves as the warm-up pass. */
+   for (unsigned long i = 0; success && i < n; i++) {
+      const unsigned r = rand() % ARRAY_SIZE(resolutions);
+
+      success &= test_case(&test, verbose, fp, resolutions[r].width,
+                           resolutions[r].height, 1);
+   }
+
+   fini_test(&test);
+   return success;
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
@@ -34,9 +34,10 @@
 struct lp_build_sampler_soa;
 struct lp_sampler_static_state;
 /**
- * Whether texture cache is used for s3tc textures.
+ * Whether the decoded block cache is used for compressed textures
+ * (see lp_build_format_cache_supported()).
  */
-#define LP_USE_TEXTURE_CACHE 0
+#define LP_USE_TEXTURE_CACHE 1
 
 struct lp_build_sampler_soa *
 lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *static_state,
@@ -35,6 +35,7 @@
 #include "pipe/p_context.h"
 #include "pipe/p_screen.h"
 #include "util/mesa-sha1.h"
+#include "util/u_atomic.h"
 
 static const char *image_function_base_hash = "8ca89d7a4ab5830be6a1ba1140844081235b01164a8fce8316ca6a2f81f1a899";
 static const char *sample_function_base_hash = "0789b032c4a1ddba086e07496fe2a992b1ee08f78c0884a2923564b1ed52b9cc";
@@ -538,7 +539,15 @@ get_sample_function(uint64_t _matrix, uint64_t _texture_functions, uint64_t _sam
       .sample_key = sample_key,
    };
 
-   void *result;
+   /* Another context may have moved the function into the table since this
+    * draw loaded the trampoline.
+    */
+   void *result = texture_functions->sample_functions[sampler_index][sample_key];
+   if (result != matrix->jit_sample_functions[sample_key]) {
+      simple_mtx_unlock(&matrix->lock);
+      return (uint64_t)(uintptr_t)result;
+   }
+
    struct hash_entry *entry = _mesa_hash_table_search(matrix->cache, &key);
    if (entry) {
       result = entry->data;
@@ -1033,13 +1042,22 @@ llvmpipe_clear_sample_functions_cache(struct llvmpipe_context *ctx, struct pipe_
    simple_mtx_unlock(&matrix->lock);
 
    if (fence) {
+      /* The rasterizer is shared by all contexts of the screen, so this also
+       * waits for draws flushed by other contexts using these handles.
+       * Compute dispatches of other contexts (lavapipe's async queues) may
+       * still run and call get_sample_function(): keep the lock while moving
+       * entries and publish each one atomically, readers then see either the
+       * trampoline or the compiled function, which both work.
+       */
       ctx->pipe.screen->fence_finish(ctx->pipe.screen, NULL, *fence, OS_TIMEOUT_INFINITE);
 
-      /* All work is finished, it's safe to move cache entries into the table. */
+      simple_mtx_lock(&matrix->lock);
       hash_table_foreach_remove(matrix->cache, entry) {
          struct sample_function_cache_key *key = (void *)entry->key;
-         key->texture_functions->sample_functions[key->sampler_index][key->sample_key] = entry->data;
+         p_atomic_set(&key->texture_functions->sample_functions[key->sampler_index][key->sample_key],
+                      entry->data);
          free(key);
       }
+      simple_mtx_unlock(&matrix->lock);
    }
 }
@@ -1448,6 +1448,16 @@ VKAPI_ATTR void VKAPI_CALL lvp_GetPhysicalDeviceQueueFamilyProperties2(
          .minImageTransferGranularity = (VkExtent3D) { 1, 1, 1 },
       };
    }
+
+   vk_outarray_append_typed(VkQueueFamilyProperties2, &out, p) {
+      p->queueFamilyProperties = (VkQueueFamilyProperties) {
+         .queueFlags = VK_QUEUE_COMPUTE_BIT |
+         VK_QUEUE_TRANSFER_BIT,
+         .queueCount = LVP_NUM_ASYNC_QUEUES,
+         .timestampValidBits = 64,
+         .minImageTransferGranularity = (VkExtent3D) { 1, 1, 1 },
+      };
+   }
 }
 
 VKAPI_ATTR void VKAPI_CALL lvp_GetPhysicalDeviceMemoryProperties(
@@ -1548,6 +1558,20 @@ destroy_pipelines(struct lvp_queue *queue)
    simple_mtx_unlock(&queue->lock);
 }
 
+/* Called with queue->lock held. */
+static void
+destroy_async_csos(struct lvp_queue *queue)
+{
+   simple_mtx_lock(&queue->destroys_lock);
+   util_dynarray_foreach(&queue->cso_destroys, void *, cso)
+      queue->ctx->delete_compute_state(queue->ctx, *cso);
+   util_dynarray_clear(&queue->cso_destroys);
+   util_dynarray_foreach(&queue->query_destroys, struct pipe_query *, query)
+      queue->ctx->destroy_query(queue->ctx, *query);
+   util_dynarray_clear(&queue->query_destroys);
+   simple_mtx_unlock(&queue->destroys_lock);
+}
+
 static VkResult
 lvp_queue_submit(struct vk_queue *vk_queue,
                  struct vk_queue_submit *submit)
@@ -1562,6 +1586,8 @@ lvp_queue_submit(struct vk_queue *vk_queue,
 
    simple_mtx_lock(&queue->lock);
 
+   destroy_async_csos(queue);
+
    for (uint32_t i = 0; i < submit->buffer_bind_count; i++) {
       VkSparseBufferMemoryBindInfo *bind = &submit->buffer_binds[i];
 
@@ -1628,6 +1654,9 @@ lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
 
    simple_mtx_init(&queue->lock, mtx_plain);
    util_dynarray_init(&queue->pipeline_destroys, NULL);
+   simple_mtx_init(&queue->destroys_lock, mtx_plain);
+   util_dynarray_init(&queue->cso_destroys, NULL);
+   util_dynarray_init(&queue->query_destroys, NULL);
 
    return VK_SUCCESS;
 }
@@ -1638,8 +1667,15 @@ lvp_queue_finish(struct lvp_queue *queue)
    vk_queue_finish(&queue->vk);
 
    destroy_pipelines(queue);
+   destroy_async_csos(queue);
    simple_mtx_destroy(&queue->lock);
    util_dynarray_fini(&queue->pipeline_destroys);
+   simple_mtx_destroy(&queue->destroys_lock);
+   util_dynarray_fini(&queue->cso_destroys);
+   util_dynarray_fini(&queue->query_destroys);
+
+   if (queue->last_fence)
+      queue->device->pscreen->fence_reference(queue->device->pscreen, &queue->last_fence, NULL);
 
    u_upload_destroy(queue->uploader);
    cso_destroy_context(queue->cso);
@@ -1660,12 +1696,14 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    size_t state_size = lvp_get_rendering_state_size();
    device = vk_zalloc2(&physical_device->vk.instance->alloc, pAllocator,
-                       sizeof(*device) + state_size, 8,
+                       sizeof(*device) + state_size * (1 + LVP_NUM_ASYNC_QUEUES), 8,
                        VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
    if (!device)
       return vk_error(instance, VK_ERROR_OUT_OF_HOST_MEMORY);
 
    device->queue.state = device + 1;
+   for (unsigned i = 0; i < LVP_NUM_ASYNC_QUEUES; i++)
+      device->async_queues[i].state = (uint8_t *)(device + 1) + state_size * (i + 1);
    device->poison_mem = debug_get_bool_option("LVP_POISON_MEMORY", false);
    device->print_cmds = debug_get_bool_option("LVP_CMD_DEBUG", false);
 
@@ -1692,15 +1730,47 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    device->pscreen = physical_device->pscreen;
 
-   assert(pCreateInfo->queueCreateInfoCount == 1);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueFamilyIndex == 0);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueCount == 1);
-   result = lvp_queue_init(device, &device->queue, pCreateInfo->pQueueCreateInfos, 0);
+   /* The device queue's context is also the one everything outside of
+    * command buffers goes through, so it exists even when only async
+    * queues were asked for.
+    */
+   const VkDeviceQueueCreateInfo *queue_info = &(VkDeviceQueueCreateInfo) {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = 0,
+      .queueCount = 1,
+   };
+   const VkDeviceQueueCreateInfo *async_info = NULL;
+   for (uint32_t i = 0; i < pCreateInfo->queueCreateInfoCount; i++) {
+      const VkDeviceQueueCreateInfo *info = &pCreateInfo->pQueueCreateInfos[i];
+
+      if (info->queueFamilyIndex == LVP_QUEUE_FAMILY_ASYNC) {
+         assert(info->queueCount <= LVP_NUM_ASYNC_QUEUES);
+         async_info = info;
+      } else {
+         assert(info->queueFamilyIndex == 0);
+         assert(info->queueCount == 1);
+         queue_info = info;
+      }
+   }
+
+   result = lvp_queue_init(device, &device->queue, queue_info, 0);
    if (result != VK_SUCCESS) {
       vk_free(&device->vk.alloc, device);
       return result;
    }
 
+   for (uint32_t i = 0; async_info && i < async_info->queueCount; i++) {
+      result = lvp_queue_init(device, &device->async_queues[i], async_info, i);
+      if (result != VK_SUCCESS) {
+         for (uint32_t j = 0; j < device->async_queue_count; j++)
+            lvp_queue_finish(&device->async_queues[j]);
+         lvp_queue_finish(&device->queue);
+         vk_free(&device->vk.alloc, device);
+         return result;
+      }
+      device->async_queue_count++;
+   }
+
    nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_FRAGMENT, NULL, "dummy_frag");
    struct pipe_shader_state shstate = {0};
    shstate.type = PIPE_SHADER_IR_NIR;
@@ -1749,13 +1819,16 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
 
    device->queue.ctx->delete_fs_state(device->queue.ctx, device->noop_fs);
 
-   if (device->queue.last_fence)
-      device->pscreen->fence_reference(device->pscreen, &device->queue.last_fence, NULL);
    ralloc_free(device->bda.table);
    simple_mtx_destroy(&device->bda_lock);
    pipe_resource_reference(&device->zero_buffer, NULL);
 
+   /* Pipelines destroyed by the device queue hand their CSOs to the async
+    * queues, so those go last.
+    */
    lvp_queue_finish(&device->queue);
+   for (uint32_t i = 0; i < device->async_queue_count; i++)
+      lvp_queue_finish(&device->async_queues[i]);
    vk_device_finish(&device->vk);
    vk_free(&device->vk.alloc, device);
 }
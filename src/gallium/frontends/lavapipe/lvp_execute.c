@@ -82,6 +82,7 @@ struct lvp_render_attachment {
 struct rendering_state {
    struct pipe_context *pctx;
    struct lvp_device *device; //for uniform inlining only
+   struct lvp_queue *queue;
    struct u_upload_mgr *uploader;
    struct cso_context *cso;
 
@@ -379,6 +380,24 @@ update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type
    }
 }
 
+static bool
+is_async_queue(const struct rendering_state *state)
+{
+   return state->queue != &state->device->queue;
+}
+
+static void *
+get_compute_cso(struct rendering_state *state, struct lvp_shader *shader)
+{
+   if (!is_async_queue(state))
+      return shader->shader_cso;
+
+   void **cso = &shader->async_cso[state->queue->vk.index_in_family];
+   if (!*cso)
+      *cso = lvp_shader_compile_async(state->queue, shader);
+   return *cso;
+}
+
 static void emit_compute_state(struct rendering_state *state)
 {
    bool pcbuf_dirty = state->pcbuf_dirty[MESA_SHADER_COMPUTE];
@@ -392,11 +411,13 @@ static void emit_compute_state(struct rendering_state *state)
       state->constbuf_dirty[MESA_SHADER_COMPUTE] = false;
    }
 
-   if (state->inlines_dirty[MESA_SHADER_COMPUTE] &&
+   /* inlined variants live on the device queue's context */
+   if (state->inlines_dirty[MESA_SHADER_COMPUTE] && !is_async_queue(state) &&
        state->shaders[MESA_SHADER_COMPUTE]->inlines.can_inline) {
       update_inline_shader_state(state, MESA_SHADER_COMPUTE, pcbuf_dirty);
    } else if (state->compute_shader_dirty) {
-      state->pctx->bind_compute_state(state->pctx, state->shaders[MESA_SHADER_COMPUTE]->shader_cso);
+      state->pctx->bind_compute_state(state->pctx,
+                                      get_compute_cso(state, state->shaders[MESA_SHADER_COMPUTE]));
    }
 
    state->compute_shader_dirty = false;
@@ -2890,6 +2911,7 @@ static void handle_begin_query(struct vk_cmd_queue_entry *cmd,
          enum pipe_query_type qtype = pool->base_type;
          pool->queries[qcmd->query + idx] = state->pctx->create_query(state->pctx,
                                                                qtype, 0);
+         pool->owners[qcmd->query + idx] = state->queue;
       }
 
       state->pctx->begin_query(state->pctx, pool->queries[qcmd->query + idx]);
@@ -2927,6 +2949,7 @@ static void handle_begin_query_indexed_ext(struct vk_cmd_queue_entry *cmd,
          enum pipe_query_type qtype = pool->base_type;
          pool->queries[qcmd->query + idx] = state->pctx->create_query(state->pctx,
                                                                       qtype, qcmd->index);
+         pool->owners[qcmd->query + idx] = state->queue;
       }
 
       state->pctx->begin_query(state->pctx, pool->queries[qcmd->query + idx]);
@@ -2951,10 +2974,8 @@ static void handle_reset_query_pool(struct vk_cmd_queue_entry *cmd,
    struct vk_cmd_reset_query_pool *qcmd = &cmd->u.reset_query_pool;
    LVP_FROM_HANDLE(lvp_query_pool, pool, qcmd->query_pool);
    for (unsigned i = qcmd->first_query; i < qcmd->first_query + qcmd->query_count; i++) {
-      if (pool->queries[i]) {
-         state->pctx->destroy_query(state->pctx, pool->queries[i]);
-         pool->queries[i] = NULL;
-      }
+      if (pool->queries[i])
+         lvp_queue_destroy_query(state->queue, pool, i);
    }
 }
 
@@ -2971,6 +2992,7 @@ static void handle_write_timestamp2(struct vk_cmd_queue_entry *cmd,
    for (unsigned idx = 0; idx < count; idx++) {
       if (!pool->queries[qcmd->query + idx]) {
          pool->queries[qcmd->query + idx] = state->pctx->create_query(state->pctx, PIPE_QUERY_TIMESTAMP, 0);
+         pool->owners[qcmd->query + idx] = state->queue;
       }
 
       state->pctx->end_query(state->pctx, pool->queries[qcmd->query + idx]);
@@ -4541,7 +4563,7 @@ static void emit_ray_tracing_state(struct rendering_state *state)
       state->constbuf_dirty[MESA_SHADER_RAYGEN] = false;
    }
 
-   state->pctx->bind_compute_state(state->pctx, state->shaders[MESA_SHADER_RAYGEN]->shader_cso);
+   state->pctx->bind_compute_state(state->pctx, get_compute_cso(state, state->shaders[MESA_SHADER_RAYGEN]));
 
    state->pcbuf_dirty[MESA_SHADER_COMPUTE] = true;
    state->constbuf_dirty[MESA_SHADER_COMPUTE] = true;
@@ -5224,6 +5246,7 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    memset(state, 0, sizeof(*state));
    state->pctx = queue->ctx;
    state->device = device;
+   state->queue = queue;
    state->uploader = queue->uploader;
    state->cso = queue->cso;
    state->blend_dirty = true;
@@ -101,6 +101,12 @@ extern "C" {
 #define MAX_DGC_STREAMS 16
 #define MAX_DGC_TOKENS 16
 
+/* Queues of the compute/transfer family, each with a pipe context and a
+ * submit thread of its own so that their work overlaps with the rest.
+ */
+#define LVP_QUEUE_FAMILY_ASYNC 1
+#define LVP_NUM_ASYNC_QUEUES 2
+
 #ifdef _WIN32
 #define lvp_printflike(a, b)
 #else
@@ -188,6 +194,13 @@ struct lvp_queue {
    void *state;
    struct util_dynarray pipeline_destroys;
    simple_mtx_t lock;
+
+   /* compute CSOs of destroyed shaders and queries created on ctx but reset
+    * by other queues, deleted on ctx by the next submit
+    */
+   struct util_dynarray cso_destroys;
+   struct util_dynarray query_destroys;
+   simple_mtx_t destroys_lock;
 };
 
 struct lvp_pipeline_cache {
@@ -200,6 +213,8 @@ struct lvp_device {
    struct vk_device vk;
 
    struct lvp_queue queue;
+   struct lvp_queue async_queues[LVP_NUM_ASYNC_QUEUES];
+   uint32_t async_queue_count;
    struct lvp_instance *                       instance;
    struct lvp_physical_device *physical_device;
    struct pipe_screen *pscreen;
@@ -440,6 +455,8 @@ struct lvp_shader {
    struct lvp_pipeline_nir *tess_ccw;
    void *shader_cso;
    void *tess_ccw_cso;
+   /* compute shaders only, created on first use by each async queue */
+   void *async_cso[LVP_NUM_ASYNC_QUEUES];
    struct {
       uint32_t uniform_offsets[PIPE_MAX_CONSTANT_BUFFERS][MAX_INLINABLE_UNIFORMS];
       uint8_t count[PIPE_MAX_CONSTANT_BUFFERS];
@@ -607,6 +624,7 @@ struct lvp_query_pool {
    VkQueryPipelineStatisticFlags pipeline_stats;
    enum pipe_query_type base_type;
    void *data; /* Used by queries that are not implemented by pipe_query */
+   struct lvp_queue **owners; /* queue whose ctx created each pipe_query */
    struct pipe_query *queries[0];
 };
 
@@ -698,6 +716,10 @@ VkResult lvp_image_bind_sparse(struct lvp_device *device,
                                struct lvp_queue *queue,
                                VkSparseImageMemoryBindInfo *bind);
 
+void lvp_queue_destroy_query(struct lvp_queue *queue,
+                             struct lvp_query_pool *pool,
+                             uint32_t index);
+
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
                           struct lvp_cmd_buffer *cmd_buffer);
@@ -769,6 +791,8 @@ void
 lvp_inline_uniforms(nir_shader *nir, const struct lvp_shader *shader, const uint32_t *uniform_values, uint32_t ubo);
 void *
 lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_shader *nir, bool locked);
+void *
+lvp_shader_compile_async(struct lvp_queue *queue, struct lvp_shader *shader);
 bool
 lvp_nir_lower_ray_queries(struct nir_shader *shader);
 bool
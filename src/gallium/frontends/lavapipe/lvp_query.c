@@ -24,6 +24,45 @@
 #include "lvp_private.h"
 #include "pipe/p_context.h"
 
+/* Queries are created on the ctx of the queue that first uses them, and are
+ * only touched through that ctx, with its queue's lock held.
+ */
+static void
+destroy_query(struct lvp_query_pool *pool, uint32_t index)
+{
+   struct lvp_queue *owner = pool->owners[index];
+
+   simple_mtx_lock(&owner->lock);
+   owner->ctx->destroy_query(owner->ctx, pool->queries[index]);
+   simple_mtx_unlock(&owner->lock);
+
+   pool->queries[index] = NULL;
+   pool->owners[index] = NULL;
+}
+
+/* Called from the submit thread of queue, with queue->lock held.  Queries of
+ * other queues are handed to their owner instead of taking its lock, which
+ * could deadlock with the owner doing the same.
+ */
+void
+lvp_queue_destroy_query(struct lvp_queue *queue, struct lvp_query_pool *pool,
+                        uint32_t index)
+{
+   struct lvp_queue *owner = pool->owners[index];
+
+   if (owner == queue) {
+      queue->ctx->destroy_query(queue->ctx, pool->queries[index]);
+   } else {
+      simple_mtx_lock(&owner->destroys_lock);
+      util_dynarray_append(&owner->query_destroys, struct pipe_query *,
+                           pool->queries[index]);
+      simple_mtx_unlock(&owner->destroys_lock);
+   }
+
+   pool->queries[index] = NULL;
+   pool->owners[index] = NULL;
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
     VkDevice                                    _device,
     const VkQueryPoolCreateInfo*                pCreateInfo,
@@ -74,6 +113,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
    struct lvp_query_pool *pool;
    size_t pool_size = sizeof(*pool)
       + pCreateInfo->queryCount * query_size;
+   if (pipeq < PIPE_QUERY_TYPES)
+      pool_size += pCreateInfo->queryCount * sizeof(struct lvp_queue *);
 
    pool = vk_zalloc2(&device->vk.alloc, pAllocator,
                     pool_size, 8,
@@ -88,6 +129,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
    pool->base_type = pipeq;
    pool->pipeline_stats = pCreateInfo->pipelineStatistics;
    pool->data = &pool->queries;
+   if (pipeq < PIPE_QUERY_TYPES)
+      pool->owners = (struct lvp_queue **)(pool->queries + pool->count);
 
    *pQueryPool = lvp_query_pool_to_handle(pool);
    return VK_SUCCESS;
@@ -107,7 +150,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyQueryPool(
    if (pool->base_type < PIPE_QUERY_TYPES) {
       for (unsigned i = 0; i < pool->count; i++)
          if (pool->queries[i])
-            device->queue.ctx->destroy_query(device->queue.ctx, pool->queries[i]);
+            destroy_query(pool, i);
    }
    vk_object_base_finish(&pool->base);
    vk_free2(&device->vk.alloc, pAllocator, pool);
@@ -148,10 +191,14 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_GetQueryPoolResults(
       }
 
       if (pool->queries[i]) {
-         ready = device->queue.ctx->get_query_result(device->queue.ctx,
-                                                     pool->queries[i],
-                                                     (flags & VK_QUERY_RESULT_WAIT_BIT),
-                                                     &result);
+         struct lvp_queue *owner = pool->owners[i];
+
+         simple_mtx_lock(&owner->lock);
+         ready = owner->ctx->get_query_result(owner->ctx,
+                                              pool->queries[i],
+                                              (flags & VK_QUERY_RESULT_WAIT_BIT),
+                                              &result);
+         simple_mtx_unlock(&owner->lock);
       } else {
          result.u64 = 0;
       }
@@ -224,7 +271,6 @@ VKAPI_ATTR void VKAPI_CALL lvp_ResetQueryPool(
    uint32_t                                    firstQuery,
    uint32_t                                    queryCount)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
    LVP_FROM_HANDLE(lvp_query_pool, pool, queryPool);
 
    if (pool->base_type >= PIPE_QUERY_TYPES)
@@ -233,9 +279,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_ResetQueryPool(
    for (uint32_t i = 0; i < queryCount; i++) {
       uint32_t idx = i + firstQuery;
 
-      if (pool->queries[idx]) {
-         device->queue.ctx->destroy_query(device->queue.ctx, pool->queries[idx]);
-         pool->queries[idx] = NULL;
-      }
+      if (pool->queries[idx])
+         destroy_query(pool, idx);
    }
 }
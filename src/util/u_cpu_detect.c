@@ -480,34 +480,62 @@ get_cpu_topology(void)
    memset(util_cpu_caps.cpu_to_L3, 0xff, sizeof(util_cpu_caps.cpu_to_L3));
 
 #if DETECT_OS_LINUX
-   uint64_t big_cap = 0;
+   /* Clusters are told apart by cpu_capacity, or by the maximum frequency
+    * on kernels that don't expose capacities or report them all equal.
+    * When every CPU looks the same there are no big cores, and
+    * nr_big_cpus stays 0.
+    */
+   static const char *const cap_files[] = {
+      "cpu_capacity",
+      "cpufreq/cpuinfo_max_freq",
+   };
+   uint64_t big_cap = 0, min_cap = 0;
    unsigned num_big_cpus = 0;
    uint64_t *caps = malloc(sizeof(uint64_t) * util_cpu_caps.max_cpus);
-   bool fail = false;
-   for (unsigned i = 0; caps && i < util_cpu_caps.max_cpus; i++) {
-      char name[PATH_MAX];
-      snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%u/cpu_capacity", i);
-      size_t size = 0;
-      char *cap = os_read_file(name, &size);
-      if (!cap) {
-         num_big_cpus = 0;
-         fail = true;
-         break;
+   bool fail = true;
+   for (unsigned f = 0; caps && fail && f < ARRAY_SIZE(cap_files); f++) {
+      fail = false;
+      big_cap = 0;
+      min_cap = UINT64_MAX;
+      for (unsigned i = 0; i < util_cpu_caps.max_cpus; i++) {
+         char name[PATH_MAX];
+         snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%u/%s",
+                  i, cap_files[f]);
+         size_t size = 0;
+         char *cap = os_read_file(name, &size);
+         if (!cap) {
+            fail = true;
+            break;
+         }
+         errno = 0;
+         caps[i] = strtoull(cap, NULL, 10);
+         free(cap);
+         if (errno) {
+            fail = true;
+            break;
+         }
+         big_cap = MAX2(caps[i], big_cap);
+         min_cap = MIN2(caps[i], min_cap);
       }
-      errno = 0;
-      caps[i] = strtoull(cap, NULL, 10);
-      free(cap);
-      if (errno) {
+      if (!fail && min_cap == big_cap)
          fail = true;
-         break;
-      }
-      big_cap = MAX2(caps[i], big_cap);
    }
-   if (!fail) {
-      for (unsigned i = 0; caps && i < util_cpu_caps.max_cpus; i++) {
-         if (caps[i] >= big_cap / 2)
+   if (caps && !fail) {
+      uint64_t little_cap = 0;
+
+      for (unsigned i = 0; i < util_cpu_caps.max_cpus; i++) {
+         if (caps[i] >= big_cap / 2) {
             num_big_cpus++;
+            if (i < UTIL_MAX_CPUS)
+               util_cpu_caps.big_cpu_mask[i / 32] |= 1u << (i % 32);
+         } else {
+            little_cap = MAX2(caps[i], little_cap);
+         }
       }
+
+      /* Capacities are scaled so the biggest CPU is 1024. */
+      if (little_cap && big_cap)
+         util_cpu_caps.little_cpu_capacity = little_cap * 1024 / big_cap;
    }
    free(caps);
    util_cpu_caps.nr_big_cpus = num_big_cpus;
@@ -630,6 +658,161 @@ get_cpu_topology(void)
 #endif
 }
 
+
+#if DETECT_OS_LINUX
+/**
+ * Parse a sysfs list such as "0-15,32-47" into a mask.  Returns the number
+ * of bits set.
+ */
+static unsigned
+parse_cpu_list(const char *list, util_affinity_mask mask)
+{
+   unsigned count = 0;
+
+   memset(mask, 0, sizeof(util_affinity_mask));
+
+   while (*list && *list != '\n') {
+      char *end;
+      unsigned first = strtoul(list, &end, 10);
+      unsigned last = first;
+
+      if (end == list)
+         break;
+      if (*end == '-')
+         last = strtoul(end + 1, &end, 10);
+
+      for (unsigned i = first; i <= last && i < UTIL_MAX_CPUS; i++) {
+         mask[i / 32] |= 1u << (i % 32);
+         count++;
+      }
+
+      list = *end == ',' ? end + 1 : end;
+   }
+
+   return count;
+}
+#endif
+
+
+static void
+get_numa_topology(void)
+{
+   /* Default. Everything is local. */
+   util_cpu_caps.num_numa_nodes = 1;
+
+#if DETECT_OS_LINUX
+   util_affinity_mask online, cpus;
+   util_affinity_mask *masks = NULL;
+   unsigned num_nodes = 0;
+   char *list;
+
+   list = os_read_file("/sys/devices/system/node/online", NULL);
+   if (!list)
+      return;
+   parse_cpu_list(list, online);
+   free(list);
+
+   for (unsigned n = 0; n < UTIL_MAX_CPUS; n++) {
+      char name[PATH_MAX];
+
+      if (!(online[n / 32] & (1u << (n % 32))))
+         continue;
+
+      snprintf(name, sizeof(name), "/sys/devices/system/node/node%u/cpulist", n);
+      list = os_read_file(name, NULL);
+      if (!list)
+         continue;
+
+      /* Memory-only nodes have no CPUs to run on. */
+      if (parse_cpu_list(list, cpus)) {
+         util_affinity_mask *tmp = realloc(masks, sizeof(util_affinity_mask) * (num_nodes + 1));
+         if (!tmp) {
+            free(list);
+            free(masks);
+            return;
+         }
+         masks = tmp;
+         memcpy(masks[num_nodes++], cpus, sizeof(util_affinity_mask));
+      }
+      free(list);
+   }
+
+   if (num_nodes < 2) {
+      free(masks);
+      return;
+   }
+
+   util_cpu_caps.num_numa_nodes = num_nodes;
+   util_cpu_caps.numa_affinity_mask = masks;
+
+   if (debug_get_option_dump_cpu()) {
+      fprintf(stderr, "CPU <-> NUMA node mapping:\n");
+      for (unsigned i = 0; i < num_nodes; i++) {
+         fprintf(stderr, "  - node %u mask = ", i);
+         for (int j = util_cpu_caps.max_cpus - 1; j >= 0; j -= 32)
+            fprintf(stderr, "%08x ", masks[i][j / 32]);
+         fprintf(stderr, "\n");
+      }
+   }
+#endif
+}
+
+
+static void
+get_cpu_cache_sizes(void)
+{
+#if DETECT_OS_LINUX
+   unsigned cpu = 0;
+
+   /* Little CPUs tend to have smaller caches, and aren't where the heavy
+    * lifting happens.
+    */
+   if (util_cpu_caps.nr_big_cpus) {
+      while (cpu < UTIL_MAX_CPUS - 1 &&
+             !(util_cpu_caps.big_cpu_mask[cpu / 32] & (1u << (cpu % 32))))
+         cpu++;
+   }
+
+   for (unsigned i = 0; ; i++) {
+      char name[PATH_MAX];
+      char *level, *type, *size;
+      unsigned bytes;
+
+      snprintf(name, sizeof(name),
+               "/sys/devices/system/cpu/cpu%u/cache/index%u/level", cpu, i);
+      level = os_read_file(name, NULL);
+      if (!level)
+         break;
+
+      snprintf(name, sizeof(name),
+               "/sys/devices/system/cpu/cpu%u/cache/index%u/type", cpu, i);
+      type = os_read_file(name, NULL);
+      snprintf(name, sizeof(name),
+               "/sys/devices/system/cpu/cpu%u/cache/index%u/size", cpu, i);
+      size = os_read_file(name, NULL);
+
+      if (type && size && strncmp(type, "Instruction", 11) != 0) {
+         char *end;
+
+         bytes = strtoul(size, &end, 10);
+         if (*end == 'K')
+            bytes *= 1024;
+         else if (*end == 'M')
+            bytes *= 1024 * 1024;
+
+         if (atoi(level) == 1)
+            util_cpu_caps.L1d_cache_size = bytes;
+         else if (atoi(level) == 2)
+            util_cpu_caps.L2_cache_size = bytes;
+      }
+
+      free(level);
+      free(type);
+      free(size);
+   }
+#endif
+}
+
 static
 void check_cpu_caps_override(void)
 {
@@ -927,6 +1110,7 @@ _util_cpu_detect_once(void)
          cacheline = regs2[2] & 0xFF;
          if (cacheline > 0)
             util_cpu_caps.cacheline = cacheline;
+         util_cpu_caps.L2_cache_size = (regs2[2] >> 16) * 1024;
       }
    }
 #endif /* DETECT_ARCH_X86 || DETECT_ARCH_X86_64 */
@@ -953,12 +1137,16 @@ _util_cpu_detect_once(void)
    check_max_vector_bits();
 
    get_cpu_topology();
+   get_numa_topology();
+   get_cpu_cache_sizes();
 
    if (debug_get_option_dump_cpu()) {
       printf("util_cpu_caps.nr_cpus = %u\n", util_cpu_caps.nr_cpus);
 
       printf("util_cpu_caps.x86_cpu_type = %u\n", util_cpu_caps.x86_cpu_type);
       printf("util_cpu_caps.cacheline = %u\n", util_cpu_caps.cacheline);
+      printf("util_cpu_caps.L1d_cache_size = %u\n", util_cpu_caps.L1d_cache_size);
+      printf("util_cpu_caps.L2_cache_size = %u\n", util_cpu_caps.L2_cache_size);
 
       printf("util_cpu_caps.has_mmx = %u\n", util_cpu_caps.has_mmx);
       printf("util_cpu_caps.has_mmx2 = %u\n", util_cpu_caps.has_mmx2);
@@ -991,6 +1179,7 @@ _util_cpu_detect_once(void)
       printf("util_cpu_caps.has_avx512vbmi = %u\n", util_cpu_caps.has_avx512vbmi);
       printf("util_cpu_caps.has_clflushopt = %u\n", util_cpu_caps.has_clflushopt);
       printf("util_cpu_caps.num_L3_caches = %u\n", util_cpu_caps.num_L3_caches);
+      printf("util_cpu_caps.num_numa_nodes = %u\n", util_cpu_caps.num_numa_nodes);
       printf("util_cpu_caps.num_cpu_mask_bits = %u\n", util_cpu_caps.num_cpu_mask_bits);
    }
    _util_cpu_caps_state.caps = util_cpu_caps;
@@ -126,10 +126,23 @@ struct util_cpu_caps_t {
    unsigned num_cpu_mask_bits;
    unsigned max_vector_bits;
 
+   /* Sizes in bytes of the L1 data and L2 caches of a big CPU, zero if
+    * unknown.
+    */
+   unsigned L1d_cache_size;
+   unsigned L2_cache_size;
+
    uint16_t cpu_to_L3[UTIL_MAX_CPUS];
 
    /* Affinity masks for each L3 cache. */
    util_affinity_mask *L3_affinity_mask;
+
+   /* NUMA nodes with CPUs, and the CPUs of each one.  There is always at
+    * least one node, but numa_affinity_mask is NULL unless there are more.
+    */
+   unsigned num_numa_nodes;
+   util_affinity_mask *numa_affinity_mask;
+
    /**
     * number of "big" CPUs in big.LITTLE configuration
     * 
@@ -140,6 +153,15 @@ struct util_cpu_caps_t {
     * A value of zero indicates that CPUs are homogeneous.
     */
    int16_t nr_big_cpus;
+
+   /* CPUs counted in nr_big_cpus.  Everything else is a little CPU. */
+   util_affinity_mask big_cpu_mask;
+
+   /**
+    * Capacity of the fastest little CPU, on a scale where the biggest CPU
+    * is 1024, or zero if CPUs are homogeneous.
+    */
+   unsigned little_cpu_capacity;
 };
 
 struct _util_cpu_caps_state_t {
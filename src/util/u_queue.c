@@ -273,6 +273,11 @@ util_queue_thread_func(void *input)
    }
 #endif
 
+   if (queue->flags & UTIL_QUEUE_INIT_LATENCY_CRITICAL)
+      util_thread_apply_placement(UTIL_THREAD_ROLE_LATENCY);
+   else if (queue->flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY)
+      util_thread_apply_placement(UTIL_THREAD_ROLE_BULK);
+
    if (strlen(queue->name) > 0) {
       char name[16];
       snprintf(name, sizeof(name), "%s%i", queue->name, thread_index);
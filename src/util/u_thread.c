@@ -6,6 +6,8 @@
  */
 
 #include "util/u_thread.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 
 #include "macros.h"
 
@@ -20,8 +22,10 @@
 #include <OS.h>
 #endif
 
-#if DETECT_OS_LINUX && !DETECT_OS_ANDROID
+#if DETECT_OS_LINUX
 #include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #elif defined(_WIN32) && !defined(HAVE_PTHREAD)
 #include <windows.h>
 #endif
@@ -151,6 +155,143 @@ util_set_thread_affinity(thrd_t thread,
 #endif
 }
 
+enum util_thread_placement {
+   UTIL_THREAD_PLACEMENT_NONE,
+   UTIL_THREAD_PLACEMENT_PIN,
+   UTIL_THREAD_PLACEMENT_PREFER,
+};
+
+static const struct debug_named_value placement_options[] = {
+   { "pin", UTIL_THREAD_PLACEMENT_PIN, "Pin threads to big or little CPUs" },
+   { "prefer", UTIL_THREAD_PLACEMENT_PREFER, "Bias the scheduler with utilization clamps" },
+   DEBUG_NAMED_VALUE_END
+};
+
+DEBUG_GET_ONCE_FLAGS_OPTION(thread_placement, "MESA_THREAD_PLACEMENT",
+                            placement_options, 0)
+
+#if DETECT_OS_LINUX
+/* Not in every libc's headers yet. */
+struct util_sched_attr {
+   uint32_t size;
+   uint32_t sched_policy;
+   uint64_t sched_flags;
+   int32_t sched_nice;
+   uint32_t sched_priority;
+   uint64_t sched_runtime;
+   uint64_t sched_deadline;
+   uint64_t sched_period;
+   uint32_t sched_util_min;
+   uint32_t sched_util_max;
+};
+
+#define UTIL_SCHED_FLAG_KEEP_ALL        0x18
+#define UTIL_SCHED_FLAG_UTIL_CLAMP_MIN  0x20
+#define UTIL_SCHED_FLAG_UTIL_CLAMP_MAX  0x40
+
+static void
+util_thread_pin(const struct util_cpu_caps_t *caps, bool big)
+{
+   cpu_set_t cpuset;
+   unsigned count = 0;
+
+   CPU_ZERO(&cpuset);
+   for (unsigned i = 0; i < caps->max_cpus && i < CPU_SETSIZE &&
+                        i < UTIL_MAX_CPUS; i++) {
+      bool is_big = caps->big_cpu_mask[i / 32] & (1u << (i % 32));
+      if (is_big == big) {
+         CPU_SET(i, &cpuset);
+         count++;
+      }
+   }
+
+   if (count)
+      sched_setaffinity(0, sizeof(cpuset), &cpuset);
+}
+
+static void
+util_thread_prefer(const struct util_cpu_caps_t *caps, bool big)
+{
+   /* A minimum above what little CPUs can deliver moves the thread to a
+    * big CPU whenever it runs, a maximum at their capacity keeps it off.
+    */
+   struct util_sched_attr attr = {
+      .size = sizeof(attr),
+      .sched_flags = UTIL_SCHED_FLAG_KEEP_ALL |
+                     (big ? UTIL_SCHED_FLAG_UTIL_CLAMP_MIN :
+                            UTIL_SCHED_FLAG_UTIL_CLAMP_MAX),
+      .sched_util_min = MIN2(caps->little_cpu_capacity + 1, 1024),
+      .sched_util_max = caps->little_cpu_capacity,
+   };
+
+   /* Kernels without uclamp just refuse this. */
+#ifdef SYS_sched_setattr
+   syscall(SYS_sched_setattr, 0, &attr, 0);
+#else
+   (void)attr;
+#endif
+}
+#endif
+
+void
+util_thread_apply_placement(enum util_thread_role role)
+{
+#if DETECT_OS_LINUX
+   const struct util_cpu_caps_t *caps;
+   uint64_t placement = debug_get_option_thread_placement();
+   bool big = role == UTIL_THREAD_ROLE_LATENCY;
+
+   if (placement == UTIL_THREAD_PLACEMENT_NONE)
+      return;
+
+   caps = util_get_cpu_caps();
+   if (!caps->little_cpu_capacity)
+      return;
+
+   if (placement & UTIL_THREAD_PLACEMENT_PIN)
+      util_thread_pin(caps, big);
+   else
+      util_thread_prefer(caps, big);
+#else
+   (void)role;
+#endif
+}
+
+bool
+util_thread_bind_numa_node(unsigned node)
+{
+#if DETECT_OS_LINUX
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   cpu_set_t cpuset;
+   unsigned count = 0;
+
+   if (node >= caps->num_numa_nodes || !caps->numa_affinity_mask)
+      return false;
+
+   /* Keep whatever taskset or cpuset restrictions we were started with. */
+   if (sched_getaffinity(0, sizeof(cpuset), &cpuset))
+      return false;
+
+   for (unsigned i = 0; i < CPU_SETSIZE; i++) {
+      if (!CPU_ISSET(i, &cpuset))
+         continue;
+      if (i < UTIL_MAX_CPUS &&
+          (caps->numa_affinity_mask[node][i / 32] & (1u << (i % 32))))
+         count++;
+      else
+         CPU_CLR(i, &cpuset);
+   }
+
+   if (!count)
+      return false;
+
+   return sched_setaffinity(0, sizeof(cpuset), &cpuset) == 0;
+#else
+   (void)node;
+   return false;
+#endif
+}
+
 int64_t
 util_thread_get_time_nano(thrd_t thread)
 {
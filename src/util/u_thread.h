@@ -92,6 +92,36 @@ util_set_current_thread_affinity(const uint32_t *mask,
                                    num_mask_bits);
 }
 
+/**
+ * What a thread's latency means for the frame, for placing it on
+ * big.LITTLE systems.
+ */
+enum util_thread_role {
+   /* Submit, present and recording threads the frame waits on. */
+   UTIL_THREAD_ROLE_LATENCY,
+   /* Cache writes, compiles and other work nobody waits on. */
+   UTIL_THREAD_ROLE_BULK,
+};
+
+/**
+ * Place the current thread according to MESA_THREAD_PLACEMENT.
+ *
+ * "pin" restricts latency threads to the big CPUs and bulk threads to the
+ * little ones, "prefer" only sets utilization clamps so the scheduler
+ * leans the same way.  Does nothing by default or on homogeneous CPUs.
+ */
+void
+util_thread_apply_placement(enum util_thread_role role);
+
+/**
+ * Restrict the current thread to those of its allowed CPUs that belong to
+ * NUMA node \p node (see util_cpu_caps_t::num_numa_nodes).  Returns false,
+ * leaving the affinity alone, if that would leave no CPU or the node is
+ * unknown.
+ */
+bool
+util_thread_bind_numa_node(unsigned node);
+
 /*
  * Thread statistics.
  */
@@ -253,6 +253,10 @@ vk_command_pool_trim(struct vk_command_pool *pool,
       cmd_buffer->ops->destroy(cmd_buffer);
    }
    assert(list_is_empty(&pool->free_command_buffers));
+
+   list_for_each_entry(struct vk_command_buffer, cmd_buffer,
+                       &pool->command_buffers, pool_link)
+      vk_cmd_queue_trim(&cmd_buffer->cmd_queue);
 }
 
 VKAPI_ATTR void VKAPI_CALL
@@ -76,7 +76,10 @@ TEMPLATE_H = Template(COPYRIGHT + """\
 
 #pragma once
 
+#include <string.h>
+
 #include "util/list.h"
+#include "util/macros.h"
 
 #define VK_PROTOTYPES
 #include <vulkan/vulkan_core.h>
@@ -89,10 +92,30 @@ extern "C" {
 #endif
 
 struct vk_device_dispatch_table;
+struct vk_cmd_queue_chunk;
+
+/* Recorded commands, and the arrays and structs they point to, are carved
+ * out of chunks of VK_CMD_QUEUE_CHUNK_SIZE bytes instead of being
+ * allocated one by one.  Nothing is freed per command: resetting the queue
+ * rewinds to its first chunk, which is kept for the next recording, and
+ * frees the others.  vk_cmd_queue_trim() also gives back the kept chunk.
+ * Allocations too large to share a chunk get one of their own, which is
+ * freed on reset.
+ */
+#define VK_CMD_QUEUE_CHUNK_SIZE (16 * 1024)
 
 struct vk_cmd_queue {
    const VkAllocationCallbacks *alloc;
    struct list_head cmds;
+
+   /* Chunks in the order they are filled, and the one being filled */
+   struct list_head chunks;
+   struct vk_cmd_queue_chunk *chunk;
+   uint8_t *cursor;
+   uint8_t *end;
+
+   /* Dedicated chunks for large allocations */
+   struct list_head large_chunks;
 };
 
 enum vk_cmd_type {
@@ -179,6 +202,29 @@ struct vk_cmd_queue_entry {
 
 % endfor
 
+void *vk_cmd_queue_alloc_chunk(struct vk_cmd_queue *queue, size_t size);
+
+/* Returns zeroed memory, aligned to 8 bytes, that stays valid until the
+ * queue is reset.  Returns NULL if a new chunk could not be allocated.
+ */
+static inline void *
+vk_cmd_queue_zalloc(struct vk_cmd_queue *queue, size_t size)
+{
+   void *ptr;
+
+   size = ALIGN_POT(MAX2(size, 1), 8);
+   if (likely(size <= (size_t)(queue->end - queue->cursor))) {
+      ptr = queue->cursor;
+      queue->cursor += size;
+   } else {
+      ptr = vk_cmd_queue_alloc_chunk(queue, size);
+      if (unlikely(!ptr))
+         return NULL;
+   }
+
+   return memset(ptr, 0, size);
+}
+
 void vk_free_queue(struct vk_cmd_queue *queue);
 
 static inline void
@@ -186,21 +232,21 @@ vk_cmd_queue_init(struct vk_cmd_queue *queue, VkAllocationCallbacks *alloc)
 {
    queue->alloc = alloc;
    list_inithead(&queue->cmds);
+   list_inithead(&queue->chunks);
+   list_inithead(&queue->large_chunks);
+   queue->chunk = NULL;
+   queue->cursor = NULL;
+   queue->end = NULL;
 }
 
-static inline void
-vk_cmd_queue_reset(struct vk_cmd_queue *queue)
-{
-   vk_free_queue(queue);
-   list_inithead(&queue->cmds);
-}
+void vk_cmd_queue_reset(struct vk_cmd_queue *queue);
 
-static inline void
-vk_cmd_queue_finish(struct vk_cmd_queue *queue)
-{
-   vk_free_queue(queue);
-   list_inithead(&queue->cmds);
-}
+/* Frees the chunks that hold no commands.  Commands recorded so far stay
+ * valid, so this can be called on a command buffer in any state.
+ */
+void vk_cmd_queue_trim(struct vk_cmd_queue *queue);
+
+void vk_cmd_queue_finish(struct vk_cmd_queue *queue);
 
 void vk_cmd_queue_execute(struct vk_cmd_queue *queue,
                           VkCommandBuffer commandBuffer,
@@ -255,29 +301,68 @@ size_t vk_cmd_queue_type_sizes[] = {
 % endfor
 };
 
-% for c in commands:
-% if c.guard is not None:
-#ifdef ${c.guard}
-% endif
+struct vk_cmd_queue_chunk {
+   struct list_head link;
+   uint8_t data[];
+};
+
+/* Frees the chunks after \p last, or all of them if \p last is NULL. */
 static void
-vk_free_${to_underscore(c.name)}(struct vk_cmd_queue *queue,
-${' ' * len('vk_free_' + to_underscore(c.name) + '(')}\\
-struct vk_cmd_queue_entry *cmd)
+vk_cmd_queue_free_chunks_after(struct vk_cmd_queue *queue,
+                               struct vk_cmd_queue_chunk *last)
 {
-   if (cmd->driver_free_cb)
-      cmd->driver_free_cb(queue, cmd);
-   else
-      vk_free(queue->alloc, cmd->driver_data);
-% for p in c.params[1:]:
-% if p.len:
-   vk_free(queue->alloc, (${remove_suffix(p.decl.replace("const", ""), p.name)})cmd->u.${to_struct_field_name(c.name)}.${to_field_name(p.name)});
-% elif '*' in p.decl:
-   ${get_struct_free(c, p, types)}
-% endif
-% endfor
-   vk_free(queue->alloc, cmd);
+   struct list_head *head = last ? &last->link : &queue->chunks;
+
+   while (head->next != &queue->chunks) {
+      struct vk_cmd_queue_chunk *chunk =
+         list_entry(head->next, struct vk_cmd_queue_chunk, link);
+
+      list_del(&chunk->link);
+      vk_free(queue->alloc, chunk);
+   }
+}
+
+/* Slow path of vk_cmd_queue_zalloc(): moves on to the next chunk, reusing
+ * the ones kept from before the last reset first.
+ */
+void *
+vk_cmd_queue_alloc_chunk(struct vk_cmd_queue *queue, size_t size)
+{
+   struct vk_cmd_queue_chunk *chunk;
+
+   if (size > VK_CMD_QUEUE_CHUNK_SIZE / 4) {
+      chunk = vk_alloc(queue->alloc, sizeof(*chunk) + size, 8,
+                       VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (!chunk)
+         return NULL;
+
+      list_addtail(&chunk->link, &queue->large_chunks);
+      return chunk->data;
+   }
+
+   struct list_head *next =
+      queue->chunk ? queue->chunk->link.next : queue->chunks.next;
+   if (next != &queue->chunks) {
+      chunk = list_entry(next, struct vk_cmd_queue_chunk, link);
+   } else {
+      chunk = vk_alloc(queue->alloc, sizeof(*chunk) + VK_CMD_QUEUE_CHUNK_SIZE,
+                       8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (!chunk)
+         return NULL;
+
+      list_addtail(&chunk->link, &queue->chunks);
+   }
+
+   queue->chunk = chunk;
+   queue->cursor = chunk->data + size;
+   queue->end = chunk->data + VK_CMD_QUEUE_CHUNK_SIZE;
+   return chunk->data;
 }
 
+% for c in commands:
+% if c.guard is not None:
+#ifdef ${c.guard}
+% endif
 % if c.name not in manual_commands and c.name not in no_enqueue_commands:
 VkResult vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 % for p in c.params[1:]:
@@ -285,8 +370,8 @@ VkResult vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 % endfor
 )
 {
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(queue->alloc, vk_cmd_queue_type_sizes[${to_enum_name(c.name)}], 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   struct vk_cmd_queue_entry *cmd =
+      vk_cmd_queue_zalloc(queue, vk_cmd_queue_type_sizes[${to_enum_name(c.name)}]);
    if (!cmd) return VK_ERROR_OUT_OF_HOST_MEMORY;
 
    cmd->type = ${to_enum_name(c.name)};
@@ -316,8 +401,7 @@ VkResult vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 
 % if need_error_handling:
 err:
-   if (cmd)
-      vk_free_${to_underscore(c.name)}(queue, cmd);
+   /* What was copied so far goes away with the chunk on reset. */
    return VK_ERROR_OUT_OF_HOST_MEMORY;
 % endif
 }
@@ -328,25 +412,56 @@ err:
 
 % endfor
 
+/* The commands themselves live in the chunks, so only what drivers hung
+ * off them has to be released.
+ */
 void
 vk_free_queue(struct vk_cmd_queue *queue)
 {
-   struct vk_cmd_queue_entry *tmp, *cmd;
-   LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &queue->cmds, cmd_link) {
-      switch(cmd->type) {
-% for c in commands:
-% if c.guard is not None:
-#ifdef ${c.guard}
-% endif
-      case ${to_enum_name(c.name)}:
-         vk_free_${to_underscore(c.name)}(queue, cmd);
-         break;
-% if c.guard is not None:
-#endif // ${c.guard}
-% endif
-% endfor
-      }
+   list_for_each_entry(struct vk_cmd_queue_entry, cmd, &queue->cmds, cmd_link) {
+      if (cmd->driver_free_cb)
+         cmd->driver_free_cb(queue, cmd);
+      else if (cmd->driver_data)
+         vk_free(queue->alloc, cmd->driver_data);
+   }
+}
+
+void
+vk_cmd_queue_reset(struct vk_cmd_queue *queue)
+{
+   vk_free_queue(queue);
+   list_inithead(&queue->cmds);
+
+   list_for_each_entry_safe(struct vk_cmd_queue_chunk, chunk,
+                            &queue->large_chunks, link)
+      vk_free(queue->alloc, chunk);
+   list_inithead(&queue->large_chunks);
+
+   /* One chunk is all most command buffers need, keep it for the next
+    * recording and let the ones only a long recording needed go.
+    */
+   if (!list_is_empty(&queue->chunks)) {
+      vk_cmd_queue_free_chunks_after(queue,
+         list_first_entry(&queue->chunks, struct vk_cmd_queue_chunk, link));
    }
+
+   queue->chunk = NULL;
+   queue->cursor = NULL;
+   queue->end = NULL;
+}
+
+void
+vk_cmd_queue_trim(struct vk_cmd_queue *queue)
+{
+   /* Everything up to the chunk being filled holds commands. */
+   vk_cmd_queue_free_chunks_after(queue, queue->chunk);
+}
+
+void
+vk_cmd_queue_finish(struct vk_cmd_queue *queue)
+{
+   vk_cmd_queue_reset(queue);
+   vk_cmd_queue_free_chunks_after(queue, NULL);
 }
 
 void
@@ -470,7 +585,7 @@ def get_array_copy(command, param):
         field_size = "1"
     else:
         field_size = "sizeof(*%s)" % field_name
-    allocation = "%s = vk_zalloc(queue->alloc, %s * (%s), 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);\n   if (%s == NULL) goto err;\n" % (field_name, field_size, param.len, field_name)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s * (%s));\n   if (%s == NULL) goto err;\n" % (field_name, field_size, param.len, field_name)
     copy = "memcpy((void*)%s, %s, %s * (%s));" % (field_name, param.name, field_size, param.len)
     return "%s\n   %s" % (allocation, copy)
 
@@ -480,7 +595,7 @@ def get_array_member_copy(struct, src_name, member):
         field_size = "sizeof(*%s)" % (field_name)
     else:
         field_size = "sizeof(*%s) * %s->%s" % (field_name, struct, member.len)
-    allocation = "%s = vk_zalloc(queue->alloc, %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);\n   if (%s == NULL) goto err;\n" % (field_name, field_size, field_name)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s);\n   if (%s == NULL) goto err;\n" % (field_name, field_size, field_name)
     copy = "memcpy((void*)%s, %s->%s, %s);" % (field_name, src_name, member.name, field_size)
     return "if (%s->%s) {\n   %s\n   %s\n}\n" % (src_name, member.name, allocation, copy)
 
@@ -516,7 +631,7 @@ def get_struct_copy(dst, src_name, src_type, size, types, level=0):
     global tmp_dst_idx
     global tmp_src_idx
 
-    allocation = "%s = vk_zalloc(queue->alloc, %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);\n      if (%s == NULL) goto err;\n" % (dst, size, dst)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s);\n      if (%s == NULL) goto err;\n" % (dst, size, dst)
     copy = "memcpy((void*)%s, %s, %s);" % (dst, src_name, size)
 
     level += 1
@@ -536,19 +651,6 @@ def get_struct_copy(dst, src_name, src_type, size, types, level=0):
     indent = "   " * level
     return "%s\n      %s\n      %s\n      %s\n      %s\n      %s\n%s} else {\n      %s\n%s}" % (if_stmt, allocation, copy, tmp_dst, tmp_src, member_copies, indent, null_assignment, indent)
 
-def get_struct_free(command, param, types):
-    field_name = "cmd->u.%s.%s" % (to_struct_field_name(command.name), to_field_name(param.name))
-    const_cast = remove_suffix(param.decl.replace("const", ""), param.name)
-    struct_free = "vk_free(queue->alloc, (%s)%s);" % (const_cast, field_name)
-    member_frees = ""
-    if (param.type in types):
-        for member in types[param.type].members:
-            if member.len and member.len != 'null-terminated':
-                member_name = "cmd->u.%s.%s->%s" % (to_struct_field_name(command.name), to_field_name(param.name), member.name)
-                const_cast = remove_suffix(member.decl.replace("const", ""), member.name)
-                member_frees += "vk_free(queue->alloc, (%s)%s);\n" % (const_cast, member_name)
-    return "%s      %s\n" % (member_frees, struct_free)
-
 EntrypointType = namedtuple('EntrypointType', 'name enum members extended_by guard')
 
 def get_types_defines(doc):
@@ -666,7 +768,6 @@ def main():
         'to_struct_name': to_struct_name,
         'get_array_copy': get_array_copy,
         'get_struct_copy': get_struct_copy,
-        'get_struct_free': get_struct_free,
         'types': types,
         'manual_commands': MANUAL_COMMANDS,
         'no_enqueue_commands': NO_ENQUEUE_COMMANDS,
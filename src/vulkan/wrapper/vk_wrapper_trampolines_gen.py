@@ -34,6 +34,18 @@ from mako.template import Template
 # '{file_without_suffix}_depend_files'.
 from vk_entrypoints import get_entrypoints_from_xml
 
+# Queue entrypoints that hand work to the queue, and so have to be
+# serialized with the wrapper's own submissions.  Waits and labels are
+# left alone so that a long vkQueueWaitIdle() doesn't hold up a host
+# image copy.
+SUBMIT_ENTRYPOINTS = {
+    'QueueBindSparse',
+    'QueuePresentKHR',
+    'QueueSignalReleaseImageANDROID',
+    'QueueSubmit',
+    'QueueSubmit2',
+}
+
 TEMPLATE_H = Template(COPYRIGHT + """\
 /* This file generated from ${filename}, don't edit directly. */
 
@@ -127,6 +139,7 @@ ${e.prefixed_name('wrapper_tramp')}(${e.decl_params()})
     % endif
   % elif e.params[0].type == 'VkCommandBuffer':
     VK_FROM_HANDLE(wrapper_command_buffer, wcb, ${e.params[0].name});
+    wrapper_command_buffer_flush(wcb);
     % if e.return_type == 'void':
       % if len(e.params) > 1:
     wcb->device->dispatch_table.${e.name}(wcb->dispatch_handle, ${e.call_params(1)});
@@ -140,6 +153,18 @@ ${e.prefixed_name('wrapper_tramp')}(${e.decl_params()})
     return wcb->device->dispatch_table.${e.name}(wcb->dispatch_handle);
       % endif
     % endif
+  % elif e.params[0].type == 'VkQueue' and e.name in submit_entrypoints:
+    VK_FROM_HANDLE(wrapper_queue, wqueue, ${e.params[0].name});
+    /* The wrapper submits its own work to application queues too. */
+    simple_mtx_lock(&wqueue->submit_mutex);
+    % if e.return_type == 'void':
+    wqueue->device->dispatch_table.${e.name}(wqueue->dispatch_handle, ${e.call_params(1)});
+    simple_mtx_unlock(&wqueue->submit_mutex);
+    % else:
+    ${e.return_type} result = wqueue->device->dispatch_table.${e.name}(wqueue->dispatch_handle, ${e.call_params(1)});
+    simple_mtx_unlock(&wqueue->submit_mutex);
+    return result;
+    % endif
   % elif e.params[0].type == 'VkQueue':
     VK_FROM_HANDLE(wrapper_queue, wqueue, ${e.params[0].name});
     % if e.return_type == 'void':
@@ -204,6 +229,7 @@ def main():
         if args.out_c:
             with open(args.out_c, 'w', encoding='utf-8') as f:
                 f.write(TEMPLATE_C.render(entrypoints=entrypoints,
+                                          submit_entrypoints=SUBMIT_ENTRYPOINTS,
                                           filename=os.path.basename(__file__)))
     except Exception:
         # In the event there's an error, this imports some helpers from mako
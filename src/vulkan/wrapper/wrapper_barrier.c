@@ -0,0 +1,674 @@
+#include "wrapper_private.h"
+#include "vk_cmd_queue.h"
+#include "util/list.h"
+#include "util/log.h"
+#include "util/u_atomic.h"
+
+/* Barrier coalescing: enabled with WRAPPER_COALESCE_BARRIERS=1.
+ *
+ * Barriers are not forwarded right away but appended to the vk_cmd_queue
+ * of the wrapper command buffer, which the next non-barrier command
+ * replays before it reaches the driver (see
+ * wrapper_command_buffer_flush()).  A barrier that directly follows
+ * another one of the same kind is merged into the queued one instead:
+ * stage masks are unioned and the barrier arrays are concatenated.
+ *
+ * A merged barrier makes both halves wait on the same work, so it is only
+ * equivalent to the pair when the second one does not depend on the
+ * first: its source stages and accesses must not intersect the queued
+ * destination stages and accesses, and no image subresource or buffer
+ * range may appear in both.  Merging is also skipped for queue family
+ * ownership transfers, a layout transition next to a global memory
+ * barrier, differing dependency flags, and extension structs we would
+ * have to deep-copy.  A barrier that can't be merged is queued after the
+ * other one, which keeps their order.
+ */
+
+static inline bool
+wrapper_barriers_have_pnext(uint32_t count, const void *barriers, size_t size)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      const VkBaseInStructure *base =
+         (const void *)((const char *)barriers + i * size);
+      if (base->pNext)
+         return true;
+   }
+   return false;
+}
+
+/* Expands the stage bits that stand for a group of stages, so that two
+ * masks intersect whenever they name a common stage.  TOP_OF_PIPE as a
+ * destination and BOTTOM_OF_PIPE as a source mean all commands.
+ */
+static inline VkPipelineStageFlags2
+wrapper_barrier_expand_stages(VkPipelineStageFlags2 stages, bool src)
+{
+   if (stages & (src ? VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT :
+                       VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT))
+      return ~(VkPipelineStageFlags2)0;
+   if (stages & (VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT |
+                 VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT))
+      return ~(VkPipelineStageFlags2)0;
+
+   stages &= ~(VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT |
+               VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT);
+
+   if (stages & VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT)
+      stages |= VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+                VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT;
+   if (stages & VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT)
+      stages |= VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT |
+                VK_PIPELINE_STAGE_2_TESSELLATION_CONTROL_SHADER_BIT |
+                VK_PIPELINE_STAGE_2_TESSELLATION_EVALUATION_SHADER_BIT |
+                VK_PIPELINE_STAGE_2_GEOMETRY_SHADER_BIT |
+                VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT |
+                VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+   if (stages & VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT)
+      stages |= VK_PIPELINE_STAGE_2_COPY_BIT |
+                VK_PIPELINE_STAGE_2_BLIT_BIT |
+                VK_PIPELINE_STAGE_2_RESOLVE_BIT |
+                VK_PIPELINE_STAGE_2_CLEAR_BIT |
+                VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_COPY_BIT_KHR;
+
+   return stages;
+}
+
+/* Same for access bits.  MEMORY_READ and MEMORY_WRITE are not worth
+ * expanding precisely, so they intersect everything.
+ */
+static inline VkAccessFlags2
+wrapper_barrier_expand_access(VkAccessFlags2 access)
+{
+   if (access & (VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT))
+      return ~(VkAccessFlags2)0;
+
+   if (access & VK_ACCESS_2_SHADER_READ_BIT)
+      access |= VK_ACCESS_2_SHADER_SAMPLED_READ_BIT |
+                VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                VK_ACCESS_2_SHADER_BINDING_TABLE_READ_BIT_KHR;
+   if (access & VK_ACCESS_2_SHADER_WRITE_BIT)
+      access |= VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+   return access;
+}
+
+/* Whether a barrier with the given source scope has to wait for one with
+ * the given destination scope.
+ */
+static inline bool
+wrapper_barrier_depends(VkPipelineStageFlags2 dst_stages,
+                        VkAccessFlags2 dst_access,
+                        VkPipelineStageFlags2 src_stages,
+                        VkAccessFlags2 src_access)
+{
+   return (wrapper_barrier_expand_stages(dst_stages, false) &
+           wrapper_barrier_expand_stages(src_stages, true)) ||
+          (wrapper_barrier_expand_access(dst_access) &
+           wrapper_barrier_expand_access(src_access));
+}
+
+/* [a_start, a_start + a_count) and [b_start, b_start + b_count) overlap,
+ * where a count of whole runs to the end.
+ */
+static inline bool
+wrapper_barrier_ranges_overlap(uint64_t a_start, uint64_t a_count,
+                               uint64_t b_start, uint64_t b_count,
+                               uint64_t whole)
+{
+   uint64_t a_end = a_count == whole ? UINT64_MAX : a_start + a_count;
+   uint64_t b_end = b_count == whole ? UINT64_MAX : b_start + b_count;
+
+   return a_start < b_end && b_start < a_end;
+}
+
+static inline bool
+wrapper_barrier_images_overlap(VkImage a_image,
+                               const VkImageSubresourceRange *a,
+                               VkImage b_image,
+                               const VkImageSubresourceRange *b)
+{
+   return a_image == b_image &&
+          (a->aspectMask & b->aspectMask) &&
+          wrapper_barrier_ranges_overlap(a->baseMipLevel, a->levelCount,
+                                         b->baseMipLevel, b->levelCount,
+                                         VK_REMAINING_MIP_LEVELS) &&
+          wrapper_barrier_ranges_overlap(a->baseArrayLayer, a->layerCount,
+                                         b->baseArrayLayer, b->layerCount,
+                                         VK_REMAINING_ARRAY_LAYERS);
+}
+
+static inline bool
+wrapper_barrier_buffers_overlap(VkBuffer a_buffer, VkDeviceSize a_offset,
+                                VkDeviceSize a_size, VkBuffer b_buffer,
+                                VkDeviceSize b_offset, VkDeviceSize b_size)
+{
+   return a_buffer == b_buffer &&
+          wrapper_barrier_ranges_overlap(a_offset, a_size, b_offset, b_size,
+                                         VK_WHOLE_SIZE);
+}
+
+static inline bool
+wrapper_buffer_barriers_have_qfot(uint32_t count,
+                                  const VkBufferMemoryBarrier *barriers)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      if (barriers[i].srcQueueFamilyIndex != barriers[i].dstQueueFamilyIndex)
+         return true;
+   }
+   return false;
+}
+
+static inline bool
+wrapper_image_barriers_have_qfot(uint32_t count,
+                                 const VkImageMemoryBarrier *barriers)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      if (barriers[i].srcQueueFamilyIndex != barriers[i].dstQueueFamilyIndex)
+         return true;
+   }
+   return false;
+}
+
+static inline bool
+wrapper_image_barriers_have_transition(uint32_t count,
+                                       const VkImageMemoryBarrier *barriers)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      if (barriers[i].oldLayout != barriers[i].newLayout)
+         return true;
+   }
+   return false;
+}
+
+static inline bool
+wrapper_buffer_barriers2_have_qfot(uint32_t count,
+                                   const VkBufferMemoryBarrier2 *barriers)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      if (barriers[i].srcQueueFamilyIndex != barriers[i].dstQueueFamilyIndex)
+         return true;
+   }
+   return false;
+}
+
+static inline bool
+wrapper_image_barriers2_have_qfot(uint32_t count,
+                                  const VkImageMemoryBarrier2 *barriers)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      if (barriers[i].srcQueueFamilyIndex != barriers[i].dstQueueFamilyIndex)
+         return true;
+   }
+   return false;
+}
+
+static inline bool
+wrapper_image_barriers2_have_transition(uint32_t count,
+                                        const VkImageMemoryBarrier2 *barriers)
+{
+   for (uint32_t i = 0; i < count; i++) {
+      if (barriers[i].oldLayout != barriers[i].newLayout)
+         return true;
+   }
+   return false;
+}
+
+/* Grow *array so it can hold count + extra elements.  The contents and the
+ * count are left alone, so a failure part way leaves the entry valid.  The
+ * old array stays in the queue's chunks until the queue is reset.
+ */
+static bool
+wrapper_barrier_reserve(struct vk_cmd_queue *queue, void *array,
+                        uint32_t count, uint32_t extra, size_t size)
+{
+   void **data = array;
+   void *new_data;
+
+   if (!extra)
+      return true;
+
+   new_data = vk_cmd_queue_zalloc(queue, size * (count + extra));
+   if (!new_data)
+      return false;
+
+   if (count)
+      memcpy(new_data, *data, size * count);
+   *data = new_data;
+   return true;
+}
+
+static uint32_t
+wrapper_barrier_append(void *array, uint32_t count,
+                       const void *extra, uint32_t extra_count, size_t size)
+{
+   if (extra_count)
+      memcpy((char *)array + size * count, extra, size * extra_count);
+   return count + extra_count;
+}
+
+static struct vk_cmd_queue_entry *
+wrapper_barrier_tail(struct wrapper_command_buffer *wcb, enum vk_cmd_type type)
+{
+   struct list_head *cmds = &wcb->vk.cmd_queue.cmds;
+   struct vk_cmd_queue_entry *cmd;
+
+   if (list_is_empty(cmds))
+      return NULL;
+
+   cmd = list_last_entry(cmds, struct vk_cmd_queue_entry, cmd_link);
+   return cmd->type == type ? cmd : NULL;
+}
+
+/* Whether the incoming barrier depends on the queued one, see the top of
+ * the file.
+ */
+static bool
+wrapper_barrier_conflicts(const struct vk_cmd_pipeline_barrier *prev,
+                          VkPipelineStageFlags srcStageMask,
+                          uint32_t memoryBarrierCount,
+                          const VkMemoryBarrier* pMemoryBarriers,
+                          uint32_t bufferMemoryBarrierCount,
+                          const VkBufferMemoryBarrier* pBufferMemoryBarriers,
+                          uint32_t imageMemoryBarrierCount,
+                          const VkImageMemoryBarrier* pImageMemoryBarriers)
+{
+   VkAccessFlags dst_access = 0, src_access = 0;
+
+   for (uint32_t i = 0; i < prev->memory_barrier_count; i++)
+      dst_access |= prev->memory_barriers[i].dstAccessMask;
+   for (uint32_t i = 0; i < prev->buffer_memory_barrier_count; i++)
+      dst_access |= prev->buffer_memory_barriers[i].dstAccessMask;
+   for (uint32_t i = 0; i < prev->image_memory_barrier_count; i++)
+      dst_access |= prev->image_memory_barriers[i].dstAccessMask;
+
+   for (uint32_t i = 0; i < memoryBarrierCount; i++)
+      src_access |= pMemoryBarriers[i].srcAccessMask;
+   for (uint32_t i = 0; i < bufferMemoryBarrierCount; i++)
+      src_access |= pBufferMemoryBarriers[i].srcAccessMask;
+   for (uint32_t i = 0; i < imageMemoryBarrierCount; i++)
+      src_access |= pImageMemoryBarriers[i].srcAccessMask;
+
+   if (wrapper_barrier_depends(prev->dst_stage_mask, dst_access,
+                               srcStageMask, src_access))
+      return true;
+
+   for (uint32_t i = 0; i < prev->buffer_memory_barrier_count; i++) {
+      const VkBufferMemoryBarrier *a = &prev->buffer_memory_barriers[i];
+
+      for (uint32_t j = 0; j < bufferMemoryBarrierCount; j++) {
+         const VkBufferMemoryBarrier *b = &pBufferMemoryBarriers[j];
+
+         if (wrapper_barrier_buffers_overlap(a->buffer, a->offset, a->size,
+                                             b->buffer, b->offset, b->size))
+            return true;
+      }
+   }
+
+   for (uint32_t i = 0; i < prev->image_memory_barrier_count; i++) {
+      const VkImageMemoryBarrier *a = &prev->image_memory_barriers[i];
+
+      for (uint32_t j = 0; j < imageMemoryBarrierCount; j++) {
+         const VkImageMemoryBarrier *b = &pImageMemoryBarriers[j];
+
+         if (wrapper_barrier_images_overlap(a->image, &a->subresourceRange,
+                                            b->image, &b->subresourceRange))
+            return true;
+      }
+   }
+
+   return false;
+}
+
+static bool
+wrapper_barrier_merge(struct wrapper_command_buffer *wcb,
+                      VkPipelineStageFlags srcStageMask,
+                      VkPipelineStageFlags dstStageMask,
+                      VkDependencyFlags dependencyFlags,
+                      uint32_t memoryBarrierCount,
+                      const VkMemoryBarrier* pMemoryBarriers,
+                      uint32_t bufferMemoryBarrierCount,
+                      const VkBufferMemoryBarrier* pBufferMemoryBarriers,
+                      uint32_t imageMemoryBarrierCount,
+                      const VkImageMemoryBarrier* pImageMemoryBarriers)
+{
+   struct vk_cmd_queue *queue = &wcb->vk.cmd_queue;
+   struct vk_cmd_queue_entry *cmd;
+   struct vk_cmd_pipeline_barrier *prev;
+
+   cmd = wrapper_barrier_tail(wcb, VK_CMD_PIPELINE_BARRIER);
+   if (!cmd)
+      return false;
+
+   prev = &cmd->u.pipeline_barrier;
+   if (prev->dependency_flags != dependencyFlags)
+      return false;
+
+   if (wrapper_barrier_conflicts(prev, srcStageMask,
+                                 memoryBarrierCount, pMemoryBarriers,
+                                 bufferMemoryBarrierCount,
+                                 pBufferMemoryBarriers,
+                                 imageMemoryBarrierCount,
+                                 pImageMemoryBarriers))
+      return false;
+
+   if ((prev->memory_barrier_count &&
+        wrapper_image_barriers_have_transition(imageMemoryBarrierCount,
+                                               pImageMemoryBarriers)) ||
+       (memoryBarrierCount &&
+        wrapper_image_barriers_have_transition(prev->image_memory_barrier_count,
+                                               prev->image_memory_barriers)))
+      return false;
+
+   if (!wrapper_barrier_reserve(queue, &prev->memory_barriers,
+                                prev->memory_barrier_count,
+                                memoryBarrierCount,
+                                sizeof(*pMemoryBarriers)) ||
+       !wrapper_barrier_reserve(queue, &prev->buffer_memory_barriers,
+                                prev->buffer_memory_barrier_count,
+                                bufferMemoryBarrierCount,
+                                sizeof(*pBufferMemoryBarriers)) ||
+       !wrapper_barrier_reserve(queue, &prev->image_memory_barriers,
+                                prev->image_memory_barrier_count,
+                                imageMemoryBarrierCount,
+                                sizeof(*pImageMemoryBarriers)))
+      return false;
+
+   prev->src_stage_mask |= srcStageMask;
+   prev->dst_stage_mask |= dstStageMask;
+   prev->memory_barrier_count =
+      wrapper_barrier_append(prev->memory_barriers,
+                             prev->memory_barrier_count,
+                             pMemoryBarriers, memoryBarrierCount,
+                             sizeof(*pMemoryBarriers));
+   prev->buffer_memory_barrier_count =
+      wrapper_barrier_append(prev->buffer_memory_barriers,
+                             prev->buffer_memory_barrier_count,
+                             pBufferMemoryBarriers, bufferMemoryBarrierCount,
+                             sizeof(*pBufferMemoryBarriers));
+   prev->image_memory_barrier_count =
+      wrapper_barrier_append(prev->image_memory_barriers,
+                             prev->image_memory_barrier_count,
+                             pImageMemoryBarriers, imageMemoryBarrierCount,
+                             sizeof(*pImageMemoryBarriers));
+
+   return true;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_barrier_CmdPipelineBarrier(VkCommandBuffer commandBuffer,
+                                   VkPipelineStageFlags srcStageMask,
+                                   VkPipelineStageFlags dstStageMask,
+                                   VkDependencyFlags dependencyFlags,
+                                   uint32_t memoryBarrierCount,
+                                   const VkMemoryBarrier* pMemoryBarriers,
+                                   uint32_t bufferMemoryBarrierCount,
+                                   const VkBufferMemoryBarrier* pBufferMemoryBarriers,
+                                   uint32_t imageMemoryBarrierCount,
+                                   const VkImageMemoryBarrier* pImageMemoryBarriers)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->barriers_in++;
+
+   if (wrapper_barriers_have_pnext(memoryBarrierCount, pMemoryBarriers,
+                                   sizeof(*pMemoryBarriers)) ||
+       wrapper_barriers_have_pnext(bufferMemoryBarrierCount,
+                                   pBufferMemoryBarriers,
+                                   sizeof(*pBufferMemoryBarriers)) ||
+       wrapper_barriers_have_pnext(imageMemoryBarrierCount,
+                                   pImageMemoryBarriers,
+                                   sizeof(*pImageMemoryBarriers)) ||
+       wrapper_buffer_barriers_have_qfot(bufferMemoryBarrierCount,
+                                         pBufferMemoryBarriers) ||
+       wrapper_image_barriers_have_qfot(imageMemoryBarrierCount,
+                                        pImageMemoryBarriers))
+      goto forward;
+
+   if (wrapper_barrier_merge(wcb, srcStageMask, dstStageMask,
+                             dependencyFlags,
+                             memoryBarrierCount, pMemoryBarriers,
+                             bufferMemoryBarrierCount, pBufferMemoryBarriers,
+                             imageMemoryBarrierCount, pImageMemoryBarriers)) {
+      wcb->barriers_merged++;
+      return;
+   }
+
+   if (vk_enqueue_cmd_pipeline_barrier(&wcb->vk.cmd_queue,
+                                       srcStageMask, dstStageMask,
+                                       dependencyFlags,
+                                       memoryBarrierCount,
+                                       memoryBarrierCount ?
+                                          pMemoryBarriers : NULL,
+                                       bufferMemoryBarrierCount,
+                                       bufferMemoryBarrierCount ?
+                                          pBufferMemoryBarriers : NULL,
+                                       imageMemoryBarrierCount,
+                                       imageMemoryBarrierCount ?
+                                          pImageMemoryBarriers : NULL) ==
+       VK_SUCCESS)
+      return;
+
+forward:
+   wcb->device->cmd_dispatch.CmdPipelineBarrier(commandBuffer,
+                                                srcStageMask, dstStageMask,
+                                                dependencyFlags,
+                                                memoryBarrierCount,
+                                                pMemoryBarriers,
+                                                bufferMemoryBarrierCount,
+                                                pBufferMemoryBarriers,
+                                                imageMemoryBarrierCount,
+                                                pImageMemoryBarriers);
+}
+
+static bool
+wrapper_barrier_conflicts2(const VkDependencyInfo *prev,
+                           const VkDependencyInfo *info)
+{
+   VkPipelineStageFlags2 dst_stages = 0, src_stages = 0;
+   VkAccessFlags2 dst_access = 0, src_access = 0;
+
+   for (uint32_t i = 0; i < prev->memoryBarrierCount; i++) {
+      dst_stages |= prev->pMemoryBarriers[i].dstStageMask;
+      dst_access |= prev->pMemoryBarriers[i].dstAccessMask;
+   }
+   for (uint32_t i = 0; i < prev->bufferMemoryBarrierCount; i++) {
+      dst_stages |= prev->pBufferMemoryBarriers[i].dstStageMask;
+      dst_access |= prev->pBufferMemoryBarriers[i].dstAccessMask;
+   }
+   for (uint32_t i = 0; i < prev->imageMemoryBarrierCount; i++) {
+      dst_stages |= prev->pImageMemoryBarriers[i].dstStageMask;
+      dst_access |= prev->pImageMemoryBarriers[i].dstAccessMask;
+   }
+
+   for (uint32_t i = 0; i < info->memoryBarrierCount; i++) {
+      src_stages |= info->pMemoryBarriers[i].srcStageMask;
+      src_access |= info->pMemoryBarriers[i].srcAccessMask;
+   }
+   for (uint32_t i = 0; i < info->bufferMemoryBarrierCount; i++) {
+      src_stages |= info->pBufferMemoryBarriers[i].srcStageMask;
+      src_access |= info->pBufferMemoryBarriers[i].srcAccessMask;
+   }
+   for (uint32_t i = 0; i < info->imageMemoryBarrierCount; i++) {
+      src_stages |= info->pImageMemoryBarriers[i].srcStageMask;
+      src_access |= info->pImageMemoryBarriers[i].srcAccessMask;
+   }
+
+   if (wrapper_barrier_depends(dst_stages, dst_access,
+                               src_stages, src_access))
+      return true;
+
+   for (uint32_t i = 0; i < prev->bufferMemoryBarrierCount; i++) {
+      const VkBufferMemoryBarrier2 *a = &prev->pBufferMemoryBarriers[i];
+
+      for (uint32_t j = 0; j < info->bufferMemoryBarrierCount; j++) {
+         const VkBufferMemoryBarrier2 *b = &info->pBufferMemoryBarriers[j];
+
+         if (wrapper_barrier_buffers_overlap(a->buffer, a->offset, a->size,
+                                             b->buffer, b->offset, b->size))
+            return true;
+      }
+   }
+
+   for (uint32_t i = 0; i < prev->imageMemoryBarrierCount; i++) {
+      const VkImageMemoryBarrier2 *a = &prev->pImageMemoryBarriers[i];
+
+      for (uint32_t j = 0; j < info->imageMemoryBarrierCount; j++) {
+         const VkImageMemoryBarrier2 *b = &info->pImageMemoryBarriers[j];
+
+         if (wrapper_barrier_images_overlap(a->image, &a->subresourceRange,
+                                            b->image, &b->subresourceRange))
+            return true;
+      }
+   }
+
+   return false;
+}
+
+static bool
+wrapper_barrier_merge2(struct wrapper_command_buffer *wcb,
+                       const VkDependencyInfo* pDependencyInfo)
+{
+   struct vk_cmd_queue *queue = &wcb->vk.cmd_queue;
+   struct vk_cmd_queue_entry *cmd;
+   VkDependencyInfo *prev;
+
+   cmd = wrapper_barrier_tail(wcb, VK_CMD_PIPELINE_BARRIER2);
+   if (!cmd)
+      return false;
+
+   prev = cmd->u.pipeline_barrier2.dependency_info;
+   if (prev->dependencyFlags != pDependencyInfo->dependencyFlags)
+      return false;
+
+   if (wrapper_barrier_conflicts2(prev, pDependencyInfo))
+      return false;
+
+   if ((prev->memoryBarrierCount &&
+        wrapper_image_barriers2_have_transition(
+           pDependencyInfo->imageMemoryBarrierCount,
+           pDependencyInfo->pImageMemoryBarriers)) ||
+       (pDependencyInfo->memoryBarrierCount &&
+        wrapper_image_barriers2_have_transition(prev->imageMemoryBarrierCount,
+                                                prev->pImageMemoryBarriers)))
+      return false;
+
+   if (!wrapper_barrier_reserve(queue, &prev->pMemoryBarriers,
+                                prev->memoryBarrierCount,
+                                pDependencyInfo->memoryBarrierCount,
+                                sizeof(VkMemoryBarrier2)) ||
+       !wrapper_barrier_reserve(queue, &prev->pBufferMemoryBarriers,
+                                prev->bufferMemoryBarrierCount,
+                                pDependencyInfo->bufferMemoryBarrierCount,
+                                sizeof(VkBufferMemoryBarrier2)) ||
+       !wrapper_barrier_reserve(queue, &prev->pImageMemoryBarriers,
+                                prev->imageMemoryBarrierCount,
+                                pDependencyInfo->imageMemoryBarrierCount,
+                                sizeof(VkImageMemoryBarrier2)))
+      return false;
+
+   /* Synchronization2 barriers carry their own stage masks, so the
+    * merged barrier is just the concatenation.
+    */
+   prev->memoryBarrierCount =
+      wrapper_barrier_append((void *)prev->pMemoryBarriers,
+                             prev->memoryBarrierCount,
+                             pDependencyInfo->pMemoryBarriers,
+                             pDependencyInfo->memoryBarrierCount,
+                             sizeof(VkMemoryBarrier2));
+   prev->bufferMemoryBarrierCount =
+      wrapper_barrier_append((void *)prev->pBufferMemoryBarriers,
+                             prev->bufferMemoryBarrierCount,
+                             pDependencyInfo->pBufferMemoryBarriers,
+                             pDependencyInfo->bufferMemoryBarrierCount,
+                             sizeof(VkBufferMemoryBarrier2));
+   prev->imageMemoryBarrierCount =
+      wrapper_barrier_append((void *)prev->pImageMemoryBarriers,
+                             prev->imageMemoryBarrierCount,
+                             pDependencyInfo->pImageMemoryBarriers,
+                             pDependencyInfo->imageMemoryBarrierCount,
+                             sizeof(VkImageMemoryBarrier2));
+
+   return true;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_barrier_CmdPipelineBarrier2(VkCommandBuffer commandBuffer,
+                                    const VkDependencyInfo* pDependencyInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   const VkDependencyInfo *info = pDependencyInfo;
+   VkDependencyInfo copy;
+
+   wcb->barriers_in++;
+
+   if (info->pNext ||
+       wrapper_barriers_have_pnext(info->memoryBarrierCount,
+                                   info->pMemoryBarriers,
+                                   sizeof(VkMemoryBarrier2)) ||
+       wrapper_barriers_have_pnext(info->bufferMemoryBarrierCount,
+                                   info->pBufferMemoryBarriers,
+                                   sizeof(VkBufferMemoryBarrier2)) ||
+       wrapper_barriers_have_pnext(info->imageMemoryBarrierCount,
+                                   info->pImageMemoryBarriers,
+                                   sizeof(VkImageMemoryBarrier2)) ||
+       wrapper_buffer_barriers2_have_qfot(info->bufferMemoryBarrierCount,
+                                          info->pBufferMemoryBarriers) ||
+       wrapper_image_barriers2_have_qfot(info->imageMemoryBarrierCount,
+                                         info->pImageMemoryBarriers))
+      goto forward;
+
+   if (wrapper_barrier_merge2(wcb, info)) {
+      wcb->barriers_merged++;
+      return;
+   }
+
+   copy = *info;
+   if (!copy.memoryBarrierCount)
+      copy.pMemoryBarriers = NULL;
+   if (!copy.bufferMemoryBarrierCount)
+      copy.pBufferMemoryBarriers = NULL;
+   if (!copy.imageMemoryBarrierCount)
+      copy.pImageMemoryBarriers = NULL;
+
+   if (vk_enqueue_cmd_pipeline_barrier2(&wcb->vk.cmd_queue, &copy) ==
+       VK_SUCCESS)
+      return;
+
+forward:
+   wcb->device->cmd_dispatch.CmdPipelineBarrier2(commandBuffer,
+                                                 pDependencyInfo);
+}
+
+void
+wrapper_barrier_end(struct wrapper_command_buffer *wcb)
+{
+   struct wrapper_device *device = wcb->device;
+
+   if (!wcb->barriers_in)
+      return;
+
+   p_atomic_add(&device->barriers_in, wcb->barriers_in);
+   p_atomic_add(&device->barriers_merged, wcb->barriers_merged);
+   wcb->barriers_in = 0;
+   wcb->barriers_merged = 0;
+}
+
+void
+wrapper_barrier_report(struct wrapper_device *device)
+{
+   if (!device->barriers_in)
+      return;
+
+   mesa_logi("wrapper: coalesced %" PRIu64 " barriers into %" PRIu64,
+             device->barriers_in,
+             device->barriers_in - device->barriers_merged);
+}
+
+void
+wrapper_get_barrier_entrypoints(struct vk_device_entrypoint_table *entrypoints)
+{
+   *entrypoints = (struct vk_device_entrypoint_table) {
+      .CmdPipelineBarrier = wrapper_barrier_CmdPipelineBarrier,
+      .CmdPipelineBarrier2 = wrapper_barrier_CmdPipelineBarrier2,
+   };
+}
@@ -0,0 +1,1575 @@
+/* Measures what the wrapper costs on top of the driver it wraps.
+ *
+ * Usage: WRAPPER_VULKAN_LIBRARY=<driver> wrapper_bench <libvulkan_wrapper.so>
+ *
+ * The driver can be a loader or a bare ICD such as lavapipe.  Every test
+ * runs once directly against it and once through the wrapper, and one
+ * JSON object per test is printed to stdout:
+ *
+ *    {"test": "cmd_set_viewport", "unit": "ns/op",
+ *     "direct": 21.3, "wrapper": 48.9, "overhead": 27.6}
+ *
+ * Tests whose subject is an opt-in wrapper option also run on a second
+ * device created with that option set, and report as "<test>+<variant>".
+ * The driver ignores the option, so "overhead" is then what the wrapper
+ * with the option costs or saves against the bare driver.
+ *
+ * WRAPPER_BENCH_SCALE multiplies the iteration counts.
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <vulkan/vulkan_core.h>
+#include <vulkan/vk_icd.h>
+
+#include "c11/threads.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
+
+#define BENCH_INSTANCE_FUNCS(F) \
+   F(DestroyInstance) \
+   F(EnumeratePhysicalDevices) \
+   F(GetPhysicalDeviceProperties) \
+   F(GetPhysicalDeviceFeatures2) \
+   F(EnumerateDeviceExtensionProperties) \
+   F(GetPhysicalDeviceQueueFamilyProperties) \
+   F(GetPhysicalDeviceMemoryProperties) \
+   F(GetPhysicalDeviceSurfaceCapabilitiesKHR) \
+   F(CreateDevice) \
+   F(GetDeviceProcAddr) \
+   F(CreateHeadlessSurfaceEXT) \
+   F(DestroySurfaceKHR)
+
+#define BENCH_DEVICE_FUNCS(F) \
+   F(DestroyDevice) \
+   F(DeviceWaitIdle) \
+   F(GetDeviceQueue) \
+   F(CreateCommandPool) \
+   F(DestroyCommandPool) \
+   F(ResetCommandPool) \
+   F(AllocateCommandBuffers) \
+   F(BeginCommandBuffer) \
+   F(EndCommandBuffer) \
+   F(CmdSetViewport) \
+   F(CmdSetScissor) \
+   F(CmdPipelineBarrier) \
+   F(CmdFillBuffer) \
+   F(CmdResetQueryPool) \
+   F(CmdWriteTimestamp) \
+   F(CreateQueryPool) \
+   F(DestroyQueryPool) \
+   F(GetQueryPoolResults) \
+   F(CreateBuffer) \
+   F(DestroyBuffer) \
+   F(GetBufferMemoryRequirements) \
+   F(BindBufferMemory) \
+   F(CreateImage) \
+   F(DestroyImage) \
+   F(GetImageMemoryRequirements) \
+   F(BindImageMemory) \
+   F(CreateImageView) \
+   F(DestroyImageView) \
+   F(CmdBeginRendering) \
+   F(CmdEndRendering) \
+   F(CmdClearAttachments) \
+   F(CmdCopyBufferToImage) \
+   F(CopyMemoryToImageEXT) \
+   F(TransitionImageLayoutEXT) \
+   F(AllocateMemory) \
+   F(FreeMemory) \
+   F(MapMemory) \
+   F(UnmapMemory) \
+   F(QueueSubmit) \
+   F(CreateFence) \
+   F(DestroyFence) \
+   F(WaitForFences) \
+   F(ResetFences) \
+   F(CreateSemaphore) \
+   F(DestroySemaphore) \
+   F(CreateSwapchainKHR) \
+   F(DestroySwapchainKHR) \
+   F(GetSwapchainImagesKHR) \
+   F(AcquireNextImageKHR) \
+   F(QueuePresentKHR)
+
+#define BENCH_DECLARE(name) PFN_vk##name name;
+
+struct bench_target {
+   const char *name;
+   PFN_vkGetInstanceProcAddr gipa;
+   PFN_vkCreateInstance CreateInstance;
+
+   VkInstance instance;
+   VkPhysicalDevice pdevice;
+   bool headless;
+   uint32_t queue_family;
+   uint32_t async_family;
+   /* 0 if the graphics queue has no timestamps */
+   float timestamp_period;
+   VkSampleCountFlags sample_counts;
+   bool dynamic_rendering;
+   bool host_image_copy;
+   VkPhysicalDeviceMemoryProperties memory_properties;
+   BENCH_INSTANCE_FUNCS(BENCH_DECLARE)
+
+   VkDevice device;
+   VkQueue queue;
+   VkQueue async_queue;
+   VkCommandPool pool;
+   VkCommandBuffer cmd;
+   VkFence fence;
+   BENCH_DEVICE_FUNCS(BENCH_DECLARE)
+};
+
+#define BENCH_MAX_TESTS 64
+
+struct bench_result {
+   char *test;
+   const char *unit;
+   double value[2];
+};
+
+static struct bench_result results[BENCH_MAX_TESTS];
+static unsigned result_count;
+static unsigned scale;
+/* Name of the variant being run, if any. */
+static const char *variant;
+
+static void
+bench_report(unsigned target, const char *test, const char *unit,
+             double value)
+{
+   struct bench_result *r = NULL;
+   char name[128];
+
+   if (variant) {
+      snprintf(name, sizeof(name), "%s+%s", test, variant);
+      test = name;
+   }
+
+   for (unsigned i = 0; i < result_count; i++) {
+      if (!strcmp(results[i].test, test))
+         r = &results[i];
+   }
+   if (!r) {
+      assert(result_count < BENCH_MAX_TESTS);
+      r = &results[result_count++];
+      r->test = strdup(test);
+      r->unit = unit;
+      r->value[0] = r->value[1] = -1.0;
+   }
+   r->value[target] = value;
+}
+
+static bool
+bench_open(struct bench_target *t, const char *path)
+{
+   void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+   if (!handle) {
+      fprintf(stderr, "%s\n", dlerror());
+      return false;
+   }
+
+   t->gipa = dlsym(handle, "vk_icdGetInstanceProcAddr");
+   if (!t->gipa)
+      t->gipa = dlsym(handle, "vkGetInstanceProcAddr");
+   if (!t->gipa) {
+      fprintf(stderr, "%s: no vkGetInstanceProcAddr\n", path);
+      return false;
+   }
+
+   t->CreateInstance = (PFN_vkCreateInstance)
+      t->gipa(NULL, "vkCreateInstance");
+   return t->CreateInstance != NULL;
+}
+
+static VkResult
+bench_create_instance(struct bench_target *t, bool headless,
+                      VkInstance *instance)
+{
+   const char *extensions[] = {
+      VK_KHR_SURFACE_EXTENSION_NAME,
+      VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME,
+   };
+
+   return t->CreateInstance(
+      &(VkInstanceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+         .pApplicationInfo = &(VkApplicationInfo) {
+            .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+            .pApplicationName = "wrapper_bench",
+            .apiVersion = VK_API_VERSION_1_3,
+         },
+         .enabledExtensionCount = headless ? ARRAY_SIZE(extensions) : 0,
+         .ppEnabledExtensionNames = extensions,
+      }, NULL, instance);
+}
+
+static VkResult
+bench_create_device(struct bench_target *t, VkDevice *device)
+{
+   const char *extensions[2];
+   uint32_t extension_count = 0;
+   const float priority = 1.0f;
+   const VkDeviceQueueCreateInfo queues[2] = {
+      {
+         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+         .queueFamilyIndex = t->queue_family,
+         .queueCount = 1,
+         .pQueuePriorities = &priority,
+      },
+      {
+         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+         .queueFamilyIndex = t->async_family,
+         .queueCount = 1,
+         .pQueuePriorities = &priority,
+      },
+   };
+
+   VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
+      .hostImageCopy = VK_TRUE,
+   };
+   VkPhysicalDeviceVulkan13Features features13 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+      .pNext = t->host_image_copy ? &host_image_copy : NULL,
+      .dynamicRendering = t->dynamic_rendering,
+   };
+
+   if (t->headless)
+      extensions[extension_count++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+   if (t->host_image_copy)
+      extensions[extension_count++] = VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME;
+
+   return t->CreateDevice(
+      t->pdevice,
+      &(VkDeviceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+         .pNext = t->dynamic_rendering || t->host_image_copy ?
+                  &features13 : NULL,
+         .queueCreateInfoCount = t->async_family != UINT32_MAX ? 2 : 1,
+         .pQueueCreateInfos = queues,
+         .enabledExtensionCount = extension_count,
+         .ppEnabledExtensionNames = extensions,
+      }, NULL, device);
+}
+
+static bool
+bench_init(struct bench_target *t)
+{
+   VkQueueFamilyProperties families[16];
+   VkPhysicalDeviceProperties props;
+   uint32_t count = 1;
+   VkResult result;
+
+   t->headless = true;
+   result = bench_create_instance(t, true, &t->instance);
+   if (result != VK_SUCCESS) {
+      t->headless = false;
+      result = bench_create_instance(t, false, &t->instance);
+   }
+   if (result != VK_SUCCESS)
+      return false;
+
+#define BENCH_LOAD_INSTANCE(name) \
+   t->name = (PFN_vk##name)t->gipa(t->instance, "vk" #name);
+   BENCH_INSTANCE_FUNCS(BENCH_LOAD_INSTANCE)
+#undef BENCH_LOAD_INSTANCE
+
+   result = t->EnumeratePhysicalDevices(t->instance, &count, &t->pdevice);
+   if (result < 0 || count == 0)
+      return false;
+
+   /* Tests that need 1.3 features skip themselves when they are off. */
+   t->GetPhysicalDeviceProperties(t->pdevice, &props);
+   t->sample_counts = props.limits.framebufferColorSampleCounts;
+   if (props.apiVersion >= VK_API_VERSION_1_3) {
+      VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy = {
+         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
+      };
+      VkPhysicalDeviceVulkan13Features features13 = {
+         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+      };
+      VkExtensionProperties extensions[512];
+      uint32_t extension_count = ARRAY_SIZE(extensions);
+
+      t->EnumerateDeviceExtensionProperties(t->pdevice, NULL,
+                                            &extension_count, extensions);
+      for (uint32_t i = 0; i < extension_count; i++) {
+         if (!strcmp(extensions[i].extensionName,
+                     VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME))
+            features13.pNext = &host_image_copy;
+      }
+
+      t->GetPhysicalDeviceFeatures2(t->pdevice,
+         &(VkPhysicalDeviceFeatures2) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &features13,
+         });
+      t->dynamic_rendering = features13.dynamicRendering;
+      t->host_image_copy = host_image_copy.hostImageCopy;
+   }
+
+   count = ARRAY_SIZE(families);
+   t->GetPhysicalDeviceQueueFamilyProperties(t->pdevice, &count, families);
+   t->queue_family = UINT32_MAX;
+   for (uint32_t i = 0; i < count; i++) {
+      if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+         t->queue_family = i;
+         break;
+      }
+   }
+   if (t->queue_family == UINT32_MAX)
+      return false;
+   if (families[t->queue_family].timestampValidBits)
+      t->timestamp_period = props.limits.timestampPeriod;
+
+   /* A compute queue outside of the graphics family, if there is one. */
+   t->async_family = UINT32_MAX;
+   for (uint32_t i = 0; i < count; i++) {
+      if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+          !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+         t->async_family = i;
+         break;
+      }
+   }
+
+   t->GetPhysicalDeviceMemoryProperties(t->pdevice, &t->memory_properties);
+
+   if (bench_create_device(t, &t->device) != VK_SUCCESS)
+      return false;
+
+#define BENCH_LOAD_DEVICE(name) \
+   t->name = (PFN_vk##name)t->GetDeviceProcAddr(t->device, "vk" #name);
+   BENCH_DEVICE_FUNCS(BENCH_LOAD_DEVICE)
+#undef BENCH_LOAD_DEVICE
+
+   t->GetDeviceQueue(t->device, t->queue_family, 0, &t->queue);
+   if (t->async_family != UINT32_MAX)
+      t->GetDeviceQueue(t->device, t->async_family, 0, &t->async_queue);
+
+   t->CreateCommandPool(t->device,
+      &(VkCommandPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+         .queueFamilyIndex = t->queue_family,
+      }, NULL, &t->pool);
+   t->AllocateCommandBuffers(t->device,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = t->pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 1,
+      }, &t->cmd);
+   t->CreateFence(t->device,
+      &(VkFenceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      }, NULL, &t->fence);
+
+   return true;
+}
+
+static void
+bench_finish(struct bench_target *t)
+{
+   t->DeviceWaitIdle(t->device);
+   t->DestroyFence(t->device, t->fence, NULL);
+   t->DestroyCommandPool(t->device, t->pool, NULL);
+   t->DestroyDevice(t->device, NULL);
+   t->DestroyInstance(t->instance, NULL);
+}
+
+static uint32_t
+bench_host_memory_type(struct bench_target *t, uint32_t type_bits)
+{
+   const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+   for (uint32_t i = 0; i < t->memory_properties.memoryTypeCount; i++) {
+      if ((type_bits & (1u << i)) &&
+          (t->memory_properties.memoryTypes[i].propertyFlags & flags) == flags)
+         return i;
+   }
+   return UINT32_MAX;
+}
+
+static void
+bench_instance(struct bench_target *t, unsigned target)
+{
+   unsigned iterations = 20 * scale;
+   int64_t start, instance_time = 0, device_time = 0;
+
+   for (unsigned i = 0; i < iterations; i++) {
+      VkInstance instance;
+      VkDevice device;
+
+      start = os_time_get_nano();
+      if (bench_create_instance(t, t->headless, &instance) != VK_SUCCESS)
+         return;
+      instance_time += os_time_get_nano() - start;
+      t->DestroyInstance(instance, NULL);
+
+      start = os_time_get_nano();
+      if (bench_create_device(t, &device) != VK_SUCCESS)
+         return;
+      device_time += os_time_get_nano() - start;
+      t->DestroyDevice(device, NULL);
+   }
+
+   bench_report(target, "create_instance", "us/op",
+                instance_time / 1000.0 / iterations);
+   bench_report(target, "create_device", "us/op",
+                device_time / 1000.0 / iterations);
+}
+
+enum bench_cmd {
+   BENCH_CMD_SET_VIEWPORT,
+   BENCH_CMD_SET_SCISSOR,
+   BENCH_CMD_PIPELINE_BARRIER,
+   BENCH_CMD_FILL_BUFFER,
+};
+
+static void
+bench_cmd(struct bench_target *t, unsigned target, enum bench_cmd type,
+          const char *test, VkBuffer buffer)
+{
+   unsigned iterations = 10 * scale, count = 10000;
+   const VkViewport viewport = { 0, 0, 64, 64, 0, 1 };
+   const VkRect2D scissor = { { 0, 0 }, { 64, 64 } };
+   const VkMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+   };
+   int64_t start, time = 0;
+
+   for (unsigned i = 0; i < iterations; i++) {
+      t->ResetCommandPool(t->device, t->pool, 0);
+
+      /* End is included since deferred recording does its work there. */
+      start = os_time_get_nano();
+      t->BeginCommandBuffer(t->cmd,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+         });
+      for (unsigned j = 0; j < count; j++) {
+         switch (type) {
+         case BENCH_CMD_SET_VIEWPORT:
+            t->CmdSetViewport(t->cmd, 0, 1, &viewport);
+            break;
+         case BENCH_CMD_SET_SCISSOR:
+            t->CmdSetScissor(t->cmd, 0, 1, &scissor);
+            break;
+         case BENCH_CMD_PIPELINE_BARRIER:
+            t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                  1, &barrier, 0, NULL, 0, NULL);
+            break;
+         case BENCH_CMD_FILL_BUFFER:
+            t->CmdFillBuffer(t->cmd, buffer, 0, 256, j);
+            break;
+         }
+      }
+      t->EndCommandBuffer(t->cmd);
+      time += os_time_get_nano() - start;
+   }
+
+   bench_report(target, test, "ns/op", (double)time / iterations / count);
+}
+
+static void
+bench_submit(struct bench_target *t, unsigned target)
+{
+   unsigned iterations = 500 * scale;
+   const VkSubmitInfo submit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &t->cmd,
+   };
+   int64_t start, submit_time = 0, roundtrip_time = 0;
+
+   t->ResetCommandPool(t->device, t->pool, 0);
+   t->BeginCommandBuffer(t->cmd,
+      &(VkCommandBufferBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      });
+   t->EndCommandBuffer(t->cmd);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      start = os_time_get_nano();
+      t->QueueSubmit(t->queue, 1, &submit, t->fence);
+      submit_time += os_time_get_nano() - start;
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      roundtrip_time += os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+   }
+
+   bench_report(target, "queue_submit", "us/op",
+                submit_time / 1000.0 / iterations);
+   bench_report(target, "queue_submit_wait", "us/op",
+                roundtrip_time / 1000.0 / iterations);
+}
+
+/* A mix of small commands recorded, replayed by a submit and reset, which
+ * is what the vk_cmd_queue of lavapipe and of deferred recording do for
+ * every frame.  Record is the render thread's time; with deferred
+ * recording the driver's share of it moves to the submit.
+ */
+static void
+bench_record_replay(struct bench_target *t, unsigned target, VkBuffer buffer)
+{
+   unsigned iterations = 10 * scale, count = 10000;
+   const VkViewport viewport = { 0, 0, 64, 64, 0, 1 };
+   const VkRect2D scissor = { { 0, 0 }, { 64, 64 } };
+   const VkMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+   };
+   const VkSubmitInfo submit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &t->cmd,
+   };
+   int64_t start, record_time = 0, replay_time = 0, reset_time = 0;
+
+   t->ResetCommandPool(t->device, t->pool, 0);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      start = os_time_get_nano();
+      t->BeginCommandBuffer(t->cmd,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+         });
+      for (unsigned j = 0; j < count; j += 4) {
+         t->CmdSetViewport(t->cmd, 0, 1, &viewport);
+         t->CmdSetScissor(t->cmd, 0, 1, &scissor);
+         t->CmdFillBuffer(t->cmd, buffer, 0, 256, j);
+         t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                               1, &barrier, 0, NULL, 0, NULL);
+      }
+      t->EndCommandBuffer(t->cmd);
+      record_time += os_time_get_nano() - start;
+
+      start = os_time_get_nano();
+      t->QueueSubmit(t->queue, 1, &submit, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      replay_time += os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+
+      start = os_time_get_nano();
+      t->ResetCommandPool(t->device, t->pool, 0);
+      reset_time += os_time_get_nano() - start;
+   }
+
+   bench_report(target, "cmd_queue_record", "ns/op",
+                (double)record_time / iterations / count);
+   bench_report(target, "cmd_queue_replay", "ns/op",
+                (double)replay_time / iterations / count);
+   bench_report(target, "cmd_queue_reset", "ns/op",
+                (double)reset_time / iterations / count);
+}
+
+/* GPU time of a barrier-heavy command stream, between timestamps written
+ * at its start and end: batches of fills to disjoint ranges of the
+ * buffer, each range then handed to compute by a barrier of its own, the
+ * way engines emit one barrier per resource.  Barrier coalescing merges
+ * the barriers of a batch into one.
+ */
+static void
+bench_barrier_gpu(struct bench_target *t, unsigned target, VkBuffer buffer)
+{
+   const unsigned iterations = 20 * scale, batches = 256, ranges = 8;
+   const VkDeviceSize range_size = (1 << 20) / ranges;
+   const VkSubmitInfo submit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &t->cmd,
+   };
+   VkQueryPool query_pool;
+   double time = 0.0;
+
+   if (!t->timestamp_period)
+      return;
+
+   if (t->CreateQueryPool(t->device,
+         &(VkQueryPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2,
+         }, NULL, &query_pool) != VK_SUCCESS)
+      return;
+
+   for (unsigned i = 0; i < iterations; i++) {
+      uint64_t timestamps[2];
+
+      t->ResetCommandPool(t->device, t->pool, 0);
+      t->BeginCommandBuffer(t->cmd,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+         });
+      t->CmdResetQueryPool(t->cmd, query_pool, 0, 2);
+      t->CmdWriteTimestamp(t->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                           query_pool, 0);
+      for (unsigned j = 0; j < batches; j++) {
+         for (unsigned k = 0; k < ranges; k++)
+            t->CmdFillBuffer(t->cmd, buffer, k * range_size, 256, j);
+         for (unsigned k = 0; k < ranges; k++) {
+            t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+               1, &(VkBufferMemoryBarrier) {
+                  .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                  .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                  .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                  .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                  .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                  .buffer = buffer,
+                  .offset = k * range_size,
+                  .size = 256,
+               }, 0, NULL);
+         }
+      }
+      t->CmdWriteTimestamp(t->cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                           query_pool, 1);
+      t->EndCommandBuffer(t->cmd);
+
+      t->QueueSubmit(t->queue, 1, &submit, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      t->ResetFences(t->device, 1, &t->fence);
+
+      if (t->GetQueryPoolResults(t->device, query_pool, 0, 2,
+                                 sizeof(timestamps), timestamps,
+                                 sizeof(timestamps[0]),
+                                 VK_QUERY_RESULT_64_BIT |
+                                 VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS)
+         break;
+      time += (timestamps[1] - timestamps[0]) * t->timestamp_period;
+   }
+
+   bench_report(target, "barrier_gpu_time", "us/op",
+                time / 1000.0 / iterations);
+
+   t->DestroyQueryPool(t->device, query_pool, NULL);
+}
+
+static void
+bench_record_fills(struct bench_target *t, VkCommandBuffer cmd,
+                   VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                   unsigned count)
+{
+   t->BeginCommandBuffer(cmd,
+      &(VkCommandBufferBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      });
+   for (unsigned i = 0; i < count; i++)
+      t->CmdFillBuffer(cmd, buffer, offset, size, i);
+   t->EndCommandBuffer(cmd);
+}
+
+/* Two equal batches of fills, first both on the graphics queue and then
+ * one on it and one on the async compute queue.  On a driver that runs
+ * its queues in parallel, as lavapipe does, the second takes about half
+ * as long as the first.
+ */
+static void
+bench_async_queue(struct bench_target *t, unsigned target, VkBuffer buffer)
+{
+   unsigned iterations = 20 * scale, count = 256;
+   const VkDeviceSize half = (1 << 20) / 2;
+   VkCommandBuffer cmds[2], async_cmd;
+   VkCommandPool async_pool;
+   VkFence async_fence;
+   int64_t start, serial_time = 0, overlap_time = 0;
+
+   if (!t->async_queue)
+      return;
+
+   t->ResetCommandPool(t->device, t->pool, 0);
+   t->AllocateCommandBuffers(t->device,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = t->pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 2,
+      }, cmds);
+   t->CreateCommandPool(t->device,
+      &(VkCommandPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+         .queueFamilyIndex = t->async_family,
+      }, NULL, &async_pool);
+   t->AllocateCommandBuffers(t->device,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = async_pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 1,
+      }, &async_cmd);
+   t->CreateFence(t->device,
+      &(VkFenceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      }, NULL, &async_fence);
+
+   /* Each batch fills its own half of the buffer. */
+   bench_record_fills(t, cmds[0], buffer, 0, half, count);
+   bench_record_fills(t, cmds[1], buffer, half, half, count);
+   bench_record_fills(t, async_cmd, buffer, half, half, count);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      const VkFence fences[2] = { t->fence, async_fence };
+
+      start = os_time_get_nano();
+      t->QueueSubmit(t->queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 2,
+            .pCommandBuffers = cmds,
+         }, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      serial_time += os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+
+      start = os_time_get_nano();
+      t->QueueSubmit(t->queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &cmds[0],
+         }, t->fence);
+      t->QueueSubmit(t->async_queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &async_cmd,
+         }, async_fence);
+      t->WaitForFences(t->device, 2, fences, VK_TRUE, UINT64_MAX);
+      overlap_time += os_time_get_nano() - start;
+      t->ResetFences(t->device, 2, fences);
+   }
+
+   bench_report(target, "async_queue_serial", "us/op",
+                serial_time / 1000.0 / iterations);
+   bench_report(target, "async_queue_overlap", "us/op",
+                overlap_time / 1000.0 / iterations);
+
+   t->DestroyFence(t->device, async_fence, NULL);
+   t->DestroyCommandPool(t->device, async_pool, NULL);
+}
+
+struct bench_contention {
+   struct bench_target *t;
+   VkCommandBuffer cmd;
+   VkFence fence;
+   int stop;
+};
+
+static int
+bench_contention_thread(void *data)
+{
+   struct bench_contention *c = data;
+   struct bench_target *t = c->t;
+
+   while (!p_atomic_read(&c->stop)) {
+      t->QueueSubmit(t->async_queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &c->cmd,
+         }, c->fence);
+      t->WaitForFences(t->device, 1, &c->fence, VK_TRUE, UINT64_MAX);
+      t->ResetFences(t->device, 1, &c->fence);
+   }
+   return 0;
+}
+
+static int
+bench_compare_time(const void *a, const void *b)
+{
+   const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+   return x < y ? -1 : x > y;
+}
+
+/* Latency of a small submit on the graphics queue, from vkQueueSubmit to
+ * its fence signalling, first on an idle device and then while another
+ * thread keeps the async compute queue busy with large batches.  The
+ * medians are reported, and the 99th percentile under contention.  With
+ * queue priorities on, the contended latency should stay close to the
+ * idle one on a driver that honours them.
+ */
+static void
+bench_contended_submit(struct bench_target *t, unsigned target,
+                       VkBuffer buffer)
+{
+   const unsigned iterations = 200 * scale;
+   const VkDeviceSize half = (1 << 20) / 2;
+   struct bench_contention c = { .t = t };
+   VkCommandBuffer cmd;
+   VkCommandPool async_pool;
+   int64_t start, *samples, idle;
+   thrd_t thread;
+
+   if (!t->async_queue)
+      return;
+
+   samples = malloc(iterations * sizeof(*samples));
+   if (!samples)
+      return;
+
+   t->ResetCommandPool(t->device, t->pool, 0);
+   t->AllocateCommandBuffers(t->device,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = t->pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 1,
+      }, &cmd);
+   t->CreateCommandPool(t->device,
+      &(VkCommandPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+         .queueFamilyIndex = t->async_family,
+      }, NULL, &async_pool);
+   t->AllocateCommandBuffers(t->device,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = async_pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 1,
+      }, &c.cmd);
+   t->CreateFence(t->device,
+      &(VkFenceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      }, NULL, &c.fence);
+
+   bench_record_fills(t, cmd, buffer, 0, 256, 1);
+   bench_record_fills(t, c.cmd, buffer, half, half, 1024);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      start = os_time_get_nano();
+      t->QueueSubmit(t->queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &cmd,
+         }, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      samples[i] = os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+   }
+   qsort(samples, iterations, sizeof(*samples), bench_compare_time);
+   idle = samples[iterations / 2];
+
+   if (thrd_create(&thread, bench_contention_thread, &c) != thrd_success)
+      goto out;
+
+   for (unsigned i = 0; i < iterations; i++) {
+      start = os_time_get_nano();
+      t->QueueSubmit(t->queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &cmd,
+         }, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      samples[i] = os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+   }
+
+   p_atomic_set(&c.stop, 1);
+   thrd_join(thread, NULL);
+
+   qsort(samples, iterations, sizeof(*samples), bench_compare_time);
+   bench_report(target, "submit_latency_idle", "us/op",
+                idle / 1000.0);
+   bench_report(target, "submit_latency_contended", "us/op",
+                samples[iterations / 2] / 1000.0);
+   bench_report(target, "submit_latency_contended_p99", "us/op",
+                samples[iterations * 99 / 100] / 1000.0);
+
+out:
+   t->DestroyFence(t->device, c.fence, NULL);
+   t->DestroyCommandPool(t->device, async_pool, NULL);
+   free(samples);
+}
+
+static void
+bench_memory(struct bench_target *t, unsigned target, VkBuffer buffer)
+{
+   unsigned iterations = 200 * scale;
+   int64_t start, alloc_time = 0, map_time = 0, unmap_time = 0, free_time = 0;
+   VkMemoryRequirements reqs;
+   uint32_t type;
+
+   t->GetBufferMemoryRequirements(t->device, buffer, &reqs);
+   type = bench_host_memory_type(t, reqs.memoryTypeBits);
+   if (type == UINT32_MAX)
+      return;
+
+   for (unsigned i = 0; i < iterations; i++) {
+      VkDeviceMemory memory;
+      void *map;
+
+      start = os_time_get_nano();
+      if (t->AllocateMemory(t->device,
+            &(VkMemoryAllocateInfo) {
+               .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+               .allocationSize = 1 << 20,
+               .memoryTypeIndex = type,
+            }, NULL, &memory) != VK_SUCCESS)
+         return;
+      alloc_time += os_time_get_nano() - start;
+
+      start = os_time_get_nano();
+      t->MapMemory(t->device, memory, 0, VK_WHOLE_SIZE, 0, &map);
+      map_time += os_time_get_nano() - start;
+
+      start = os_time_get_nano();
+      t->UnmapMemory(t->device, memory);
+      unmap_time += os_time_get_nano() - start;
+
+      start = os_time_get_nano();
+      t->FreeMemory(t->device, memory, NULL);
+      free_time += os_time_get_nano() - start;
+   }
+
+   bench_report(target, "allocate_memory", "us/op",
+                alloc_time / 1000.0 / iterations);
+   bench_report(target, "map_memory", "us/op",
+                map_time / 1000.0 / iterations);
+   bench_report(target, "unmap_memory", "us/op",
+                unmap_time / 1000.0 / iterations);
+   bench_report(target, "free_memory", "us/op",
+                free_time / 1000.0 / iterations);
+}
+
+static void
+bench_present(struct bench_target *t, unsigned target)
+{
+   unsigned iterations = 200 * scale;
+   VkSurfaceCapabilitiesKHR caps;
+   VkSwapchainKHR swapchain;
+   VkSurfaceKHR surface;
+   VkSemaphore acquired, rendered;
+   VkImage images[8];
+   uint32_t image_count = ARRAY_SIZE(images);
+   int64_t start;
+
+   if (!t->headless ||
+       t->CreateHeadlessSurfaceEXT(t->instance,
+          &(VkHeadlessSurfaceCreateInfoEXT) {
+             .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+          }, NULL, &surface) != VK_SUCCESS)
+      return;
+
+   t->GetPhysicalDeviceSurfaceCapabilitiesKHR(t->pdevice, surface, &caps);
+   if (t->CreateSwapchainKHR(t->device,
+         &(VkSwapchainCreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+            .surface = surface,
+            .minImageCount = MAX2(caps.minImageCount, 3),
+            .imageFormat = VK_FORMAT_B8G8R8A8_UNORM,
+            .imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+            .imageExtent = { 256, 256 },
+            .imageArrayLayers = 1,
+            .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            .preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
+            .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+            .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+            .clipped = VK_TRUE,
+         }, NULL, &swapchain) != VK_SUCCESS) {
+      t->DestroySurfaceKHR(t->instance, surface, NULL);
+      return;
+   }
+
+   t->GetSwapchainImagesKHR(t->device, swapchain, &image_count, images);
+   t->CreateSemaphore(t->device,
+      &(VkSemaphoreCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      }, NULL, &acquired);
+   t->CreateSemaphore(t->device,
+      &(VkSemaphoreCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      }, NULL, &rendered);
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < iterations; i++) {
+      const VkPipelineStageFlags wait_stage =
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      uint32_t index;
+
+      if (t->AcquireNextImageKHR(t->device, swapchain, UINT64_MAX, acquired,
+                                 VK_NULL_HANDLE, &index) < 0)
+         break;
+
+      t->ResetCommandPool(t->device, t->pool, 0);
+      t->BeginCommandBuffer(t->cmd,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+         });
+      t->CmdPipelineBarrier(t->cmd,
+         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL,
+         1, &(VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = images[index],
+            .subresourceRange = {
+               VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1,
+            },
+         });
+      t->EndCommandBuffer(t->cmd);
+
+      t->QueueSubmit(t->queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &acquired,
+            .pWaitDstStageMask = &wait_stage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &t->cmd,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &rendered,
+         }, t->fence);
+      t->QueuePresentKHR(t->queue,
+         &(VkPresentInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &rendered,
+            .swapchainCount = 1,
+            .pSwapchains = &swapchain,
+            .pImageIndices = &index,
+         });
+
+      /* One command buffer, so one frame in flight. */
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      t->ResetFences(t->device, 1, &t->fence);
+   }
+   bench_report(target, "headless_present", "frames/s",
+                iterations * 1e9 / (os_time_get_nano() - start));
+
+   t->DeviceWaitIdle(t->device);
+   t->DestroySemaphore(t->device, acquired, NULL);
+   t->DestroySemaphore(t->device, rendered, NULL);
+   t->DestroySwapchainKHR(t->device, swapchain, NULL);
+   t->DestroySurfaceKHR(t->instance, surface, NULL);
+}
+
+/* A frame of four back-to-back rendering instances on one 4x
+ * multisampled color attachment, each loading what the previous one
+ * stored, clearing a rectangle as a stand-in for draws and resolving.
+ * Only the frame's result is needed, so the last instance doesn't store.
+ * This is the memory traffic that load/store op rewriting, rendering
+ * merging and transient attachments are meant to cut.
+ */
+static void
+bench_bandwidth(struct bench_target *t, unsigned target, VkBuffer buffer)
+{
+   const unsigned iterations = 50 * scale, passes = 4, size = 1024;
+   const VkSampleCountFlagBits samples =
+      (t->sample_counts & VK_SAMPLE_COUNT_4_BIT) ? VK_SAMPLE_COUNT_4_BIT :
+                                                    VK_SAMPLE_COUNT_1_BIT;
+   const VkSubmitInfo submit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &t->cmd,
+   };
+   VkImage images[2];
+   VkImageView views[2];
+   VkDeviceMemory memory[2];
+   int64_t start, time = 0;
+
+   if (!t->dynamic_rendering)
+      return;
+
+   /* The attachment only has attachment usage, so the transient variant
+    * tracks it; it loads and stores, so it is never promoted.  Promotion
+    * needs a dedicated allocation.
+    */
+   for (unsigned i = 0; i < 2; i++) {
+      VkMemoryRequirements reqs;
+
+      t->CreateImage(t->device,
+         &(VkImageCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .extent = { size, size, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = i == 0 ? samples : VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = i == 0 ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT :
+                              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+         }, NULL, &images[i]);
+      t->GetImageMemoryRequirements(t->device, images[i], &reqs);
+      t->AllocateMemory(t->device,
+         &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = &(VkMemoryDedicatedAllocateInfo) {
+               .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+               .image = images[i],
+            },
+            .allocationSize = reqs.size,
+            .memoryTypeIndex = ffs(reqs.memoryTypeBits) - 1,
+         }, NULL, &memory[i]);
+      t->BindImageMemory(t->device, images[i], memory[i], 0);
+      t->CreateImageView(t->device,
+         &(VkImageViewCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+         }, NULL, &views[i]);
+   }
+
+   for (unsigned i = 0; i < iterations; i++) {
+      VkImageMemoryBarrier barriers[2];
+
+      for (unsigned j = 0; j < 2; j++) {
+         barriers[j] = (VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = images[j],
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+         };
+      }
+
+      start = os_time_get_nano();
+      t->ResetCommandPool(t->device, t->pool, 0);
+      t->BeginCommandBuffer(t->cmd,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+         });
+      t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                            0, NULL, 0, NULL, 2, barriers);
+
+      for (unsigned j = 0; j < passes; j++) {
+         const VkRenderingAttachmentInfo color = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = views[0],
+            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .resolveMode = samples != VK_SAMPLE_COUNT_1_BIT ?
+                           VK_RESOLVE_MODE_AVERAGE_BIT :
+                           VK_RESOLVE_MODE_NONE,
+            .resolveImageView = samples != VK_SAMPLE_COUNT_1_BIT ?
+                                views[1] : VK_NULL_HANDLE,
+            .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .loadOp = j == 0 ? VK_ATTACHMENT_LOAD_OP_CLEAR :
+                               VK_ATTACHMENT_LOAD_OP_LOAD,
+            .storeOp = j == passes - 1 ? VK_ATTACHMENT_STORE_OP_DONT_CARE :
+                                         VK_ATTACHMENT_STORE_OP_STORE,
+         };
+
+         t->CmdBeginRendering(t->cmd,
+            &(VkRenderingInfo) {
+               .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+               .renderArea = { { 0, 0 }, { size, size } },
+               .layerCount = 1,
+               .colorAttachmentCount = 1,
+               .pColorAttachments = &color,
+            });
+         t->CmdClearAttachments(t->cmd, 1,
+            &(VkClearAttachment) {
+               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+               .clearValue.color.float32 = { j & 1, (j >> 1) & 1, 1, 1 },
+            }, 1,
+            &(VkClearRect) {
+               .rect = { { j * 64, j * 64 }, { size / 2, size / 2 } },
+               .layerCount = 1,
+            });
+         t->CmdEndRendering(t->cmd);
+      }
+
+      t->EndCommandBuffer(t->cmd);
+      t->QueueSubmit(t->queue, 1, &submit, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      time += os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+   }
+
+   bench_report(target, "bandwidth_frame", "us/op",
+                time / 1000.0 / iterations);
+
+   for (unsigned i = 0; i < 2; i++) {
+      t->DestroyImageView(t->device, views[i], NULL);
+      t->DestroyImage(t->device, images[i], NULL);
+      t->FreeMemory(t->device, memory[i], NULL);
+   }
+}
+
+/* Uploads a 1024x1024 RGBA8 texture per iteration, once through a
+ * staging buffer and a copy on the queue and once with
+ * vkCopyMemoryToImageEXT, when VK_EXT_host_image_copy is there.  The
+ * source data is written by the CPU in both cases.
+ */
+static void
+bench_upload(struct bench_target *t, unsigned target, VkBuffer buffer)
+{
+   const unsigned iterations = 50 * scale, size = 1024;
+   const VkDeviceSize bytes = (VkDeviceSize)size * size * 4;
+   const VkImageSubresourceRange range = {
+      VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1,
+   };
+   const VkSubmitInfo submit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &t->cmd,
+   };
+   VkImage images[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+   VkDeviceMemory memory[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+   VkBuffer staging;
+   VkDeviceMemory staging_memory;
+   VkMemoryRequirements reqs;
+   uint8_t *data, *map;
+   uint32_t type;
+   int64_t start, staged_time = 0, host_time = 0;
+
+   data = malloc(bytes);
+   if (!data)
+      return;
+
+   t->CreateBuffer(t->device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .size = bytes,
+         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      }, NULL, &staging);
+   t->GetBufferMemoryRequirements(t->device, staging, &reqs);
+   type = bench_host_memory_type(t, reqs.memoryTypeBits);
+   if (type == UINT32_MAX) {
+      t->DestroyBuffer(t->device, staging, NULL);
+      free(data);
+      return;
+   }
+   t->AllocateMemory(t->device,
+      &(VkMemoryAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+         .allocationSize = reqs.size,
+         .memoryTypeIndex = type,
+      }, NULL, &staging_memory);
+   t->BindBufferMemory(t->device, staging, staging_memory, 0);
+   t->MapMemory(t->device, staging_memory, 0, VK_WHOLE_SIZE, 0,
+                (void **)&map);
+
+   for (unsigned i = 0; i < (t->host_image_copy ? 2 : 1); i++) {
+      t->CreateImage(t->device,
+         &(VkImageCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .extent = { size, size, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                     (i == 0 ? VK_IMAGE_USAGE_TRANSFER_DST_BIT :
+                               VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT),
+         }, NULL, &images[i]);
+      t->GetImageMemoryRequirements(t->device, images[i], &reqs);
+      t->AllocateMemory(t->device,
+         &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = reqs.size,
+            .memoryTypeIndex = ffs(reqs.memoryTypeBits) - 1,
+         }, NULL, &memory[i]);
+      t->BindImageMemory(t->device, images[i], memory[i], 0);
+   }
+
+   for (unsigned i = 0; i < iterations; i++) {
+      memset(data, i, bytes);
+
+      start = os_time_get_nano();
+      memcpy(map, data, bytes);
+      t->ResetCommandPool(t->device, t->pool, 0);
+      t->BeginCommandBuffer(t->cmd,
+         &(VkCommandBufferBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+         });
+      t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
+         1, &(VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = images[0],
+            .subresourceRange = range,
+         });
+      t->CmdCopyBufferToImage(t->cmd, staging, images[0],
+         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+         &(VkBufferImageCopy) {
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageExtent = { size, size, 1 },
+         });
+      t->EndCommandBuffer(t->cmd);
+      t->QueueSubmit(t->queue, 1, &submit, t->fence);
+      t->WaitForFences(t->device, 1, &t->fence, VK_TRUE, UINT64_MAX);
+      staged_time += os_time_get_nano() - start;
+      t->ResetFences(t->device, 1, &t->fence);
+
+      if (!t->host_image_copy)
+         continue;
+
+      start = os_time_get_nano();
+      t->TransitionImageLayoutEXT(t->device, 1,
+         &(VkHostImageLayoutTransitionInfoEXT) {
+            .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT,
+            .image = images[1],
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .subresourceRange = range,
+         });
+      t->CopyMemoryToImageEXT(t->device,
+         &(VkCopyMemoryToImageInfoEXT) {
+            .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT,
+            .dstImage = images[1],
+            .dstImageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .regionCount = 1,
+            .pRegions = &(VkMemoryToImageCopyEXT) {
+               .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT,
+               .pHostPointer = data,
+               .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+               .imageExtent = { size, size, 1 },
+            },
+         });
+      host_time += os_time_get_nano() - start;
+   }
+
+   bench_report(target, "upload_staging", "MB/s",
+                (double)bytes * iterations / staged_time * 1000.0);
+   if (t->host_image_copy) {
+      bench_report(target, "upload_host_copy", "MB/s",
+                   (double)bytes * iterations / host_time * 1000.0);
+   }
+
+   for (unsigned i = 0; i < 2; i++) {
+      t->DestroyImage(t->device, images[i], NULL);
+      t->FreeMemory(t->device, memory[i], NULL);
+   }
+   t->DestroyBuffer(t->device, staging, NULL);
+   t->FreeMemory(t->device, staging_memory, NULL);
+   free(data);
+}
+
+static void
+bench_create_buffer(struct bench_target *t, VkBuffer *buffer,
+                    VkDeviceMemory *memory)
+{
+   VkMemoryRequirements reqs;
+
+   t->CreateBuffer(t->device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .size = 1 << 20,
+         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      }, NULL, buffer);
+   t->GetBufferMemoryRequirements(t->device, *buffer, &reqs);
+   t->AllocateMemory(t->device,
+      &(VkMemoryAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+         .allocationSize = reqs.size,
+         .memoryTypeIndex = ffs(reqs.memoryTypeBits) - 1,
+      }, NULL, memory);
+   t->BindBufferMemory(t->device, *buffer, *memory, 0);
+}
+
+#define BENCH_MAX_OPTIONS 3
+
+struct bench_variant {
+   const char *name;
+   /* "NAME=VALUE" */
+   const char *options[BENCH_MAX_OPTIONS];
+   void (*run)(struct bench_target *t, unsigned target, VkBuffer buffer);
+};
+
+static const struct bench_variant bench_variants[] = {
+   {
+      .name = "coalesced",
+      .options = { "WRAPPER_COALESCE_BARRIERS=1" },
+      .run = bench_barrier_gpu,
+   },
+   {
+      .name = "deferred",
+      .options = { "WRAPPER_RECORD_THREADS=2" },
+      .run = bench_record_replay,
+   },
+   {
+      .name = "merged",
+      .options = { "WRAPPER_RECORD_THREADS=1", "WRAPPER_LOAD_STORE_OPS=1",
+                   "WRAPPER_MERGE_RENDERING=1" },
+      .run = bench_bandwidth,
+   },
+   {
+      .name = "transient",
+      .options = { "WRAPPER_RECORD_THREADS=1", "WRAPPER_MERGE_RENDERING=1",
+                   "WRAPPER_TRANSIENT_ATTACHMENTS=1" },
+      .run = bench_bandwidth,
+   },
+   {
+      .name = "host_copy",
+      .options = { "WRAPPER_HOST_IMAGE_COPY=1" },
+      .run = bench_upload,
+   },
+   {
+      .name = "priority",
+      .options = { "WRAPPER_QUEUE_PRIORITY=1" },
+      .run = bench_contended_submit,
+   },
+};
+
+/* Runs a test again on a new instance and device created, and used, with
+ * the variant's wrapper options set in the environment.
+ */
+static void
+bench_variant(struct bench_target *t, unsigned target,
+              const struct bench_variant *v)
+{
+   struct bench_target vt = {
+      .name = t->name,
+      .gipa = t->gipa,
+      .CreateInstance = t->CreateInstance,
+   };
+   char *saved[BENCH_MAX_OPTIONS] = { NULL };
+   char names[BENCH_MAX_OPTIONS][64];
+   VkDeviceMemory memory;
+   VkBuffer buffer;
+
+   for (unsigned i = 0; i < BENCH_MAX_OPTIONS && v->options[i]; i++) {
+      const char *value = strchr(v->options[i], '=');
+
+      snprintf(names[i], sizeof(names[i]), "%.*s",
+               (int)(value - v->options[i]), v->options[i]);
+      if (getenv(names[i]))
+         saved[i] = strdup(getenv(names[i]));
+      setenv(names[i], value + 1, 1);
+   }
+
+   if (bench_init(&vt)) {
+      bench_create_buffer(&vt, &buffer, &memory);
+      variant = v->name;
+      v->run(&vt, target, buffer);
+      variant = NULL;
+      vt.DestroyBuffer(vt.device, buffer, NULL);
+      vt.FreeMemory(vt.device, memory, NULL);
+      bench_finish(&vt);
+   } else {
+      fprintf(stderr, "%s: failed to set up a device for %s\n",
+              t->name, v->name);
+   }
+
+   for (unsigned i = 0; i < BENCH_MAX_OPTIONS && v->options[i]; i++) {
+      if (saved[i])
+         setenv(names[i], saved[i], 1);
+      else
+         unsetenv(names[i]);
+      free(saved[i]);
+   }
+}
+
+static bool
+bench_run(struct bench_target *t, unsigned target)
+{
+   VkDeviceMemory memory;
+   VkBuffer buffer;
+
+   if (!bench_init(t)) {
+      fprintf(stderr, "%s: failed to set up a device\n", t->name);
+      return false;
+   }
+
+   bench_create_buffer(t, &buffer, &memory);
+
+   bench_instance(t, target);
+   bench_cmd(t, target, BENCH_CMD_SET_VIEWPORT, "cmd_set_viewport", buffer);
+   bench_cmd(t, target, BENCH_CMD_SET_SCISSOR, "cmd_set_scissor", buffer);
+   bench_cmd(t, target, BENCH_CMD_PIPELINE_BARRIER, "cmd_pipeline_barrier",
+             buffer);
+   bench_cmd(t, target, BENCH_CMD_FILL_BUFFER, "cmd_fill_buffer", buffer);
+   bench_submit(t, target);
+   bench_record_replay(t, target, buffer);
+   bench_barrier_gpu(t, target, buffer);
+   bench_async_queue(t, target, buffer);
+   bench_contended_submit(t, target, buffer);
+   bench_memory(t, target, buffer);
+   bench_present(t, target);
+   bench_bandwidth(t, target, buffer);
+   bench_upload(t, target, buffer);
+
+   t->DestroyBuffer(t->device, buffer, NULL);
+   t->FreeMemory(t->device, memory, NULL);
+   bench_finish(t);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(bench_variants); i++)
+      bench_variant(t, target, &bench_variants[i]);
+
+   return true;
+}
+
+int
+main(int argc, char **argv)
+{
+   const char *driver = getenv("WRAPPER_VULKAN_LIBRARY");
+   struct bench_target targets[2] = {
+      { .name = "direct" },
+      { .name = "wrapper" },
+   };
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: WRAPPER_VULKAN_LIBRARY=<driver> %s "
+              "<libvulkan_wrapper.so>\n", argv[0]);
+      return 1;
+   }
+
+   /* Nothing to wrap, so skip rather than fail. */
+   if (!driver) {
+      fprintf(stderr, "WRAPPER_VULKAN_LIBRARY is not set, skipping\n");
+      return 77;
+   }
+
+   scale = MAX2(debug_get_num_option("WRAPPER_BENCH_SCALE", 1), 1);
+
+   if (!bench_open(&targets[0], driver) || !bench_open(&targets[1], argv[1]))
+      return 1;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(targets); i++) {
+      if (!bench_run(&targets[i], i))
+         return 1;
+   }
+
+   for (unsigned i = 0; i < result_count; i++) {
+      const struct bench_result *r = &results[i];
+
+      printf("{\"test\": \"%s\", \"unit\": \"%s\", "
+             "\"direct\": %.3f, \"wrapper\": %.3f, \"overhead\": %.3f}\n",
+             r->test, r->unit, r->value[0], r->value[1],
+             r->value[1] - r->value[0]);
+   }
+
+   return 0;
+}
@@ -0,0 +1,485 @@
+#include "wrapper_private.h"
+#include "wrapper_entrypoints.h"
+#include "vk_alloc.h"
+#include "vk_cmd_enqueue_entrypoints.h"
+#include "vk_cmd_queue.h"
+#include "vk_dispatch_table.h"
+#include "vk_util.h"
+#include "util/list.h"
+#include "util/simple_mtx.h"
+
+/* Deferred recording: when the device was created with
+ * WRAPPER_RECORD_THREADS > 0, vkCmd* calls are captured into the
+ * vk_cmd_queue of the wrapper command buffer instead of being forwarded,
+ * and the queue is replayed into the driver command buffer on a worker
+ * thread once the application calls vkEndCommandBuffer.
+ *
+ * Commands that cannot be captured (they reference runtime objects the
+ * wrapper does not own, or vk_cmd_queue has no copy for them) go through
+ * the trampolines, which replay whatever was captured so far on the
+ * calling thread first so the driver still sees them in order.
+ */
+
+static void
+wrapper_command_buffer_replay_job(void *data, void *gdata, int thread_index)
+{
+   struct wrapper_command_buffer *wcb = data;
+   struct wrapper_device *device = wcb->device;
+
+   if (device->load_store_ops || device->merge_rendering)
+      wrapper_load_store_optimize(wcb);
+   vk_cmd_queue_execute(&wcb->vk.cmd_queue, wcb->dispatch_handle,
+                        &device->dispatch_table);
+   vk_cmd_queue_reset(&wcb->vk.cmd_queue);
+
+   wcb->replay_result =
+      device->dispatch_table.EndCommandBuffer(wcb->dispatch_handle);
+}
+
+void
+wrapper_command_buffer_replay(struct wrapper_command_buffer *wcb)
+{
+   if (wcb->device->load_store_ops || wcb->device->merge_rendering)
+      wrapper_load_store_optimize(wcb);
+   vk_cmd_queue_execute(&wcb->vk.cmd_queue, wcb->dispatch_handle,
+                        &wcb->device->dispatch_table);
+   vk_cmd_queue_reset(&wcb->vk.cmd_queue);
+}
+
+VkResult
+wrapper_command_buffer_wait(struct wrapper_command_buffer *wcb)
+{
+   util_queue_fence_wait(&wcb->replay_fence);
+   return wcb->replay_result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_enqueue_CmdBindDescriptorSets(VkCommandBuffer commandBuffer,
+                                      VkPipelineBindPoint pipelineBindPoint,
+                                      VkPipelineLayout layout,
+                                      uint32_t firstSet,
+                                      uint32_t descriptorSetCount,
+                                      const VkDescriptorSet* pDescriptorSets,
+                                      uint32_t dynamicOffsetCount,
+                                      const uint32_t *pDynamicOffsets)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct vk_cmd_queue *queue = &wcb->vk.cmd_queue;
+   struct vk_cmd_bind_descriptor_sets *bind;
+   struct vk_cmd_queue_entry *cmd;
+
+   if (vk_command_buffer_has_error(&wcb->vk))
+      return;
+
+   /* Unlike vk_cmd_enqueue_CmdBindDescriptorSets() this does not reference
+    * the pipeline layout: it belongs to the driver, not to the runtime.
+    */
+   cmd = vk_cmd_queue_zalloc(queue, sizeof(*cmd));
+   if (!cmd)
+      goto err;
+
+   cmd->type = VK_CMD_BIND_DESCRIPTOR_SETS;
+   list_addtail(&cmd->cmd_link, &queue->cmds);
+
+   bind = &cmd->u.bind_descriptor_sets;
+   bind->pipeline_bind_point = pipelineBindPoint;
+   bind->layout = layout;
+   bind->first_set = firstSet;
+   bind->descriptor_set_count = descriptorSetCount;
+   bind->dynamic_offset_count = dynamicOffsetCount;
+
+   if (descriptorSetCount) {
+      bind->descriptor_sets =
+         vk_cmd_queue_zalloc(queue,
+                             sizeof(*bind->descriptor_sets) *
+                             descriptorSetCount);
+      if (!bind->descriptor_sets)
+         goto err;
+      memcpy(bind->descriptor_sets, pDescriptorSets,
+             sizeof(*bind->descriptor_sets) * descriptorSetCount);
+   }
+
+   if (dynamicOffsetCount) {
+      bind->dynamic_offsets =
+         vk_cmd_queue_zalloc(queue,
+                             sizeof(*bind->dynamic_offsets) *
+                             dynamicOffsetCount);
+      if (!bind->dynamic_offsets)
+         goto err;
+      memcpy(bind->dynamic_offsets, pDynamicOffsets,
+             sizeof(*bind->dynamic_offsets) * dynamicOffsetCount);
+   }
+
+   return;
+
+err:
+   vk_command_buffer_set_error(&wcb->vk, VK_ERROR_OUT_OF_HOST_MEMORY);
+}
+
+void
+wrapper_get_deferred_entrypoints(struct vk_device_entrypoint_table *entrypoints)
+{
+   *entrypoints = vk_cmd_enqueue_device_entrypoints;
+
+   entrypoints->CmdBindDescriptorSets = wrapper_enqueue_CmdBindDescriptorSets;
+
+   /* The runtime versions of these look inside vk_pipeline_layout,
+    * vk_descriptor_update_template or acceleration structure objects.
+    * Leave them to the trampolines.
+    */
+   entrypoints->CmdPushDescriptorSetKHR = NULL;
+   entrypoints->CmdPushDescriptorSetWithTemplateKHR = NULL;
+   entrypoints->CmdPushDescriptorSetWithTemplate2KHR = NULL;
+   entrypoints->CmdPushDescriptorSet2KHR = NULL;
+   entrypoints->CmdBuildAccelerationStructuresKHR = NULL;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_BeginCommandBuffer(VkCommandBuffer commandBuffer,
+                           const VkCommandBufferBeginInfo* pBeginInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (wcb->device->deferred_recording ||
+       wcb->device->coalesce_barriers) {
+      wrapper_command_buffer_wait(wcb);
+      vk_cmd_queue_reset(&wcb->vk.cmd_queue);
+      wcb->vk.record_result = VK_SUCCESS;
+      wcb->replay_result = VK_SUCCESS;
+   }
+
+   if (wcb->state)
+      wrapper_state_shadow_invalidate(wcb);
+
+   return wcb->device->dispatch_table.BeginCommandBuffer(wcb->dispatch_handle,
+                                                         pBeginInfo);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_EndCommandBuffer(VkCommandBuffer commandBuffer)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_device *device = wcb->device;
+
+   if (wcb->state)
+      wrapper_state_shadow_end(wcb);
+   if (device->coalesce_barriers)
+      wrapper_barrier_end(wcb);
+
+   if (!device->deferred_recording) {
+      wrapper_command_buffer_flush(wcb);
+      return device->dispatch_table.EndCommandBuffer(wcb->dispatch_handle);
+   }
+
+   if (vk_command_buffer_has_error(&wcb->vk)) {
+      vk_cmd_queue_reset(&wcb->vk.cmd_queue);
+      return vk_command_buffer_get_record_result(&wcb->vk);
+   }
+
+   util_queue_add_job(&device->record_queue, wcb, &wcb->replay_fence,
+                      wrapper_command_buffer_replay_job, NULL, 0);
+
+   return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_ResetCommandBuffer(VkCommandBuffer commandBuffer,
+                           VkCommandBufferResetFlags flags)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (wcb->device->deferred_recording ||
+       wcb->device->coalesce_barriers) {
+      wrapper_command_buffer_wait(wcb);
+      vk_cmd_queue_reset(&wcb->vk.cmd_queue);
+      wcb->vk.record_result = VK_SUCCESS;
+      wcb->replay_result = VK_SUCCESS;
+   }
+
+   if (wcb->state)
+      wrapper_state_shadow_invalidate(wcb);
+
+   return wcb->device->dispatch_table.ResetCommandBuffer(wcb->dispatch_handle,
+                                                         flags);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_CmdExecuteCommands(VkCommandBuffer commandBuffer,
+                           uint32_t commandBufferCount,
+                           const VkCommandBuffer* pCommandBuffers)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   VkCommandBuffer command_buffers[commandBufferCount];
+
+   for (int i = 0; i < commandBufferCount; i++) {
+      VK_FROM_HANDLE(wrapper_command_buffer, secondary, pCommandBuffers[i]);
+      if (wcb->device->deferred_recording)
+         wrapper_command_buffer_wait(secondary);
+      command_buffers[i] = secondary->dispatch_handle;
+   }
+
+   /* Secondaries leave the bound state undefined. */
+   if (wcb->state)
+      wrapper_state_shadow_invalidate(wcb);
+
+   if (wcb->device->deferred_recording) {
+      VkResult result = vk_enqueue_cmd_execute_commands(&wcb->vk.cmd_queue,
+                                                        commandBufferCount,
+                                                        command_buffers);
+      if (result != VK_SUCCESS)
+         vk_command_buffer_set_error(&wcb->vk, result);
+      return;
+   }
+
+   wrapper_command_buffer_flush(wcb);
+   wcb->device->dispatch_table.CmdExecuteCommands(
+      wcb->dispatch_handle, commandBufferCount, command_buffers);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CreateCommandPool(VkDevice _device,
+                          const VkCommandPoolCreateInfo* pCreateInfo,
+                          const VkAllocationCallbacks* pAllocator,
+                          VkCommandPool* pCommandPool)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   struct wrapper_command_pool *pool;
+   VkResult result;
+
+   pool = vk_object_zalloc(&device->vk, pAllocator, sizeof(*pool),
+                           VK_OBJECT_TYPE_COMMAND_POOL);
+   if (!pool)
+      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+
+   result = device->dispatch_table.CreateCommandPool(device->dispatch_handle,
+                                                     pCreateInfo,
+                                                     pAllocator,
+                                                     &pool->dispatch_handle);
+   if (result != VK_SUCCESS) {
+      vk_object_free(&device->vk, pAllocator, pool);
+      return result;
+   }
+
+   pool->device = device;
+   pool->alloc = pAllocator ? *pAllocator : device->vk.alloc;
+   pool->has_alloc = pAllocator != NULL;
+   list_inithead(&pool->command_buffers);
+   /* Command pools are externally synchronized, so the single-threaded
+    * slab is enough and allocation never touches the device lock.
+    */
+   slab_create(&pool->command_buffer_slab,
+               sizeof(struct wrapper_command_buffer), 64);
+
+   simple_mtx_lock(&device->resource_mutex);
+   list_addtail(&pool->link, &device->command_pool_list);
+   simple_mtx_unlock(&device->resource_mutex);
+
+   *pCommandPool = wrapper_command_pool_to_handle(pool);
+
+   return VK_SUCCESS;
+}
+
+static VkResult
+wrapper_command_buffer_create(struct wrapper_command_pool *pool,
+                              VkCommandBuffer dispatch_handle,
+                              VkCommandBuffer *pCommandBuffers) {
+   struct wrapper_device *device = pool->device;
+   struct wrapper_command_buffer *wcb;
+
+   wcb = slab_alloc_st(&pool->command_buffer_slab);
+   if (!wcb)
+      return vk_error(&device->vk, VK_ERROR_OUT_OF_HOST_MEMORY);
+
+   memset(wcb, 0, sizeof(*wcb));
+   vk_object_base_init(&device->vk, &wcb->vk.base,
+                       VK_OBJECT_TYPE_COMMAND_BUFFER);
+   vk_cmd_queue_init(&wcb->vk.cmd_queue, &device->vk.alloc);
+   util_queue_fence_init(&wcb->replay_fence);
+
+   wcb->device = device;
+   if (device->state_filter &&
+       wrapper_state_shadow_create(wcb) != VK_SUCCESS) {
+      util_queue_fence_destroy(&wcb->replay_fence);
+      vk_cmd_queue_finish(&wcb->vk.cmd_queue);
+      vk_object_base_finish(&wcb->vk.base);
+      slab_free_st(&pool->command_buffer_slab, wcb);
+      return vk_error(&device->vk, VK_ERROR_OUT_OF_HOST_MEMORY);
+   }
+
+   wcb->pool = pool;
+   wcb->dispatch_handle = dispatch_handle;
+   list_addtail(&wcb->link, &pool->command_buffers);
+
+   *pCommandBuffers = wrapper_command_buffer_to_handle(wcb);
+
+   return VK_SUCCESS;
+}
+
+static void
+wrapper_command_buffer_destroy(struct wrapper_command_buffer *wcb) {
+   struct wrapper_command_pool *pool = wcb->pool;
+
+   util_queue_fence_wait(&wcb->replay_fence);
+   util_queue_fence_destroy(&wcb->replay_fence);
+   vk_cmd_queue_finish(&wcb->vk.cmd_queue);
+   if (wcb->state)
+      wrapper_state_shadow_destroy(wcb);
+
+   list_del(&wcb->link);
+   vk_object_base_finish(&wcb->vk.base);
+   slab_free_st(&pool->command_buffer_slab, wcb);
+}
+
+void
+wrapper_command_pool_destroy(struct wrapper_command_pool *pool,
+                             const VkAllocationCallbacks* pAllocator) {
+   struct wrapper_device *device = pool->device;
+
+   list_for_each_entry_safe(struct wrapper_command_buffer, wcb,
+                            &pool->command_buffers, link) {
+      wrapper_command_buffer_destroy(wcb);
+   }
+   slab_destroy(&pool->command_buffer_slab);
+
+   device->dispatch_table.DestroyCommandPool(device->dispatch_handle,
+                                             pool->dispatch_handle,
+                                             pAllocator);
+   list_del(&pool->link);
+   vk_object_free(&device->vk, pAllocator, pool);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_AllocateCommandBuffers(VkDevice _device,
+                               const VkCommandBufferAllocateInfo* pAllocateInfo,
+                               VkCommandBuffer* pCommandBuffers)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VK_FROM_HANDLE(wrapper_command_pool, pool, pAllocateInfo->commandPool);
+   VkCommandBuffer dispatch_handles[pAllocateInfo->commandBufferCount];
+   VkCommandBufferAllocateInfo allocate_info = *pAllocateInfo;
+   VkResult result;
+   uint32_t i;
+
+   allocate_info.commandPool = pool->dispatch_handle;
+   result = device->dispatch_table.AllocateCommandBuffers(device->dispatch_handle,
+                                                          &allocate_info,
+                                                          dispatch_handles);
+   if (result != VK_SUCCESS)
+      return result;
+
+   for (i = 0; i < pAllocateInfo->commandBufferCount; i++) {
+      result = wrapper_command_buffer_create(pool, dispatch_handles[i],
+                                             &pCommandBuffers[i]);
+      if (result != VK_SUCCESS)
+         break;
+   }
+
+   if (result != VK_SUCCESS) {
+      device->dispatch_table.FreeCommandBuffers(device->dispatch_handle,
+                                                pool->dispatch_handle,
+                                                pAllocateInfo->commandBufferCount,
+                                                dispatch_handles);
+      for (int q = 0; q < i; q++) {
+         VK_FROM_HANDLE(wrapper_command_buffer, wcb, pCommandBuffers[q]);
+         wrapper_command_buffer_destroy(wcb);
+      }
+
+      for (i = 0; i < pAllocateInfo->commandBufferCount; i++) {
+         pCommandBuffers[i] = VK_NULL_HANDLE;
+      }
+   }
+
+   return result;
+}
+
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_FreeCommandBuffers(VkDevice _device,
+                           VkCommandPool commandPool,
+                           uint32_t commandBufferCount,
+                           const VkCommandBuffer* pCommandBuffers)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VK_FROM_HANDLE(wrapper_command_pool, pool, commandPool);
+   VkCommandBuffer dispatch_handles[commandBufferCount];
+
+   for (int i = 0; i < commandBufferCount; i++) {
+      VK_FROM_HANDLE(wrapper_command_buffer, wcb, pCommandBuffers[i]);
+      if (!wcb) {
+         dispatch_handles[i] = VK_NULL_HANDLE;
+         continue;
+      }
+      dispatch_handles[i] = wcb->dispatch_handle;
+      wrapper_command_buffer_destroy(wcb);
+   }
+
+   device->dispatch_table.FreeCommandBuffers(device->dispatch_handle,
+                                             pool->dispatch_handle,
+                                             commandBufferCount,
+                                             dispatch_handles);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_ResetCommandPool(VkDevice _device, VkCommandPool commandPool,
+                         VkCommandPoolResetFlags flags)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VK_FROM_HANDLE(wrapper_command_pool, pool, commandPool);
+
+   if (device->deferred_recording || device->coalesce_barriers) {
+      list_for_each_entry(struct wrapper_command_buffer, wcb,
+                          &pool->command_buffers, link) {
+         wrapper_command_buffer_wait(wcb);
+         vk_cmd_queue_reset(&wcb->vk.cmd_queue);
+         wcb->vk.record_result = VK_SUCCESS;
+         wcb->replay_result = VK_SUCCESS;
+      }
+   }
+
+   if (device->state_filter) {
+      list_for_each_entry(struct wrapper_command_buffer, wcb,
+                          &pool->command_buffers, link) {
+         wrapper_state_shadow_invalidate(wcb);
+      }
+   }
+
+   return device->dispatch_table.ResetCommandPool(device->dispatch_handle,
+                                                  pool->dispatch_handle,
+                                                  flags);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_TrimCommandPool(VkDevice _device, VkCommandPool commandPool,
+                        VkCommandPoolTrimFlags flags)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VK_FROM_HANDLE(wrapper_command_pool, pool, commandPool);
+
+   if (device->deferred_recording || device->coalesce_barriers) {
+      list_for_each_entry(struct wrapper_command_buffer, wcb,
+                          &pool->command_buffers, link) {
+         /* A pending replay still fills the queue. */
+         wrapper_command_buffer_wait(wcb);
+         vk_cmd_queue_trim(&wcb->vk.cmd_queue);
+      }
+   }
+
+   device->dispatch_table.TrimCommandPool(device->dispatch_handle,
+                                          pool->dispatch_handle,
+                                          flags);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_DestroyCommandPool(VkDevice _device, VkCommandPool commandPool,
+                           const VkAllocationCallbacks* pAllocator)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VK_FROM_HANDLE(wrapper_command_pool, pool, commandPool);
+
+   if (!pool)
+      return;
+
+   simple_mtx_lock(&device->resource_mutex);
+   wrapper_command_pool_destroy(pool, pAllocator);
+   simple_mtx_unlock(&device->resource_mutex);
+}
@@ -8,8 +8,10 @@
 #include "vk_extensions.h"
 #include "vk_queue.h"
 #include "vk_util.h"
+#include "util/hash_table.h"
 #include "util/list.h"
 #include "util/simple_mtx.h"
+#include "util/u_debug.h"
 
 const struct vk_device_extension_table wrapper_device_extensions =
 {
@@ -26,6 +28,7 @@ const struct vk_device_extension_table wrapper_device_extensions =
    .EXT_map_memory_placed = true,
    .KHR_maintenance4 = true,
    .KHR_map_memory2 = true,
+   .EXT_memory_budget = true,
 };
 
 const struct vk_device_extension_table wrapper_filter_extensions =
@@ -120,9 +123,11 @@ wrapper_create_device_queue(struct wrapper_device *device,
                j, &queue->dispatch_handle);
          }
          queue->device = device;
+         simple_mtx_init(&queue->submit_mutex, mtx_plain);
 
          result = vk_queue_init(&queue->vk, &device->vk, create_info, j);
          if (result != VK_SUCCESS) {
+            simple_mtx_destroy(&queue->submit_mutex);
             vk_free(&device->vk.alloc, queue);
             return result;
          }
@@ -144,8 +149,14 @@ wrapper_CreateDevice(VkPhysicalDevice physicalDevice,
    VkDeviceCreateInfo wrapper_create_info = *pCreateInfo;
    struct vk_device_dispatch_table dispatch_table;
    struct wrapper_device *device;
+   VkDeviceQueueCreateInfo queue_infos[pCreateInfo->queueCreateInfoCount];
+   VkDeviceQueueGlobalPriorityCreateInfoKHR
+      priority_infos[pCreateInfo->queueCreateInfoCount];
+   VkPhysicalDeviceGlobalPriorityQueryFeaturesKHR *priority_query;
+   VkPhysicalDeviceHostImageCopyFeaturesEXT *host_image_copy;
    VkPhysicalDeviceFeatures2 *pdf2;
    VkPhysicalDeviceFeatures *pdf;
+   unsigned record_threads;
    VkResult result;
 
    device = vk_zalloc2(&physical_device->instance->vk.alloc, pAllocator,
@@ -153,22 +164,82 @@ wrapper_CreateDevice(VkPhysicalDevice physicalDevice,
    if (!device)
       return vk_error(physical_device, VK_ERROR_OUT_OF_HOST_MEMORY);
 
-   list_inithead(&device->command_buffer_list);
+   list_inithead(&device->command_pool_list);
    list_inithead(&device->device_memory_list);
    simple_mtx_init(&device->resource_mutex, mtx_plain);
    device->physical = physical_device;
 
+   device->memory_usage = _mesa_hash_table_u64_create(NULL);
+   if (!device->memory_usage) {
+      simple_mtx_destroy(&device->resource_mutex);
+      vk_free2(&physical_device->instance->vk.alloc, pAllocator, device);
+      return vk_error(physical_device, VK_ERROR_OUT_OF_HOST_MEMORY);
+   }
+
+   record_threads = debug_get_num_option("WRAPPER_RECORD_THREADS", 0);
+   if (record_threads > 0) {
+      device->deferred_recording =
+         util_queue_init(&device->record_queue, "wrapper_rec", 64,
+                         record_threads,
+                         UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                         UTIL_QUEUE_INIT_LATENCY_CRITICAL, NULL);
+   }
+
+   device->state_filter = debug_get_bool_option("WRAPPER_STATE_FILTER",
+                                                false);
+   device->coalesce_barriers =
+      debug_get_bool_option("WRAPPER_COALESCE_BARRIERS", false);
+   device->load_store_ops = device->deferred_recording &&
+      debug_get_bool_option("WRAPPER_LOAD_STORE_OPS", false);
+   device->merge_rendering = device->deferred_recording &&
+      debug_get_bool_option("WRAPPER_MERGE_RENDERING", false);
+   device->transient_attachments =
+      debug_get_bool_option("WRAPPER_TRANSIENT_ATTACHMENTS", false);
+
    vk_device_dispatch_table_from_entrypoints(
       &dispatch_table, &wrapper_device_entrypoints, true);
    vk_device_dispatch_table_from_entrypoints(
       &dispatch_table, &wsi_device_entrypoints, false);
+   if (device->state_filter) {
+      struct vk_device_entrypoint_table filter_entrypoints;
+      wrapper_get_state_filter_entrypoints(&filter_entrypoints);
+      vk_device_dispatch_table_from_entrypoints(
+         &dispatch_table, &filter_entrypoints, false);
+   }
+   if (device->coalesce_barriers) {
+      struct vk_device_entrypoint_table barrier_entrypoints;
+      wrapper_get_barrier_entrypoints(&barrier_entrypoints);
+      vk_device_dispatch_table_from_entrypoints(
+         &dispatch_table, &barrier_entrypoints, false);
+   }
+   if (device->transient_attachments) {
+      struct vk_device_entrypoint_table transient_entrypoints;
+      wrapper_get_transient_entrypoints(&transient_entrypoints);
+      vk_device_dispatch_table_from_entrypoints(
+         &dispatch_table, &transient_entrypoints, false);
+   }
+   if (device->deferred_recording) {
+      struct vk_device_entrypoint_table deferred_entrypoints;
+      wrapper_get_deferred_entrypoints(&deferred_entrypoints);
+      vk_device_dispatch_table_from_entrypoints(
+         &dispatch_table, &deferred_entrypoints, false);
+      vk_device_dispatch_table_from_entrypoints(
+         &device->cmd_dispatch, &deferred_entrypoints, true);
+   }
    vk_device_dispatch_table_from_entrypoints(
       &dispatch_table, &wrapper_device_trampolines, false);
+   vk_device_dispatch_table_from_entrypoints(
+      &device->cmd_dispatch, &wrapper_device_trampolines,
+      !device->deferred_recording);
 
    result = vk_device_init(&device->vk, &physical_device->vk,
                            &dispatch_table, pCreateInfo, pAllocator);
 
    if (result != VK_SUCCESS) {
+      if (device->deferred_recording)
+         util_queue_destroy(&device->record_queue);
+      _mesa_hash_table_u64_destroy(device->memory_usage);
+      simple_mtx_destroy(&device->resource_mutex);
       vk_free2(&physical_device->instance->vk.alloc, pAllocator,
                device);
       return vk_error(physical_device, result);
@@ -243,11 +314,47 @@ wrapper_CreateDevice(VkPhysicalDevice physicalDevice,
        pdf2->features.shaderCullDistance &=
             physical_device->base_supported_features.shaderCullDistance;
    }
+   host_image_copy = __vk_find_struct((void *)pCreateInfo->pNext,
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT);
+   if (host_image_copy && host_image_copy->hostImageCopy) {
+       host_image_copy->hostImageCopy &=
+            physical_device->base_supported_features.hostImageCopy;
+   }
+   priority_query = __vk_find_struct((void *)pCreateInfo->pNext,
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GLOBAL_PRIORITY_QUERY_FEATURES_KHR);
+   if (priority_query && priority_query->globalPriorityQuery) {
+       priority_query->globalPriorityQuery &=
+            physical_device->base_supported_features.globalPriorityQuery;
+   }
+
+   if (physical_device->queue_priority &&
+       wrapper_queue_priority_create_infos(physical_device, pCreateInfo,
+                                           queue_infos, priority_infos)) {
+      wrapper_create_info.pQueueCreateInfos = queue_infos;
+      if (!device->vk.enabled_extensions.KHR_global_priority &&
+          !device->vk.enabled_extensions.EXT_global_priority) {
+         wrapper_enable_extensions[wrapper_enable_extension_count++] =
+            wrapper_queue_priority_extension(physical_device);
+         wrapper_create_info.enabledExtensionCount =
+            wrapper_enable_extension_count;
+      }
+   }
    
    result = physical_device->dispatch_table.CreateDevice(
       physical_device->dispatch_handle, &wrapper_create_info,
          pAllocator, &device->dispatch_handle);
 
+   /* Permissions can change after we probed them, so never fail device
+    * creation over a priority the application didn't ask for.
+    */
+   if (result == VK_ERROR_NOT_PERMITTED_KHR &&
+       wrapper_create_info.pQueueCreateInfos == queue_infos) {
+      wrapper_create_info.pQueueCreateInfos = pCreateInfo->pQueueCreateInfos;
+      result = physical_device->dispatch_table.CreateDevice(
+         physical_device->dispatch_handle, &wrapper_create_info,
+            pAllocator, &device->dispatch_handle);
+   }
+
    if (result != VK_SUCCESS) {
       wrapper_DestroyDevice(wrapper_device_to_handle(device),
                             &device->vk.alloc);
@@ -265,6 +372,10 @@ wrapper_CreateDevice(VkPhysicalDevice physicalDevice,
                             &device->vk.alloc);
       return vk_error(physical_device, result);
    }
+
+   wrapper_shader_module_cache_init(device);
+   wrapper_transient_init(device);
+   wrapper_host_copy_init(device);
    
    *pDevice = wrapper_device_to_handle(device);
 
@@ -308,6 +419,7 @@ wrapper_QueueSubmit(VkQueue _queue, uint32_t submitCount,
    VK_FROM_HANDLE(wrapper_queue, queue, _queue);
    VkSubmitInfo wrapper_submits[submitCount];
    VkCommandBuffer *command_buffers;
+   VkResult replay_result = VK_SUCCESS;
    VkResult result;
 
    for (int i = 0; i < submitCount; i++) {
@@ -317,14 +429,25 @@ wrapper_QueueSubmit(VkQueue _queue, uint32_t submitCount,
       for (int j = 0; j < submit_info->commandBufferCount; j++) {
          VK_FROM_HANDLE(wrapper_command_buffer, wcb,
                         submit_info->pCommandBuffers[j]);
+         if (queue->device->deferred_recording) {
+            result = wrapper_command_buffer_wait(wcb);
+            if (result != VK_SUCCESS)
+               replay_result = result;
+         }
          command_buffers[j] = wcb->dispatch_handle;
       }
       wrapper_submits[i] = pSubmits[i];
       wrapper_submits[i].pCommandBuffers = command_buffers;
    }
 
-   result = queue->device->dispatch_table.QueueSubmit(
-      queue->dispatch_handle, submitCount, wrapper_submits, fence);
+   if (replay_result != VK_SUCCESS) {
+      result = replay_result;
+   } else {
+      simple_mtx_lock(&queue->submit_mutex);
+      result = queue->device->dispatch_table.QueueSubmit(
+         queue->dispatch_handle, submitCount, wrapper_submits, fence);
+      simple_mtx_unlock(&queue->submit_mutex);
+   }
 
    for (int i = 0; i < submitCount; i++)
       free((void *)wrapper_submits[i].pCommandBuffers);
@@ -339,6 +462,7 @@ wrapper_QueueSubmit2(VkQueue _queue, uint32_t submitCount,
    VK_FROM_HANDLE(wrapper_queue, queue, _queue);
    VkSubmitInfo2 wrapper_submits[submitCount];
    VkCommandBufferSubmitInfo *command_buffers;
+   VkResult replay_result = VK_SUCCESS;
    VkResult result;
 
    for (int i = 0; i < submitCount; i++) {
@@ -348,6 +472,11 @@ wrapper_QueueSubmit2(VkQueue _queue, uint32_t submitCount,
       for (int j = 0; j < submit_info->commandBufferInfoCount; j++) {
          VK_FROM_HANDLE(wrapper_command_buffer, wcb,
                         submit_info->pCommandBufferInfos[j].commandBuffer);
+         if (queue->device->deferred_recording) {
+            result = wrapper_command_buffer_wait(wcb);
+            if (result != VK_SUCCESS)
+               replay_result = result;
+         }
          command_buffers[j] = pSubmits[i].pCommandBufferInfos[j];
          command_buffers[j].commandBuffer = wcb->dispatch_handle;
       }
@@ -355,8 +484,14 @@ wrapper_QueueSubmit2(VkQueue _queue, uint32_t submitCount,
       wrapper_submits[i].pCommandBufferInfos = command_buffers;
    }
 
-   result = queue->device->dispatch_table.QueueSubmit2(
-      queue->dispatch_handle, submitCount, wrapper_submits, fence);
+   if (replay_result != VK_SUCCESS) {
+      result = replay_result;
+   } else {
+      simple_mtx_lock(&queue->submit_mutex);
+      result = queue->device->dispatch_table.QueueSubmit2(
+         queue->dispatch_handle, submitCount, wrapper_submits, fence);
+      simple_mtx_unlock(&queue->submit_mutex);
+   }
 
    for (int i = 0; i < submitCount; i++)
       free((void *)wrapper_submits[i].pCommandBufferInfos);
@@ -364,145 +499,6 @@ wrapper_QueueSubmit2(VkQueue _queue, uint32_t submitCount,
    return result;
 }
 
-
-VKAPI_ATTR void VKAPI_CALL
-wrapper_CmdExecuteCommands(VkCommandBuffer commandBuffer,
-                           uint32_t commandBufferCount,
-                           const VkCommandBuffer* pCommandBuffers)
-{
-   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
-   VkCommandBuffer command_buffers[commandBufferCount];
-
-   for (int i = 0; i < commandBufferCount; i++) {
-      command_buffers[i] =
-         wrapper_command_buffer_from_handle(pCommandBuffers[i])->dispatch_handle;
-   }
-   wcb->device->dispatch_table.CmdExecuteCommands(
-      wcb->dispatch_handle, commandBufferCount, command_buffers);
-}
-
-static VkResult
-wrapper_command_buffer_create(struct wrapper_device *device,
-                              VkCommandPool pool,
-                              VkCommandBuffer dispatch_handle,
-                              VkCommandBuffer *pCommandBuffers) {
-   struct wrapper_command_buffer *wcb;
-   wcb = vk_object_zalloc(&device->vk, &device->vk.alloc,
-                          sizeof(struct wrapper_command_buffer),
-                          VK_OBJECT_TYPE_COMMAND_BUFFER);
-   if (!wcb)
-      return vk_error(&device->vk, VK_ERROR_OUT_OF_HOST_MEMORY);
-
-   wcb->device = device;
-   wcb->pool = pool;
-   wcb->dispatch_handle = dispatch_handle;
-   list_add(&wcb->link, &device->command_buffer_list);
-
-   *pCommandBuffers = wrapper_command_buffer_to_handle(wcb);
-
-   return VK_SUCCESS;
-}
-
-static void
-wrapper_command_buffer_destroy(struct wrapper_device *device,
-                               struct wrapper_command_buffer *wcb) {
-   list_del(&wcb->link);
-   vk_object_free(&device->vk, &device->vk.alloc, wcb);
-}
-
-VKAPI_ATTR VkResult VKAPI_CALL
-wrapper_AllocateCommandBuffers(VkDevice _device,
-                               const VkCommandBufferAllocateInfo* pAllocateInfo,
-                               VkCommandBuffer* pCommandBuffers)
-{
-   VK_FROM_HANDLE(wrapper_device, device, _device);
-   VkCommandBuffer dispatch_handles[pAllocateInfo->commandBufferCount];
-   VkResult result;
-   uint32_t i;
-   
-   result = device->dispatch_table.AllocateCommandBuffers(device->dispatch_handle,
-                                                          pAllocateInfo,
-                                                          dispatch_handles);
-   if (result != VK_SUCCESS)
-      return result;
-
-   simple_mtx_lock(&device->resource_mutex);
-
-   for (i = 0; i < pAllocateInfo->commandBufferCount; i++) {
-      result = wrapper_command_buffer_create(device,
-                                             pAllocateInfo->commandPool,
-                                             dispatch_handles[i],
-                                             &pCommandBuffers[i]);
-      if (result != VK_SUCCESS)
-         break;
-   }
-
-   if (result != VK_SUCCESS) {
-      device->dispatch_table.FreeCommandBuffers(device->dispatch_handle,
-                                                pAllocateInfo->commandPool,
-                                                pAllocateInfo->commandBufferCount,
-                                                dispatch_handles);
-      for (int q = 0; q < i; q++) {
-         VK_FROM_HANDLE(wrapper_command_buffer, wcb, pCommandBuffers[q]);
-         wrapper_command_buffer_destroy(device, wcb);
-      }
-
-      for (i = 0; i < pAllocateInfo->commandBufferCount; i++) {
-         pCommandBuffers[i] = VK_NULL_HANDLE;
-      }
-   }
-
-   simple_mtx_unlock(&device->resource_mutex);
-
-   return result;
-}
-
-
-VKAPI_ATTR void VKAPI_CALL
-wrapper_FreeCommandBuffers(VkDevice _device,
-                           VkCommandPool commandPool,
-                           uint32_t commandBufferCount,
-                           const VkCommandBuffer* pCommandBuffers)
-{
-   VK_FROM_HANDLE(wrapper_device, device, _device);
-   VkCommandBuffer dispatch_handles[commandBufferCount];
-
-   simple_mtx_lock(&device->resource_mutex);
-
-   for (int i = 0; i < commandBufferCount; i++) {
-      VK_FROM_HANDLE(wrapper_command_buffer, wcb, pCommandBuffers[i]);
-      dispatch_handles[i] = wcb->dispatch_handle;
-      wrapper_command_buffer_destroy(device, wcb);
-   }
-
-   simple_mtx_unlock(&device->resource_mutex);
-
-   device->dispatch_table.FreeCommandBuffers(device->dispatch_handle,
-                                             commandPool, commandBufferCount,
-                                             dispatch_handles);
-}
-
-VKAPI_ATTR void VKAPI_CALL
-wrapper_DestroyCommandPool(VkDevice _device, VkCommandPool commandPool,
-                           const VkAllocationCallbacks* pAllocator)
-{
-   VK_FROM_HANDLE(wrapper_device, device, _device);
-
-   simple_mtx_lock(&device->resource_mutex);
-
-   list_for_each_entry_safe(struct wrapper_command_buffer, wcb,
-                            &device->command_buffer_list, link) {
-      if (wcb->pool == commandPool) {
-         wrapper_command_buffer_destroy(device, wcb);
-      }
-   }
-
-   simple_mtx_unlock(&device->resource_mutex);
-
-   device->dispatch_table.DestroyCommandPool(device->dispatch_handle,
-                                             commandPool, pAllocator);
-}
-
 VKAPI_ATTR void VKAPI_CALL
 wrapper_DestroyDevice(VkDevice _device, const VkAllocationCallbacks* pAllocator)
 {
@@ -510,19 +506,37 @@ wrapper_DestroyDevice(VkDevice _device, const VkAllocationCallbacks* pAllocator)
 
    simple_mtx_lock(&device->resource_mutex);
 
-   list_for_each_entry_safe(struct wrapper_command_buffer, wcb,
-                            &device->command_buffer_list, link) {
-      wrapper_command_buffer_destroy(device, wcb);
+   list_for_each_entry_safe(struct wrapper_command_pool, pool,
+                            &device->command_pool_list, link) {
+      wrapper_command_pool_destroy(pool, pool->has_alloc ? &pool->alloc
+                                                         : NULL);
    }
    list_for_each_entry_safe(struct wrapper_device_memory, mem,
                             &device->device_memory_list, link) {
       wrapper_device_memory_destroy(mem);
    }
+   wrapper_memory_usage_finish(device);
 
    simple_mtx_unlock(&device->resource_mutex);
 
-   list_for_each_entry_safe(struct vk_queue, queue, &device->vk.queues, link) {
-      vk_queue_finish(queue);
+   wrapper_shader_module_cache_finish(device);
+   wrapper_transient_finish(device);
+   wrapper_host_copy_finish(device);
+
+   if (device->deferred_recording)
+      util_queue_destroy(&device->record_queue);
+
+   if (device->state_filter)
+      wrapper_state_filter_report(device);
+   if (device->coalesce_barriers)
+      wrapper_barrier_report(device);
+   if (device->load_store_ops || device->merge_rendering)
+      wrapper_load_store_report(device);
+
+   list_for_each_entry_safe(struct wrapper_queue, queue, &device->vk.queues,
+                            vk.link) {
+      simple_mtx_destroy(&queue->submit_mutex);
+      vk_queue_finish(&queue->vk);
       vk_free2(&device->vk.alloc, pAllocator, queue);
    }
    if (device->dispatch_handle != VK_NULL_HANDLE) {
@@ -545,6 +559,8 @@ unwrap_device_object(VkObjectType objectType,
       return (uint64_t)(uintptr_t)wrapper_queue_from_handle((VkQueue)(uintptr_t)objectHandle)->dispatch_handle;
    case VK_OBJECT_TYPE_COMMAND_BUFFER:
       return (uint64_t)(uintptr_t)wrapper_command_buffer_from_handle((VkCommandBuffer)(uintptr_t)objectHandle)->dispatch_handle;
+   case VK_OBJECT_TYPE_COMMAND_POOL:
+      return (uint64_t)wrapper_command_pool_from_handle((VkCommandPool)(uintptr_t)objectHandle)->dispatch_handle;
    default:
       return objectHandle;
    }
@@ -5,7 +5,12 @@
 #include "vk_common_entrypoints.h"
 #undef native_handle_t
 #undef buffer_handle_t
+#include "util/hash_table.h"
 #include "util/os_file.h"
+#include "util/os_misc.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/u_atomic.h"
 #include "vk_util.h"
 
 #include <android/hardware_buffer.h>
@@ -294,12 +299,184 @@ wrapper_device_memory_from_handle(struct wrapper_device *device,
    return mem;
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL
-wrapper_AllocateMemory(VkDevice _device,
-                       const VkMemoryAllocateInfo* pAllocateInfo,
-                       const VkAllocationCallbacks* pAllocator,
-                       VkDeviceMemory* pMemory) {
-   VK_FROM_HANDLE(wrapper_device, device, _device);
+/* Returns the dma-buf backing a wrapper allocation, or -1 if the driver
+ * allocated the memory itself.  The fd stays owned by the allocation.
+ */
+int
+wrapper_device_memory_get_dmabuf(struct wrapper_device *device,
+                                 VkDeviceMemory memory, size_t *size)
+{
+   struct wrapper_device_memory *mem =
+      wrapper_device_memory_from_handle(device, memory);
+
+   if (!mem || mem->dmabuf_fd < 0)
+      return -1;
+
+   *size = mem->alloc_size > 0 ?
+      mem->alloc_size : lseek(mem->dmabuf_fd, 0, SEEK_END);
+   return mem->dmabuf_fd;
+}
+
+struct wrapper_memory_usage {
+   uint32_t heap_index;
+   VkDeviceSize size;
+   bool lazy;
+};
+
+/* Every allocation made through the wrapper, including the dma-buf and
+ * AHardwareBuffer backed ones the driver only sees as imports, is
+ * accounted against the heap of the memory type the application asked
+ * for.  This is what VK_EXT_memory_budget reports as heap usage.
+ */
+static void
+wrapper_memory_usage_add(struct wrapper_device *device,
+                         VkDeviceMemory memory,
+                         const VkMemoryAllocateInfo* pAllocateInfo,
+                         bool lazy)
+{
+   struct wrapper_physical_device *pdevice = device->physical;
+   struct wrapper_memory_usage *usage;
+
+   simple_mtx_lock(&device->resource_mutex);
+   usage = ralloc(device->memory_usage, struct wrapper_memory_usage);
+   if (usage) {
+      usage->heap_index = pdevice->memory_properties.memoryTypes[
+         pAllocateInfo->memoryTypeIndex].heapIndex;
+      usage->size = pAllocateInfo->allocationSize;
+      usage->lazy = lazy;
+      _mesa_hash_table_u64_insert(device->memory_usage,
+                                  (uint64_t)memory, usage);
+      p_atomic_add(&pdevice->heap_usage[usage->heap_index], usage->size);
+   }
+   simple_mtx_unlock(&device->resource_mutex);
+}
+
+static void
+wrapper_memory_usage_remove(struct wrapper_device *device,
+                            VkDeviceMemory memory)
+{
+   struct wrapper_physical_device *pdevice = device->physical;
+   struct wrapper_memory_usage *usage;
+
+   simple_mtx_lock(&device->resource_mutex);
+   usage = _mesa_hash_table_u64_search(device->memory_usage,
+                                       (uint64_t)memory);
+   if (usage) {
+      if (usage->lazy)
+         wrapper_transient_free(device, memory);
+      p_atomic_add(&pdevice->heap_usage[usage->heap_index], -usage->size);
+      _mesa_hash_table_u64_remove(device->memory_usage, (uint64_t)memory);
+      ralloc_free(usage);
+   }
+   simple_mtx_unlock(&device->resource_mutex);
+}
+
+void
+wrapper_memory_usage_finish(struct wrapper_device *device)
+{
+   struct wrapper_physical_device *pdevice = device->physical;
+
+   /* Whatever the application leaked goes away with the device. */
+   hash_table_u64_foreach(device->memory_usage, entry) {
+      struct wrapper_memory_usage *usage = entry.data;
+      p_atomic_add(&pdevice->heap_usage[usage->heap_index], -usage->size);
+   }
+   _mesa_hash_table_u64_destroy(device->memory_usage);
+}
+
+/* How much more memory the system can give us before the low memory
+ * killer gets involved: MemAvailable minus a reserve for the rest of the
+ * system, scaled down by the share of time tasks recently spent stalled
+ * on memory according to PSI.
+ */
+static uint64_t
+wrapper_memory_headroom(void)
+{
+   uint64_t total, available, reserve;
+   float some_avg10 = 0.0f;
+   char *pressure;
+
+   if (!os_get_total_physical_memory(&total) ||
+       !os_get_available_system_memory(&available))
+      return UINT64_MAX;
+
+   reserve = total / 16;
+   available = available > reserve ? available - reserve : 0;
+
+   pressure = os_read_file("/proc/pressure/memory", NULL);
+   if (pressure) {
+      if (sscanf(pressure, "some avg10=%f", &some_avg10) != 1)
+         some_avg10 = 0.0f;
+      free(pressure);
+   }
+   some_avg10 = CLAMP(some_avg10, 0.0f, 100.0f);
+
+   return available * (1.0 - some_avg10 / 100.0);
+}
+
+void
+wrapper_get_memory_budget(struct wrapper_physical_device *pdevice,
+                          VkPhysicalDeviceMemoryBudgetPropertiesEXT *budget,
+                          bool driver_budget)
+{
+   const VkPhysicalDeviceMemoryProperties *props =
+      &pdevice->memory_properties;
+   uint64_t now = os_time_get_nano();
+   uint64_t headroom, total_size = 0;
+
+   /* Applications tend to query the budget every frame; don't hit procfs
+    * more often than needed.
+    */
+   simple_mtx_lock(&pdevice->budget_mutex);
+   if (now - pdevice->budget_timestamp > 100 * 1000 * 1000 ||
+       !pdevice->budget_timestamp) {
+      pdevice->budget_headroom = wrapper_memory_headroom();
+      pdevice->budget_timestamp = now;
+   }
+   headroom = pdevice->budget_headroom;
+   simple_mtx_unlock(&pdevice->budget_mutex);
+
+   for (uint32_t i = 0; i < props->memoryHeapCount; i++)
+      total_size += props->memoryHeaps[i].size;
+
+   for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++) {
+      uint64_t usage, heap_budget, share;
+
+      if (i >= props->memoryHeapCount) {
+         budget->heapUsage[i] = 0;
+         budget->heapBudget[i] = 0;
+         continue;
+      }
+
+      /* Every heap is carved out of the same system memory, so the
+       * headroom is split between them in proportion to their size instead
+       * of being counted once per heap.
+       */
+      share = headroom;
+      if (headroom != UINT64_MAX && total_size) {
+         share = (double)headroom * props->memoryHeaps[i].size /
+                 total_size;
+      }
+
+      usage = p_atomic_read(&pdevice->heap_usage[i]);
+      heap_budget = MIN2(props->memoryHeaps[i].size,
+                         usage + MIN2(share, UINT64_MAX - usage));
+
+      if (driver_budget) {
+         usage = MAX2(usage, budget->heapUsage[i]);
+         heap_budget = MIN2(heap_budget, budget->heapBudget[i]);
+      }
+
+      budget->heapUsage[i] = usage;
+      budget->heapBudget[i] = MAX2(heap_budget, usage);
+   }
+}
+
+static VkResult
+wrapper_allocate_memory(struct wrapper_device *device,
+                        const VkMemoryAllocateInfo* pAllocateInfo,
+                        const VkAllocationCallbacks* pAllocator,
+                        VkDeviceMemory* pMemory) {
    struct wrapper_device_memory *mem;
    VkResult result;
 
@@ -362,6 +539,28 @@ fallback:
       pAllocateInfo, pAllocator, pMemory);
 }
 
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_AllocateMemory(VkDevice _device,
+                       const VkMemoryAllocateInfo* pAllocateInfo,
+                       const VkAllocationCallbacks* pAllocator,
+                       VkDeviceMemory* pMemory) {
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VkMemoryAllocateInfo lazy_info;
+   bool lazy;
+   VkResult result;
+
+   lazy = wrapper_transient_allocate_info(device, pAllocateInfo, &lazy_info);
+   if (lazy)
+      pAllocateInfo = &lazy_info;
+
+   result = wrapper_allocate_memory(device, pAllocateInfo, pAllocator,
+                                    pMemory);
+   if (result == VK_SUCCESS)
+      wrapper_memory_usage_add(device, *pMemory, pAllocateInfo, lazy);
+
+   return result;
+}
+
 VKAPI_ATTR void VKAPI_CALL
 wrapper_FreeMemory(VkDevice _device, VkDeviceMemory _memory,
                    const VkAllocationCallbacks* pAllocator)
@@ -369,6 +568,9 @@ wrapper_FreeMemory(VkDevice _device, VkDeviceMemory _memory,
    VK_FROM_HANDLE(wrapper_device, device, _device);
    struct wrapper_device_memory *mem;
 
+   if (_memory != VK_NULL_HANDLE)
+      wrapper_memory_usage_remove(device, _memory);
+
    mem = wrapper_device_memory_from_handle(device, _memory);
    if (mem) {
       mem->alloc = pAllocator;
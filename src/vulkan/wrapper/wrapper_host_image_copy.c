@@ -0,0 +1,1022 @@
+#include "wrapper_private.h"
+#include "wrapper_entrypoints.h"
+#include "vk_alloc.h"
+#include "vk_format.h"
+#include "vk_util.h"
+#include "util/bitscan.h"
+#include "util/hash_table.h"
+#include "util/log.h"
+#include "util/ralloc.h"
+#include "util/u_atomic.h"
+#include "util/u_math.h"
+
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "drm-uapi/dma-buf.h"
+
+/* VK_EXT_host_image_copy emulation: enabled with WRAPPER_HOST_IMAGE_COPY=1
+ * on drivers that don't have the extension.
+ *
+ * Images created with HOST_TRANSFER usage get TRANSFER_SRC/DST instead.
+ * Linear images bound to memory the wrapper allocated from a dma-buf
+ * are copied with memcpy through a mapping of that dma-buf, made once per
+ * copy call and bracketed with DMA_BUF_IOCTL_SYNC so CPU caches are kept
+ * coherent with the device.  Everything
+ * else goes through a staging buffer and a copy on the first queue,
+ * waited on before returning, so applications still never have to
+ * record or submit anything themselves.
+ *
+ * The memcpy layout we report is simply the tightly packed one.
+ */
+
+const VkImageLayout wrapper_host_copy_src_layouts[] = {
+   VK_IMAGE_LAYOUT_GENERAL,
+   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+};
+const uint32_t wrapper_host_copy_src_layout_count =
+   ARRAY_SIZE(wrapper_host_copy_src_layouts);
+
+const VkImageLayout wrapper_host_copy_dst_layouts[] = {
+   VK_IMAGE_LAYOUT_GENERAL,
+   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+};
+const uint32_t wrapper_host_copy_dst_layout_count =
+   ARRAY_SIZE(wrapper_host_copy_dst_layouts);
+
+struct wrapper_host_copy_image {
+   VkFormat format;
+   VkImageTiling tiling;
+   VkExtent3D extent;
+   uint32_t array_layers;
+   VkDeviceMemory memory;
+   VkDeviceSize offset;
+};
+
+struct wrapper_host_copy {
+   simple_mtx_t mutex;
+   struct hash_table_u64 *images;
+
+   struct wrapper_queue *queue;
+   VkCommandPool command_pool;
+   VkCommandBuffer command_buffer;
+   VkFence fence;
+
+   VkBuffer staging;
+   VkDeviceMemory staging_memory;
+   VkDeviceSize staging_size;
+   void *staging_map;
+
+   uint64_t bytes_direct;
+   uint64_t bytes_staged;
+};
+
+/* Host side layout of one region, in bytes. */
+struct wrapper_host_copy_layout {
+   uint32_t row_size;
+   uint32_t row_count;
+   uint32_t depth;
+   uint32_t layer_count;
+   uint64_t row_pitch;
+   uint64_t slice_pitch;
+   uint64_t layer_pitch;
+};
+
+static struct wrapper_host_copy_image *
+wrapper_host_copy_image(struct wrapper_device *device, VkImage image)
+{
+   struct wrapper_host_copy_image *himage;
+
+   simple_mtx_lock(&device->host_copy->mutex);
+   himage = _mesa_hash_table_u64_search(device->host_copy->images,
+                                        (uint64_t)image);
+   simple_mtx_unlock(&device->host_copy->mutex);
+
+   return himage;
+}
+
+static void
+wrapper_host_copy_get_layout(const struct wrapper_host_copy_image *himage,
+                             const VkImageSubresourceLayers *subresource,
+                             VkExtent3D extent,
+                             uint32_t row_length, uint32_t image_height,
+                             struct wrapper_host_copy_layout *layout)
+{
+   VkFormat format = vk_format_get_aspect_format(himage->format,
+                                                 subresource->aspectMask);
+   uint32_t block_width = vk_format_get_blockwidth(format);
+   uint32_t block_height = vk_format_get_blockheight(format);
+   uint32_t block_size = vk_format_get_blocksize(format);
+
+   if (!row_length)
+      row_length = extent.width;
+   if (!image_height)
+      image_height = extent.height;
+
+   layout->row_size = DIV_ROUND_UP(extent.width, block_width) * block_size;
+   layout->row_count = DIV_ROUND_UP(extent.height, block_height);
+   layout->depth = extent.depth;
+   layout->layer_count =
+      subresource->layerCount == VK_REMAINING_ARRAY_LAYERS ?
+      himage->array_layers - subresource->baseArrayLayer :
+      subresource->layerCount;
+   layout->row_pitch =
+      (uint64_t)DIV_ROUND_UP(row_length, block_width) * block_size;
+   layout->slice_pitch =
+      layout->row_pitch * DIV_ROUND_UP(image_height, block_height);
+   layout->layer_pitch = layout->slice_pitch * extent.depth;
+}
+
+static uint64_t
+wrapper_host_copy_packed_size(const struct wrapper_host_copy_layout *layout)
+{
+   return (uint64_t)layout->row_size * layout->row_count * layout->depth *
+          layout->layer_count;
+}
+
+/* Copies between host memory laid out as described by layout and a
+ * destination/source with the given pitches.
+ */
+static void
+wrapper_host_copy_rows(const struct wrapper_host_copy_layout *layout,
+                       void *host, uint64_t dev_row_pitch,
+                       uint64_t dev_slice_pitch, uint64_t dev_layer_pitch,
+                       void *dev, bool to_device)
+{
+   for (uint32_t l = 0; l < layout->layer_count; l++) {
+      for (uint32_t z = 0; z < layout->depth; z++) {
+         for (uint32_t y = 0; y < layout->row_count; y++) {
+            uint8_t *h = (uint8_t *)host + l * layout->layer_pitch +
+                         z * layout->slice_pitch + y * layout->row_pitch;
+            uint8_t *d = (uint8_t *)dev + l * dev_layer_pitch +
+                         z * dev_slice_pitch + y * dev_row_pitch;
+
+            if (to_device)
+               memcpy(d, h, layout->row_size);
+            else
+               memcpy(h, d, layout->row_size);
+         }
+      }
+   }
+}
+
+/* A CPU mapping of the dma-buf behind a linear image, for the direct
+ * path.
+ */
+struct wrapper_host_copy_map {
+   uint8_t *ptr;
+   size_t size;
+   int fd;
+   uint64_t sync_flags;
+};
+
+static void
+wrapper_host_copy_sync(const struct wrapper_host_copy_map *map, uint64_t flag)
+{
+   struct dma_buf_sync sync = {
+      .flags = map->sync_flags | flag,
+   };
+   int ret;
+
+   do {
+      ret = ioctl(map->fd, DMA_BUF_IOCTL_SYNC, &sync);
+   } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+}
+
+/* Returns false if the image can't take the direct path. */
+static bool
+wrapper_host_copy_map(struct wrapper_device *device,
+                      const struct wrapper_host_copy_image *himage,
+                      bool to_device, struct wrapper_host_copy_map *map)
+{
+   void *ptr;
+
+   if (himage->tiling != VK_IMAGE_TILING_LINEAR ||
+       himage->memory == VK_NULL_HANDLE)
+      return false;
+
+   map->fd = wrapper_device_memory_get_dmabuf(device, himage->memory,
+                                              &map->size);
+   if (map->fd < 0)
+      return false;
+
+   ptr = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd,
+              0);
+   if (ptr == MAP_FAILED)
+      return false;
+
+   map->ptr = ptr;
+   map->sync_flags = to_device ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ;
+   wrapper_host_copy_sync(map, DMA_BUF_SYNC_START);
+   return true;
+}
+
+static void
+wrapper_host_copy_unmap(struct wrapper_host_copy_map *map)
+{
+   wrapper_host_copy_sync(map, DMA_BUF_SYNC_END);
+   munmap(map->ptr, map->size);
+}
+
+/* Direct path: a linear image in wrapper-allocated dma-buf memory. */
+static void
+wrapper_host_copy_direct(struct wrapper_device *device,
+                         const struct wrapper_host_copy_image *himage,
+                         const struct wrapper_host_copy_map *map,
+                         VkImage image,
+                         const VkImageSubresourceLayers *subresource,
+                         VkOffset3D offset,
+                         const struct wrapper_host_copy_layout *layout,
+                         void *host, bool to_device)
+{
+   VkFormat format = vk_format_get_aspect_format(himage->format,
+                                                 subresource->aspectMask);
+   VkSubresourceLayout sub_layout;
+
+   device->dispatch_table.GetImageSubresourceLayout(
+      device->dispatch_handle, image,
+      &(VkImageSubresource) {
+         .aspectMask = subresource->aspectMask,
+         .mipLevel = subresource->mipLevel,
+         .arrayLayer = subresource->baseArrayLayer,
+      }, &sub_layout);
+
+   wrapper_host_copy_rows(layout, host, sub_layout.rowPitch,
+                          sub_layout.depthPitch, sub_layout.arrayPitch,
+                          map->ptr + himage->offset + sub_layout.offset +
+                          offset.z * sub_layout.depthPitch +
+                          offset.y / vk_format_get_blockheight(format) *
+                          sub_layout.rowPitch +
+                          offset.x / vk_format_get_blockwidth(format) *
+                          vk_format_get_blocksize(format),
+                          to_device);
+
+   p_atomic_add(&device->host_copy->bytes_direct,
+                wrapper_host_copy_packed_size(layout));
+}
+
+static uint32_t
+wrapper_host_copy_memory_type(struct wrapper_device *device,
+                              uint32_t memory_type_bits,
+                              VkMemoryPropertyFlags flags)
+{
+   const VkPhysicalDeviceMemoryProperties *props =
+      &device->physical->memory_properties;
+
+   u_foreach_bit(i, memory_type_bits) {
+      if (i < props->memoryTypeCount &&
+          (props->memoryTypes[i].propertyFlags & flags) == flags)
+         return i;
+   }
+
+   return UINT32_MAX;
+}
+
+static VkResult
+wrapper_host_copy_reserve(struct wrapper_device *device, VkDeviceSize size)
+{
+   struct wrapper_host_copy *hc = device->host_copy;
+   VkMemoryRequirements reqs;
+   uint32_t memory_type;
+   VkResult result;
+
+   if (size <= hc->staging_size)
+      return VK_SUCCESS;
+
+   if (hc->staging_memory)
+      device->dispatch_table.FreeMemory(device->dispatch_handle,
+                                        hc->staging_memory, NULL);
+   if (hc->staging)
+      device->dispatch_table.DestroyBuffer(device->dispatch_handle,
+                                           hc->staging, NULL);
+   hc->staging = VK_NULL_HANDLE;
+   hc->staging_memory = VK_NULL_HANDLE;
+   hc->staging_size = 0;
+
+   size = util_next_power_of_two64(MAX2(size, 1 << 20));
+
+   result = device->dispatch_table.CreateBuffer(
+      device->dispatch_handle,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .size = size,
+         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      }, NULL, &hc->staging);
+   if (result != VK_SUCCESS)
+      return result;
+
+   device->dispatch_table.GetBufferMemoryRequirements(
+      device->dispatch_handle, hc->staging, &reqs);
+
+   /* Cached memory makes reading back from staging a lot cheaper. */
+   memory_type = wrapper_host_copy_memory_type(device, reqs.memoryTypeBits,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+      VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+   if (memory_type == UINT32_MAX)
+      memory_type = wrapper_host_copy_memory_type(device, reqs.memoryTypeBits,
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+   if (memory_type == UINT32_MAX) {
+      result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+      goto fail;
+   }
+
+   result = device->dispatch_table.AllocateMemory(
+      device->dispatch_handle,
+      &(VkMemoryAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+         .allocationSize = reqs.size,
+         .memoryTypeIndex = memory_type,
+      }, NULL, &hc->staging_memory);
+   if (result != VK_SUCCESS)
+      goto fail;
+
+   result = device->dispatch_table.BindBufferMemory(device->dispatch_handle,
+                                                    hc->staging,
+                                                    hc->staging_memory, 0);
+   if (result != VK_SUCCESS)
+      goto fail;
+
+   result = device->dispatch_table.MapMemory(device->dispatch_handle,
+                                             hc->staging_memory, 0,
+                                             VK_WHOLE_SIZE, 0,
+                                             &hc->staging_map);
+   if (result != VK_SUCCESS)
+      goto fail;
+
+   hc->staging_size = size;
+   return VK_SUCCESS;
+
+fail:
+   device->dispatch_table.FreeMemory(device->dispatch_handle,
+                                     hc->staging_memory, NULL);
+   device->dispatch_table.DestroyBuffer(device->dispatch_handle,
+                                        hc->staging, NULL);
+   hc->staging = VK_NULL_HANDLE;
+   hc->staging_memory = VK_NULL_HANDLE;
+   return result;
+}
+
+static VkResult
+wrapper_host_copy_begin(struct wrapper_device *device)
+{
+   struct wrapper_host_copy *hc = device->host_copy;
+
+   device->dispatch_table.ResetCommandPool(device->dispatch_handle,
+                                           hc->command_pool, 0);
+   return device->dispatch_table.BeginCommandBuffer(
+      hc->command_buffer,
+      &(VkCommandBufferBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      });
+}
+
+static VkResult
+wrapper_host_copy_submit(struct wrapper_device *device)
+{
+   struct wrapper_host_copy *hc = device->host_copy;
+   VkResult result;
+
+   /* Make the copy available to whatever the application submits next,
+    * and visible to the host for image to memory copies.
+    */
+   device->dispatch_table.CmdPipelineBarrier(
+      hc->command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT |
+                          VK_ACCESS_MEMORY_WRITE_BIT |
+                          VK_ACCESS_HOST_READ_BIT,
+      }, 0, NULL, 0, NULL);
+
+   result = device->dispatch_table.EndCommandBuffer(hc->command_buffer);
+   if (result != VK_SUCCESS)
+      return result;
+
+   simple_mtx_lock(&hc->queue->submit_mutex);
+   result = device->dispatch_table.QueueSubmit(
+      hc->queue->dispatch_handle, 1,
+      &(VkSubmitInfo) {
+         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+         .commandBufferCount = 1,
+         .pCommandBuffers = &hc->command_buffer,
+      }, hc->fence);
+   simple_mtx_unlock(&hc->queue->submit_mutex);
+   if (result != VK_SUCCESS)
+      return result;
+
+   result = device->dispatch_table.WaitForFences(device->dispatch_handle, 1,
+                                                 &hc->fence, VK_TRUE,
+                                                 UINT64_MAX);
+   device->dispatch_table.ResetFences(device->dispatch_handle, 1, &hc->fence);
+   return result;
+}
+
+/* The copy commands only take GENERAL or TRANSFER_*_OPTIMAL, so images
+ * in any other layout we allow are moved there and back.
+ */
+static VkImageLayout
+wrapper_host_copy_transition(struct wrapper_device *device, VkImage image,
+                             const VkImageSubresourceLayers *subresource,
+                             VkImageLayout layout, bool to_copy, bool dst)
+{
+   VkImageLayout copy_layout = dst ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL :
+                                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+   if (layout == VK_IMAGE_LAYOUT_GENERAL || layout == copy_layout)
+      return layout;
+
+   device->dispatch_table.CmdPipelineBarrier(
+      device->host_copy->command_buffer,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      0, 0, NULL, 0, NULL,
+      1, &(VkImageMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT |
+                          VK_ACCESS_MEMORY_WRITE_BIT,
+         .oldLayout = to_copy ? layout : copy_layout,
+         .newLayout = to_copy ? copy_layout : layout,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .image = image,
+         .subresourceRange = {
+            .aspectMask = subresource->aspectMask,
+            .baseMipLevel = subresource->mipLevel,
+            .levelCount = 1,
+            .baseArrayLayer = subresource->baseArrayLayer,
+            .layerCount = subresource->layerCount,
+         },
+      });
+
+   return copy_layout;
+}
+
+static VkResult
+wrapper_host_copy_staged(struct wrapper_device *device, VkImage image,
+                         VkImageLayout layout, uint32_t region_count,
+                         const VkImageSubresourceLayers **subresources,
+                         const VkOffset3D *offsets, const VkExtent3D *extents,
+                         const struct wrapper_host_copy_layout *layouts,
+                         void **hosts, bool to_device)
+{
+   struct wrapper_host_copy *hc = device->host_copy;
+   VkDeviceSize total = 0, staging_offset = 0;
+   VkResult result;
+
+   for (uint32_t i = 0; i < region_count; i++)
+      total += align64(wrapper_host_copy_packed_size(&layouts[i]), 16);
+
+   result = wrapper_host_copy_reserve(device, total);
+   if (result != VK_SUCCESS)
+      return result;
+
+   result = wrapper_host_copy_begin(device);
+   if (result != VK_SUCCESS)
+      return result;
+
+   for (uint32_t i = 0; i < region_count; i++) {
+      const struct wrapper_host_copy_layout *l = &layouts[i];
+      uint64_t packed_row = l->row_size;
+      uint64_t packed_slice = packed_row * l->row_count;
+      VkImageLayout copy_layout;
+      VkBufferImageCopy region = {
+         .bufferOffset = staging_offset,
+         .imageSubresource = *subresources[i],
+         .imageOffset = offsets[i],
+         .imageExtent = extents[i],
+      };
+
+      region.imageSubresource.layerCount = l->layer_count;
+
+      if (to_device) {
+         wrapper_host_copy_rows(l, hosts[i], packed_row, packed_slice,
+                                packed_slice * l->depth,
+                                (uint8_t *)hc->staging_map + staging_offset,
+                                true);
+      }
+
+      copy_layout = wrapper_host_copy_transition(device, image,
+                                                 &region.imageSubresource,
+                                                 layout, true, to_device);
+      if (to_device) {
+         device->dispatch_table.CmdCopyBufferToImage(hc->command_buffer,
+                                                     hc->staging, image,
+                                                     copy_layout, 1, &region);
+      } else {
+         device->dispatch_table.CmdCopyImageToBuffer(hc->command_buffer,
+                                                     image, copy_layout,
+                                                     hc->staging, 1, &region);
+      }
+      wrapper_host_copy_transition(device, image, &region.imageSubresource,
+                                   layout, false, to_device);
+
+      staging_offset += align64(wrapper_host_copy_packed_size(l), 16);
+   }
+
+   result = wrapper_host_copy_submit(device);
+   if (result != VK_SUCCESS)
+      return result;
+
+   if (!to_device) {
+      staging_offset = 0;
+      for (uint32_t i = 0; i < region_count; i++) {
+         const struct wrapper_host_copy_layout *l = &layouts[i];
+         uint64_t packed_slice = (uint64_t)l->row_size * l->row_count;
+
+         wrapper_host_copy_rows(l, hosts[i], l->row_size, packed_slice,
+                                packed_slice * l->depth,
+                                (uint8_t *)hc->staging_map + staging_offset,
+                                false);
+         staging_offset += align64(wrapper_host_copy_packed_size(l), 16);
+      }
+   }
+
+   p_atomic_add(&hc->bytes_staged, total);
+   return VK_SUCCESS;
+}
+
+static VkResult
+wrapper_host_copy_regions(struct wrapper_device *device, VkImage image,
+                          VkImageLayout layout, VkHostImageCopyFlagsEXT flags,
+                          uint32_t region_count,
+                          const VkImageSubresourceLayers **subresources,
+                          VkOffset3D *offsets, VkExtent3D *extents,
+                          const uint32_t *row_lengths,
+                          const uint32_t *image_heights,
+                          void **hosts, bool to_device)
+{
+   struct wrapper_host_copy_image *himage =
+      wrapper_host_copy_image(device, image);
+   struct wrapper_host_copy_layout *layouts;
+   struct wrapper_host_copy_map map;
+   VkResult result = VK_SUCCESS;
+
+   if (!himage)
+      return VK_ERROR_UNKNOWN;
+
+   layouts = vk_alloc(&device->vk.alloc, sizeof(*layouts) * region_count, 8,
+                      VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   if (!layouts)
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+   for (uint32_t i = 0; i < region_count; i++) {
+      /* Our memcpy layout is the tightly packed one. */
+      bool memcpy_layout = flags & VK_HOST_IMAGE_COPY_MEMCPY_EXT;
+
+      wrapper_host_copy_get_layout(himage, subresources[i], extents[i],
+                                   memcpy_layout ? 0 : row_lengths[i],
+                                   memcpy_layout ? 0 : image_heights[i],
+                                   &layouts[i]);
+   }
+
+   /* Either every region takes the direct path or all of them are staged
+    * with a single submit.  The direct path only touches the image's own
+    * mapping, so only the staging path needs the shared staging buffer,
+    * command buffer and fence.
+    */
+   if (wrapper_host_copy_map(device, himage, to_device, &map)) {
+      for (uint32_t i = 0; i < region_count; i++) {
+         wrapper_host_copy_direct(device, himage, &map, image,
+                                  subresources[i], offsets[i], &layouts[i],
+                                  hosts[i], to_device);
+      }
+      wrapper_host_copy_unmap(&map);
+   } else {
+      simple_mtx_lock(&device->host_copy->mutex);
+      result = wrapper_host_copy_staged(device, image, layout, region_count,
+                                        subresources, offsets, extents,
+                                        layouts, hosts, to_device);
+      simple_mtx_unlock(&device->host_copy->mutex);
+   }
+
+   vk_free(&device->vk.alloc, layouts);
+   return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CopyMemoryToImageEXT(VkDevice _device,
+                             const VkCopyMemoryToImageInfoEXT* pCopyMemoryToImageInfo)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   const VkCopyMemoryToImageInfoEXT *info = pCopyMemoryToImageInfo;
+   uint32_t count = info->regionCount;
+   const VkImageSubresourceLayers *subresources[count];
+   VkOffset3D offsets[count];
+   VkExtent3D extents[count];
+   uint32_t row_lengths[count], image_heights[count];
+   void *hosts[count];
+
+   if (!device->host_copy)
+      return device->dispatch_table.CopyMemoryToImageEXT(
+         device->dispatch_handle, pCopyMemoryToImageInfo);
+
+   for (uint32_t i = 0; i < count; i++) {
+      const VkMemoryToImageCopyEXT *region = &info->pRegions[i];
+      subresources[i] = &region->imageSubresource;
+      offsets[i] = region->imageOffset;
+      extents[i] = region->imageExtent;
+      row_lengths[i] = region->memoryRowLength;
+      image_heights[i] = region->memoryImageHeight;
+      hosts[i] = (void *)region->pHostPointer;
+   }
+
+   return wrapper_host_copy_regions(device, info->dstImage,
+                                    info->dstImageLayout, info->flags, count,
+                                    subresources, offsets, extents,
+                                    row_lengths, image_heights, hosts, true);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CopyImageToMemoryEXT(VkDevice _device,
+                             const VkCopyImageToMemoryInfoEXT* pCopyImageToMemoryInfo)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   const VkCopyImageToMemoryInfoEXT *info = pCopyImageToMemoryInfo;
+   uint32_t count = info->regionCount;
+   const VkImageSubresourceLayers *subresources[count];
+   VkOffset3D offsets[count];
+   VkExtent3D extents[count];
+   uint32_t row_lengths[count], image_heights[count];
+   void *hosts[count];
+
+   if (!device->host_copy)
+      return device->dispatch_table.CopyImageToMemoryEXT(
+         device->dispatch_handle, pCopyImageToMemoryInfo);
+
+   for (uint32_t i = 0; i < count; i++) {
+      const VkImageToMemoryCopyEXT *region = &info->pRegions[i];
+      subresources[i] = &region->imageSubresource;
+      offsets[i] = region->imageOffset;
+      extents[i] = region->imageExtent;
+      row_lengths[i] = region->memoryRowLength;
+      image_heights[i] = region->memoryImageHeight;
+      hosts[i] = region->pHostPointer;
+   }
+
+   return wrapper_host_copy_regions(device, info->srcImage,
+                                    info->srcImageLayout, info->flags, count,
+                                    subresources, offsets, extents,
+                                    row_lengths, image_heights, hosts, false);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CopyImageToImageEXT(VkDevice _device,
+                            const VkCopyImageToImageInfoEXT* pCopyImageToImageInfo)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   const VkCopyImageToImageInfoEXT *info = pCopyImageToImageInfo;
+   VkResult result;
+
+   if (!device->host_copy)
+      return device->dispatch_table.CopyImageToImageEXT(
+         device->dispatch_handle, pCopyImageToImageInfo);
+
+   simple_mtx_lock(&device->host_copy->mutex);
+
+   result = wrapper_host_copy_begin(device);
+   if (result != VK_SUCCESS)
+      goto out;
+
+   for (uint32_t i = 0; i < info->regionCount; i++) {
+      const VkImageCopy2 *region = &info->pRegions[i];
+      VkImageLayout src_layout, dst_layout;
+      VkImageCopy copy = {
+         .srcSubresource = region->srcSubresource,
+         .srcOffset = region->srcOffset,
+         .dstSubresource = region->dstSubresource,
+         .dstOffset = region->dstOffset,
+         .extent = region->extent,
+      };
+
+      src_layout = wrapper_host_copy_transition(device, info->srcImage,
+                                                &copy.srcSubresource,
+                                                info->srcImageLayout,
+                                                true, false);
+      dst_layout = wrapper_host_copy_transition(device, info->dstImage,
+                                                &copy.dstSubresource,
+                                                info->dstImageLayout,
+                                                true, true);
+      device->dispatch_table.CmdCopyImage(device->host_copy->command_buffer,
+                                          info->srcImage, src_layout,
+                                          info->dstImage, dst_layout,
+                                          1, &copy);
+      wrapper_host_copy_transition(device, info->srcImage,
+                                   &copy.srcSubresource,
+                                   info->srcImageLayout, false, false);
+      wrapper_host_copy_transition(device, info->dstImage,
+                                   &copy.dstSubresource,
+                                   info->dstImageLayout, false, true);
+   }
+
+   result = wrapper_host_copy_submit(device);
+
+out:
+   simple_mtx_unlock(&device->host_copy->mutex);
+   return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_TransitionImageLayoutEXT(VkDevice _device,
+                                 uint32_t transitionCount,
+                                 const VkHostImageLayoutTransitionInfoEXT* pTransitions)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VkImageMemoryBarrier barriers[transitionCount];
+   uint32_t barrier_count = 0;
+   VkResult result;
+
+   if (!device->host_copy)
+      return device->dispatch_table.TransitionImageLayoutEXT(
+         device->dispatch_handle, transitionCount, pTransitions);
+
+   for (uint32_t i = 0; i < transitionCount; i++) {
+      const VkHostImageLayoutTransitionInfoEXT *t = &pTransitions[i];
+
+      if (t->oldLayout == t->newLayout)
+         continue;
+
+      barriers[barrier_count++] = (VkImageMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT |
+                          VK_ACCESS_MEMORY_WRITE_BIT,
+         .oldLayout = t->oldLayout,
+         .newLayout = t->newLayout,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .image = t->image,
+         .subresourceRange = t->subresourceRange,
+      };
+   }
+
+   if (!barrier_count)
+      return VK_SUCCESS;
+
+   simple_mtx_lock(&device->host_copy->mutex);
+
+   result = wrapper_host_copy_begin(device);
+   if (result == VK_SUCCESS) {
+      device->dispatch_table.CmdPipelineBarrier(
+         device->host_copy->command_buffer,
+         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL,
+         barrier_count, barriers);
+      result = wrapper_host_copy_submit(device);
+   }
+
+   simple_mtx_unlock(&device->host_copy->mutex);
+   return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_GetImageSubresourceLayout2KHR(VkDevice _device, VkImage image,
+                                      const VkImageSubresource2KHR* pSubresource,
+                                      VkSubresourceLayout2KHR* pLayout)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   struct wrapper_host_copy_image *himage;
+   VkSubresourceHostMemcpySizeEXT *memcpy_size;
+
+   if (device->dispatch_table.GetImageSubresourceLayout2KHR) {
+      device->dispatch_table.GetImageSubresourceLayout2KHR(
+         device->dispatch_handle, image, pSubresource, pLayout);
+   } else {
+      device->dispatch_table.GetImageSubresourceLayout(
+         device->dispatch_handle, image, &pSubresource->imageSubresource,
+         &pLayout->subresourceLayout);
+   }
+
+   if (!device->host_copy)
+      return;
+
+   memcpy_size = vk_find_struct(pLayout->pNext,
+                                SUBRESOURCE_HOST_MEMCPY_SIZE_EXT);
+   himage = wrapper_host_copy_image(device, image);
+   if (memcpy_size && himage) {
+      const VkImageSubresource *sub = &pSubresource->imageSubresource;
+      struct wrapper_host_copy_layout layout;
+
+      wrapper_host_copy_get_layout(
+         himage,
+         &(VkImageSubresourceLayers) {
+            .aspectMask = sub->aspectMask,
+            .mipLevel = sub->mipLevel,
+            .baseArrayLayer = sub->arrayLayer,
+            .layerCount = 1,
+         },
+         (VkExtent3D) {
+            .width = u_minify(himage->extent.width, sub->mipLevel),
+            .height = u_minify(himage->extent.height, sub->mipLevel),
+            .depth = u_minify(himage->extent.depth, sub->mipLevel),
+         }, 0, 0, &layout);
+      memcpy_size->size = wrapper_host_copy_packed_size(&layout);
+   }
+}
+
+/* Swaps HOST_TRANSFER usage for the transfer usage the copies need.
+ * Returns false if the image doesn't use host transfers.
+ */
+bool
+wrapper_host_copy_fixup_usage(VkImageUsageFlags *usage)
+{
+   if (!(*usage & VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT))
+      return false;
+
+   *usage &= ~VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+   *usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+             VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+   return true;
+}
+
+void
+wrapper_host_copy_image_create(struct wrapper_device *device, VkImage image,
+                               const VkImageCreateInfo *pCreateInfo)
+{
+   struct wrapper_host_copy_image *himage;
+
+   simple_mtx_lock(&device->host_copy->mutex);
+   himage = rzalloc(device->host_copy->images,
+                    struct wrapper_host_copy_image);
+   if (himage) {
+      himage->format = pCreateInfo->format;
+      himage->tiling = pCreateInfo->tiling;
+      himage->extent = pCreateInfo->extent;
+      himage->array_layers = pCreateInfo->arrayLayers;
+      _mesa_hash_table_u64_insert(device->host_copy->images,
+                                  (uint64_t)image, himage);
+   }
+   simple_mtx_unlock(&device->host_copy->mutex);
+}
+
+void
+wrapper_host_copy_image_destroy(struct wrapper_device *device, VkImage image)
+{
+   struct wrapper_host_copy_image *himage;
+
+   simple_mtx_lock(&device->host_copy->mutex);
+   himage = _mesa_hash_table_u64_search(device->host_copy->images,
+                                        (uint64_t)image);
+   if (himage) {
+      _mesa_hash_table_u64_remove(device->host_copy->images, (uint64_t)image);
+      ralloc_free(himage);
+   }
+   simple_mtx_unlock(&device->host_copy->mutex);
+}
+
+static void
+wrapper_host_copy_image_bind(struct wrapper_device *device, VkImage image,
+                             VkDeviceMemory memory, VkDeviceSize offset)
+{
+   struct wrapper_host_copy_image *himage;
+
+   simple_mtx_lock(&device->host_copy->mutex);
+   himage = _mesa_hash_table_u64_search(device->host_copy->images,
+                                        (uint64_t)image);
+   if (himage) {
+      himage->memory = memory;
+      himage->offset = offset;
+   }
+   simple_mtx_unlock(&device->host_copy->mutex);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_BindImageMemory(VkDevice _device, VkImage image,
+                        VkDeviceMemory memory, VkDeviceSize memoryOffset)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VkResult result;
+
+   result = device->dispatch_table.BindImageMemory(device->dispatch_handle,
+                                                   image, memory,
+                                                   memoryOffset);
+   if (result == VK_SUCCESS && device->host_copy)
+      wrapper_host_copy_image_bind(device, image, memory, memoryOffset);
+
+   return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_BindImageMemory2(VkDevice _device, uint32_t bindInfoCount,
+                         const VkBindImageMemoryInfo* pBindInfos)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VkResult result;
+
+   result = device->dispatch_table.BindImageMemory2(device->dispatch_handle,
+                                                    bindInfoCount,
+                                                    pBindInfos);
+   if (result != VK_SUCCESS || !device->host_copy)
+      return result;
+
+   for (uint32_t i = 0; i < bindInfoCount; i++) {
+      wrapper_host_copy_image_bind(device, pBindInfos[i].image,
+                                   pBindInfos[i].memory,
+                                   pBindInfos[i].memoryOffset);
+   }
+
+   return result;
+}
+
+void
+wrapper_host_copy_init(struct wrapper_device *device)
+{
+   struct wrapper_host_copy *hc;
+   struct wrapper_queue *queue;
+   VkResult result;
+
+   if (!device->physical->emulate_host_image_copy ||
+       !device->vk.enabled_features.hostImageCopy ||
+       list_is_empty(&device->vk.queues))
+      return;
+
+   hc = vk_zalloc(&device->vk.alloc, sizeof(*hc), 8,
+                  VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!hc)
+      return;
+
+   hc->images = _mesa_hash_table_u64_create(NULL);
+   if (!hc->images)
+      goto fail;
+
+   queue = container_of(list_first_entry(&device->vk.queues,
+                                         struct vk_queue, link),
+                        struct wrapper_queue, vk);
+   hc->queue = queue;
+
+   result = device->dispatch_table.CreateCommandPool(
+      device->dispatch_handle,
+      &(VkCommandPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+         .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+         .queueFamilyIndex = queue->vk.queue_family_index,
+      }, NULL, &hc->command_pool);
+   if (result != VK_SUCCESS)
+      goto fail;
+
+   result = device->dispatch_table.AllocateCommandBuffers(
+      device->dispatch_handle,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = hc->command_pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 1,
+      }, &hc->command_buffer);
+   if (result != VK_SUCCESS)
+      goto fail;
+
+   result = device->dispatch_table.CreateFence(
+      device->dispatch_handle,
+      &(VkFenceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      }, NULL, &hc->fence);
+   if (result != VK_SUCCESS)
+      goto fail;
+
+   simple_mtx_init(&hc->mutex, mtx_plain);
+   device->host_copy = hc;
+   return;
+
+fail:
+   device->dispatch_table.DestroyCommandPool(device->dispatch_handle,
+                                             hc->command_pool, NULL);
+   _mesa_hash_table_u64_destroy(hc->images);
+   vk_free(&device->vk.alloc, hc);
+   mesa_loge("wrapper: failed to set up host image copy emulation");
+}
+
+void
+wrapper_host_copy_finish(struct wrapper_device *device)
+{
+   struct wrapper_host_copy *hc = device->host_copy;
+
+   if (!hc)
+      return;
+
+   if (hc->bytes_direct || hc->bytes_staged) {
+      mesa_logi("wrapper: host image copy moved %" PRIu64 " bytes directly "
+                "and %" PRIu64 " bytes through staging",
+                hc->bytes_direct, hc->bytes_staged);
+   }
+
+   device->dispatch_table.DestroyFence(device->dispatch_handle, hc->fence,
+                                       NULL);
+   device->dispatch_table.DestroyCommandPool(device->dispatch_handle,
+                                             hc->command_pool, NULL);
+   device->dispatch_table.FreeMemory(device->dispatch_handle,
+                                     hc->staging_memory, NULL);
+   device->dispatch_table.DestroyBuffer(device->dispatch_handle, hc->staging,
+                                        NULL);
+   _mesa_hash_table_u64_destroy(hc->images);
+   simple_mtx_destroy(&hc->mutex);
+   vk_free(&device->vk.alloc, hc);
+   device->host_copy = NULL;
+}
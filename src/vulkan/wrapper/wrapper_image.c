@@ -0,0 +1,744 @@
+#include "wrapper_private.h"
+#include "wrapper_entrypoints.h"
+#include "vk_util.h"
+#include "util/bitscan.h"
+#include "util/hash_table.h"
+#include "util/log.h"
+#include "util/ralloc.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
+
+/* Transient attachment promotion: enabled with WRAPPER_TRANSIENT_ATTACHMENTS=1.
+ *
+ * An image whose usage is nothing but attachment bits can't be sampled,
+ * copied or presented, but its contents still survive from one render
+ * pass to the next through LOAD_OP_LOAD and STORE_OP_STORE.  Only images
+ * whose contents never leave the render pass are worth backing with
+ * lazily allocated memory, and that isn't known when the image is
+ * created.
+ *
+ * So attachment-only images are tracked through their views, and every
+ * dynamic rendering instance that uses them is checked: any load or
+ * store op other than CLEAR/DONT_CARE, or a resolve into them, marks the
+ * image as kept.  Legacy render passes bake their ops into objects we
+ * don't track, so using an image in a framebuffer marks it as kept too.
+ * When an image that was rendered to and never kept is destroyed, images
+ * created later with the same parameters are promoted: they get
+ * TRANSIENT_ATTACHMENT usage added, ask for a dedicated allocation, and
+ * that allocation is moved to a LAZILY_ALLOCATED memory type.  Once any
+ * image with those parameters is kept, they are never promoted again.
+ * This catches render targets that are recreated on resize or that come
+ * out of a per-frame pool.
+ *
+ * Lazy memory is still committed on demand, so a promoted image that
+ * turns out to be kept after all stays correct, it just gains nothing.
+ */
+
+#define WRAPPER_ATTACHMENT_USAGE (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | \
+                                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | \
+                                  VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)
+
+/* Everything in VkImageCreateInfo that can tell render targets apart. */
+struct wrapper_transient_key {
+   VkImageCreateFlags flags;
+   VkImageType image_type;
+   VkFormat format;
+   VkExtent3D extent;
+   uint32_t mip_levels;
+   uint32_t array_layers;
+   VkSampleCountFlagBits samples;
+   VkImageUsageFlags usage;
+};
+
+enum wrapper_transient_history {
+   WRAPPER_TRANSIENT_UNKNOWN,
+   WRAPPER_TRANSIENT_DISCARDED,
+   WRAPPER_TRANSIENT_KEPT,
+};
+
+struct wrapper_transient_image {
+   struct wrapper_transient_key key;
+   /* UINT32_MAX unless the image was promoted. */
+   uint32_t memory_type;
+   bool rendered;
+   bool kept;
+};
+
+static bool
+wrapper_image_can_be_transient(const VkImageCreateInfo *pCreateInfo)
+{
+   if ((pCreateInfo->usage & ~WRAPPER_ATTACHMENT_USAGE) ||
+       !(pCreateInfo->usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)))
+      return false;
+
+   if (pCreateInfo->tiling != VK_IMAGE_TILING_OPTIMAL ||
+       (pCreateInfo->flags & (VK_IMAGE_CREATE_SPARSE_BINDING_BIT |
+                              VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT |
+                              VK_IMAGE_CREATE_SPARSE_ALIASED_BIT |
+                              VK_IMAGE_CREATE_DISJOINT_BIT)))
+      return false;
+
+   /* External memory, modifiers and swapchain images are shared with
+    * someone else, so only allow structs we know are harmless.
+    */
+   vk_foreach_struct_const(ext, pCreateInfo->pNext) {
+      switch (ext->sType) {
+      case VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO:
+         break;
+      case VK_STRUCTURE_TYPE_IMAGE_STENCIL_USAGE_CREATE_INFO: {
+         const VkImageStencilUsageCreateInfo *stencil_usage = (void *)ext;
+         if (stencil_usage->stencilUsage & ~WRAPPER_ATTACHMENT_USAGE)
+            return false;
+         break;
+      }
+      default:
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static uint32_t
+wrapper_find_lazy_memory_type(struct wrapper_device *device,
+                              uint32_t memory_type_bits)
+{
+   const VkPhysicalDeviceMemoryProperties *props =
+      &device->physical->memory_properties;
+
+   u_foreach_bit(i, memory_type_bits) {
+      if (i < props->memoryTypeCount &&
+          (props->memoryTypes[i].propertyFlags &
+           VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+         return i;
+   }
+
+   return UINT32_MAX;
+}
+
+static uint32_t
+wrapper_transient_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, sizeof(struct wrapper_transient_key));
+}
+
+static bool
+wrapper_transient_key_equal(const void *a, const void *b)
+{
+   return !memcmp(a, b, sizeof(struct wrapper_transient_key));
+}
+
+void
+wrapper_transient_init(struct wrapper_device *device)
+{
+   if (!device->transient_attachments)
+      return;
+
+   /* Nothing to promote to on immediate mode GPUs. */
+   if (wrapper_find_lazy_memory_type(device, UINT32_MAX) == UINT32_MAX)
+      return;
+
+   device->transient_images = _mesa_hash_table_u64_create(NULL);
+   device->transient_views = _mesa_hash_table_u64_create(NULL);
+   device->transient_history =
+      _mesa_hash_table_create(NULL, wrapper_transient_key_hash,
+                              wrapper_transient_key_equal);
+   if (!device->transient_images || !device->transient_views ||
+       !device->transient_history) {
+      _mesa_hash_table_u64_destroy(device->transient_images);
+      _mesa_hash_table_u64_destroy(device->transient_views);
+      _mesa_hash_table_destroy(device->transient_history, NULL);
+      device->transient_images = NULL;
+      device->transient_views = NULL;
+      device->transient_history = NULL;
+   }
+}
+
+void
+wrapper_transient_finish(struct wrapper_device *device)
+{
+   if (!device->transient_images)
+      return;
+
+   _mesa_hash_table_u64_destroy(device->transient_images);
+   _mesa_hash_table_u64_destroy(device->transient_views);
+   _mesa_hash_table_destroy(device->transient_history, NULL);
+
+   if (device->transient_promoted) {
+      mesa_logi("wrapper: promoted %" PRIu64 " images to transient "
+                "attachments, %" PRIu64 " of %" PRIu64 " lazy bytes were "
+                "committed", device->transient_promoted,
+                device->transient_committed, device->transient_bytes);
+   }
+}
+
+static enum wrapper_transient_history
+wrapper_transient_history(struct wrapper_device *device,
+                          const struct wrapper_transient_key *key)
+{
+   struct hash_entry *entry;
+
+   entry = _mesa_hash_table_search(device->transient_history, key);
+   return entry ? (enum wrapper_transient_history)(uintptr_t)entry->data :
+                  WRAPPER_TRANSIENT_UNKNOWN;
+}
+
+/* Called with resource_mutex held.  KEPT is final. */
+static void
+wrapper_transient_set_history(struct wrapper_device *device,
+                              const struct wrapper_transient_key *key,
+                              enum wrapper_transient_history history)
+{
+   struct hash_entry *entry;
+   struct wrapper_transient_key *copy;
+
+   entry = _mesa_hash_table_search(device->transient_history, key);
+   if (entry) {
+      if ((uintptr_t)entry->data != WRAPPER_TRANSIENT_KEPT)
+         entry->data = (void *)(uintptr_t)history;
+      return;
+   }
+
+   copy = ralloc(device->transient_history, struct wrapper_transient_key);
+   if (!copy)
+      return;
+
+   *copy = *key;
+   _mesa_hash_table_insert(device->transient_history, copy,
+                           (void *)(uintptr_t)history);
+}
+
+/* Called with resource_mutex held. */
+static void
+wrapper_transient_use(struct wrapper_device *device, VkImageView view,
+                      bool kept)
+{
+   struct wrapper_transient_image *transient;
+   VkImage image;
+
+   if (view == VK_NULL_HANDLE)
+      return;
+
+   image = (VkImage)(uintptr_t)
+      _mesa_hash_table_u64_search(device->transient_views, (uint64_t)view);
+   if (image == VK_NULL_HANDLE)
+      return;
+
+   transient = _mesa_hash_table_u64_search(device->transient_images,
+                                           (uint64_t)image);
+   if (!transient)
+      return;
+
+   transient->rendered = true;
+   if (kept && !transient->kept) {
+      transient->kept = true;
+      wrapper_transient_set_history(device, &transient->key,
+                                    WRAPPER_TRANSIENT_KEPT);
+   }
+}
+
+static void
+wrapper_transient_use_attachment(struct wrapper_device *device,
+                                 const VkRenderingAttachmentInfo *attachment)
+{
+   if (!attachment || attachment->imageView == VK_NULL_HANDLE)
+      return;
+
+   wrapper_transient_use(device, attachment->imageView,
+      (attachment->loadOp != VK_ATTACHMENT_LOAD_OP_CLEAR &&
+       attachment->loadOp != VK_ATTACHMENT_LOAD_OP_DONT_CARE) ||
+      attachment->storeOp != VK_ATTACHMENT_STORE_OP_DONT_CARE);
+
+   if (attachment->resolveMode != VK_RESOLVE_MODE_NONE)
+      wrapper_transient_use(device, attachment->resolveImageView, true);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_transient_CreateImageView(VkDevice _device,
+                                  const VkImageViewCreateInfo* pCreateInfo,
+                                  const VkAllocationCallbacks* pAllocator,
+                                  VkImageView* pView)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   VkResult result;
+
+   result = device->dispatch_table.CreateImageView(device->dispatch_handle,
+                                                   pCreateInfo, pAllocator,
+                                                   pView);
+   if (result != VK_SUCCESS || !device->transient_images)
+      return result;
+
+   simple_mtx_lock(&device->resource_mutex);
+   if (_mesa_hash_table_u64_search(device->transient_images,
+                                   (uint64_t)pCreateInfo->image)) {
+      _mesa_hash_table_u64_insert(device->transient_views, (uint64_t)*pView,
+                                  (void *)(uintptr_t)pCreateInfo->image);
+   }
+   simple_mtx_unlock(&device->resource_mutex);
+
+   return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_transient_DestroyImageView(VkDevice _device, VkImageView imageView,
+                                   const VkAllocationCallbacks* pAllocator)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+
+   if (device->transient_images && imageView != VK_NULL_HANDLE) {
+      simple_mtx_lock(&device->resource_mutex);
+      _mesa_hash_table_u64_remove(device->transient_views,
+                                  (uint64_t)imageView);
+      simple_mtx_unlock(&device->resource_mutex);
+   }
+
+   device->dispatch_table.DestroyImageView(device->dispatch_handle,
+                                           imageView, pAllocator);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_transient_CreateFramebuffer(VkDevice _device,
+                                    const VkFramebufferCreateInfo* pCreateInfo,
+                                    const VkAllocationCallbacks* pAllocator,
+                                    VkFramebuffer* pFramebuffer)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+
+   if (device->transient_images &&
+       !(pCreateInfo->flags & VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT)) {
+      simple_mtx_lock(&device->resource_mutex);
+      for (uint32_t i = 0; i < pCreateInfo->attachmentCount; i++)
+         wrapper_transient_use(device, pCreateInfo->pAttachments[i], true);
+      simple_mtx_unlock(&device->resource_mutex);
+   }
+
+   return device->dispatch_table.CreateFramebuffer(device->dispatch_handle,
+                                                   pCreateInfo, pAllocator,
+                                                   pFramebuffer);
+}
+
+static void
+wrapper_transient_begin_render_pass(struct wrapper_device *device,
+                                    const VkRenderPassBeginInfo *info)
+{
+   const VkRenderPassAttachmentBeginInfo *attachments =
+      vk_find_struct_const(info->pNext, RENDER_PASS_ATTACHMENT_BEGIN_INFO);
+
+   if (!device->transient_images || !attachments)
+      return;
+
+   simple_mtx_lock(&device->resource_mutex);
+   for (uint32_t i = 0; i < attachments->attachmentCount; i++)
+      wrapper_transient_use(device, attachments->pAttachments[i], true);
+   simple_mtx_unlock(&device->resource_mutex);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_transient_CmdBeginRenderPass(VkCommandBuffer commandBuffer,
+                                     const VkRenderPassBeginInfo* pRenderPassBegin,
+                                     VkSubpassContents contents)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_transient_begin_render_pass(wcb->device, pRenderPassBegin);
+   wcb->device->cmd_dispatch.CmdBeginRenderPass(commandBuffer,
+                                                pRenderPassBegin, contents);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_transient_CmdBeginRenderPass2(VkCommandBuffer commandBuffer,
+                                      const VkRenderPassBeginInfo* pRenderPassBegin,
+                                      const VkSubpassBeginInfo* pSubpassBeginInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_transient_begin_render_pass(wcb->device, pRenderPassBegin);
+   wcb->device->cmd_dispatch.CmdBeginRenderPass2(commandBuffer,
+                                                 pRenderPassBegin,
+                                                 pSubpassBeginInfo);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_transient_CmdBeginRendering(VkCommandBuffer commandBuffer,
+                                    const VkRenderingInfo* pRenderingInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_device *device = wcb->device;
+
+   if (device->transient_images) {
+      simple_mtx_lock(&device->resource_mutex);
+      for (uint32_t i = 0; i < pRenderingInfo->colorAttachmentCount; i++) {
+         wrapper_transient_use_attachment(device,
+            &pRenderingInfo->pColorAttachments[i]);
+      }
+      wrapper_transient_use_attachment(device,
+                                       pRenderingInfo->pDepthAttachment);
+      wrapper_transient_use_attachment(device,
+                                       pRenderingInfo->pStencilAttachment);
+      simple_mtx_unlock(&device->resource_mutex);
+   }
+
+   device->cmd_dispatch.CmdBeginRendering(commandBuffer, pRenderingInfo);
+}
+
+void
+wrapper_get_transient_entrypoints(struct vk_device_entrypoint_table *entrypoints)
+{
+   *entrypoints = (struct vk_device_entrypoint_table) {
+      .CreateImageView = wrapper_transient_CreateImageView,
+      .DestroyImageView = wrapper_transient_DestroyImageView,
+      .CreateFramebuffer = wrapper_transient_CreateFramebuffer,
+      .CmdBeginRenderPass = wrapper_transient_CmdBeginRenderPass,
+      .CmdBeginRenderPass2 = wrapper_transient_CmdBeginRenderPass2,
+      .CmdBeginRendering = wrapper_transient_CmdBeginRendering,
+   };
+}
+
+static bool
+wrapper_image_format_supports_transient(struct wrapper_device *device,
+                                        const VkImageCreateInfo *pCreateInfo)
+{
+   struct wrapper_physical_device *pdevice = device->physical;
+   VkImageFormatProperties props;
+
+   return pdevice->dispatch_table.GetPhysicalDeviceImageFormatProperties(
+      pdevice->dispatch_handle, pCreateInfo->format, pCreateInfo->imageType,
+      pCreateInfo->tiling,
+      pCreateInfo->usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+      pCreateInfo->flags, &props) == VK_SUCCESS &&
+      (props.sampleCounts & pCreateInfo->samples);
+}
+
+/* VkImageCreateInfo extension structs that can come before the stencil
+ * usage, as a chain copied up to it has to hold them.
+ */
+union wrapper_image_create_ext {
+   VkBaseOutStructure base;
+   VkDedicatedAllocationImageCreateInfoNV dedicated_allocation_nv;
+   VkExternalMemoryImageCreateInfoNV external_memory_nv;
+   VkExternalMemoryImageCreateInfo external_memory;
+   VkImageSwapchainCreateInfoKHR swapchain;
+   VkImageFormatListCreateInfo format_list;
+   VkImageDrmFormatModifierListCreateInfoEXT modifier_list;
+   VkImageDrmFormatModifierExplicitCreateInfoEXT modifier_explicit;
+   VkVideoProfileListInfoKHR video_profiles;
+   VkOpaqueCaptureDescriptorDataCreateInfoEXT capture_descriptor_data;
+   VkImageCompressionControlEXT compression_control;
+   VkOpticalFlowImageFormatInfoNV optical_flow;
+   VkImageAlignmentControlCreateInfoMESA alignment_control;
+#ifdef VK_USE_PLATFORM_ANDROID_KHR
+   VkExternalFormatANDROID external_format;
+#endif
+};
+
+static size_t
+wrapper_image_create_ext_size(VkStructureType type)
+{
+   switch (type) {
+   case VK_STRUCTURE_TYPE_DEDICATED_ALLOCATION_IMAGE_CREATE_INFO_NV:
+      return sizeof(VkDedicatedAllocationImageCreateInfoNV);
+   case VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO_NV:
+      return sizeof(VkExternalMemoryImageCreateInfoNV);
+   case VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO:
+      return sizeof(VkExternalMemoryImageCreateInfo);
+   case VK_STRUCTURE_TYPE_IMAGE_SWAPCHAIN_CREATE_INFO_KHR:
+      return sizeof(VkImageSwapchainCreateInfoKHR);
+   case VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO:
+      return sizeof(VkImageFormatListCreateInfo);
+   case VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_LIST_CREATE_INFO_EXT:
+      return sizeof(VkImageDrmFormatModifierListCreateInfoEXT);
+   case VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT:
+      return sizeof(VkImageDrmFormatModifierExplicitCreateInfoEXT);
+   case VK_STRUCTURE_TYPE_VIDEO_PROFILE_LIST_INFO_KHR:
+      return sizeof(VkVideoProfileListInfoKHR);
+   case VK_STRUCTURE_TYPE_OPAQUE_CAPTURE_DESCRIPTOR_DATA_CREATE_INFO_EXT:
+      return sizeof(VkOpaqueCaptureDescriptorDataCreateInfoEXT);
+   case VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT:
+      return sizeof(VkImageCompressionControlEXT);
+   case VK_STRUCTURE_TYPE_OPTICAL_FLOW_IMAGE_FORMAT_INFO_NV:
+      return sizeof(VkOpticalFlowImageFormatInfoNV);
+   case VK_STRUCTURE_TYPE_IMAGE_ALIGNMENT_CONTROL_CREATE_INFO_MESA:
+      return sizeof(VkImageAlignmentControlCreateInfoMESA);
+#ifdef VK_USE_PLATFORM_ANDROID_KHR
+   case VK_STRUCTURE_TYPE_EXTERNAL_FORMAT_ANDROID:
+      return sizeof(VkExternalFormatANDROID);
+#endif
+   default:
+      return 0;
+   }
+}
+
+#define WRAPPER_IMAGE_CHAIN_LENGTH 8
+
+struct wrapper_image_chain {
+   union wrapper_image_create_ext exts[WRAPPER_IMAGE_CHAIN_LENGTH];
+   VkImageStencilUsageCreateInfo stencil_usage;
+};
+
+/* The stencil usage in the application's chain needs host transfer
+ * replaced as well, but the application's structs are const.  Points
+ * create_info->pNext at copies of the structs up to the stencil usage,
+ * followed by a fixed up copy of it, which continues with the rest of the
+ * original chain.  Returns false if the chain holds something we don't
+ * know how to copy, and the original chain has to be used.
+ */
+static bool
+wrapper_host_copy_fixup_chain(VkImageCreateInfo *create_info,
+                              struct wrapper_image_chain *chain)
+{
+   VkBaseOutStructure *prev = (VkBaseOutStructure *)create_info;
+   unsigned count = 0;
+
+   vk_foreach_struct_const(ext, create_info->pNext) {
+      size_t size;
+
+      if (ext->sType == VK_STRUCTURE_TYPE_IMAGE_STENCIL_USAGE_CREATE_INFO) {
+         chain->stencil_usage = *(const VkImageStencilUsageCreateInfo *)ext;
+         wrapper_host_copy_fixup_usage(&chain->stencil_usage.stencilUsage);
+         prev->pNext = (VkBaseOutStructure *)&chain->stencil_usage;
+         return true;
+      }
+
+      size = wrapper_image_create_ext_size(ext->sType);
+      if (!size || count == WRAPPER_IMAGE_CHAIN_LENGTH)
+         break;
+
+      memcpy(&chain->exts[count], ext, size);
+      prev->pNext = &chain->exts[count].base;
+      prev = &chain->exts[count++].base;
+   }
+
+   return false;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CreateImage(VkDevice _device,
+                    const VkImageCreateInfo* pCreateInfo,
+                    const VkAllocationCallbacks* pAllocator,
+                    VkImage* pImage)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   struct wrapper_transient_image *transient;
+   struct wrapper_transient_key key;
+   VkImageCreateInfo create_info;
+   VkMemoryRequirements reqs;
+   uint32_t memory_type;
+   VkResult result;
+   bool promote;
+
+   if (device->host_copy) {
+      struct wrapper_image_chain chain;
+
+      create_info = *pCreateInfo;
+      if (wrapper_host_copy_fixup_usage(&create_info.usage)) {
+         if (vk_find_struct_const(pCreateInfo->pNext,
+                                  IMAGE_STENCIL_USAGE_CREATE_INFO) &&
+             !wrapper_host_copy_fixup_chain(&create_info, &chain))
+            create_info.pNext = pCreateInfo->pNext;
+
+         result = device->dispatch_table.CreateImage(device->dispatch_handle,
+                                                     &create_info, pAllocator,
+                                                     pImage);
+         if (result == VK_SUCCESS)
+            wrapper_host_copy_image_create(device, *pImage, &create_info);
+         return result;
+      }
+   }
+
+   if (!device->transient_images ||
+       (pCreateInfo->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ||
+       !wrapper_image_can_be_transient(pCreateInfo))
+      goto passthrough;
+
+   key = (struct wrapper_transient_key) {
+      .flags = pCreateInfo->flags,
+      .image_type = pCreateInfo->imageType,
+      .format = pCreateInfo->format,
+      .extent = pCreateInfo->extent,
+      .mip_levels = pCreateInfo->mipLevels,
+      .array_layers = pCreateInfo->arrayLayers,
+      .samples = pCreateInfo->samples,
+      .usage = pCreateInfo->usage,
+   };
+
+   simple_mtx_lock(&device->resource_mutex);
+   promote = wrapper_transient_history(device, &key) ==
+             WRAPPER_TRANSIENT_DISCARDED;
+   simple_mtx_unlock(&device->resource_mutex);
+
+   memory_type = UINT32_MAX;
+   result = VK_ERROR_UNKNOWN;
+   if (promote && wrapper_image_format_supports_transient(device,
+                                                          pCreateInfo)) {
+      create_info = *pCreateInfo;
+      create_info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+      result = device->dispatch_table.CreateImage(device->dispatch_handle,
+                                                  &create_info, pAllocator,
+                                                  pImage);
+   }
+   if (result == VK_SUCCESS) {
+      device->dispatch_table.GetImageMemoryRequirements(
+         device->dispatch_handle, *pImage, &reqs);
+      memory_type = wrapper_find_lazy_memory_type(device,
+                                                  reqs.memoryTypeBits);
+      if (memory_type == UINT32_MAX) {
+         device->dispatch_table.DestroyImage(device->dispatch_handle,
+                                             *pImage, pAllocator);
+         result = VK_ERROR_UNKNOWN;
+      }
+   }
+   if (result != VK_SUCCESS) {
+      result = device->dispatch_table.CreateImage(device->dispatch_handle,
+                                                  pCreateInfo, pAllocator,
+                                                  pImage);
+      if (result != VK_SUCCESS)
+         return result;
+   }
+
+   /* Unpromoted images are tracked too, to learn whether images like them
+    * can be.
+    */
+   simple_mtx_lock(&device->resource_mutex);
+   transient = ralloc(device->transient_images,
+                      struct wrapper_transient_image);
+   if (transient) {
+      *transient = (struct wrapper_transient_image) {
+         .key = key,
+         .memory_type = memory_type,
+      };
+      _mesa_hash_table_u64_insert(device->transient_images,
+                                  (uint64_t)*pImage, transient);
+   }
+   simple_mtx_unlock(&device->resource_mutex);
+
+   if (memory_type != UINT32_MAX)
+      p_atomic_inc(&device->transient_promoted);
+
+   return VK_SUCCESS;
+
+passthrough:
+   return device->dispatch_table.CreateImage(device->dispatch_handle,
+                                             pCreateInfo, pAllocator,
+                                             pImage);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_DestroyImage(VkDevice _device, VkImage image,
+                     const VkAllocationCallbacks* pAllocator)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+
+   if (device->host_copy && image != VK_NULL_HANDLE)
+      wrapper_host_copy_image_destroy(device, image);
+
+   if (device->transient_images && image != VK_NULL_HANDLE) {
+      struct wrapper_transient_image *transient;
+
+      simple_mtx_lock(&device->resource_mutex);
+      transient = _mesa_hash_table_u64_search(device->transient_images,
+                                              (uint64_t)image);
+      if (transient) {
+         /* Its contents never left the render pass, so the next image
+          * like it can be promoted.
+          */
+         if (transient->rendered && !transient->kept) {
+            wrapper_transient_set_history(device, &transient->key,
+                                          WRAPPER_TRANSIENT_DISCARDED);
+         }
+         _mesa_hash_table_u64_remove(device->transient_images,
+                                     (uint64_t)image);
+         ralloc_free(transient);
+      }
+      simple_mtx_unlock(&device->resource_mutex);
+   }
+
+   device->dispatch_table.DestroyImage(device->dispatch_handle, image,
+                                       pAllocator);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_GetImageMemoryRequirements2(VkDevice _device,
+                                    const VkImageMemoryRequirementsInfo2* pInfo,
+                                    VkMemoryRequirements2* pMemoryRequirements)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   struct wrapper_transient_image *transient;
+   VkMemoryDedicatedRequirements *dedicated;
+   bool promoted;
+
+   device->dispatch_table.GetImageMemoryRequirements2(device->dispatch_handle,
+                                                      pInfo,
+                                                      pMemoryRequirements);
+   if (!device->transient_images)
+      return;
+
+   simple_mtx_lock(&device->resource_mutex);
+   transient = _mesa_hash_table_u64_search(device->transient_images,
+                                           (uint64_t)pInfo->image);
+   promoted = transient && transient->memory_type != UINT32_MAX;
+   simple_mtx_unlock(&device->resource_mutex);
+
+   /* Only dedicated allocations can be moved to lazy memory. */
+   dedicated = vk_find_struct(pMemoryRequirements->pNext,
+                              MEMORY_DEDICATED_REQUIREMENTS);
+   if (promoted && dedicated)
+      dedicated->prefersDedicatedAllocation = VK_TRUE;
+}
+
+/* Returns true and fills *lazy_info if the allocation is dedicated to a
+ * promoted image and can be moved to a lazily allocated memory type.
+ */
+bool
+wrapper_transient_allocate_info(struct wrapper_device *device,
+                                const VkMemoryAllocateInfo *pAllocateInfo,
+                                VkMemoryAllocateInfo *lazy_info)
+{
+   const VkMemoryDedicatedAllocateInfo *dedicated;
+   struct wrapper_transient_image *transient;
+   VkMemoryPropertyFlags flags;
+   uint32_t memory_type = UINT32_MAX;
+
+   if (!device->transient_images)
+      return false;
+
+   dedicated = vk_find_struct_const(pAllocateInfo->pNext,
+                                    MEMORY_DEDICATED_ALLOCATE_INFO);
+   if (!dedicated || dedicated->image == VK_NULL_HANDLE)
+      return false;
+
+   /* Host visible memory could be mapped by the application. */
+   flags = device->physical->memory_properties.memoryTypes[
+      pAllocateInfo->memoryTypeIndex].propertyFlags;
+   if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+      return false;
+
+   simple_mtx_lock(&device->resource_mutex);
+   transient = _mesa_hash_table_u64_search(device->transient_images,
+                                           (uint64_t)dedicated->image);
+   if (transient)
+      memory_type = transient->memory_type;
+   simple_mtx_unlock(&device->resource_mutex);
+
+   if (memory_type == UINT32_MAX)
+      return false;
+
+   *lazy_info = *pAllocateInfo;
+   lazy_info->memoryTypeIndex = memory_type;
+   p_atomic_add(&device->transient_bytes, pAllocateInfo->allocationSize);
+   return true;
+}
+
+/* Called before a lazily allocated block is freed to account for what
+ * the driver actually had to back.
+ */
+void
+wrapper_transient_free(struct wrapper_device *device, VkDeviceMemory memory)
+{
+   VkDeviceSize committed = 0;
+
+   device->dispatch_table.GetDeviceMemoryCommitment(device->dispatch_handle,
+                                                    memory, &committed);
+   p_atomic_add(&device->transient_committed, committed);
+}
@@ -50,6 +50,7 @@ static struct vk_instance_extension_table *supported_instance_extensions;
 
 static void *get_vulkan_handle() 
 {
+   char *library = getenv("WRAPPER_VULKAN_LIBRARY");
    char *path = getenv("ADRENOTOOLS_DRIVER_PATH");
    char *name = getenv("ADRENOTOOLS_DRIVER_NAME");
    char *hooks = getenv("ADRENOTOOLS_HOOKS_PATH");
@@ -60,6 +61,10 @@ static void *get_vulkan_handle()
 
    struct stat sb;
 
+   /* Any loader or ICD, e.g. lavapipe for testing off-device. */
+   if (library)
+      return dlopen(library, RTLD_NOW | RTLD_LOCAL);
+
    if (hooks && path && (stat(path, &sb) == 0)) {
       char *temp;
       asprintf(&temp, "%s%s", path, "temp");
@@ -79,13 +84,34 @@ static bool vulkan_library_init()
    vulkan_library_handle = get_vulkan_handle();
 
    if (vulkan_library_handle) {
-      create_instance = dlsym(vulkan_library_handle, "vkCreateInstance");
       get_instance_proc_addr = dlsym(vulkan_library_handle,
                                      "vkGetInstanceProcAddr");
-      enumerate_instance_version = dlsym(vulkan_library_handle,
-                                         "vkEnumerateInstanceVersion");
+      if (!get_instance_proc_addr) {
+         /* A bare ICD only exports the loader interface. */
+         PFN_vk_icdNegotiateLoaderICDInterfaceVersion negotiate =
+            dlsym(vulkan_library_handle,
+                  "vk_icdNegotiateLoaderICDInterfaceVersion");
+         uint32_t version = 7;
+
+         if (negotiate)
+            negotiate(&version);
+         get_instance_proc_addr = dlsym(vulkan_library_handle,
+                                        "vk_icdGetInstanceProcAddr");
+      }
+      if (!get_instance_proc_addr) {
+         fprintf(stderr, "no vkGetInstanceProcAddr in the Vulkan library\n");
+         dlclose(vulkan_library_handle);
+         vulkan_library_handle = NULL;
+         return false;
+      }
+
+      create_instance = (PFN_vkCreateInstance)
+         get_instance_proc_addr(NULL, "vkCreateInstance");
+      enumerate_instance_version = (PFN_vkEnumerateInstanceVersion)
+         get_instance_proc_addr(NULL, "vkEnumerateInstanceVersion");
       enumerate_instance_extension_properties =
-         dlsym(vulkan_library_handle, "vkEnumerateInstanceExtensionProperties");
+         (PFN_vkEnumerateInstanceExtensionProperties)
+         get_instance_proc_addr(NULL, "vkEnumerateInstanceExtensionProperties");
    }
    else {
       fprintf(stderr, "%s", dlerror());
@@ -0,0 +1,403 @@
+#include "wrapper_private.h"
+#include "vk_cmd_queue.h"
+#include "util/bitscan.h"
+#include "util/list.h"
+#include "util/log.h"
+#include "util/u_atomic.h"
+
+/* Load/store op optimization: enabled with WRAPPER_LOAD_STORE_OPS=1.
+ * Like rendering merging below it requires WRAPPER_RECORD_THREADS, since
+ * it needs to see the commands that follow a render pass before the
+ * driver does.
+ *
+ * Right before a vk_cmd_queue is replayed, dynamic rendering instances
+ * in it are rewritten when that provably doesn't change the result:
+ *
+ *  - a vkCmdClearAttachments covering the whole render area right after
+ *    vkCmdBeginRendering becomes a CLEAR load op,
+ *  - a STORE whose contents the next rendering instance discards or
+ *    clears without anything in between but barriers becomes DONT_CARE,
+ *  - a LOAD of contents the previous rendering instance didn't store
+ *    becomes DONT_CARE.
+ *
+ * With WRAPPER_MERGE_RENDERING=1, a vkCmdBeginRendering that directly
+ * follows a vkCmdEndRendering on the same attachments, and doesn't clear
+ * them, is dropped along with that vkCmdEndRendering so the tiles stay
+ * on chip.
+ *
+ * Attachments are matched by image view, so aliasing views are never
+ * optimized.  VkRenderPass objects bake their ops in at creation, so
+ * legacy render passes are neither rewritten nor merged.
+ */
+
+struct wrapper_load_store_stats {
+   uint32_t loads;
+   uint32_t stores;
+   uint32_t clears;
+   uint32_t merged;
+};
+
+static bool
+wrapper_rect_contains(const VkRect2D *outer, const VkRect2D *inner)
+{
+   return outer->offset.x <= inner->offset.x &&
+          outer->offset.y <= inner->offset.y &&
+          (int64_t)outer->offset.x + outer->extent.width >=
+          (int64_t)inner->offset.x + inner->extent.width &&
+          (int64_t)outer->offset.y + outer->extent.height >=
+          (int64_t)inner->offset.y + inner->extent.height;
+}
+
+static bool
+wrapper_rendering_is_simple(const VkRenderingInfo *info)
+{
+   /* Suspended instances continue in another command buffer and the
+    * pNext structs change what the attachments mean.
+    */
+   return !info->pNext &&
+          !(info->flags & (VK_RENDERING_SUSPENDING_BIT |
+                           VK_RENDERING_RESUMING_BIT));
+}
+
+static bool
+wrapper_clear_covers(const VkRenderingInfo *info,
+                     const struct vk_cmd_clear_attachments *clear)
+{
+   for (uint32_t i = 0; i < clear->rect_count; i++) {
+      const VkClearRect *rect = &clear->rects[i];
+      uint32_t layer_count = info->viewMask ? 1 : info->layerCount;
+
+      if (rect->baseArrayLayer == 0 && rect->layerCount >= layer_count &&
+          wrapper_rect_contains(&rect->rect, &info->renderArea))
+         return true;
+   }
+
+   return false;
+}
+
+static VkRenderingAttachmentInfo *
+wrapper_clear_attachment_target(VkRenderingInfo *info,
+                                const VkClearAttachment *clear,
+                                VkImageAspectFlagBits aspect)
+{
+   VkRenderingAttachmentInfo *att;
+
+   switch (aspect) {
+   case VK_IMAGE_ASPECT_COLOR_BIT:
+      if (clear->colorAttachment >= info->colorAttachmentCount)
+         return NULL;
+      att = (VkRenderingAttachmentInfo *)
+         &info->pColorAttachments[clear->colorAttachment];
+      break;
+   case VK_IMAGE_ASPECT_DEPTH_BIT:
+      att = (VkRenderingAttachmentInfo *)info->pDepthAttachment;
+      break;
+   case VK_IMAGE_ASPECT_STENCIL_BIT:
+      att = (VkRenderingAttachmentInfo *)info->pStencilAttachment;
+      break;
+   default:
+      return NULL;
+   }
+
+   return att && att->imageView != VK_NULL_HANDLE ? att : NULL;
+}
+
+/* Folds the attachments of a vkCmdClearAttachments into the load ops of
+ * the rendering instance it starts.  Returns true if the command became
+ * empty and was removed.
+ */
+static bool
+wrapper_fold_clear(VkRenderingInfo *info, struct vk_cmd_queue_entry *cmd,
+                   struct wrapper_load_store_stats *stats)
+{
+   struct vk_cmd_clear_attachments *clear = &cmd->u.clear_attachments;
+   uint32_t kept = 0;
+
+   if (!wrapper_clear_covers(info, clear))
+      return false;
+
+   for (uint32_t i = 0; i < clear->attachment_count; i++) {
+      const VkClearAttachment *attachment = &clear->attachments[i];
+      VkRenderingAttachmentInfo *targets[3] = { NULL };
+      uint32_t target_count = 0;
+      bool foldable = true;
+
+      u_foreach_bit(bit, attachment->aspectMask) {
+         VkRenderingAttachmentInfo *att =
+            wrapper_clear_attachment_target(info, attachment, 1u << bit);
+
+         if (!att || target_count == ARRAY_SIZE(targets)) {
+            foldable = false;
+            break;
+         }
+         targets[target_count++] = att;
+      }
+
+      if (!foldable || !target_count) {
+         clear->attachments[kept++] = *attachment;
+         continue;
+      }
+
+      for (uint32_t j = 0; j < target_count; j++) {
+         targets[j]->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+         targets[j]->clearValue = attachment->clearValue;
+      }
+      stats->clears++;
+   }
+
+   clear->attachment_count = kept;
+   if (kept)
+      return false;
+
+   list_del(&cmd->cmd_link);
+   return true;
+}
+
+static void
+wrapper_link_attachment(VkRenderingAttachmentInfo *prev,
+                        VkRenderingAttachmentInfo *next,
+                        bool next_covers_prev, bool prev_covers_next,
+                        struct wrapper_load_store_stats *stats)
+{
+   if (!prev || !next || prev->imageView == VK_NULL_HANDLE ||
+       prev->imageView != next->imageView)
+      return;
+
+   if (prev->storeOp == VK_ATTACHMENT_STORE_OP_STORE && next_covers_prev &&
+       (next->loadOp == VK_ATTACHMENT_LOAD_OP_CLEAR ||
+        next->loadOp == VK_ATTACHMENT_LOAD_OP_DONT_CARE)) {
+      prev->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      stats->stores++;
+   } else if (prev->storeOp == VK_ATTACHMENT_STORE_OP_DONT_CARE &&
+              prev_covers_next &&
+              next->loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) {
+      next->loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      stats->loads++;
+   }
+}
+
+static void
+wrapper_link_rendering(VkRenderingInfo *prev, VkRenderingInfo *next,
+                       struct wrapper_load_store_stats *stats)
+{
+   bool next_covers_prev, prev_covers_next;
+
+   if (prev->viewMask != next->viewMask ||
+       prev->layerCount != next->layerCount)
+      return;
+
+   next_covers_prev = wrapper_rect_contains(&next->renderArea,
+                                            &prev->renderArea);
+   prev_covers_next = wrapper_rect_contains(&prev->renderArea,
+                                            &next->renderArea);
+
+   for (uint32_t i = 0; i < prev->colorAttachmentCount; i++) {
+      for (uint32_t j = 0; j < next->colorAttachmentCount; j++) {
+         wrapper_link_attachment(
+            (VkRenderingAttachmentInfo *)&prev->pColorAttachments[i],
+            (VkRenderingAttachmentInfo *)&next->pColorAttachments[j],
+            next_covers_prev, prev_covers_next, stats);
+      }
+   }
+
+   wrapper_link_attachment((VkRenderingAttachmentInfo *)prev->pDepthAttachment,
+                           (VkRenderingAttachmentInfo *)next->pDepthAttachment,
+                           next_covers_prev, prev_covers_next, stats);
+   wrapper_link_attachment((VkRenderingAttachmentInfo *)prev->pStencilAttachment,
+                           (VkRenderingAttachmentInfo *)next->pStencilAttachment,
+                           next_covers_prev, prev_covers_next, stats);
+}
+
+static bool
+wrapper_attachments_match(const VkRenderingAttachmentInfo *a,
+                          const VkRenderingAttachmentInfo *b)
+{
+   if (!a || !b)
+      return a == b;
+
+   /* The second instance's contents must continue the first one's, so
+    * it can't clear.
+    */
+   return !a->pNext && !b->pNext &&
+          a->imageView == b->imageView &&
+          a->imageLayout == b->imageLayout &&
+          a->resolveMode == b->resolveMode &&
+          a->resolveImageView == b->resolveImageView &&
+          a->resolveImageLayout == b->resolveImageLayout &&
+          (b->imageView == VK_NULL_HANDLE ||
+           b->loadOp != VK_ATTACHMENT_LOAD_OP_CLEAR);
+}
+
+static bool
+wrapper_rendering_can_merge(const VkRenderingInfo *a,
+                            const VkRenderingInfo *b)
+{
+   if (a->flags != b->flags ||
+       a->layerCount != b->layerCount ||
+       a->viewMask != b->viewMask ||
+       a->colorAttachmentCount != b->colorAttachmentCount ||
+       memcmp(&a->renderArea, &b->renderArea, sizeof(a->renderArea)))
+      return false;
+
+   for (uint32_t i = 0; i < a->colorAttachmentCount; i++) {
+      if (!wrapper_attachments_match(&a->pColorAttachments[i],
+                                     &b->pColorAttachments[i]))
+         return false;
+   }
+
+   return wrapper_attachments_match(a->pDepthAttachment,
+                                    b->pDepthAttachment) &&
+          wrapper_attachments_match(a->pStencilAttachment,
+                                    b->pStencilAttachment);
+}
+
+static void
+wrapper_merge_store_op(const VkRenderingAttachmentInfo *from,
+                       const VkRenderingAttachmentInfo *to)
+{
+   if (to)
+      ((VkRenderingAttachmentInfo *)to)->storeOp = from->storeOp;
+}
+
+/* Drops the vkCmdEndRendering of the first instance and the
+ * vkCmdBeginRendering of the second, so the first one carries on with
+ * the second's store ops.
+ */
+static void
+wrapper_merge_rendering(VkRenderingInfo *info,
+                        struct vk_cmd_queue_entry *end,
+                        struct vk_cmd_queue_entry *begin)
+{
+   VkRenderingInfo *next = begin->u.begin_rendering.rendering_info;
+
+   for (uint32_t i = 0; i < info->colorAttachmentCount; i++)
+      wrapper_merge_store_op(&next->pColorAttachments[i],
+                             &info->pColorAttachments[i]);
+   if (next->pDepthAttachment)
+      wrapper_merge_store_op(next->pDepthAttachment, info->pDepthAttachment);
+   if (next->pStencilAttachment)
+      wrapper_merge_store_op(next->pStencilAttachment,
+                             info->pStencilAttachment);
+
+   /* Both stay in the queue's chunks until it is reset. */
+   list_del(&end->cmd_link);
+   list_del(&begin->cmd_link);
+}
+
+void
+wrapper_load_store_optimize(struct wrapper_command_buffer *wcb)
+{
+   struct wrapper_device *device = wcb->device;
+   struct vk_cmd_queue *queue = &wcb->vk.cmd_queue;
+   struct wrapper_load_store_stats stats = { 0 };
+   VkRenderingInfo *current = NULL, *prev = NULL, *link = NULL;
+   VkRenderingInfo *prev_link = NULL;
+   struct vk_cmd_queue_entry *end = NULL;
+   bool first = false, remapped = false, prev_remapped = false;
+
+   list_for_each_entry_safe(struct vk_cmd_queue_entry, cmd,
+                            &queue->cmds, cmd_link) {
+      struct vk_cmd_queue_entry *prev_end = end;
+
+      end = NULL;
+
+      switch (cmd->type) {
+      case VK_CMD_BEGIN_RENDERING:
+         current = cmd->u.begin_rendering.rendering_info;
+         if (!wrapper_rendering_is_simple(current)) {
+            current = prev = link = NULL;
+            break;
+         }
+
+         /* Attachment locations and input indices are reset by
+          * vkCmdBeginRendering, so instances that changed them can't
+          * run on into the next one.
+          */
+         if (device->merge_rendering && prev_end && !prev_remapped &&
+             wrapper_rendering_can_merge(prev, current)) {
+            wrapper_merge_rendering(prev, prev_end, cmd);
+            current = prev;
+            link = prev_link;
+            prev = NULL;
+            first = false;
+            stats.merged++;
+            break;
+         }
+
+         /* prev is only still set if nothing but barriers followed it. */
+         link = prev;
+         prev = NULL;
+         first = true;
+         remapped = false;
+         break;
+
+      case VK_CMD_END_RENDERING:
+         /* The next instance's load ops are final once its first
+          * command has been looked at, which is always the case here.
+          */
+         if (device->load_store_ops && current && link)
+            wrapper_link_rendering(link, current, &stats);
+         if (current)
+            end = cmd;
+         prev = current;
+         prev_link = link;
+         prev_remapped = remapped;
+         current = link = NULL;
+         break;
+
+      case VK_CMD_CLEAR_ATTACHMENTS:
+         if (device->load_store_ops && current && first)
+            wrapper_fold_clear(current, cmd, &stats);
+         first = false;
+         break;
+
+      case VK_CMD_PIPELINE_BARRIER:
+      case VK_CMD_PIPELINE_BARRIER2:
+         /* Barriers neither read nor write attachment contents. */
+         first = false;
+         break;
+
+      case VK_CMD_SET_RENDERING_ATTACHMENT_LOCATIONS_KHR:
+      case VK_CMD_SET_RENDERING_INPUT_ATTACHMENT_INDICES_KHR:
+         remapped = true;
+         first = false;
+         break;
+
+      default:
+         /* Anything else outside of a rendering instance might read the
+          * attachments.
+          */
+         if (!current)
+            prev = NULL;
+         first = false;
+         break;
+      }
+   }
+
+   if (stats.loads)
+      p_atomic_add(&device->load_ops_rewritten, stats.loads);
+   if (stats.stores)
+      p_atomic_add(&device->store_ops_rewritten, stats.stores);
+   if (stats.clears)
+      p_atomic_add(&device->clears_folded, stats.clears);
+   if (stats.merged)
+      p_atomic_add(&device->renderings_merged, stats.merged);
+}
+
+void
+wrapper_load_store_report(struct wrapper_device *device)
+{
+   if (device->load_store_ops &&
+       (device->load_ops_rewritten || device->store_ops_rewritten ||
+        device->clears_folded)) {
+      mesa_logi("wrapper: rewrote %" PRIu64 " load ops and %" PRIu64
+                " store ops, folded %" PRIu64 " attachment clears",
+                device->load_ops_rewritten, device->store_ops_rewritten,
+                device->clears_folded);
+   }
+
+   if (device->merge_rendering && device->renderings_merged) {
+      mesa_logi("wrapper: merged %" PRIu64 " rendering instances",
+                device->renderings_merged);
+   }
+}
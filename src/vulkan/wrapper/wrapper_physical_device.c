@@ -11,6 +11,7 @@
 #include "vk_util.h"
 #include "wsi_common.h"
 #include "util/os_misc.h"
+#include "util/u_debug.h"
 
 static VkResult
 wrapper_setup_device_extensions(struct wrapper_physical_device *pdevice) {
@@ -114,6 +115,7 @@ VkResult enumerate_physical_device(struct vk_instance *_instance)
 
       pdevice->instance = instance;
       pdevice->dispatch_handle = physical_devices[i];
+      simple_mtx_init(&pdevice->budget_mutex, mtx_plain);
       get_instance_proc_addr = instance->dispatch_table.GetInstanceProcAddr;
 
       vk_physical_device_dispatch_table_load(&pdevice->dispatch_table,
@@ -139,12 +141,21 @@ VkResult enumerate_physical_device(struct vk_instance *_instance)
       supported_features->presentWait = supported_features->timelineSemaphore;
       supported_features->swapchainMaintenance1 = true;
       supported_features->imageCompressionControlSwapchain = false;
+
+      pdevice->emulate_host_image_copy =
+         !pdevice->base_supported_extensions.EXT_host_image_copy &&
+         debug_get_bool_option("WRAPPER_HOST_IMAGE_COPY", false);
+      if (pdevice->emulate_host_image_copy) {
+         pdevice->vk.supported_extensions.EXT_host_image_copy = true;
+         supported_features->hostImageCopy = true;
+      }
       
       result = wsi_device_init(&pdevice->wsi_device,
                                wrapper_physical_device_to_handle(pdevice),
                                wrapper_wsi_proc_addr, &_instance->alloc, -1,
                                NULL, &(struct wsi_device_options){});
       if (result != VK_SUCCESS) {
+         simple_mtx_destroy(&pdevice->budget_mutex);
          vk_physical_device_finish(&pdevice->vk);
          vk_free(&_instance->alloc, pdevice);
          return result;
@@ -167,6 +178,13 @@ VkResult enumerate_physical_device(struct vk_instance *_instance)
          
       pdevice->dispatch_table.GetPhysicalDeviceMemoryProperties(
          pdevice->dispatch_handle, &pdevice->memory_properties);
+
+      wrapper_setup_subgroup_operations(pdevice);
+      wrapper_setup_queue_priorities(pdevice);
+      if (pdevice->emulate_global_priority_query) {
+         pdevice->vk.supported_extensions.EXT_global_priority_query = true;
+         supported_features->globalPriorityQuery = true;
+      }
      
       const char *app_name = instance->vk.app_info.app_name
          ? instance->vk.app_info.app_name : "wrapper";
@@ -194,6 +212,7 @@ void destroy_physical_device(struct vk_physical_device *pdevice) {
    if (wpdevice->dma_heap_fd != -1)
       close(wpdevice->dma_heap_fd);
    wsi_device_finish(pdevice->wsi_device, &pdevice->instance->alloc);
+   simple_mtx_destroy(&wpdevice->budget_mutex);
    vk_physical_device_finish(pdevice);
    vk_free(&pdevice->instance->alloc, pdevice);
 }
@@ -268,8 +287,13 @@ wrapper_GetPhysicalDeviceProperties2(VkPhysicalDevice physicalDevice,
       {
          VkPhysicalDeviceVulkan11Properties *vk11_prop =
               (VkPhysicalDeviceVulkan11Properties *)prop;
-         vk11_prop->subgroupSupportedOperations = 0;
-         vk11_prop->subgroupSupportedStages = 0;
+         /* Only what passed the self-test, and only in the stage it
+          * was tested in, unless the test could not run to the end.
+          */
+         vk11_prop->subgroupSupportedOperations &= pdevice->subgroup_operations;
+         vk11_prop->subgroupSupportedStages &= pdevice->subgroup_operations ?
+            pdevice->subgroup_stages : 0;
+         vk11_prop->subgroupQuadOperationsInAllStages = false;
          break;
       }
       case VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES:
@@ -298,8 +322,81 @@ wrapper_GetPhysicalDeviceProperties2(VkPhysicalDevice physicalDevice,
       {
          VkPhysicalDeviceSubgroupProperties *subgroup_prop =
               (VkPhysicalDeviceSubgroupProperties *)prop;
-         subgroup_prop->supportedOperations = 0;
-         subgroup_prop->supportedStages = 0;
+         subgroup_prop->supportedOperations &= pdevice->subgroup_operations;
+         subgroup_prop->supportedStages &= pdevice->subgroup_operations ?
+            pdevice->subgroup_stages : 0;
+         subgroup_prop->quadOperationsInAllStages = false;
+         break;
+      }
+      case VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT:
+      {
+         VkPhysicalDeviceHostImageCopyPropertiesEXT *host_copy_prop =
+              (VkPhysicalDeviceHostImageCopyPropertiesEXT *)prop;
+         /* Layout UUID for the emulated copies, which never depend on
+          * the driver's tiling since they go through the copy commands.
+          */
+         static const uint8_t layout_uuid[VK_UUID_SIZE] = {
+            'w', 'r', 'a', 'p', 'p', 'e', 'r', '-',
+            'h', 'o', 's', 't', 'c', 'o', 'p', 'y',
+         };
+
+         if (!pdevice->emulate_host_image_copy)
+            break;
+
+         if (host_copy_prop->pCopySrcLayouts) {
+            host_copy_prop->copySrcLayoutCount =
+               MIN2(host_copy_prop->copySrcLayoutCount,
+                    wrapper_host_copy_src_layout_count);
+            memcpy(host_copy_prop->pCopySrcLayouts,
+                   wrapper_host_copy_src_layouts,
+                   host_copy_prop->copySrcLayoutCount *
+                   sizeof(VkImageLayout));
+         } else {
+            host_copy_prop->copySrcLayoutCount =
+               wrapper_host_copy_src_layout_count;
+         }
+         if (host_copy_prop->pCopyDstLayouts) {
+            host_copy_prop->copyDstLayoutCount =
+               MIN2(host_copy_prop->copyDstLayoutCount,
+                    wrapper_host_copy_dst_layout_count);
+            memcpy(host_copy_prop->pCopyDstLayouts,
+                   wrapper_host_copy_dst_layouts,
+                   host_copy_prop->copyDstLayoutCount *
+                   sizeof(VkImageLayout));
+         } else {
+            host_copy_prop->copyDstLayoutCount =
+               wrapper_host_copy_dst_layout_count;
+         }
+         memcpy(host_copy_prop->optimalTilingLayoutUUID, layout_uuid,
+                VK_UUID_SIZE);
+         host_copy_prop->identicalMemoryTypeRequirements = VK_FALSE;
+         break;
+      }
+      default:
+         break;
+      }
+   }
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_GetPhysicalDeviceMemoryProperties2(VkPhysicalDevice physicalDevice,
+                                           VkPhysicalDeviceMemoryProperties2* pMemoryProperties)
+{
+   VK_FROM_HANDLE(wrapper_physical_device, pdevice, physicalDevice);
+   pdevice->dispatch_table.GetPhysicalDeviceMemoryProperties2(
+      pdevice->dispatch_handle, pMemoryProperties);
+
+   vk_foreach_struct(prop, pMemoryProperties->pNext) {
+      switch (prop->sType) {
+      case VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT:
+      {
+         /* Drivers without VK_EXT_memory_budget leave this untouched, and
+          * the ones with it don't know about the memory we allocate from
+          * dma-heap or AHardwareBuffers on their behalf.
+          */
+         wrapper_get_memory_budget(pdevice,
+            (VkPhysicalDeviceMemoryBudgetPropertiesEXT *)prop,
+            pdevice->base_supported_extensions.EXT_memory_budget);
          break;
       }
       default:
@@ -320,6 +417,9 @@ wrapper_GetPhysicalDeviceImageFormatProperties(VkPhysicalDevice physicalDevice,
    VkResult result;
    VK_FROM_HANDLE(wrapper_physical_device, pdevice, physicalDevice);
 
+   if (pdevice->emulate_host_image_copy)
+      wrapper_host_copy_fixup_usage(&usage);
+
    result = pdevice->dispatch_table.GetPhysicalDeviceImageFormatProperties(
       pdevice->dispatch_handle, format, type, tiling, usage, flags, pImageFormatProperties);
       
@@ -392,10 +492,32 @@ wrapper_GetPhysicalDeviceImageFormatProperties2(VkPhysicalDevice physicalDevice,
 {
    VkResult result;
    VK_FROM_HANDLE(wrapper_physical_device, pdevice, physicalDevice);
-   
+   VkPhysicalDeviceImageFormatInfo2 format_info = *pImageFormatInfo;
+   VkHostImageCopyDevicePerformanceQueryEXT *host_copy_perf;
+   VkImageUsageFlags usage = pImageFormatInfo->usage;
+
+   if (pdevice->emulate_host_image_copy &&
+       wrapper_host_copy_fixup_usage(&format_info.usage))
+      pImageFormatInfo = &format_info;
+
    result = pdevice->dispatch_table.GetPhysicalDeviceImageFormatProperties2(
       pdevice->dispatch_handle, pImageFormatInfo, pImageFormatProperties);
 
+   /* The emulation adds transfer usage, which the driver may lay the
+    * image out differently for unless the application asked for it
+    * anyway.
+    */
+   host_copy_perf = vk_find_struct(pImageFormatProperties->pNext,
+                                   HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT);
+   if (host_copy_perf && pdevice->emulate_host_image_copy) {
+      const VkImageUsageFlags transfer_usage =
+         VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+      bool identical = (usage & transfer_usage) == transfer_usage;
+
+      host_copy_perf->optimalDeviceAccess = identical;
+      host_copy_perf->identicalMemoryLayout = identical;
+   }
+
    switch(pImageFormatInfo->format) {
    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:                                    
    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
@@ -492,3 +614,29 @@ wrapper_GetPhysicalDeviceFormatProperties(VkPhysicalDevice physicalDevice,
       break;   
    }
 }                                      
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_GetPhysicalDeviceFormatProperties2(VkPhysicalDevice physicalDevice,
+                                           VkFormat format,
+                                           VkFormatProperties2* pFormatProperties)
+{
+   VK_FROM_HANDLE(wrapper_physical_device, pdevice, physicalDevice);
+   VkFormatProperties3 *props3;
+   pdevice->dispatch_table.GetPhysicalDeviceFormatProperties2(
+      pdevice->dispatch_handle, format, pFormatProperties);
+
+   props3 = vk_find_struct(pFormatProperties->pNext, FORMAT_PROPERTIES_3);
+   if (!props3 || !pdevice->emulate_host_image_copy)
+      return;
+
+   /* Host copies are done with the transfer commands. */
+#define WRAPPER_HOST_COPY_FEATURES (VK_FORMAT_FEATURE_2_TRANSFER_SRC_BIT | \
+                                    VK_FORMAT_FEATURE_2_TRANSFER_DST_BIT)
+   if ((props3->linearTilingFeatures & WRAPPER_HOST_COPY_FEATURES) ==
+       WRAPPER_HOST_COPY_FEATURES)
+      props3->linearTilingFeatures |= VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT;
+   if ((props3->optimalTilingFeatures & WRAPPER_HOST_COPY_FEATURES) ==
+       WRAPPER_HOST_COPY_FEATURES)
+      props3->optimalTilingFeatures |= VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT;
+#undef WRAPPER_HOST_COPY_FEATURES
+}
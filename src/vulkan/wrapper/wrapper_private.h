@@ -9,12 +9,16 @@
 #include "vulkan/util/vk_dispatch_table.h"
 #include "vulkan/wsi/wsi_common.h"
 #include "util/simple_mtx.h"
+#include "util/slab.h"
+#include "util/u_queue.h"
 #include "adrenotools/driver.h"
 
 extern const struct vk_instance_extension_table wrapper_instance_extensions;
 extern const struct vk_device_extension_table wrapper_device_extensions;
 extern const struct vk_device_extension_table wrapper_filter_extensions;
 
+#define WRAPPER_MAX_QUEUE_FAMILIES 16
+
 struct wrapper_instance {
    struct vk_instance vk;
 
@@ -38,6 +42,23 @@ struct wrapper_physical_device {
    struct vk_features base_supported_features;
    struct vk_device_extension_table base_supported_extensions;
    struct vk_physical_device_dispatch_table dispatch_table;
+
+   uint64_t heap_usage[VK_MAX_MEMORY_HEAPS];
+   simple_mtx_t budget_mutex;
+   uint64_t budget_timestamp;
+   uint64_t budget_headroom;
+
+   VkSubgroupFeatureFlags subgroup_operations;
+   VkShaderStageFlags subgroup_stages;
+   bool emulate_host_image_copy;
+
+   bool queue_priority;
+   bool emulate_global_priority_query;
+   uint32_t queue_family_count;
+   struct {
+      VkQueueFlags flags;
+      VkQueueGlobalPriorityKHR max_priority;
+   } queue_families[WRAPPER_MAX_QUEUE_FAMILIES];
 };
 
 VK_DEFINE_HANDLE_CASTS(wrapper_physical_device, vk.base, VkPhysicalDevice,
@@ -48,32 +69,102 @@ struct wrapper_queue {
 
    struct wrapper_device *device;
    VkQueue dispatch_handle;
+
+   /* Serializes our own submissions with the application's. */
+   simple_mtx_t submit_mutex;
 };
 
 VK_DEFINE_HANDLE_CASTS(wrapper_queue, vk.base, VkQueue,
                        VK_OBJECT_TYPE_QUEUE)
 
+enum wrapper_filter_counter {
+   WRAPPER_FILTER_PIPELINE,
+   WRAPPER_FILTER_VIEWPORT,
+   WRAPPER_FILTER_SCISSOR,
+   WRAPPER_FILTER_DESCRIPTOR_SETS,
+   WRAPPER_FILTER_VERTEX_BUFFERS,
+   WRAPPER_FILTER_INDEX_BUFFER,
+   WRAPPER_FILTER_DYNAMIC_STATE,
+   WRAPPER_FILTER_COUNT,
+};
+
 struct wrapper_device {
    struct vk_device vk;
 
    VkDevice dispatch_handle;
    simple_mtx_t resource_mutex;
-   struct list_head command_buffer_list;
+   bool deferred_recording;
+   struct util_queue record_queue;
+   struct list_head command_pool_list;
    struct list_head device_memory_list;
+   struct hash_table_u64 *memory_usage;
+   struct wrapper_shader_module_cache *shader_module_cache;
+   bool transient_attachments;
+   struct hash_table_u64 *transient_images;
+   struct hash_table_u64 *transient_views;
+   struct hash_table *transient_history;
+   uint64_t transient_promoted;
+   uint64_t transient_bytes;
+   uint64_t transient_committed;
    struct wrapper_physical_device *physical;
    struct vk_device_dispatch_table dispatch_table;
+
+   /* Commands not dropped by the state filter continue here. */
+   bool state_filter;
+   struct vk_device_dispatch_table cmd_dispatch;
+   uint64_t filter_calls[WRAPPER_FILTER_COUNT];
+   uint64_t filter_dropped[WRAPPER_FILTER_COUNT];
+
+   bool coalesce_barriers;
+   uint64_t barriers_in;
+   uint64_t barriers_merged;
+
+   bool load_store_ops;
+   uint64_t load_ops_rewritten;
+   uint64_t store_ops_rewritten;
+   uint64_t clears_folded;
+
+   bool merge_rendering;
+   uint64_t renderings_merged;
+
+   struct wrapper_host_copy *host_copy;
 };
 
 VK_DEFINE_HANDLE_CASTS(wrapper_device, vk.base, VkDevice,
                        VK_OBJECT_TYPE_DEVICE)
 
+struct wrapper_command_pool {
+   struct vk_object_base base;
+
+   struct wrapper_device *device;
+   struct list_head link;
+   struct list_head command_buffers;
+   struct slab_mempool command_buffer_slab;
+   VkCommandPool dispatch_handle;
+
+   /* What the pool was created with, for destroying it with the device. */
+   VkAllocationCallbacks alloc;
+   bool has_alloc;
+};
+
+VK_DEFINE_NONDISP_HANDLE_CASTS(wrapper_command_pool, base, VkCommandPool,
+                               VK_OBJECT_TYPE_COMMAND_POOL)
+
 struct wrapper_command_buffer {
    struct vk_command_buffer vk;
 
    struct wrapper_device *device;
    struct list_head link;
-   VkCommandPool pool;
+   struct wrapper_command_pool *pool;
    VkCommandBuffer dispatch_handle;
+
+   struct util_queue_fence replay_fence;
+   VkResult replay_result;
+
+   struct wrapper_state_shadow *state;
+
+   uint32_t barriers_in;
+   uint32_t barriers_merged;
 };
 
 VK_DEFINE_HANDLE_CASTS(wrapper_command_buffer, vk.base, VkCommandBuffer,
@@ -97,6 +188,21 @@ void destroy_physical_device(struct vk_physical_device *pdevice);
 void
 wrapper_setup_device_features(struct wrapper_physical_device *physical_device);
 
+void
+wrapper_setup_subgroup_operations(struct wrapper_physical_device *pdevice);
+
+void
+wrapper_setup_queue_priorities(struct wrapper_physical_device *pdevice);
+
+const char *
+wrapper_queue_priority_extension(struct wrapper_physical_device *pdevice);
+
+bool
+wrapper_queue_priority_create_infos(struct wrapper_physical_device *pdevice,
+                                    const VkDeviceCreateInfo *pCreateInfo,
+                                    VkDeviceQueueCreateInfo *queue_infos,
+                                    VkDeviceQueueGlobalPriorityCreateInfoKHR *priority_infos);
+
 uint32_t
 wrapper_select_device_memory_type(struct wrapper_device *device,
                                   VkMemoryPropertyFlags flags);
@@ -108,3 +214,112 @@ wrapper_device_memory_create(struct wrapper_device *device,
 
 void
 wrapper_device_memory_destroy(struct wrapper_device_memory *mem);
+
+void
+wrapper_memory_usage_finish(struct wrapper_device *device);
+
+void
+wrapper_get_memory_budget(struct wrapper_physical_device *pdevice,
+                          VkPhysicalDeviceMemoryBudgetPropertiesEXT *budget,
+                          bool driver_budget);
+
+void
+wrapper_transient_init(struct wrapper_device *device);
+
+void
+wrapper_transient_finish(struct wrapper_device *device);
+
+bool
+wrapper_transient_allocate_info(struct wrapper_device *device,
+                                const VkMemoryAllocateInfo *pAllocateInfo,
+                                VkMemoryAllocateInfo *lazy_info);
+
+void
+wrapper_transient_free(struct wrapper_device *device, VkDeviceMemory memory);
+
+void
+wrapper_get_transient_entrypoints(struct vk_device_entrypoint_table *entrypoints);
+
+int
+wrapper_device_memory_get_dmabuf(struct wrapper_device *device,
+                                 VkDeviceMemory memory, size_t *size);
+
+extern const VkImageLayout wrapper_host_copy_src_layouts[];
+extern const uint32_t wrapper_host_copy_src_layout_count;
+extern const VkImageLayout wrapper_host_copy_dst_layouts[];
+extern const uint32_t wrapper_host_copy_dst_layout_count;
+
+void
+wrapper_host_copy_init(struct wrapper_device *device);
+
+void
+wrapper_host_copy_finish(struct wrapper_device *device);
+
+bool
+wrapper_host_copy_fixup_usage(VkImageUsageFlags *usage);
+
+void
+wrapper_host_copy_image_create(struct wrapper_device *device, VkImage image,
+                               const VkImageCreateInfo *pCreateInfo);
+
+void
+wrapper_host_copy_image_destroy(struct wrapper_device *device, VkImage image);
+
+void
+wrapper_command_pool_destroy(struct wrapper_command_pool *pool,
+                             const VkAllocationCallbacks* pAllocator);
+
+void
+wrapper_get_deferred_entrypoints(struct vk_device_entrypoint_table *entrypoints);
+
+void
+wrapper_command_buffer_replay(struct wrapper_command_buffer *wcb);
+
+VkResult
+wrapper_command_buffer_wait(struct wrapper_command_buffer *wcb);
+
+static inline void
+wrapper_command_buffer_flush(struct wrapper_command_buffer *wcb)
+{
+   if (unlikely(!list_is_empty(&wcb->vk.cmd_queue.cmds)))
+      wrapper_command_buffer_replay(wcb);
+}
+
+void
+wrapper_get_state_filter_entrypoints(struct vk_device_entrypoint_table *entrypoints);
+
+VkResult
+wrapper_state_shadow_create(struct wrapper_command_buffer *wcb);
+
+void
+wrapper_state_shadow_destroy(struct wrapper_command_buffer *wcb);
+
+void
+wrapper_state_shadow_invalidate(struct wrapper_command_buffer *wcb);
+
+void
+wrapper_state_shadow_end(struct wrapper_command_buffer *wcb);
+
+void
+wrapper_state_filter_report(struct wrapper_device *device);
+
+void
+wrapper_get_barrier_entrypoints(struct vk_device_entrypoint_table *entrypoints);
+
+void
+wrapper_barrier_end(struct wrapper_command_buffer *wcb);
+
+void
+wrapper_barrier_report(struct wrapper_device *device);
+
+void
+wrapper_load_store_optimize(struct wrapper_command_buffer *wcb);
+
+void
+wrapper_load_store_report(struct wrapper_device *device);
+
+void
+wrapper_shader_module_cache_init(struct wrapper_device *device);
+
+void
+wrapper_shader_module_cache_finish(struct wrapper_device *device);
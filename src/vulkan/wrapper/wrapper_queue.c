@@ -0,0 +1,212 @@
+#include "wrapper_private.h"
+#include "wrapper_entrypoints.h"
+#include "vk_util.h"
+#include "util/log.h"
+#include "util/u_debug.h"
+
+/* Queue priorities: enabled with WRAPPER_QUEUE_PRIORITY=1.
+ *
+ * Games share the GPU with the compositor and whatever compute runs in
+ * the background, so queues in graphics capable families are created
+ * with the highest global priority the driver permits, and queues in
+ * compute or transfer only families with the lowest.  Priorities the
+ * application asks for itself are left alone.
+ *
+ * What the driver permits is found by creating a throwaway device per
+ * priority and family, unless the driver can report it itself.  Those
+ * results also back VK_EXT_global_priority_query when the driver
+ * doesn't have it.
+ */
+
+const char *
+wrapper_queue_priority_extension(struct wrapper_physical_device *pdevice)
+{
+   if (pdevice->base_supported_extensions.KHR_global_priority)
+      return VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME;
+   if (pdevice->base_supported_extensions.EXT_global_priority)
+      return VK_EXT_GLOBAL_PRIORITY_EXTENSION_NAME;
+   return NULL;
+}
+
+static bool
+wrapper_try_global_priority(struct wrapper_physical_device *pdevice,
+                            uint32_t family, VkQueueGlobalPriorityKHR priority)
+{
+   const char *extension = wrapper_queue_priority_extension(pdevice);
+   const float queue_priority = 1.0f;
+   PFN_vkDestroyDevice destroy_device;
+   PFN_vkGetDeviceProcAddr gdpa;
+   VkDevice device;
+   VkResult result;
+
+   result = pdevice->dispatch_table.CreateDevice(
+      pdevice->dispatch_handle,
+      &(VkDeviceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+         .queueCreateInfoCount = 1,
+         .pQueueCreateInfos = &(VkDeviceQueueCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .pNext = &(VkDeviceQueueGlobalPriorityCreateInfoKHR) {
+               .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_GLOBAL_PRIORITY_CREATE_INFO_KHR,
+               .globalPriority = priority,
+            },
+            .queueFamilyIndex = family,
+            .queueCount = 1,
+            .pQueuePriorities = &queue_priority,
+         },
+         .enabledExtensionCount = 1,
+         .ppEnabledExtensionNames = &extension,
+      }, NULL, &device);
+   if (result != VK_SUCCESS)
+      return false;
+
+   gdpa = (PFN_vkGetDeviceProcAddr)
+      pdevice->instance->dispatch_table.GetInstanceProcAddr(
+         pdevice->instance->dispatch_handle, "vkGetDeviceProcAddr");
+   destroy_device = (PFN_vkDestroyDevice)gdpa(device, "vkDestroyDevice");
+   destroy_device(device, NULL);
+
+   return true;
+}
+
+static bool
+wrapper_driver_has_global_priority_query(struct wrapper_physical_device *pdevice)
+{
+   return (pdevice->base_supported_extensions.KHR_global_priority ||
+           pdevice->base_supported_extensions.EXT_global_priority_query) &&
+          pdevice->base_supported_features.globalPriorityQuery;
+}
+
+void
+wrapper_setup_queue_priorities(struct wrapper_physical_device *pdevice)
+{
+   static const VkQueueGlobalPriorityKHR probe_priorities[] = {
+      VK_QUEUE_GLOBAL_PRIORITY_REALTIME_KHR,
+      VK_QUEUE_GLOBAL_PRIORITY_HIGH_KHR,
+   };
+   VkQueueFamilyGlobalPriorityPropertiesKHR
+      driver_priorities[WRAPPER_MAX_QUEUE_FAMILIES];
+   VkQueueFamilyProperties2 families[WRAPPER_MAX_QUEUE_FAMILIES];
+   uint32_t family_count = WRAPPER_MAX_QUEUE_FAMILIES;
+   bool driver_query;
+
+   if (!debug_get_bool_option("WRAPPER_QUEUE_PRIORITY", false) ||
+       !wrapper_queue_priority_extension(pdevice))
+      return;
+
+   driver_query = wrapper_driver_has_global_priority_query(pdevice);
+   for (uint32_t i = 0; i < family_count; i++) {
+      driver_priorities[i] = (VkQueueFamilyGlobalPriorityPropertiesKHR) {
+         .sType = VK_STRUCTURE_TYPE_QUEUE_FAMILY_GLOBAL_PRIORITY_PROPERTIES_KHR,
+      };
+      families[i] = (VkQueueFamilyProperties2) {
+         .sType = VK_STRUCTURE_TYPE_QUEUE_FAMILY_PROPERTIES_2,
+         .pNext = driver_query ? &driver_priorities[i] : NULL,
+      };
+   }
+   pdevice->dispatch_table.GetPhysicalDeviceQueueFamilyProperties2(
+      pdevice->dispatch_handle, &family_count, families);
+
+   for (uint32_t i = 0; i < family_count; i++) {
+      VkQueueGlobalPriorityKHR max_priority =
+         VK_QUEUE_GLOBAL_PRIORITY_MEDIUM_KHR;
+
+      if (driver_query) {
+         for (uint32_t j = 0; j < driver_priorities[i].priorityCount; j++) {
+            max_priority = MAX2(max_priority,
+                                driver_priorities[i].priorities[j]);
+         }
+      } else {
+         for (uint32_t j = 0; j < ARRAY_SIZE(probe_priorities); j++) {
+            if (wrapper_try_global_priority(pdevice, i,
+                                            probe_priorities[j])) {
+               max_priority = probe_priorities[j];
+               break;
+            }
+         }
+      }
+
+      pdevice->queue_families[i].flags =
+         families[i].queueFamilyProperties.queueFlags;
+      pdevice->queue_families[i].max_priority = max_priority;
+   }
+
+   pdevice->queue_family_count = family_count;
+   pdevice->queue_priority = true;
+   pdevice->emulate_global_priority_query = !driver_query;
+}
+
+/* Fills *priority_infos and *queue_infos with copies of the application's
+ * queue create infos that carry the priorities we want, and returns
+ * false if none of them needed one.
+ */
+bool
+wrapper_queue_priority_create_infos(struct wrapper_physical_device *pdevice,
+                                    const VkDeviceCreateInfo *pCreateInfo,
+                                    VkDeviceQueueCreateInfo *queue_infos,
+                                    VkDeviceQueueGlobalPriorityCreateInfoKHR *priority_infos)
+{
+   bool changed = false;
+
+   for (uint32_t i = 0; i < pCreateInfo->queueCreateInfoCount; i++) {
+      const VkDeviceQueueCreateInfo *info = &pCreateInfo->pQueueCreateInfos[i];
+      uint32_t family = info->queueFamilyIndex;
+      VkQueueGlobalPriorityKHR priority;
+
+      queue_infos[i] = *info;
+
+      if (family >= pdevice->queue_family_count ||
+          vk_find_struct_const(info->pNext,
+                               DEVICE_QUEUE_GLOBAL_PRIORITY_CREATE_INFO_KHR))
+         continue;
+
+      if (pdevice->queue_families[family].flags & VK_QUEUE_GRAPHICS_BIT)
+         priority = pdevice->queue_families[family].max_priority;
+      else
+         priority = VK_QUEUE_GLOBAL_PRIORITY_LOW_KHR;
+
+      priority_infos[i] = (VkDeviceQueueGlobalPriorityCreateInfoKHR) {
+         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_GLOBAL_PRIORITY_CREATE_INFO_KHR,
+         .pNext = info->pNext,
+         .globalPriority = priority,
+      };
+      queue_infos[i].pNext = &priority_infos[i];
+      changed = true;
+   }
+
+   return changed;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_GetPhysicalDeviceQueueFamilyProperties2(VkPhysicalDevice physicalDevice,
+                                                uint32_t* pQueueFamilyPropertyCount,
+                                                VkQueueFamilyProperties2* pQueueFamilyProperties)
+{
+   VK_FROM_HANDLE(wrapper_physical_device, pdevice, physicalDevice);
+   pdevice->dispatch_table.GetPhysicalDeviceQueueFamilyProperties2(
+      pdevice->dispatch_handle, pQueueFamilyPropertyCount,
+      pQueueFamilyProperties);
+
+   if (!pdevice->emulate_global_priority_query || !pQueueFamilyProperties)
+      return;
+
+   for (uint32_t i = 0; i < *pQueueFamilyPropertyCount; i++) {
+      VkQueueFamilyGlobalPriorityPropertiesKHR *props;
+      VkQueueGlobalPriorityKHR max_priority;
+
+      props = vk_find_struct(pQueueFamilyProperties[i].pNext,
+                             QUEUE_FAMILY_GLOBAL_PRIORITY_PROPERTIES_KHR);
+      if (!props)
+         continue;
+
+      max_priority = i < pdevice->queue_family_count ?
+         pdevice->queue_families[i].max_priority :
+         VK_QUEUE_GLOBAL_PRIORITY_MEDIUM_KHR;
+
+      /* Lower priorities never need any privileges. */
+      props->priorityCount = 0;
+      for (VkQueueGlobalPriorityKHR p = VK_QUEUE_GLOBAL_PRIORITY_LOW_KHR;
+           p <= max_priority; p *= 2)
+         props->priorities[props->priorityCount++] = p;
+   }
+}
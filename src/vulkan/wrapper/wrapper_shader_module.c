@@ -0,0 +1,455 @@
+#include "wrapper_private.h"
+#include "wrapper_entrypoints.h"
+#include "vk_alloc.h"
+#include "vk_util.h"
+#include "util/hash_table.h"
+#include "util/list.h"
+#include "util/log.h"
+#include "util/mesa-blake3.h"
+#include "util/os_time.h"
+#include "util/simple_mtx.h"
+#include "util/u_debug.h"
+
+/* Shader module deduplication: enabled with WRAPPER_SHADER_MODULE_CACHE=1.
+ *
+ * Identical SPIR-V shares a single driver VkShaderModule, keyed by the
+ * BLAKE3 hash of the code.  Handles are refcounted; modules nobody holds
+ * any more stay around in a small LRU (WRAPPER_SHADER_MODULE_CACHE_SIZE,
+ * 64 by default) so that recreating them, or passing the same code inline
+ * with VkShaderModuleCreateInfo at pipeline creation, still hits.
+ *
+ * Because two VkShaderModule objects may end up with the same handle,
+ * this is turned off when privateData is enabled.
+ */
+
+struct wrapper_shader_module {
+   blake3_hash hash;
+   VkShaderModule dispatch_handle;
+   uint32_t refcount;
+   struct list_head link;
+};
+
+struct wrapper_shader_module_cache {
+   simple_mtx_t mutex;
+   struct hash_table *modules;
+   struct hash_table_u64 *handles;
+   struct list_head unused;
+   uint32_t unused_count;
+   uint32_t max_unused;
+
+   uint64_t lookups;
+   uint64_t hits;
+   uint64_t miss_time_ns;
+};
+
+static uint32_t
+wrapper_blake3_hash(const void *key)
+{
+   return *(const uint32_t *)key;
+}
+
+static bool
+wrapper_blake3_equal(const void *a, const void *b)
+{
+   return !memcmp(a, b, sizeof(blake3_hash));
+}
+
+void
+wrapper_shader_module_cache_init(struct wrapper_device *device)
+{
+   struct wrapper_shader_module_cache *cache;
+
+   if (!debug_get_bool_option("WRAPPER_SHADER_MODULE_CACHE", false) ||
+       device->vk.enabled_features.privateData)
+      return;
+
+   cache = vk_zalloc(&device->vk.alloc, sizeof(*cache), 8,
+                     VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!cache)
+      return;
+
+   cache->modules = _mesa_hash_table_create(NULL, wrapper_blake3_hash,
+                                            wrapper_blake3_equal);
+   cache->handles = _mesa_hash_table_u64_create(NULL);
+   if (!cache->modules || !cache->handles) {
+      _mesa_hash_table_destroy(cache->modules, NULL);
+      _mesa_hash_table_u64_destroy(cache->handles);
+      vk_free(&device->vk.alloc, cache);
+      return;
+   }
+
+   simple_mtx_init(&cache->mutex, mtx_plain);
+   list_inithead(&cache->unused);
+   cache->max_unused =
+      debug_get_num_option("WRAPPER_SHADER_MODULE_CACHE_SIZE", 64);
+
+   device->shader_module_cache = cache;
+}
+
+static void
+wrapper_shader_module_evict(struct wrapper_device *device,
+                            struct wrapper_shader_module *module)
+{
+   struct wrapper_shader_module_cache *cache = device->shader_module_cache;
+
+   _mesa_hash_table_remove_key(cache->modules, module->hash);
+   _mesa_hash_table_u64_remove(cache->handles,
+                               (uint64_t)module->dispatch_handle);
+   device->dispatch_table.DestroyShaderModule(device->dispatch_handle,
+                                              module->dispatch_handle,
+                                              NULL);
+   vk_free(&device->vk.alloc, module);
+}
+
+void
+wrapper_shader_module_cache_finish(struct wrapper_device *device)
+{
+   struct wrapper_shader_module_cache *cache = device->shader_module_cache;
+
+   if (!cache)
+      return;
+
+   if (cache->lookups) {
+      uint64_t misses = cache->lookups - cache->hits;
+      uint64_t saved_ns = misses ?
+         cache->hits * (cache->miss_time_ns / misses) : 0;
+
+      mesa_logi("wrapper: shader module cache hit %" PRIu64 " of %" PRIu64
+                " lookups, ~%" PRIu64 " ms of module creation saved",
+                cache->hits, cache->lookups, saved_ns / 1000000);
+   }
+
+   hash_table_foreach(cache->modules, entry) {
+      struct wrapper_shader_module *module = entry->data;
+      device->dispatch_table.DestroyShaderModule(device->dispatch_handle,
+                                                 module->dispatch_handle,
+                                                 NULL);
+      vk_free(&device->vk.alloc, module);
+   }
+
+   _mesa_hash_table_destroy(cache->modules, NULL);
+   _mesa_hash_table_u64_destroy(cache->handles);
+   simple_mtx_destroy(&cache->mutex);
+   vk_free(&device->vk.alloc, cache);
+   device->shader_module_cache = NULL;
+}
+
+/* Takes a reference on the cached module for hash, if there is one.  Called
+ * with the cache mutex held.
+ */
+static struct wrapper_shader_module *
+wrapper_shader_module_lookup(struct wrapper_shader_module_cache *cache,
+                             const blake3_hash hash)
+{
+   struct hash_entry *entry = _mesa_hash_table_search(cache->modules, hash);
+   struct wrapper_shader_module *module;
+
+   if (!entry)
+      return NULL;
+
+   module = entry->data;
+   if (module->refcount++ == 0) {
+      list_del(&module->link);
+      cache->unused_count--;
+   }
+   return module;
+}
+
+/* Returns a referenced driver module for the SPIR-V in pCreateInfo. */
+static VkResult
+wrapper_shader_module_get(struct wrapper_device *device,
+                          const VkShaderModuleCreateInfo *pCreateInfo,
+                          VkShaderModule *pShaderModule)
+{
+   struct wrapper_shader_module_cache *cache = device->shader_module_cache;
+   struct wrapper_shader_module *module, *existing;
+   blake3_hash hash;
+   uint64_t start, time_ns;
+   VkResult result;
+
+   _mesa_blake3_compute(pCreateInfo->pCode, pCreateInfo->codeSize, hash);
+
+   simple_mtx_lock(&cache->mutex);
+   cache->lookups++;
+   module = wrapper_shader_module_lookup(cache, hash);
+   if (module) {
+      cache->hits++;
+      *pShaderModule = module->dispatch_handle;
+      simple_mtx_unlock(&cache->mutex);
+      return VK_SUCCESS;
+   }
+   simple_mtx_unlock(&cache->mutex);
+
+   module = vk_zalloc(&device->vk.alloc, sizeof(*module), 8,
+                      VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!module)
+      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+
+   /* The driver can take a while, so other threads keep using the cache
+    * meanwhile.
+    */
+   start = os_time_get_nano();
+   result = device->dispatch_table.CreateShaderModule(device->dispatch_handle,
+                                                      pCreateInfo, NULL,
+                                                      &module->dispatch_handle);
+   time_ns = os_time_get_nano() - start;
+   if (result != VK_SUCCESS) {
+      vk_free(&device->vk.alloc, module);
+      return result;
+   }
+
+   simple_mtx_lock(&cache->mutex);
+   cache->miss_time_ns += time_ns;
+
+   /* Another thread may have created the same code in the meantime; keep
+    * whichever module made it into the cache first.
+    */
+   existing = wrapper_shader_module_lookup(cache, hash);
+   if (existing) {
+      *pShaderModule = existing->dispatch_handle;
+      simple_mtx_unlock(&cache->mutex);
+
+      device->dispatch_table.DestroyShaderModule(device->dispatch_handle,
+                                                 module->dispatch_handle,
+                                                 NULL);
+      vk_free(&device->vk.alloc, module);
+      return VK_SUCCESS;
+   }
+
+   memcpy(module->hash, hash, sizeof(hash));
+   module->refcount = 1;
+   _mesa_hash_table_insert(cache->modules, module->hash, module);
+   _mesa_hash_table_u64_insert(cache->handles,
+                               (uint64_t)module->dispatch_handle, module);
+   *pShaderModule = module->dispatch_handle;
+
+   simple_mtx_unlock(&cache->mutex);
+   return VK_SUCCESS;
+}
+
+/* Returns false if the handle did not come from the cache. */
+static bool
+wrapper_shader_module_put(struct wrapper_device *device,
+                          VkShaderModule shaderModule)
+{
+   struct wrapper_shader_module_cache *cache = device->shader_module_cache;
+   struct wrapper_shader_module *module;
+
+   simple_mtx_lock(&cache->mutex);
+
+   module = _mesa_hash_table_u64_search(cache->handles,
+                                        (uint64_t)shaderModule);
+   if (!module) {
+      simple_mtx_unlock(&cache->mutex);
+      return false;
+   }
+
+   if (--module->refcount == 0) {
+      list_addtail(&module->link, &cache->unused);
+      cache->unused_count++;
+
+      while (cache->unused_count > cache->max_unused) {
+         struct wrapper_shader_module *lru =
+            list_first_entry(&cache->unused, struct wrapper_shader_module,
+                             link);
+         list_del(&lru->link);
+         cache->unused_count--;
+         wrapper_shader_module_evict(device, lru);
+      }
+   }
+
+   simple_mtx_unlock(&cache->mutex);
+   return true;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CreateShaderModule(VkDevice _device,
+                           const VkShaderModuleCreateInfo* pCreateInfo,
+                           const VkAllocationCallbacks* pAllocator,
+                           VkShaderModule* pShaderModule)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+
+   /* Anything chained (validation caches, ...) makes the module more
+    * than its code.
+    */
+   if (!device->shader_module_cache || pCreateInfo->pNext)
+      return device->dispatch_table.CreateShaderModule(device->dispatch_handle,
+                                                       pCreateInfo,
+                                                       pAllocator,
+                                                       pShaderModule);
+
+   return wrapper_shader_module_get(device, pCreateInfo, pShaderModule);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+wrapper_DestroyShaderModule(VkDevice _device,
+                            VkShaderModule shaderModule,
+                            const VkAllocationCallbacks* pAllocator)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+
+   if (shaderModule == VK_NULL_HANDLE)
+      return;
+
+   if (device->shader_module_cache &&
+       wrapper_shader_module_put(device, shaderModule))
+      return;
+
+   device->dispatch_table.DestroyShaderModule(device->dispatch_handle,
+                                              shaderModule, pAllocator);
+}
+
+/* Replace inline VkShaderModuleCreateInfo (maintenance5 / graphics
+ * pipeline library style) with a cached module.  Only a create info
+ * directly chained to the stage is handled, as dropping it from the
+ * middle of a chain would mean copying structs we know nothing about.
+ */
+static uint32_t
+wrapper_shader_stages_rewrite(struct wrapper_device *device,
+                              uint32_t stage_count,
+                              const VkPipelineShaderStageCreateInfo *stages,
+                              VkPipelineShaderStageCreateInfo *out_stages,
+                              VkShaderModule *modules)
+{
+   uint32_t module_count = 0;
+
+   for (uint32_t i = 0; i < stage_count; i++) {
+      const VkShaderModuleCreateInfo *module_info = stages[i].pNext;
+
+      out_stages[i] = stages[i];
+
+      if (stages[i].module != VK_NULL_HANDLE || !module_info ||
+          module_info->sType != VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO ||
+          module_info->pNext)
+         continue;
+
+      if (wrapper_shader_module_get(device, module_info,
+                                    &modules[module_count]) != VK_SUCCESS)
+         continue;
+
+      out_stages[i].pNext = module_info->pNext;
+      out_stages[i].module = modules[module_count++];
+   }
+
+   return module_count;
+}
+
+static void
+wrapper_shader_modules_release(struct wrapper_device *device,
+                               uint32_t module_count,
+                               const VkShaderModule *modules)
+{
+   for (uint32_t i = 0; i < module_count; i++)
+      wrapper_shader_module_put(device, modules[i]);
+}
+
+static bool
+wrapper_stages_have_inline_modules(uint32_t stage_count,
+                                   const VkPipelineShaderStageCreateInfo *stages)
+{
+   for (uint32_t i = 0; i < stage_count; i++) {
+      if (stages[i].module == VK_NULL_HANDLE && stages[i].pNext)
+         return true;
+   }
+   return false;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CreateGraphicsPipelines(VkDevice _device,
+                                VkPipelineCache pipelineCache,
+                                uint32_t createInfoCount,
+                                const VkGraphicsPipelineCreateInfo* pCreateInfos,
+                                const VkAllocationCallbacks* pAllocator,
+                                VkPipeline* pPipelines)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   uint32_t stage_count = 0, module_count = 0;
+   bool has_inline = false;
+   VkResult result;
+
+   if (device->shader_module_cache) {
+      for (uint32_t i = 0; i < createInfoCount; i++) {
+         stage_count += pCreateInfos[i].stageCount;
+         has_inline |= wrapper_stages_have_inline_modules(
+            pCreateInfos[i].stageCount, pCreateInfos[i].pStages);
+      }
+   }
+
+   if (!has_inline)
+      return device->dispatch_table.CreateGraphicsPipelines(
+         device->dispatch_handle, pipelineCache, createInfoCount,
+         pCreateInfos, pAllocator, pPipelines);
+
+   VkGraphicsPipelineCreateInfo create_infos[createInfoCount];
+   VkPipelineShaderStageCreateInfo stages[stage_count];
+   VkShaderModule modules[stage_count];
+
+   stage_count = 0;
+   for (uint32_t i = 0; i < createInfoCount; i++) {
+      create_infos[i] = pCreateInfos[i];
+      if (!pCreateInfos[i].stageCount)
+         continue;
+
+      module_count +=
+         wrapper_shader_stages_rewrite(device, pCreateInfos[i].stageCount,
+                                       pCreateInfos[i].pStages,
+                                       &stages[stage_count],
+                                       &modules[module_count]);
+      create_infos[i].pStages = &stages[stage_count];
+      stage_count += pCreateInfos[i].stageCount;
+   }
+
+   result = device->dispatch_table.CreateGraphicsPipelines(
+      device->dispatch_handle, pipelineCache, createInfoCount,
+      create_infos, pAllocator, pPipelines);
+
+   wrapper_shader_modules_release(device, module_count, modules);
+
+   return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+wrapper_CreateComputePipelines(VkDevice _device,
+                               VkPipelineCache pipelineCache,
+                               uint32_t createInfoCount,
+                               const VkComputePipelineCreateInfo* pCreateInfos,
+                               const VkAllocationCallbacks* pAllocator,
+                               VkPipeline* pPipelines)
+{
+   VK_FROM_HANDLE(wrapper_device, device, _device);
+   uint32_t module_count = 0;
+   bool has_inline = false;
+   VkResult result;
+
+   if (device->shader_module_cache) {
+      for (uint32_t i = 0; i < createInfoCount; i++) {
+         has_inline |= wrapper_stages_have_inline_modules(
+            1, &pCreateInfos[i].stage);
+      }
+   }
+
+   if (!has_inline)
+      return device->dispatch_table.CreateComputePipelines(
+         device->dispatch_handle, pipelineCache, createInfoCount,
+         pCreateInfos, pAllocator, pPipelines);
+
+   VkComputePipelineCreateInfo create_infos[createInfoCount];
+   VkShaderModule modules[createInfoCount];
+
+   for (uint32_t i = 0; i < createInfoCount; i++) {
+      create_infos[i] = pCreateInfos[i];
+      module_count +=
+         wrapper_shader_stages_rewrite(device, 1, &pCreateInfos[i].stage,
+                                       &create_infos[i].stage,
+                                       &modules[module_count]);
+   }
+
+   result = device->dispatch_table.CreateComputePipelines(
+      device->dispatch_handle, pipelineCache, createInfoCount,
+      create_infos, pAllocator, pPipelines);
+
+   wrapper_shader_modules_release(device, module_count, modules);
+
+   return result;
+}
@@ -0,0 +1,887 @@
+#include "wrapper_private.h"
+#include "vk_alloc.h"
+#include "vk_limits.h"
+#include "util/bitscan.h"
+#include "util/log.h"
+#include "util/u_atomic.h"
+
+/* Redundant state filtering: enabled with WRAPPER_STATE_FILTER=1.
+ *
+ * Each wrapper command buffer keeps a shadow copy of the state the
+ * driver has seen, and calls which would set a value identical to the
+ * shadow are dropped before they reach the driver.  Anything whose effect
+ * on the tracked state we do not model (pipeline binds for dynamic state,
+ * push descriptors, descriptor buffers, secondaries, ...) invalidates the
+ * affected part of the shadow instead.
+ */
+
+#define WRAPPER_MAX_BOUND_SETS 8
+#define WRAPPER_MAX_DYNAMIC_OFFSETS 32
+
+enum wrapper_state_bit {
+   WRAPPER_STATE_LINE_WIDTH,
+   WRAPPER_STATE_DEPTH_BIAS,
+   WRAPPER_STATE_BLEND_CONSTANTS,
+   WRAPPER_STATE_DEPTH_BOUNDS,
+   WRAPPER_STATE_STENCIL_COMPARE_MASK_FRONT,
+   WRAPPER_STATE_STENCIL_COMPARE_MASK_BACK,
+   WRAPPER_STATE_STENCIL_WRITE_MASK_FRONT,
+   WRAPPER_STATE_STENCIL_WRITE_MASK_BACK,
+   WRAPPER_STATE_STENCIL_REFERENCE_FRONT,
+   WRAPPER_STATE_STENCIL_REFERENCE_BACK,
+   WRAPPER_STATE_CULL_MODE,
+   WRAPPER_STATE_FRONT_FACE,
+   WRAPPER_STATE_PRIMITIVE_TOPOLOGY,
+   WRAPPER_STATE_DEPTH_TEST_ENABLE,
+   WRAPPER_STATE_DEPTH_WRITE_ENABLE,
+   WRAPPER_STATE_DEPTH_COMPARE_OP,
+   WRAPPER_STATE_INDEX_BUFFER,
+};
+
+/* Everything above except the index buffer comes from the pipeline when
+ * it is not dynamic, and is overwritten by binding such a pipeline.
+ */
+#define WRAPPER_STATE_PIPELINE_MASK \
+   (BITFIELD_MASK(WRAPPER_STATE_INDEX_BUFFER))
+
+struct wrapper_descriptor_bind {
+   bool valid;
+   VkPipelineLayout layout;
+   uint32_t first_set;
+   uint32_t set_count;
+   uint32_t dynamic_offset_count;
+   VkDescriptorSet sets[WRAPPER_MAX_BOUND_SETS];
+   uint32_t dynamic_offsets[WRAPPER_MAX_DYNAMIC_OFFSETS];
+};
+
+struct wrapper_index_buffer {
+   VkBuffer buffer;
+   VkDeviceSize offset;
+   VkIndexType type;
+};
+
+struct wrapper_state_shadow {
+   uint32_t valid;
+   uint32_t pipeline_valid;
+   uint32_t viewport_valid;
+   uint32_t scissor_valid;
+   uint32_t vertex_buffer_valid;
+
+   VkPipeline pipelines[3];
+   VkViewport viewports[MESA_VK_MAX_VIEWPORTS];
+   VkRect2D scissors[MESA_VK_MAX_SCISSORS];
+   struct {
+      VkBuffer buffer;
+      VkDeviceSize offset;
+   } vertex_buffers[MESA_VK_MAX_VERTEX_BINDINGS];
+   struct wrapper_descriptor_bind descriptors[3];
+
+   struct wrapper_index_buffer index_buffer;
+   float line_width;
+   float depth_bias[3];
+   float blend_constants[4];
+   float depth_bounds[2];
+   uint32_t stencil_compare_mask[2];
+   uint32_t stencil_write_mask[2];
+   uint32_t stencil_reference[2];
+   VkCullModeFlags cull_mode;
+   VkFrontFace front_face;
+   VkPrimitiveTopology primitive_topology;
+   VkBool32 depth_test_enable;
+   VkBool32 depth_write_enable;
+   VkCompareOp depth_compare_op;
+
+   uint32_t calls[WRAPPER_FILTER_COUNT];
+   uint32_t filtered[WRAPPER_FILTER_COUNT];
+};
+
+static const char *wrapper_filter_names[WRAPPER_FILTER_COUNT] = {
+   [WRAPPER_FILTER_PIPELINE] = "pipeline",
+   [WRAPPER_FILTER_VIEWPORT] = "viewport",
+   [WRAPPER_FILTER_SCISSOR] = "scissor",
+   [WRAPPER_FILTER_DESCRIPTOR_SETS] = "descriptor set",
+   [WRAPPER_FILTER_VERTEX_BUFFERS] = "vertex buffer",
+   [WRAPPER_FILTER_INDEX_BUFFER] = "index buffer",
+   [WRAPPER_FILTER_DYNAMIC_STATE] = "dynamic state",
+};
+
+static inline int
+wrapper_bind_point_index(VkPipelineBindPoint bind_point)
+{
+   switch (bind_point) {
+   case VK_PIPELINE_BIND_POINT_GRAPHICS:
+      return 0;
+   case VK_PIPELINE_BIND_POINT_COMPUTE:
+      return 1;
+   case VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR:
+      return 2;
+   default:
+      return -1;
+   }
+}
+
+/* Returns true when the call must be forwarded. */
+static inline bool
+wrapper_state_update(struct wrapper_state_shadow *s,
+                     enum wrapper_filter_counter counter,
+                     enum wrapper_state_bit bit,
+                     void *field, const void *value, size_t size)
+{
+   s->calls[counter]++;
+   if ((s->valid & BITFIELD_BIT(bit)) && !memcmp(field, value, size)) {
+      s->filtered[counter]++;
+      return false;
+   }
+   memcpy(field, value, size);
+   s->valid |= BITFIELD_BIT(bit);
+   return true;
+}
+
+#define UPDATE_DYNAMIC(s, bit, field, value) \
+   wrapper_state_update((s), WRAPPER_FILTER_DYNAMIC_STATE, (bit), \
+                        &(s)->field, &(value), sizeof((s)->field))
+
+VkResult
+wrapper_state_shadow_create(struct wrapper_command_buffer *wcb)
+{
+   wcb->state = vk_zalloc(&wcb->device->vk.alloc, sizeof(*wcb->state), 8,
+                          VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   return wcb->state ? VK_SUCCESS : VK_ERROR_OUT_OF_HOST_MEMORY;
+}
+
+void
+wrapper_state_shadow_destroy(struct wrapper_command_buffer *wcb)
+{
+   vk_free(&wcb->device->vk.alloc, wcb->state);
+   wcb->state = NULL;
+}
+
+void
+wrapper_state_shadow_invalidate(struct wrapper_command_buffer *wcb)
+{
+   struct wrapper_state_shadow *s = wcb->state;
+
+   s->valid = 0;
+   s->pipeline_valid = 0;
+   s->viewport_valid = 0;
+   s->scissor_valid = 0;
+   s->vertex_buffer_valid = 0;
+   for (int i = 0; i < ARRAY_SIZE(s->descriptors); i++)
+      s->descriptors[i].valid = false;
+}
+
+void
+wrapper_state_shadow_end(struct wrapper_command_buffer *wcb)
+{
+   struct wrapper_state_shadow *s = wcb->state;
+   struct wrapper_device *device = wcb->device;
+
+   for (int i = 0; i < WRAPPER_FILTER_COUNT; i++) {
+      if (!s->calls[i])
+         continue;
+      p_atomic_add(&device->filter_calls[i], s->calls[i]);
+      p_atomic_add(&device->filter_dropped[i], s->filtered[i]);
+      s->calls[i] = 0;
+      s->filtered[i] = 0;
+   }
+}
+
+void
+wrapper_state_filter_report(struct wrapper_device *device)
+{
+   for (int i = 0; i < WRAPPER_FILTER_COUNT; i++) {
+      if (!device->filter_calls[i])
+         continue;
+      mesa_logi("wrapper: filtered %" PRIu64 " of %" PRIu64 " %s calls",
+                device->filter_dropped[i], device->filter_calls[i],
+                wrapper_filter_names[i]);
+   }
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindPipeline(VkCommandBuffer commandBuffer,
+                               VkPipelineBindPoint pipelineBindPoint,
+                               VkPipeline pipeline)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_state_shadow *s = wcb->state;
+   int idx = wrapper_bind_point_index(pipelineBindPoint);
+
+   s->calls[WRAPPER_FILTER_PIPELINE]++;
+   if (idx >= 0) {
+      if ((s->pipeline_valid & BITFIELD_BIT(idx)) &&
+          s->pipelines[idx] == pipeline) {
+         s->filtered[WRAPPER_FILTER_PIPELINE]++;
+         return;
+      }
+      s->pipelines[idx] = pipeline;
+      s->pipeline_valid |= BITFIELD_BIT(idx);
+   }
+
+   if (pipelineBindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) {
+      s->valid &= ~WRAPPER_STATE_PIPELINE_MASK;
+      s->viewport_valid = 0;
+      s->scissor_valid = 0;
+   }
+
+   wcb->device->cmd_dispatch.CmdBindPipeline(commandBuffer,
+                                             pipelineBindPoint, pipeline);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetViewport(VkCommandBuffer commandBuffer,
+                              uint32_t firstViewport,
+                              uint32_t viewportCount,
+                              const VkViewport* pViewports)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_state_shadow *s = wcb->state;
+   /* Out of range values would make the mask undefined. */
+   bool in_range = firstViewport <= MESA_VK_MAX_VIEWPORTS &&
+                   viewportCount <= MESA_VK_MAX_VIEWPORTS - firstViewport;
+   uint32_t mask = in_range ? BITFIELD_RANGE(firstViewport, viewportCount) : 0;
+
+   s->calls[WRAPPER_FILTER_VIEWPORT]++;
+   if (!in_range) {
+      s->viewport_valid = 0;
+   } else if ((s->viewport_valid & mask) == mask &&
+              !memcmp(&s->viewports[firstViewport], pViewports,
+                      sizeof(*pViewports) * viewportCount)) {
+      s->filtered[WRAPPER_FILTER_VIEWPORT]++;
+      return;
+   } else {
+      memcpy(&s->viewports[firstViewport], pViewports,
+             sizeof(*pViewports) * viewportCount);
+      s->viewport_valid |= mask;
+   }
+
+   wcb->device->cmd_dispatch.CmdSetViewport(commandBuffer, firstViewport,
+                                            viewportCount, pViewports);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetScissor(VkCommandBuffer commandBuffer,
+                             uint32_t firstScissor,
+                             uint32_t scissorCount,
+                             const VkRect2D* pScissors)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_state_shadow *s = wcb->state;
+   /* Out of range values would make the mask undefined. */
+   bool in_range = firstScissor <= MESA_VK_MAX_SCISSORS &&
+                   scissorCount <= MESA_VK_MAX_SCISSORS - firstScissor;
+   uint32_t mask = in_range ? BITFIELD_RANGE(firstScissor, scissorCount) : 0;
+
+   s->calls[WRAPPER_FILTER_SCISSOR]++;
+   if (!in_range) {
+      s->scissor_valid = 0;
+   } else if ((s->scissor_valid & mask) == mask &&
+              !memcmp(&s->scissors[firstScissor], pScissors,
+                      sizeof(*pScissors) * scissorCount)) {
+      s->filtered[WRAPPER_FILTER_SCISSOR]++;
+      return;
+   } else {
+      memcpy(&s->scissors[firstScissor], pScissors,
+             sizeof(*pScissors) * scissorCount);
+      s->scissor_valid |= mask;
+   }
+
+   wcb->device->cmd_dispatch.CmdSetScissor(commandBuffer, firstScissor,
+                                           scissorCount, pScissors);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindDescriptorSets(VkCommandBuffer commandBuffer,
+                                     VkPipelineBindPoint pipelineBindPoint,
+                                     VkPipelineLayout layout,
+                                     uint32_t firstSet,
+                                     uint32_t descriptorSetCount,
+                                     const VkDescriptorSet* pDescriptorSets,
+                                     uint32_t dynamicOffsetCount,
+                                     const uint32_t* pDynamicOffsets)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_state_shadow *s = wcb->state;
+   int idx = wrapper_bind_point_index(pipelineBindPoint);
+
+   s->calls[WRAPPER_FILTER_DESCRIPTOR_SETS]++;
+   if (idx >= 0) {
+      struct wrapper_descriptor_bind *bind = &s->descriptors[idx];
+
+      if (descriptorSetCount > WRAPPER_MAX_BOUND_SETS ||
+          dynamicOffsetCount > WRAPPER_MAX_DYNAMIC_OFFSETS) {
+         bind->valid = false;
+      } else if (bind->valid && bind->layout == layout &&
+                 bind->first_set == firstSet &&
+                 bind->set_count == descriptorSetCount &&
+                 bind->dynamic_offset_count == dynamicOffsetCount &&
+                 !memcmp(bind->sets, pDescriptorSets,
+                         sizeof(*pDescriptorSets) * descriptorSetCount) &&
+                 (!dynamicOffsetCount ||
+                  !memcmp(bind->dynamic_offsets, pDynamicOffsets,
+                          sizeof(*pDynamicOffsets) * dynamicOffsetCount))) {
+         s->filtered[WRAPPER_FILTER_DESCRIPTOR_SETS]++;
+         return;
+      } else {
+         bind->valid = true;
+         bind->layout = layout;
+         bind->first_set = firstSet;
+         bind->set_count = descriptorSetCount;
+         bind->dynamic_offset_count = dynamicOffsetCount;
+         memcpy(bind->sets, pDescriptorSets,
+                sizeof(*pDescriptorSets) * descriptorSetCount);
+         if (dynamicOffsetCount) {
+            memcpy(bind->dynamic_offsets, pDynamicOffsets,
+                   sizeof(*pDynamicOffsets) * dynamicOffsetCount);
+         }
+      }
+   }
+
+   wcb->device->cmd_dispatch.CmdBindDescriptorSets(commandBuffer,
+                                                   pipelineBindPoint,
+                                                   layout, firstSet,
+                                                   descriptorSetCount,
+                                                   pDescriptorSets,
+                                                   dynamicOffsetCount,
+                                                   pDynamicOffsets);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindVertexBuffers(VkCommandBuffer commandBuffer,
+                                    uint32_t firstBinding,
+                                    uint32_t bindingCount,
+                                    const VkBuffer* pBuffers,
+                                    const VkDeviceSize* pOffsets)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_state_shadow *s = wcb->state;
+   bool in_range = firstBinding <= MESA_VK_MAX_VERTEX_BINDINGS &&
+                   bindingCount <= MESA_VK_MAX_VERTEX_BINDINGS - firstBinding;
+   uint32_t mask = in_range ? BITFIELD_RANGE(firstBinding, bindingCount) : 0;
+   bool changed = false;
+
+   s->calls[WRAPPER_FILTER_VERTEX_BUFFERS]++;
+   if (!in_range) {
+      s->vertex_buffer_valid = 0;
+      changed = true;
+   } else {
+      changed = (s->vertex_buffer_valid & mask) != mask;
+      for (uint32_t i = 0; i < bindingCount; i++) {
+         uint32_t b = firstBinding + i;
+         changed |= s->vertex_buffers[b].buffer != pBuffers[i] ||
+                    s->vertex_buffers[b].offset != pOffsets[i];
+         s->vertex_buffers[b].buffer = pBuffers[i];
+         s->vertex_buffers[b].offset = pOffsets[i];
+      }
+      s->vertex_buffer_valid |= mask;
+   }
+
+   if (!changed) {
+      s->filtered[WRAPPER_FILTER_VERTEX_BUFFERS]++;
+      return;
+   }
+
+   wcb->device->cmd_dispatch.CmdBindVertexBuffers(commandBuffer,
+                                                  firstBinding, bindingCount,
+                                                  pBuffers, pOffsets);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindIndexBuffer(VkCommandBuffer commandBuffer,
+                                  VkBuffer buffer,
+                                  VkDeviceSize offset,
+                                  VkIndexType indexType)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   struct wrapper_state_shadow *s = wcb->state;
+   struct wrapper_index_buffer ib;
+
+   memset(&ib, 0, sizeof(ib));
+   ib.buffer = buffer;
+   ib.offset = offset;
+   ib.type = indexType;
+
+   if (!wrapper_state_update(s, WRAPPER_FILTER_INDEX_BUFFER,
+                             WRAPPER_STATE_INDEX_BUFFER,
+                             &s->index_buffer, &ib,
+                             sizeof(s->index_buffer)))
+      return;
+
+   wcb->device->cmd_dispatch.CmdBindIndexBuffer(commandBuffer, buffer,
+                                                offset, indexType);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetLineWidth(VkCommandBuffer commandBuffer, float lineWidth)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_LINE_WIDTH,
+                       line_width, lineWidth))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetLineWidth(commandBuffer, lineWidth);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDepthBias(VkCommandBuffer commandBuffer,
+                               float depthBiasConstantFactor,
+                               float depthBiasClamp,
+                               float depthBiasSlopeFactor)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   const float bias[3] = {
+      depthBiasConstantFactor, depthBiasClamp, depthBiasSlopeFactor,
+   };
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_DEPTH_BIAS,
+                       depth_bias, bias))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetDepthBias(commandBuffer,
+                                             depthBiasConstantFactor,
+                                             depthBiasClamp,
+                                             depthBiasSlopeFactor);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetBlendConstants(VkCommandBuffer commandBuffer,
+                                    const float blendConstants[4])
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!wrapper_state_update(wcb->state, WRAPPER_FILTER_DYNAMIC_STATE,
+                             WRAPPER_STATE_BLEND_CONSTANTS,
+                             wcb->state->blend_constants, blendConstants,
+                             sizeof(wcb->state->blend_constants)))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetBlendConstants(commandBuffer,
+                                                  blendConstants);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDepthBounds(VkCommandBuffer commandBuffer,
+                                 float minDepthBounds,
+                                 float maxDepthBounds)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+   const float bounds[2] = { minDepthBounds, maxDepthBounds };
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_DEPTH_BOUNDS,
+                       depth_bounds, bounds))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetDepthBounds(commandBuffer,
+                                               minDepthBounds,
+                                               maxDepthBounds);
+}
+
+static bool
+wrapper_filter_stencil(struct wrapper_state_shadow *s,
+                       VkStencilFaceFlags faceMask, uint32_t value,
+                       uint32_t *field, enum wrapper_state_bit front_bit)
+{
+   bool changed = false;
+
+   s->calls[WRAPPER_FILTER_DYNAMIC_STATE]++;
+   for (int face = 0; face < 2; face++) {
+      enum wrapper_state_bit bit = front_bit + face;
+
+      if (!(faceMask & (face ? VK_STENCIL_FACE_BACK_BIT :
+                               VK_STENCIL_FACE_FRONT_BIT)))
+         continue;
+
+      if (!(s->valid & BITFIELD_BIT(bit)) || field[face] != value)
+         changed = true;
+      field[face] = value;
+      s->valid |= BITFIELD_BIT(bit);
+   }
+
+   if (!changed)
+      s->filtered[WRAPPER_FILTER_DYNAMIC_STATE]++;
+
+   return changed;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetStencilCompareMask(VkCommandBuffer commandBuffer,
+                                        VkStencilFaceFlags faceMask,
+                                        uint32_t compareMask)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!wrapper_filter_stencil(wcb->state, faceMask, compareMask,
+                               wcb->state->stencil_compare_mask,
+                               WRAPPER_STATE_STENCIL_COMPARE_MASK_FRONT))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetStencilCompareMask(commandBuffer,
+                                                      faceMask, compareMask);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetStencilWriteMask(VkCommandBuffer commandBuffer,
+                                      VkStencilFaceFlags faceMask,
+                                      uint32_t writeMask)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!wrapper_filter_stencil(wcb->state, faceMask, writeMask,
+                               wcb->state->stencil_write_mask,
+                               WRAPPER_STATE_STENCIL_WRITE_MASK_FRONT))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetStencilWriteMask(commandBuffer,
+                                                    faceMask, writeMask);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetStencilReference(VkCommandBuffer commandBuffer,
+                                      VkStencilFaceFlags faceMask,
+                                      uint32_t reference)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!wrapper_filter_stencil(wcb->state, faceMask, reference,
+                               wcb->state->stencil_reference,
+                               WRAPPER_STATE_STENCIL_REFERENCE_FRONT))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetStencilReference(commandBuffer,
+                                                    faceMask, reference);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetCullMode(VkCommandBuffer commandBuffer,
+                              VkCullModeFlags cullMode)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_CULL_MODE,
+                       cull_mode, cullMode))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetCullMode(commandBuffer, cullMode);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetFrontFace(VkCommandBuffer commandBuffer,
+                               VkFrontFace frontFace)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_FRONT_FACE,
+                       front_face, frontFace))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetFrontFace(commandBuffer, frontFace);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetPrimitiveTopology(VkCommandBuffer commandBuffer,
+                                       VkPrimitiveTopology primitiveTopology)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_PRIMITIVE_TOPOLOGY,
+                       primitive_topology, primitiveTopology))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetPrimitiveTopology(commandBuffer,
+                                                     primitiveTopology);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDepthTestEnable(VkCommandBuffer commandBuffer,
+                                     VkBool32 depthTestEnable)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_DEPTH_TEST_ENABLE,
+                       depth_test_enable, depthTestEnable))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetDepthTestEnable(commandBuffer,
+                                                   depthTestEnable);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDepthWriteEnable(VkCommandBuffer commandBuffer,
+                                      VkBool32 depthWriteEnable)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_DEPTH_WRITE_ENABLE,
+                       depth_write_enable, depthWriteEnable))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetDepthWriteEnable(commandBuffer,
+                                                    depthWriteEnable);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDepthCompareOp(VkCommandBuffer commandBuffer,
+                                    VkCompareOp depthCompareOp)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   if (!UPDATE_DYNAMIC(wcb->state, WRAPPER_STATE_DEPTH_COMPARE_OP,
+                       depth_compare_op, depthCompareOp))
+      return;
+
+   wcb->device->cmd_dispatch.CmdSetDepthCompareOp(commandBuffer,
+                                                  depthCompareOp);
+}
+
+/* Commands that change tracked state in ways the shadow does not model. */
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetViewportWithCount(VkCommandBuffer commandBuffer,
+                                       uint32_t viewportCount,
+                                       const VkViewport* pViewports)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->state->viewport_valid = 0;
+   wcb->device->cmd_dispatch.CmdSetViewportWithCount(commandBuffer,
+                                                     viewportCount,
+                                                     pViewports);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetScissorWithCount(VkCommandBuffer commandBuffer,
+                                      uint32_t scissorCount,
+                                      const VkRect2D* pScissors)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->state->scissor_valid = 0;
+   wcb->device->cmd_dispatch.CmdSetScissorWithCount(commandBuffer,
+                                                    scissorCount,
+                                                    pScissors);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindVertexBuffers2(VkCommandBuffer commandBuffer,
+                                     uint32_t firstBinding,
+                                     uint32_t bindingCount,
+                                     const VkBuffer* pBuffers,
+                                     const VkDeviceSize* pOffsets,
+                                     const VkDeviceSize* pSizes,
+                                     const VkDeviceSize* pStrides)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->state->vertex_buffer_valid = 0;
+   wcb->device->cmd_dispatch.CmdBindVertexBuffers2(commandBuffer,
+                                                   firstBinding,
+                                                   bindingCount,
+                                                   pBuffers, pOffsets,
+                                                   pSizes, pStrides);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindIndexBuffer2KHR(VkCommandBuffer commandBuffer,
+                                      VkBuffer buffer,
+                                      VkDeviceSize offset,
+                                      VkDeviceSize size,
+                                      VkIndexType indexType)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->state->valid &= ~BITFIELD_BIT(WRAPPER_STATE_INDEX_BUFFER);
+   wcb->device->cmd_dispatch.CmdBindIndexBuffer2KHR(commandBuffer, buffer,
+                                                    offset, size, indexType);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDepthBias2EXT(VkCommandBuffer commandBuffer,
+                                   const VkDepthBiasInfoEXT* pDepthBiasInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->state->valid &= ~BITFIELD_BIT(WRAPPER_STATE_DEPTH_BIAS);
+   wcb->device->cmd_dispatch.CmdSetDepthBias2EXT(commandBuffer,
+                                                 pDepthBiasInfo);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindShadersEXT(VkCommandBuffer commandBuffer,
+                                 uint32_t stageCount,
+                                 const VkShaderStageFlagBits* pStages,
+                                 const VkShaderEXT* pShaders)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wcb->state->pipeline_valid = 0;
+   wcb->device->cmd_dispatch.CmdBindShadersEXT(commandBuffer, stageCount,
+                                               pStages, pShaders);
+}
+
+static inline void
+wrapper_filter_invalidate_descriptors(struct wrapper_command_buffer *wcb)
+{
+   for (int i = 0; i < ARRAY_SIZE(wcb->state->descriptors); i++)
+      wcb->state->descriptors[i].valid = false;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdPushDescriptorSetKHR(VkCommandBuffer commandBuffer,
+                                       VkPipelineBindPoint pipelineBindPoint,
+                                       VkPipelineLayout layout,
+                                       uint32_t set,
+                                       uint32_t descriptorWriteCount,
+                                       const VkWriteDescriptorSet* pDescriptorWrites)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdPushDescriptorSetKHR(commandBuffer,
+                                                     pipelineBindPoint,
+                                                     layout, set,
+                                                     descriptorWriteCount,
+                                                     pDescriptorWrites);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdPushDescriptorSetWithTemplateKHR(VkCommandBuffer commandBuffer,
+                                                   VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+                                                   VkPipelineLayout layout,
+                                                   uint32_t set,
+                                                   const void* pData)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdPushDescriptorSetWithTemplateKHR(
+      commandBuffer, descriptorUpdateTemplate, layout, set, pData);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindDescriptorSets2KHR(VkCommandBuffer commandBuffer,
+                                         const VkBindDescriptorSetsInfoKHR* pBindDescriptorSetsInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdBindDescriptorSets2KHR(
+      commandBuffer, pBindDescriptorSetsInfo);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdPushDescriptorSet2KHR(VkCommandBuffer commandBuffer,
+                                        const VkPushDescriptorSetInfoKHR* pPushDescriptorSetInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdPushDescriptorSet2KHR(
+      commandBuffer, pPushDescriptorSetInfo);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdPushDescriptorSetWithTemplate2KHR(VkCommandBuffer commandBuffer,
+                                                    const VkPushDescriptorSetWithTemplateInfoKHR* pPushDescriptorSetWithTemplateInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdPushDescriptorSetWithTemplate2KHR(
+      commandBuffer, pPushDescriptorSetWithTemplateInfo);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDescriptorBufferOffsetsEXT(VkCommandBuffer commandBuffer,
+                                                VkPipelineBindPoint pipelineBindPoint,
+                                                VkPipelineLayout layout,
+                                                uint32_t firstSet,
+                                                uint32_t setCount,
+                                                const uint32_t* pBufferIndices,
+                                                const VkDeviceSize* pOffsets)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdSetDescriptorBufferOffsetsEXT(
+      commandBuffer, pipelineBindPoint, layout, firstSet, setCount,
+      pBufferIndices, pOffsets);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdSetDescriptorBufferOffsets2EXT(VkCommandBuffer commandBuffer,
+                                                 const VkSetDescriptorBufferOffsetsInfoEXT* pSetDescriptorBufferOffsetsInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdSetDescriptorBufferOffsets2EXT(
+      commandBuffer, pSetDescriptorBufferOffsetsInfo);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindDescriptorBufferEmbeddedSamplersEXT(VkCommandBuffer commandBuffer,
+                                                          VkPipelineBindPoint pipelineBindPoint,
+                                                          VkPipelineLayout layout,
+                                                          uint32_t set)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdBindDescriptorBufferEmbeddedSamplersEXT(
+      commandBuffer, pipelineBindPoint, layout, set);
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+wrapper_filter_CmdBindDescriptorBufferEmbeddedSamplers2EXT(VkCommandBuffer commandBuffer,
+                                                           const VkBindDescriptorBufferEmbeddedSamplersInfoEXT* pBindDescriptorBufferEmbeddedSamplersInfo)
+{
+   VK_FROM_HANDLE(wrapper_command_buffer, wcb, commandBuffer);
+
+   wrapper_filter_invalidate_descriptors(wcb);
+   wcb->device->cmd_dispatch.CmdBindDescriptorBufferEmbeddedSamplers2EXT(
+      commandBuffer, pBindDescriptorBufferEmbeddedSamplersInfo);
+}
+
+void
+wrapper_get_state_filter_entrypoints(struct vk_device_entrypoint_table *entrypoints)
+{
+   *entrypoints = (struct vk_device_entrypoint_table) {
+#define ENTRYPOINT(name) .name = wrapper_filter_##name
+      ENTRYPOINT(CmdBindPipeline),
+      ENTRYPOINT(CmdSetViewport),
+      ENTRYPOINT(CmdSetScissor),
+      ENTRYPOINT(CmdBindDescriptorSets),
+      ENTRYPOINT(CmdBindVertexBuffers),
+      ENTRYPOINT(CmdBindIndexBuffer),
+      ENTRYPOINT(CmdSetLineWidth),
+      ENTRYPOINT(CmdSetDepthBias),
+      ENTRYPOINT(CmdSetBlendConstants),
+      ENTRYPOINT(CmdSetDepthBounds),
+      ENTRYPOINT(CmdSetStencilCompareMask),
+      ENTRYPOINT(CmdSetStencilWriteMask),
+      ENTRYPOINT(CmdSetStencilReference),
+      ENTRYPOINT(CmdSetCullMode),
+      ENTRYPOINT(CmdSetFrontFace),
+      ENTRYPOINT(CmdSetPrimitiveTopology),
+      ENTRYPOINT(CmdSetDepthTestEnable),
+      ENTRYPOINT(CmdSetDepthWriteEnable),
+      ENTRYPOINT(CmdSetDepthCompareOp),
+      ENTRYPOINT(CmdSetViewportWithCount),
+      ENTRYPOINT(CmdSetScissorWithCount),
+      ENTRYPOINT(CmdBindVertexBuffers2),
+      ENTRYPOINT(CmdBindIndexBuffer2KHR),
+      ENTRYPOINT(CmdSetDepthBias2EXT),
+      ENTRYPOINT(CmdBindShadersEXT),
+      ENTRYPOINT(CmdPushDescriptorSetKHR),
+      ENTRYPOINT(CmdPushDescriptorSetWithTemplateKHR),
+      ENTRYPOINT(CmdBindDescriptorSets2KHR),
+      ENTRYPOINT(CmdPushDescriptorSet2KHR),
+      ENTRYPOINT(CmdPushDescriptorSetWithTemplate2KHR),
+      ENTRYPOINT(CmdSetDescriptorBufferOffsetsEXT),
+      ENTRYPOINT(CmdSetDescriptorBufferOffsets2EXT),
+      ENTRYPOINT(CmdBindDescriptorBufferEmbeddedSamplersEXT),
+      ENTRYPOINT(CmdBindDescriptorBufferEmbeddedSamplers2EXT),
+#undef ENTRYPOINT
+   };
+}
@@ -0,0 +1,786 @@
+#include "wrapper_private.h"
+#include "vk_util.h"
+#include "compiler/spirv/spirv.h"
+#include "util/bitset.h"
+#include "util/disk_cache.h"
+#include "util/log.h"
+#include "util/u_debug.h"
+
+/* Subgroup self-test: disabled with WRAPPER_SUBGROUP_SELFTEST=0.
+ *
+ * Mobile drivers advertise subgroup operations they then miscompile, so
+ * rather than hiding all of them we run one tiny compute shader per
+ * feature class on the real driver and only expose the classes that
+ * produce the right results.  Results are cached on disk per driver
+ * build, so the test only runs once after a driver update.  A run that
+ * could not finish (no test device, a hang) says nothing about the
+ * driver, so it is not cached and the session keeps the driver's own
+ * mask.
+ */
+
+#define SUBGROUP_TEST_VERSION 1
+#define SUBGROUP_TEST_INVOCATIONS 128
+#define SUBGROUP_TEST_TIMEOUT_NS 1000000000ull
+
+static const VkSubgroupFeatureFlagBits subgroup_test_classes[] = {
+   VK_SUBGROUP_FEATURE_BASIC_BIT,
+   VK_SUBGROUP_FEATURE_VOTE_BIT,
+   VK_SUBGROUP_FEATURE_ARITHMETIC_BIT,
+   VK_SUBGROUP_FEATURE_BALLOT_BIT,
+   VK_SUBGROUP_FEATURE_SHUFFLE_BIT,
+   VK_SUBGROUP_FEATURE_SHUFFLE_RELATIVE_BIT,
+   VK_SUBGROUP_FEATURE_CLUSTERED_BIT,
+   VK_SUBGROUP_FEATURE_QUAD_BIT,
+};
+
+/* Every test shader writes two words per invocation:
+ *
+ *    data[2 * i + 0] = (gl_SubgroupID << 16) | gl_SubgroupInvocationID
+ *    data[2 * i + 1] = <subgroup operation on gl_SubgroupInvocationID>
+ *
+ * so the results can be checked without assuming how the driver maps
+ * invocations to subgroups.
+ */
+enum {
+   ID_VOID = 1,
+   ID_FN,
+   ID_BOOL,
+   ID_UINT,
+   ID_UVEC4,
+   ID_PTR_IN_UINT,
+   ID_SUBGROUP_INVOCATION,
+   ID_SUBGROUP_ID,
+   ID_LOCAL_INDEX,
+   ID_RUNTIME_ARRAY,
+   ID_BLOCK,
+   ID_PTR_SSBO_BLOCK,
+   ID_SSBO,
+   ID_PTR_SSBO_UINT,
+   ID_C0,
+   ID_C1,
+   ID_C2,
+   ID_C3,
+   ID_C4,
+   ID_C16,
+   ID_TRUE,
+   ID_MAIN,
+   ID_LABEL,
+   ID_INVOCATION,
+   ID_SUBGROUP,
+   ID_INDEX,
+   ID_SHIFTED,
+   ID_IDS,
+   ID_SLOT0,
+   ID_PTR0,
+   ID_TMP0,
+   ID_TMP1,
+   ID_RESULT,
+   ID_SLOT1,
+   ID_PTR1,
+   ID_BOUND,
+};
+
+struct subgroup_spirv {
+   uint32_t words[512];
+   uint32_t count;
+};
+
+static void
+subgroup_spirv_emit(struct subgroup_spirv *b, SpvOp op,
+                    const uint32_t *operands, uint32_t operand_count)
+{
+   assert(b->count + 1 + operand_count <= ARRAY_SIZE(b->words));
+   b->words[b->count++] = ((1 + operand_count) << SpvWordCountShift) | op;
+   for (uint32_t i = 0; i < operand_count; i++)
+      b->words[b->count++] = operands[i];
+}
+
+#define EMIT(b, op, ...)                                                  \
+   subgroup_spirv_emit(b, op, (const uint32_t[]){ __VA_ARGS__ },           \
+                       ARRAY_SIZE(((const uint32_t[]){ __VA_ARGS__ })))
+
+/* "main" plus its NUL terminator, packed little-endian. */
+#define SPIRV_STRING_MAIN 0x6e69616d, 0x00000000
+
+static void
+subgroup_spirv_build(struct subgroup_spirv *b, VkSubgroupFeatureFlagBits test)
+{
+   SpvCapability capability;
+
+   switch (test) {
+   case VK_SUBGROUP_FEATURE_VOTE_BIT:
+      capability = SpvCapabilityGroupNonUniformVote;
+      break;
+   case VK_SUBGROUP_FEATURE_ARITHMETIC_BIT:
+      capability = SpvCapabilityGroupNonUniformArithmetic;
+      break;
+   case VK_SUBGROUP_FEATURE_BALLOT_BIT:
+      capability = SpvCapabilityGroupNonUniformBallot;
+      break;
+   case VK_SUBGROUP_FEATURE_SHUFFLE_BIT:
+      capability = SpvCapabilityGroupNonUniformShuffle;
+      break;
+   case VK_SUBGROUP_FEATURE_SHUFFLE_RELATIVE_BIT:
+      capability = SpvCapabilityGroupNonUniformShuffleRelative;
+      break;
+   case VK_SUBGROUP_FEATURE_CLUSTERED_BIT:
+      capability = SpvCapabilityGroupNonUniformClustered;
+      break;
+   case VK_SUBGROUP_FEATURE_QUAD_BIT:
+      capability = SpvCapabilityGroupNonUniformQuad;
+      break;
+   default:
+      capability = SpvCapabilityGroupNonUniform;
+      break;
+   }
+
+   b->count = 0;
+   b->words[b->count++] = SpvMagicNumber;
+   b->words[b->count++] = 0x00010300; /* SPIR-V 1.3 */
+   b->words[b->count++] = 0;
+   b->words[b->count++] = ID_BOUND;
+   b->words[b->count++] = 0;
+
+   EMIT(b, SpvOpCapability, SpvCapabilityShader);
+   EMIT(b, SpvOpCapability, SpvCapabilityGroupNonUniform);
+   if (capability != SpvCapabilityGroupNonUniform)
+      EMIT(b, SpvOpCapability, capability);
+   EMIT(b, SpvOpMemoryModel, SpvAddressingModelLogical,
+        SpvMemoryModelGLSL450);
+   EMIT(b, SpvOpEntryPoint, SpvExecutionModelGLCompute, ID_MAIN,
+        SPIRV_STRING_MAIN, ID_SUBGROUP_INVOCATION, ID_SUBGROUP_ID,
+        ID_LOCAL_INDEX);
+   EMIT(b, SpvOpExecutionMode, ID_MAIN, SpvExecutionModeLocalSize,
+        SUBGROUP_TEST_INVOCATIONS, 1, 1);
+
+   EMIT(b, SpvOpDecorate, ID_SUBGROUP_INVOCATION, SpvDecorationBuiltIn,
+        SpvBuiltInSubgroupLocalInvocationId);
+   EMIT(b, SpvOpDecorate, ID_SUBGROUP_ID, SpvDecorationBuiltIn,
+        SpvBuiltInSubgroupId);
+   EMIT(b, SpvOpDecorate, ID_LOCAL_INDEX, SpvDecorationBuiltIn,
+        SpvBuiltInLocalInvocationIndex);
+   EMIT(b, SpvOpDecorate, ID_RUNTIME_ARRAY, SpvDecorationArrayStride, 4);
+   EMIT(b, SpvOpMemberDecorate, ID_BLOCK, 0, SpvDecorationOffset, 0);
+   EMIT(b, SpvOpDecorate, ID_BLOCK, SpvDecorationBlock);
+   EMIT(b, SpvOpDecorate, ID_SSBO, SpvDecorationDescriptorSet, 0);
+   EMIT(b, SpvOpDecorate, ID_SSBO, SpvDecorationBinding, 0);
+
+   EMIT(b, SpvOpTypeVoid, ID_VOID);
+   EMIT(b, SpvOpTypeFunction, ID_FN, ID_VOID);
+   EMIT(b, SpvOpTypeBool, ID_BOOL);
+   EMIT(b, SpvOpTypeInt, ID_UINT, 32, 0);
+   EMIT(b, SpvOpTypeVector, ID_UVEC4, ID_UINT, 4);
+   EMIT(b, SpvOpTypePointer, ID_PTR_IN_UINT, SpvStorageClassInput, ID_UINT);
+   EMIT(b, SpvOpVariable, ID_PTR_IN_UINT, ID_SUBGROUP_INVOCATION,
+        SpvStorageClassInput);
+   EMIT(b, SpvOpVariable, ID_PTR_IN_UINT, ID_SUBGROUP_ID,
+        SpvStorageClassInput);
+   EMIT(b, SpvOpVariable, ID_PTR_IN_UINT, ID_LOCAL_INDEX,
+        SpvStorageClassInput);
+   EMIT(b, SpvOpTypeRuntimeArray, ID_RUNTIME_ARRAY, ID_UINT);
+   EMIT(b, SpvOpTypeStruct, ID_BLOCK, ID_RUNTIME_ARRAY);
+   EMIT(b, SpvOpTypePointer, ID_PTR_SSBO_BLOCK, SpvStorageClassStorageBuffer,
+        ID_BLOCK);
+   EMIT(b, SpvOpVariable, ID_PTR_SSBO_BLOCK, ID_SSBO,
+        SpvStorageClassStorageBuffer);
+   EMIT(b, SpvOpTypePointer, ID_PTR_SSBO_UINT, SpvStorageClassStorageBuffer,
+        ID_UINT);
+   EMIT(b, SpvOpConstant, ID_UINT, ID_C0, 0);
+   EMIT(b, SpvOpConstant, ID_UINT, ID_C1, 1);
+   EMIT(b, SpvOpConstant, ID_UINT, ID_C2, 2);
+   EMIT(b, SpvOpConstant, ID_UINT, ID_C3, SpvScopeSubgroup);
+   EMIT(b, SpvOpConstant, ID_UINT, ID_C4, 4);
+   EMIT(b, SpvOpConstant, ID_UINT, ID_C16, 16);
+   EMIT(b, SpvOpConstantTrue, ID_BOOL, ID_TRUE);
+
+   EMIT(b, SpvOpFunction, ID_VOID, ID_MAIN, SpvFunctionControlMaskNone,
+        ID_FN);
+   EMIT(b, SpvOpLabel, ID_LABEL);
+   EMIT(b, SpvOpLoad, ID_UINT, ID_INVOCATION, ID_SUBGROUP_INVOCATION);
+   EMIT(b, SpvOpLoad, ID_UINT, ID_SUBGROUP, ID_SUBGROUP_ID);
+   EMIT(b, SpvOpLoad, ID_UINT, ID_INDEX, ID_LOCAL_INDEX);
+   EMIT(b, SpvOpShiftLeftLogical, ID_UINT, ID_SHIFTED, ID_SUBGROUP, ID_C16);
+   EMIT(b, SpvOpBitwiseOr, ID_UINT, ID_IDS, ID_SHIFTED, ID_INVOCATION);
+   EMIT(b, SpvOpIMul, ID_UINT, ID_SLOT0, ID_INDEX, ID_C2);
+   EMIT(b, SpvOpAccessChain, ID_PTR_SSBO_UINT, ID_PTR0, ID_SSBO, ID_C0,
+        ID_SLOT0);
+   EMIT(b, SpvOpStore, ID_PTR0, ID_IDS);
+
+   /* ID_C3 doubles as the Subgroup scope operand. */
+   switch (test) {
+   case VK_SUBGROUP_FEATURE_BASIC_BIT:
+      EMIT(b, SpvOpGroupNonUniformElect, ID_BOOL, ID_TMP0, ID_C3);
+      EMIT(b, SpvOpSelect, ID_UINT, ID_RESULT, ID_TMP0, ID_C1, ID_C0);
+      break;
+   case VK_SUBGROUP_FEATURE_VOTE_BIT:
+      EMIT(b, SpvOpIEqual, ID_BOOL, ID_TMP0, ID_INVOCATION, ID_C1);
+      EMIT(b, SpvOpGroupNonUniformAny, ID_BOOL, ID_TMP1, ID_C3, ID_TMP0);
+      EMIT(b, SpvOpSelect, ID_UINT, ID_RESULT, ID_TMP1, ID_C1, ID_C0);
+      break;
+   case VK_SUBGROUP_FEATURE_ARITHMETIC_BIT:
+      EMIT(b, SpvOpIAdd, ID_UINT, ID_TMP0, ID_INVOCATION, ID_C1);
+      EMIT(b, SpvOpGroupNonUniformIAdd, ID_UINT, ID_RESULT, ID_C3,
+           SpvGroupOperationInclusiveScan, ID_TMP0);
+      break;
+   case VK_SUBGROUP_FEATURE_BALLOT_BIT:
+      EMIT(b, SpvOpGroupNonUniformBallot, ID_UVEC4, ID_TMP0, ID_C3, ID_TRUE);
+      EMIT(b, SpvOpGroupNonUniformBallotBitCount, ID_UINT, ID_RESULT, ID_C3,
+           SpvGroupOperationReduce, ID_TMP0);
+      break;
+   case VK_SUBGROUP_FEATURE_SHUFFLE_BIT:
+      EMIT(b, SpvOpBitwiseXor, ID_UINT, ID_TMP0, ID_INVOCATION, ID_C1);
+      EMIT(b, SpvOpGroupNonUniformShuffle, ID_UINT, ID_RESULT, ID_C3,
+           ID_INVOCATION, ID_TMP0);
+      break;
+   case VK_SUBGROUP_FEATURE_SHUFFLE_RELATIVE_BIT:
+      EMIT(b, SpvOpGroupNonUniformShuffleDown, ID_UINT, ID_RESULT, ID_C3,
+           ID_INVOCATION, ID_C1);
+      break;
+   case VK_SUBGROUP_FEATURE_CLUSTERED_BIT:
+      EMIT(b, SpvOpGroupNonUniformIAdd, ID_UINT, ID_RESULT, ID_C3,
+           SpvGroupOperationClusteredReduce, ID_INVOCATION, ID_C4);
+      break;
+   case VK_SUBGROUP_FEATURE_QUAD_BIT:
+      EMIT(b, SpvOpGroupNonUniformQuadBroadcast, ID_UINT, ID_RESULT, ID_C3,
+           ID_INVOCATION, ID_C0);
+      break;
+   default:
+      unreachable("unknown subgroup test");
+   }
+
+   EMIT(b, SpvOpIAdd, ID_UINT, ID_SLOT1, ID_SLOT0, ID_C1);
+   EMIT(b, SpvOpAccessChain, ID_PTR_SSBO_UINT, ID_PTR1, ID_SSBO, ID_C0,
+        ID_SLOT1);
+   EMIT(b, SpvOpStore, ID_PTR1, ID_RESULT);
+   subgroup_spirv_emit(b, SpvOpReturn, NULL, 0);
+   subgroup_spirv_emit(b, SpvOpFunctionEnd, NULL, 0);
+}
+
+static bool
+subgroup_test_check(VkSubgroupFeatureFlagBits test, const uint32_t *data)
+{
+   uint32_t population[SUBGROUP_TEST_INVOCATIONS] = { 0 };
+   BITSET_DECLARE(seen, SUBGROUP_TEST_INVOCATIONS * SUBGROUP_TEST_INVOCATIONS);
+
+   BITSET_ZERO(seen);
+
+   for (uint32_t i = 0; i < SUBGROUP_TEST_INVOCATIONS; i++) {
+      uint32_t subgroup = data[2 * i] >> 16;
+      uint32_t invocation = data[2 * i] & 0xffff;
+
+      if (subgroup >= SUBGROUP_TEST_INVOCATIONS ||
+          invocation >= SUBGROUP_TEST_INVOCATIONS)
+         return false;
+      population[subgroup]++;
+   }
+
+   for (uint32_t i = 0; i < SUBGROUP_TEST_INVOCATIONS; i++) {
+      uint32_t subgroup = data[2 * i] >> 16;
+      uint32_t k = data[2 * i] & 0xffff;
+      uint32_t n = population[subgroup];
+      uint32_t result = data[2 * i + 1];
+      bool ok = true;
+
+      /* Every subgroup must number its invocations 0..n-1 exactly once. */
+      if (k >= n || BITSET_TEST(seen, subgroup * SUBGROUP_TEST_INVOCATIONS + k))
+         return false;
+      BITSET_SET(seen, subgroup * SUBGROUP_TEST_INVOCATIONS + k);
+
+      switch (test) {
+      case VK_SUBGROUP_FEATURE_BASIC_BIT:
+         ok = result == (k == 0);
+         break;
+      case VK_SUBGROUP_FEATURE_VOTE_BIT:
+         ok = result == (n > 1);
+         break;
+      case VK_SUBGROUP_FEATURE_ARITHMETIC_BIT:
+         ok = result == (k + 1) * (k + 2) / 2;
+         break;
+      case VK_SUBGROUP_FEATURE_BALLOT_BIT:
+         ok = result == n;
+         break;
+      case VK_SUBGROUP_FEATURE_SHUFFLE_BIT:
+         ok = (k ^ 1) >= n || result == (k ^ 1);
+         break;
+      case VK_SUBGROUP_FEATURE_SHUFFLE_RELATIVE_BIT:
+         ok = k + 1 >= n || result == k + 1;
+         break;
+      case VK_SUBGROUP_FEATURE_CLUSTERED_BIT:
+         ok = n % 4 || result == 4 * (k & ~3u) + 6;
+         break;
+      case VK_SUBGROUP_FEATURE_QUAD_BIT:
+         ok = n % 4 || result == (k & ~3u);
+         break;
+      default:
+         unreachable("unknown subgroup test");
+      }
+
+      if (!ok)
+         return false;
+   }
+
+   return true;
+}
+
+struct subgroup_test_context {
+   struct vk_device_dispatch_table vk;
+   VkDevice device;
+   VkQueue queue;
+   uint32_t queue_family;
+   VkBuffer buffer;
+   VkDeviceMemory memory;
+   uint32_t *data;
+   VkDescriptorSetLayout set_layout;
+   VkPipelineLayout pipeline_layout;
+   VkDescriptorPool descriptor_pool;
+   VkDescriptorSet descriptor_set;
+   VkCommandPool command_pool;
+   VkCommandBuffer command_buffer;
+   VkFence fence;
+};
+
+static VkResult
+subgroup_test_run(struct subgroup_test_context *ctx,
+                  VkSubgroupFeatureFlagBits test, bool *passed)
+{
+   struct subgroup_spirv spirv;
+   VkShaderModule module;
+   VkPipeline pipeline;
+   VkResult result;
+
+   subgroup_spirv_build(&spirv, test);
+
+   VkShaderModuleCreateInfo module_info = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = spirv.count * sizeof(uint32_t),
+      .pCode = spirv.words,
+   };
+   result = ctx->vk.CreateShaderModule(ctx->device, &module_info, NULL,
+                                       &module);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkComputePipelineCreateInfo pipeline_info = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage = {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+         .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+         .module = module,
+         .pName = "main",
+      },
+      .layout = ctx->pipeline_layout,
+   };
+   result = ctx->vk.CreateComputePipelines(ctx->device, VK_NULL_HANDLE, 1,
+                                           &pipeline_info, NULL, &pipeline);
+   ctx->vk.DestroyShaderModule(ctx->device, module, NULL);
+   if (result != VK_SUCCESS)
+      return result;
+
+   memset(ctx->data, 0xff,
+          SUBGROUP_TEST_INVOCATIONS * 2 * sizeof(uint32_t));
+
+   VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+   };
+   VkMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+   };
+   ctx->vk.ResetCommandPool(ctx->device, ctx->command_pool, 0);
+   ctx->vk.BeginCommandBuffer(ctx->command_buffer, &begin_info);
+   ctx->vk.CmdBindPipeline(ctx->command_buffer,
+                           VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+   ctx->vk.CmdBindDescriptorSets(ctx->command_buffer,
+                                 VK_PIPELINE_BIND_POINT_COMPUTE,
+                                 ctx->pipeline_layout, 0, 1,
+                                 &ctx->descriptor_set, 0, NULL);
+   ctx->vk.CmdDispatch(ctx->command_buffer, 1, 1, 1);
+   ctx->vk.CmdPipelineBarrier(ctx->command_buffer,
+                              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                              VK_PIPELINE_STAGE_HOST_BIT, 0,
+                              1, &barrier, 0, NULL, 0, NULL);
+   result = ctx->vk.EndCommandBuffer(ctx->command_buffer);
+   if (result != VK_SUCCESS)
+      goto out;
+
+   VkSubmitInfo submit_info = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &ctx->command_buffer,
+   };
+   ctx->vk.ResetFences(ctx->device, 1, &ctx->fence);
+   result = ctx->vk.QueueSubmit(ctx->queue, 1, &submit_info, ctx->fence);
+   if (result != VK_SUCCESS)
+      goto out;
+
+   result = ctx->vk.WaitForFences(ctx->device, 1, &ctx->fence, VK_TRUE,
+                                  SUBGROUP_TEST_TIMEOUT_NS);
+   if (result != VK_SUCCESS) {
+      /* A hung test leaves work in flight that we can't safely tear
+       * down, so the pipeline and the device are leaked.
+       */
+      return result == VK_TIMEOUT ? VK_ERROR_DEVICE_LOST : result;
+   }
+
+   *passed = subgroup_test_check(test, ctx->data);
+
+out:
+   ctx->vk.DestroyPipeline(ctx->device, pipeline, NULL);
+   return result;
+}
+
+static VkResult
+subgroup_test_context_init(struct wrapper_physical_device *pdevice,
+                           struct subgroup_test_context *ctx)
+{
+   VkQueueFamilyProperties families[16];
+   uint32_t family_count = ARRAY_SIZE(families);
+   VkResult result;
+
+   pdevice->dispatch_table.GetPhysicalDeviceQueueFamilyProperties(
+      pdevice->dispatch_handle, &family_count, families);
+
+   ctx->queue_family = UINT32_MAX;
+   for (uint32_t i = 0; i < family_count; i++) {
+      if (families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+         ctx->queue_family = i;
+         break;
+      }
+   }
+   if (ctx->queue_family == UINT32_MAX)
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+
+   const float priority = 1.0f;
+   VkDeviceQueueCreateInfo queue_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = ctx->queue_family,
+      .queueCount = 1,
+      .pQueuePriorities = &priority,
+   };
+   VkDeviceCreateInfo device_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .queueCreateInfoCount = 1,
+      .pQueueCreateInfos = &queue_info,
+   };
+   result = pdevice->dispatch_table.CreateDevice(pdevice->dispatch_handle,
+                                                 &device_info, NULL,
+                                                 &ctx->device);
+   if (result != VK_SUCCESS)
+      return result;
+
+   void *gdpa = pdevice->instance->dispatch_table.GetInstanceProcAddr(
+      pdevice->instance->dispatch_handle, "vkGetDeviceProcAddr");
+   vk_device_dispatch_table_load(&ctx->vk, gdpa, ctx->device);
+   ctx->vk.GetDeviceQueue(ctx->device, ctx->queue_family, 0, &ctx->queue);
+
+   VkBufferCreateInfo buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = SUBGROUP_TEST_INVOCATIONS * 2 * sizeof(uint32_t),
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+   };
+   result = ctx->vk.CreateBuffer(ctx->device, &buffer_info, NULL,
+                                 &ctx->buffer);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkMemoryRequirements reqs;
+   ctx->vk.GetBufferMemoryRequirements(ctx->device, ctx->buffer, &reqs);
+
+   const VkMemoryPropertyFlags host_flags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+   uint32_t type_index = UINT32_MAX;
+   for (uint32_t i = 0; i < pdevice->memory_properties.memoryTypeCount; i++) {
+      if ((reqs.memoryTypeBits & BITFIELD_BIT(i)) &&
+          (pdevice->memory_properties.memoryTypes[i].propertyFlags &
+           host_flags) == host_flags) {
+         type_index = i;
+         break;
+      }
+   }
+   if (type_index == UINT32_MAX)
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+
+   VkMemoryAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = reqs.size,
+      .memoryTypeIndex = type_index,
+   };
+   result = ctx->vk.AllocateMemory(ctx->device, &alloc_info, NULL,
+                                   &ctx->memory);
+   if (result != VK_SUCCESS)
+      return result;
+
+   result = ctx->vk.BindBufferMemory(ctx->device, ctx->buffer,
+                                     ctx->memory, 0);
+   if (result != VK_SUCCESS)
+      return result;
+
+   result = ctx->vk.MapMemory(ctx->device, ctx->memory, 0, VK_WHOLE_SIZE,
+                              0, (void **)&ctx->data);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkDescriptorSetLayoutBinding binding = {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+   };
+   VkDescriptorSetLayoutCreateInfo set_layout_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 1,
+      .pBindings = &binding,
+   };
+   result = ctx->vk.CreateDescriptorSetLayout(ctx->device, &set_layout_info,
+                                              NULL, &ctx->set_layout);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkPipelineLayoutCreateInfo pipeline_layout_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 1,
+      .pSetLayouts = &ctx->set_layout,
+   };
+   result = ctx->vk.CreatePipelineLayout(ctx->device, &pipeline_layout_info,
+                                         NULL, &ctx->pipeline_layout);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkDescriptorPoolSize pool_size = {
+      .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+   };
+   VkDescriptorPoolCreateInfo pool_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .maxSets = 1,
+      .poolSizeCount = 1,
+      .pPoolSizes = &pool_size,
+   };
+   result = ctx->vk.CreateDescriptorPool(ctx->device, &pool_info, NULL,
+                                         &ctx->descriptor_pool);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkDescriptorSetAllocateInfo set_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = ctx->descriptor_pool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &ctx->set_layout,
+   };
+   result = ctx->vk.AllocateDescriptorSets(ctx->device, &set_info,
+                                           &ctx->descriptor_set);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkDescriptorBufferInfo descriptor_buffer = {
+      .buffer = ctx->buffer,
+      .range = VK_WHOLE_SIZE,
+   };
+   VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = ctx->descriptor_set,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &descriptor_buffer,
+   };
+   ctx->vk.UpdateDescriptorSets(ctx->device, 1, &write, 0, NULL);
+
+   VkCommandPoolCreateInfo command_pool_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = ctx->queue_family,
+   };
+   result = ctx->vk.CreateCommandPool(ctx->device, &command_pool_info, NULL,
+                                      &ctx->command_pool);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkCommandBufferAllocateInfo command_buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = ctx->command_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+   };
+   result = ctx->vk.AllocateCommandBuffers(ctx->device, &command_buffer_info,
+                                           &ctx->command_buffer);
+   if (result != VK_SUCCESS)
+      return result;
+
+   VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+   };
+   return ctx->vk.CreateFence(ctx->device, &fence_info, NULL, &ctx->fence);
+}
+
+static void
+subgroup_test_context_finish(struct subgroup_test_context *ctx)
+{
+   if (!ctx->device)
+      return;
+
+   /* Destroy functions accept VK_NULL_HANDLE, so a partially initialized
+    * context can be torn down the same way.
+    */
+   ctx->vk.DestroyFence(ctx->device, ctx->fence, NULL);
+   ctx->vk.DestroyCommandPool(ctx->device, ctx->command_pool, NULL);
+   ctx->vk.DestroyDescriptorPool(ctx->device, ctx->descriptor_pool, NULL);
+   ctx->vk.DestroyPipelineLayout(ctx->device, ctx->pipeline_layout, NULL);
+   ctx->vk.DestroyDescriptorSetLayout(ctx->device, ctx->set_layout, NULL);
+   ctx->vk.DestroyBuffer(ctx->device, ctx->buffer, NULL);
+   ctx->vk.FreeMemory(ctx->device, ctx->memory, NULL);
+   ctx->vk.DestroyDevice(ctx->device, NULL);
+}
+
+/* Returns false if not every claimed class could be tested, in which
+ * case *passed is incomplete.
+ */
+static bool
+subgroup_test_run_all(struct wrapper_physical_device *pdevice,
+                      VkSubgroupFeatureFlags claimed,
+                      VkSubgroupFeatureFlags *passed)
+{
+   struct subgroup_test_context *ctx;
+   VkResult result;
+
+   *passed = 0;
+
+   ctx = vk_zalloc(&pdevice->instance->vk.alloc, sizeof(*ctx), 8,
+                   VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   if (!ctx)
+      return false;
+
+   result = subgroup_test_context_init(pdevice, ctx);
+   if (result != VK_SUCCESS) {
+      mesa_logw("wrapper: subgroup self-test could not create its "
+                "device (%d)", result);
+      subgroup_test_context_finish(ctx);
+      vk_free(&pdevice->instance->vk.alloc, ctx);
+      return false;
+   }
+
+   for (uint32_t i = 0; i < ARRAY_SIZE(subgroup_test_classes); i++) {
+      VkSubgroupFeatureFlagBits test = subgroup_test_classes[i];
+      bool test_passed = false;
+
+      if (!(claimed & test))
+         continue;
+
+      result = subgroup_test_run(ctx, test, &test_passed);
+      if (result == VK_ERROR_DEVICE_LOST) {
+         mesa_logw("wrapper: subgroup self-test hung");
+         vk_free(&pdevice->instance->vk.alloc, ctx);
+         return false;
+      }
+
+      if (test_passed)
+         *passed |= test;
+   }
+
+   subgroup_test_context_finish(ctx);
+   vk_free(&pdevice->instance->vk.alloc, ctx);
+   return true;
+}
+
+struct subgroup_cache_key {
+   uint32_t version;
+   uint32_t vendor_id;
+   uint32_t device_id;
+   uint32_t driver_id;
+   uint32_t driver_version;
+   uint32_t claimed_operations;
+   uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+};
+
+void
+wrapper_setup_subgroup_operations(struct wrapper_physical_device *pdevice)
+{
+   VkPhysicalDeviceSubgroupProperties subgroup_props = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+   };
+   VkPhysicalDeviceProperties2 props = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &subgroup_props,
+   };
+   const VkPhysicalDeviceProperties *base = &pdevice->properties2.properties;
+   struct subgroup_cache_key key_data;
+   struct disk_cache *cache;
+   cache_key key;
+   char uuid[VK_UUID_SIZE * 2 + 1];
+   VkSubgroupFeatureFlags passed;
+   uint32_t *cached;
+   size_t size;
+
+   pdevice->subgroup_operations = 0;
+   pdevice->subgroup_stages = 0;
+
+   if (!debug_get_bool_option("WRAPPER_SUBGROUP_SELFTEST", true))
+      return;
+
+   if (base->apiVersion < VK_API_VERSION_1_1)
+      return;
+
+   pdevice->dispatch_table.GetPhysicalDeviceProperties2(
+      pdevice->dispatch_handle, &props);
+
+   if (!(subgroup_props.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) ||
+       !(subgroup_props.supportedOperations & VK_SUBGROUP_FEATURE_BASIC_BIT))
+      return;
+
+   key_data = (struct subgroup_cache_key) {
+      .version = SUBGROUP_TEST_VERSION,
+      .vendor_id = base->vendorID,
+      .device_id = base->deviceID,
+      .driver_id = pdevice->driver_properties.driverID,
+      .driver_version = base->driverVersion,
+      .claimed_operations = subgroup_props.supportedOperations,
+   };
+   memcpy(key_data.pipeline_cache_uuid, base->pipelineCacheUUID,
+          VK_UUID_SIZE);
+
+   for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+      snprintf(&uuid[i * 2], 3, "%02x", base->pipelineCacheUUID[i]);
+
+   cache = disk_cache_create("wrapper_subgroup", uuid, 0);
+   if (cache) {
+      disk_cache_compute_key(cache, &key_data, sizeof(key_data), key);
+      cached = (uint32_t *)disk_cache_get(cache, key, &size);
+      if (cached && size == sizeof(*cached)) {
+         pdevice->subgroup_operations = *cached;
+         pdevice->subgroup_stages = VK_SHADER_STAGE_COMPUTE_BIT;
+         free(cached);
+         disk_cache_destroy(cache);
+         return;
+      }
+      free(cached);
+   }
+
+   if (!subgroup_test_run_all(pdevice, subgroup_props.supportedOperations,
+                              &passed)) {
+      mesa_logw("wrapper: subgroup self-test incomplete, using the "
+                "driver's subgroup operations for this session");
+      pdevice->subgroup_operations = subgroup_props.supportedOperations;
+      pdevice->subgroup_stages = subgroup_props.supportedStages;
+      if (cache)
+         disk_cache_destroy(cache);
+      return;
+   }
+
+   /* Without the basic class none of the others are usable. */
+   if (!(passed & VK_SUBGROUP_FEATURE_BASIC_BIT))
+      passed = 0;
+
+   if (passed != subgroup_props.supportedOperations) {
+      mesa_logi("wrapper: subgroup self-test passed 0x%x of 0x%x",
+                passed, subgroup_props.supportedOperations);
+   }
+
+   pdevice->subgroup_operations = passed;
+   pdevice->subgroup_stages = VK_SHADER_STAGE_COMPUTE_BIT;
+
+   if (cache) {
+      disk_cache_put(cache, key, &passed, sizeof(passed), NULL);
+      disk_cache_destroy(cache);
+   }
+}
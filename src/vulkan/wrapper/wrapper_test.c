@@ -0,0 +1,1428 @@
+/* Image-compare tests for the wrapper's opt-in command stream rewrites.
+ *
+ * Usage: WRAPPER_VULKAN_LIBRARY=<driver> wrapper_test <libvulkan_wrapper.so>
+ *
+ * Every test records the same commands once directly on the driver and
+ * once through the wrapper, with the wrapper options it is about set in
+ * the environment, and reads the images it rendered back.  The driver
+ * ignores the options, so its images are the reference: the wrapper's
+ * must match them exactly wherever the test defines the contents.
+ *
+ * Passing test names after the library runs only those tests.
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <vulkan/vulkan_core.h>
+#include <vulkan/vk_icd.h>
+
+#include "compiler/spirv/spirv.h"
+#include "util/macros.h"
+#include "util/u_math.h"
+
+#define TEST_INSTANCE_FUNCS(F) \
+   F(DestroyInstance) \
+   F(EnumeratePhysicalDevices) \
+   F(GetPhysicalDeviceProperties) \
+   F(GetPhysicalDeviceQueueFamilyProperties) \
+   F(GetPhysicalDeviceMemoryProperties) \
+   F(CreateDevice) \
+   F(GetDeviceProcAddr)
+
+#define TEST_DEVICE_FUNCS(F) \
+   F(DestroyDevice) \
+   F(GetDeviceQueue) \
+   F(QueueSubmit) \
+   F(QueueWaitIdle) \
+   F(CreateCommandPool) \
+   F(DestroyCommandPool) \
+   F(AllocateCommandBuffers) \
+   F(BeginCommandBuffer) \
+   F(EndCommandBuffer) \
+   F(AllocateMemory) \
+   F(FreeMemory) \
+   F(MapMemory) \
+   F(CreateBuffer) \
+   F(DestroyBuffer) \
+   F(GetBufferMemoryRequirements) \
+   F(BindBufferMemory) \
+   F(CreateImage) \
+   F(DestroyImage) \
+   F(GetImageMemoryRequirements) \
+   F(BindImageMemory) \
+   F(CreateImageView) \
+   F(DestroyImageView) \
+   F(CreateShaderModule) \
+   F(DestroyShaderModule) \
+   F(CreatePipelineLayout) \
+   F(DestroyPipelineLayout) \
+   F(CreateGraphicsPipelines) \
+   F(DestroyPipeline) \
+   F(CmdPipelineBarrier) \
+   F(CmdBeginRendering) \
+   F(CmdEndRendering) \
+   F(CmdClearAttachments) \
+   F(CmdBindPipeline) \
+   F(CmdSetViewport) \
+   F(CmdSetScissor) \
+   F(CmdSetCullMode) \
+   F(CmdSetFrontFace) \
+   F(CmdBindVertexBuffers) \
+   F(CmdBindIndexBuffer) \
+   F(CmdDraw) \
+   F(CmdDrawIndexed) \
+   F(CmdCopyImageToBuffer)
+
+#define TEST_DECLARE(name) PFN_vk##name name;
+
+#define TEST_SIZE 64
+#define TEST_MAX_IMAGES 2
+#define TEST_MAX_OPTIONS 3
+#define TEST_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+
+struct test_target {
+   const char *name;
+   PFN_vkGetInstanceProcAddr gipa;
+   PFN_vkCreateInstance CreateInstance;
+
+   VkInstance instance;
+   VkPhysicalDevice pdevice;
+   uint32_t queue_family;
+   VkSampleCountFlags sample_counts;
+   VkPhysicalDeviceMemoryProperties memory_properties;
+   TEST_INSTANCE_FUNCS(TEST_DECLARE)
+
+   VkDevice device;
+   VkQueue queue;
+   VkCommandPool pool;
+   VkCommandBuffer cmd;
+   TEST_DEVICE_FUNCS(TEST_DECLARE)
+
+   /* What a test renders to and reads back from. */
+   VkImage images[TEST_MAX_IMAGES];
+   VkImageView views[TEST_MAX_IMAGES];
+   VkDeviceMemory image_memory[TEST_MAX_IMAGES];
+   VkBuffer readback;
+   VkDeviceMemory readback_memory;
+   uint8_t *pixels;
+};
+
+/* What a test rendered, and where that is defined. */
+struct test_result {
+   unsigned image_count;
+   VkRect2D defined[TEST_MAX_IMAGES];
+};
+
+static bool
+test_open(struct test_target *t, const char *path)
+{
+   void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+   if (!handle) {
+      fprintf(stderr, "%s\n", dlerror());
+      return false;
+   }
+
+   t->gipa = dlsym(handle, "vk_icdGetInstanceProcAddr");
+   if (!t->gipa)
+      t->gipa = dlsym(handle, "vkGetInstanceProcAddr");
+   if (!t->gipa) {
+      fprintf(stderr, "%s: no vkGetInstanceProcAddr\n", path);
+      return false;
+   }
+
+   t->CreateInstance = (PFN_vkCreateInstance)
+      t->gipa(NULL, "vkCreateInstance");
+   return t->CreateInstance != NULL;
+}
+
+static uint32_t
+test_memory_type(struct test_target *t, uint32_t type_bits,
+                 VkMemoryPropertyFlags flags)
+{
+   for (uint32_t i = 0; i < t->memory_properties.memoryTypeCount; i++) {
+      if ((type_bits & (1u << i)) &&
+          (t->memory_properties.memoryTypes[i].propertyFlags & flags) == flags)
+         return i;
+   }
+   return UINT32_MAX;
+}
+
+static VkDeviceMemory
+test_alloc(struct test_target *t, const VkMemoryRequirements *reqs,
+           VkMemoryPropertyFlags flags)
+{
+   VkDeviceMemory memory = VK_NULL_HANDLE;
+   uint32_t type = test_memory_type(t, reqs->memoryTypeBits, flags);
+
+   /* Lazily allocated memory is optional. */
+   if (type == UINT32_MAX)
+      type = ffs(reqs->memoryTypeBits) - 1;
+
+   t->AllocateMemory(t->device,
+      &(VkMemoryAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+         .allocationSize = reqs->size,
+         .memoryTypeIndex = type,
+      }, NULL, &memory);
+   return memory;
+}
+
+/* Returns 77 if the driver can't run the tests, 0 on success. */
+static int
+test_init(struct test_target *t)
+{
+   VkQueueFamilyProperties families[16];
+   VkPhysicalDeviceProperties props;
+   uint32_t count = 1;
+   VkResult result;
+
+   result = t->CreateInstance(
+      &(VkInstanceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+         .pApplicationInfo = &(VkApplicationInfo) {
+            .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+            .pApplicationName = "wrapper_test",
+            .apiVersion = VK_API_VERSION_1_3,
+         },
+      }, NULL, &t->instance);
+   if (result != VK_SUCCESS)
+      return 1;
+
+#define TEST_LOAD_INSTANCE(name) \
+   t->name = (PFN_vk##name)t->gipa(t->instance, "vk" #name);
+   TEST_INSTANCE_FUNCS(TEST_LOAD_INSTANCE)
+#undef TEST_LOAD_INSTANCE
+
+   result = t->EnumeratePhysicalDevices(t->instance, &count, &t->pdevice);
+   if (result < 0 || count == 0)
+      return 1;
+
+   /* Dynamic rendering and dynamic cull mode are core in 1.3. */
+   t->GetPhysicalDeviceProperties(t->pdevice, &props);
+   if (props.apiVersion < VK_API_VERSION_1_3)
+      return 77;
+   t->sample_counts = props.limits.framebufferColorSampleCounts;
+
+   count = ARRAY_SIZE(families);
+   t->GetPhysicalDeviceQueueFamilyProperties(t->pdevice, &count, families);
+   t->queue_family = UINT32_MAX;
+   for (uint32_t i = 0; i < count; i++) {
+      if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+         t->queue_family = i;
+         break;
+      }
+   }
+   if (t->queue_family == UINT32_MAX)
+      return 77;
+
+   t->GetPhysicalDeviceMemoryProperties(t->pdevice, &t->memory_properties);
+
+   result = t->CreateDevice(
+      t->pdevice,
+      &(VkDeviceCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+         .pNext = &(VkPhysicalDeviceVulkan13Features) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+            .dynamicRendering = VK_TRUE,
+         },
+         .queueCreateInfoCount = 1,
+         .pQueueCreateInfos = &(VkDeviceQueueCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = t->queue_family,
+            .queueCount = 1,
+            .pQueuePriorities = &(float) { 1.0f },
+         },
+      }, NULL, &t->device);
+   if (result != VK_SUCCESS)
+      return 1;
+
+#define TEST_LOAD_DEVICE(name) \
+   t->name = (PFN_vk##name)t->GetDeviceProcAddr(t->device, "vk" #name);
+   TEST_DEVICE_FUNCS(TEST_LOAD_DEVICE)
+#undef TEST_LOAD_DEVICE
+
+   t->GetDeviceQueue(t->device, t->queue_family, 0, &t->queue);
+   t->CreateCommandPool(t->device,
+      &(VkCommandPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+         .queueFamilyIndex = t->queue_family,
+      }, NULL, &t->pool);
+   t->AllocateCommandBuffers(t->device,
+      &(VkCommandBufferAllocateInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+         .commandPool = t->pool,
+         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+         .commandBufferCount = 1,
+      }, &t->cmd);
+
+   for (unsigned i = 0; i < TEST_MAX_IMAGES; i++) {
+      VkMemoryRequirements reqs;
+
+      t->CreateImage(t->device,
+         &(VkImageCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = TEST_FORMAT,
+            .extent = { TEST_SIZE, TEST_SIZE, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+         }, NULL, &t->images[i]);
+      t->GetImageMemoryRequirements(t->device, t->images[i], &reqs);
+      t->image_memory[i] = test_alloc(t, &reqs, 0);
+      t->BindImageMemory(t->device, t->images[i], t->image_memory[i], 0);
+      t->CreateImageView(t->device,
+         &(VkImageViewCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = t->images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = TEST_FORMAT,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+         }, NULL, &t->views[i]);
+   }
+
+   VkMemoryRequirements reqs;
+   t->CreateBuffer(t->device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .size = TEST_MAX_IMAGES * TEST_SIZE * TEST_SIZE * 4,
+         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      }, NULL, &t->readback);
+   t->GetBufferMemoryRequirements(t->device, t->readback, &reqs);
+   t->readback_memory =
+      test_alloc(t, &reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+   t->BindBufferMemory(t->device, t->readback, t->readback_memory, 0);
+   t->MapMemory(t->device, t->readback_memory, 0, VK_WHOLE_SIZE, 0,
+                (void **)&t->pixels);
+
+   return 0;
+}
+
+static void
+test_finish(struct test_target *t)
+{
+   t->QueueWaitIdle(t->queue);
+   t->DestroyBuffer(t->device, t->readback, NULL);
+   t->FreeMemory(t->device, t->readback_memory, NULL);
+   for (unsigned i = 0; i < TEST_MAX_IMAGES; i++) {
+      t->DestroyImageView(t->device, t->views[i], NULL);
+      t->DestroyImage(t->device, t->images[i], NULL);
+      t->FreeMemory(t->device, t->image_memory[i], NULL);
+   }
+   t->DestroyCommandPool(t->device, t->pool, NULL);
+   t->DestroyDevice(t->device, NULL);
+   t->DestroyInstance(t->instance, NULL);
+}
+
+static void
+test_begin(struct test_target *t)
+{
+   const VkImageMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+   };
+   VkImageMemoryBarrier barriers[TEST_MAX_IMAGES];
+
+   for (unsigned i = 0; i < TEST_MAX_IMAGES; i++) {
+      barriers[i] = barrier;
+      barriers[i].image = t->images[i];
+   }
+
+   t->BeginCommandBuffer(t->cmd,
+      &(VkCommandBufferBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      });
+   t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                         0, NULL, 0, NULL, TEST_MAX_IMAGES, barriers);
+}
+
+/* Orders one rendering instance's attachment writes before the next's. */
+static void
+test_attachment_barrier(struct test_target *t)
+{
+   t->CmdPipelineBarrier(t->cmd,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+      1, &(VkMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      }, 0, NULL, 0, NULL);
+}
+
+/* Copies the images back, submits and waits. */
+static void
+test_end(struct test_target *t, unsigned image_count)
+{
+   VkImageMemoryBarrier barriers[TEST_MAX_IMAGES];
+
+   for (unsigned i = 0; i < image_count; i++) {
+      barriers[i] = (VkImageMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+         .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+         .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .image = t->images[i],
+         .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+      };
+   }
+   t->CmdPipelineBarrier(t->cmd,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, NULL, 0, NULL, image_count, barriers);
+
+   for (unsigned i = 0; i < image_count; i++) {
+      t->CmdCopyImageToBuffer(t->cmd, t->images[i],
+         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, t->readback, 1,
+         &(VkBufferImageCopy) {
+            .bufferOffset = i * TEST_SIZE * TEST_SIZE * 4,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageExtent = { TEST_SIZE, TEST_SIZE, 1 },
+         });
+   }
+
+   t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &(VkMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                         }, 0, NULL, 0, NULL);
+   t->EndCommandBuffer(t->cmd);
+
+   t->QueueSubmit(t->queue, 1,
+      &(VkSubmitInfo) {
+         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+         .commandBufferCount = 1,
+         .pCommandBuffers = &t->cmd,
+      }, VK_NULL_HANDLE);
+   t->QueueWaitIdle(t->queue);
+}
+
+static const VkRect2D test_full_area = { { 0, 0 }, { TEST_SIZE, TEST_SIZE } };
+
+static void
+test_begin_rendering(struct test_target *t,
+                     const VkRenderingAttachmentInfo *color,
+                     const VkRect2D *area)
+{
+   t->CmdBeginRendering(t->cmd,
+      &(VkRenderingInfo) {
+         .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+         .renderArea = *area,
+         .layerCount = 1,
+         .colorAttachmentCount = 1,
+         .pColorAttachments = color,
+      });
+}
+
+static void
+test_clear_rect(struct test_target *t, const VkRect2D *rect, float r,
+                float g, float b)
+{
+   t->CmdClearAttachments(t->cmd, 1,
+      &(VkClearAttachment) {
+         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+         .colorAttachment = 0,
+         .clearValue.color.float32 = { r, g, b, 1.0f },
+      }, 1,
+      &(VkClearRect) {
+         .rect = *rect,
+         .baseArrayLayer = 0,
+         .layerCount = 1,
+      });
+}
+
+/*
+ * A pass-through vertex and fragment shader pair, built the same way the
+ * subgroup self-test builds its compute shader.  Vertices are a vec2
+ * position at location 0 and a vec4 color at location 1.
+ */
+
+struct test_spirv {
+   uint32_t words[256];
+   uint32_t count;
+};
+
+static void
+test_spirv_emit(struct test_spirv *b, SpvOp op, const uint32_t *operands,
+                uint32_t operand_count)
+{
+   assert(b->count + 1 + operand_count <= ARRAY_SIZE(b->words));
+   b->words[b->count++] = ((1 + operand_count) << SpvWordCountShift) | op;
+   for (uint32_t i = 0; i < operand_count; i++)
+      b->words[b->count++] = operands[i];
+}
+
+#define EMIT(b, op, ...)                                                  \
+   test_spirv_emit(b, op, (const uint32_t[]){ __VA_ARGS__ },               \
+                   ARRAY_SIZE(((const uint32_t[]){ __VA_ARGS__ })))
+
+/* "main" plus its NUL terminator, packed little-endian. */
+#define SPIRV_STRING_MAIN 0x6e69616d, 0x00000000
+
+enum {
+   ID_VOID = 1,
+   ID_FN,
+   ID_FLOAT,
+   ID_VEC2,
+   ID_VEC4,
+   ID_PTR_IN_VEC2,
+   ID_PTR_IN_VEC4,
+   ID_PTR_OUT_VEC4,
+   ID_IN_POS,
+   ID_IN_COLOR,
+   ID_OUT_POS,
+   ID_OUT_COLOR,
+   ID_ZERO,
+   ID_ONE,
+   ID_MAIN,
+   ID_LABEL,
+   ID_POS,
+   ID_COLOR,
+   ID_X,
+   ID_Y,
+   ID_POSITION,
+   ID_BOUND,
+};
+
+static void
+test_spirv_build(struct test_spirv *b, bool fragment)
+{
+   b->count = 0;
+   b->words[b->count++] = SpvMagicNumber;
+   b->words[b->count++] = 0x00010000;
+   b->words[b->count++] = 0;
+   b->words[b->count++] = ID_BOUND;
+   b->words[b->count++] = 0;
+
+   EMIT(b, SpvOpCapability, SpvCapabilityShader);
+   EMIT(b, SpvOpMemoryModel, SpvAddressingModelLogical,
+        SpvMemoryModelGLSL450);
+   if (fragment) {
+      EMIT(b, SpvOpEntryPoint, SpvExecutionModelFragment, ID_MAIN,
+           SPIRV_STRING_MAIN, ID_IN_COLOR, ID_OUT_COLOR);
+      EMIT(b, SpvOpExecutionMode, ID_MAIN, SpvExecutionModeOriginUpperLeft);
+      EMIT(b, SpvOpDecorate, ID_IN_COLOR, SpvDecorationLocation, 0);
+   } else {
+      EMIT(b, SpvOpEntryPoint, SpvExecutionModelVertex, ID_MAIN,
+           SPIRV_STRING_MAIN, ID_IN_POS, ID_IN_COLOR, ID_OUT_POS,
+           ID_OUT_COLOR);
+      EMIT(b, SpvOpDecorate, ID_IN_POS, SpvDecorationLocation, 0);
+      EMIT(b, SpvOpDecorate, ID_IN_COLOR, SpvDecorationLocation, 1);
+      EMIT(b, SpvOpDecorate, ID_OUT_POS, SpvDecorationBuiltIn,
+           SpvBuiltInPosition);
+   }
+   EMIT(b, SpvOpDecorate, ID_OUT_COLOR, SpvDecorationLocation, 0);
+
+   EMIT(b, SpvOpTypeVoid, ID_VOID);
+   EMIT(b, SpvOpTypeFunction, ID_FN, ID_VOID);
+   EMIT(b, SpvOpTypeFloat, ID_FLOAT, 32);
+   EMIT(b, SpvOpTypeVector, ID_VEC2, ID_FLOAT, 2);
+   EMIT(b, SpvOpTypeVector, ID_VEC4, ID_FLOAT, 4);
+   EMIT(b, SpvOpTypePointer, ID_PTR_IN_VEC4, SpvStorageClassInput, ID_VEC4);
+   EMIT(b, SpvOpTypePointer, ID_PTR_OUT_VEC4, SpvStorageClassOutput,
+        ID_VEC4);
+   EMIT(b, SpvOpVariable, ID_PTR_IN_VEC4, ID_IN_COLOR, SpvStorageClassInput);
+   EMIT(b, SpvOpVariable, ID_PTR_OUT_VEC4, ID_OUT_COLOR,
+        SpvStorageClassOutput);
+   if (!fragment) {
+      EMIT(b, SpvOpTypePointer, ID_PTR_IN_VEC2, SpvStorageClassInput,
+           ID_VEC2);
+      EMIT(b, SpvOpVariable, ID_PTR_IN_VEC2, ID_IN_POS,
+           SpvStorageClassInput);
+      EMIT(b, SpvOpVariable, ID_PTR_OUT_VEC4, ID_OUT_POS,
+           SpvStorageClassOutput);
+      EMIT(b, SpvOpConstant, ID_FLOAT, ID_ZERO, 0x00000000);
+      EMIT(b, SpvOpConstant, ID_FLOAT, ID_ONE, 0x3f800000);
+   }
+
+   EMIT(b, SpvOpFunction, ID_VOID, ID_MAIN, SpvFunctionControlMaskNone,
+        ID_FN);
+   EMIT(b, SpvOpLabel, ID_LABEL);
+   EMIT(b, SpvOpLoad, ID_VEC4, ID_COLOR, ID_IN_COLOR);
+   EMIT(b, SpvOpStore, ID_OUT_COLOR, ID_COLOR);
+   if (!fragment) {
+      EMIT(b, SpvOpLoad, ID_VEC2, ID_POS, ID_IN_POS);
+      EMIT(b, SpvOpCompositeExtract, ID_FLOAT, ID_X, ID_POS, 0);
+      EMIT(b, SpvOpCompositeExtract, ID_FLOAT, ID_Y, ID_POS, 1);
+      EMIT(b, SpvOpCompositeConstruct, ID_VEC4, ID_POSITION, ID_X, ID_Y,
+           ID_ZERO, ID_ONE);
+      EMIT(b, SpvOpStore, ID_OUT_POS, ID_POSITION);
+   }
+   EMIT(b, SpvOpReturn);
+   EMIT(b, SpvOpFunctionEnd);
+}
+
+struct test_vertex {
+   float pos[2];
+   float color[4];
+};
+
+#define TEST_QUAD(x0, y0, x1, y1, r, g, b)                                \
+   { { x0, y0 }, { r, g, b, 1 } }, { { x1, y0 }, { r, g, b, 1 } },         \
+   { { x0, y1 }, { r, g, b, 1 } }, { { x0, y1 }, { r, g, b, 1 } },         \
+   { { x1, y0 }, { r, g, b, 1 } }, { { x1, y1 }, { r, g, b, 1 } }
+
+/* Full screen quads, six vertices each.  The last one is wound the other
+ * way around, so culling tells the two apart.
+ */
+static const struct test_vertex test_vertices[] = {
+   TEST_QUAD(-1, -1, 1, 1, 1, 0, 0),
+   TEST_QUAD(-1, -1, 1, 1, 0, 1, 0),
+   TEST_QUAD(-1, -1, 1, 1, 0, 0, 1),
+   TEST_QUAD(-1, -1, 1, 1, 1, 1, 0),
+   TEST_QUAD(1, -1, -1, 1, 1, 0, 1),
+};
+
+#define TEST_QUAD_SIZE (6 * sizeof(struct test_vertex))
+
+struct test_scene {
+   VkShaderModule modules[2];
+   VkPipelineLayout layout;
+   /* Viewport, scissor, cull mode and front face dynamic. */
+   VkPipeline dynamic;
+   /* Everything static; renders to the right half only. */
+   VkPipeline fixed;
+   VkBuffer vertices;
+   VkBuffer indices;
+   VkDeviceMemory memory;
+};
+
+static VkPipeline
+test_create_pipeline(struct test_target *t, struct test_scene *s,
+                     bool dynamic)
+{
+   static const VkDynamicState dynamic_states[] = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR,
+      VK_DYNAMIC_STATE_CULL_MODE,
+      VK_DYNAMIC_STATE_FRONT_FACE,
+   };
+   const VkViewport viewport = {
+      TEST_SIZE / 2, 0, TEST_SIZE / 2, TEST_SIZE, 0, 1,
+   };
+   const VkFormat format = TEST_FORMAT;
+   VkPipeline pipeline = VK_NULL_HANDLE;
+
+   t->CreateGraphicsPipelines(t->device, VK_NULL_HANDLE, 1,
+      &(VkGraphicsPipelineCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+         .pNext = &(VkPipelineRenderingCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+            .colorAttachmentCount = 1,
+            .pColorAttachmentFormats = &format,
+         },
+         .stageCount = 2,
+         .pStages = (VkPipelineShaderStageCreateInfo[]) {
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_VERTEX_BIT,
+               .module = s->modules[0],
+               .pName = "main",
+            },
+            {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+               .module = s->modules[1],
+               .pName = "main",
+            },
+         },
+         .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+            .vertexBindingDescriptionCount = 1,
+            .pVertexBindingDescriptions = &(VkVertexInputBindingDescription) {
+               0, sizeof(struct test_vertex), VK_VERTEX_INPUT_RATE_VERTEX,
+            },
+            .vertexAttributeDescriptionCount = 2,
+            .pVertexAttributeDescriptions =
+               (VkVertexInputAttributeDescription[]) {
+                  { 0, 0, VK_FORMAT_R32G32_SFLOAT, 0 },
+                  { 1, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
+                    offsetof(struct test_vertex, color) },
+               },
+         },
+         .pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+         },
+         .pViewportState = &(VkPipelineViewportStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            .viewportCount = 1,
+            .pViewports = &viewport,
+            .scissorCount = 1,
+            .pScissors = &test_full_area,
+         },
+         .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+            .polygonMode = VK_POLYGON_MODE_FILL,
+            .cullMode = VK_CULL_MODE_NONE,
+            .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+            .lineWidth = 1.0f,
+         },
+         .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+         },
+         .pColorBlendState = &(VkPipelineColorBlendStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            .attachmentCount = 1,
+            .pAttachments = &(VkPipelineColorBlendAttachmentState) {
+               .colorWriteMask = 0xf,
+            },
+         },
+         .pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+            .dynamicStateCount = dynamic ? ARRAY_SIZE(dynamic_states) : 0,
+            .pDynamicStates = dynamic_states,
+         },
+         .layout = s->layout,
+      }, NULL, &pipeline);
+
+   return pipeline;
+}
+
+static bool
+test_scene_init(struct test_target *t, struct test_scene *s)
+{
+   static const uint16_t indices[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+   struct test_spirv spirv;
+   VkMemoryRequirements vreqs, ireqs;
+   uint8_t *map;
+
+   memset(s, 0, sizeof(*s));
+
+   for (unsigned i = 0; i < 2; i++) {
+      test_spirv_build(&spirv, i == 1);
+      t->CreateShaderModule(t->device,
+         &(VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = spirv.count * sizeof(uint32_t),
+            .pCode = spirv.words,
+         }, NULL, &s->modules[i]);
+   }
+   t->CreatePipelineLayout(t->device,
+      &(VkPipelineLayoutCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      }, NULL, &s->layout);
+   s->dynamic = test_create_pipeline(t, s, true);
+   s->fixed = test_create_pipeline(t, s, false);
+   if (!s->dynamic || !s->fixed)
+      return false;
+
+   t->CreateBuffer(t->device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .size = sizeof(test_vertices),
+         .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      }, NULL, &s->vertices);
+   t->CreateBuffer(t->device,
+      &(VkBufferCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+         .size = sizeof(indices),
+         .usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      }, NULL, &s->indices);
+   t->GetBufferMemoryRequirements(t->device, s->vertices, &vreqs);
+   t->GetBufferMemoryRequirements(t->device, s->indices, &ireqs);
+
+   /* Both in one host visible allocation, indices after the vertices. */
+   VkDeviceSize index_offset = align64(vreqs.size, ireqs.alignment);
+   VkMemoryRequirements reqs = {
+      .size = index_offset + ireqs.size,
+      .memoryTypeBits = vreqs.memoryTypeBits & ireqs.memoryTypeBits,
+   };
+   s->memory = test_alloc(t, &reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+   t->BindBufferMemory(t->device, s->vertices, s->memory, 0);
+   t->BindBufferMemory(t->device, s->indices, s->memory, index_offset);
+   t->MapMemory(t->device, s->memory, 0, VK_WHOLE_SIZE, 0, (void **)&map);
+   memcpy(map, test_vertices, sizeof(test_vertices));
+   memcpy(map + index_offset, indices, sizeof(indices));
+
+   return true;
+}
+
+static void
+test_scene_finish(struct test_target *t, struct test_scene *s)
+{
+   t->QueueWaitIdle(t->queue);
+   t->DestroyBuffer(t->device, s->vertices, NULL);
+   t->DestroyBuffer(t->device, s->indices, NULL);
+   t->FreeMemory(t->device, s->memory, NULL);
+   t->DestroyPipeline(t->device, s->dynamic, NULL);
+   t->DestroyPipeline(t->device, s->fixed, NULL);
+   t->DestroyPipelineLayout(t->device, s->layout, NULL);
+   for (unsigned i = 0; i < 2; i++)
+      t->DestroyShaderModule(t->device, s->modules[i], NULL);
+}
+
+static void
+test_viewport(struct test_target *t, int x, int y, int w, int h)
+{
+   const VkViewport viewport = { x, y, w, h, 0, 1 };
+
+   t->CmdSetViewport(t->cmd, 0, 1, &viewport);
+}
+
+static void
+test_scissor(struct test_target *t, int x, int y, unsigned w, unsigned h)
+{
+   const VkRect2D scissor = { { x, y }, { w, h } };
+
+   t->CmdSetScissor(t->cmd, 0, 1, &scissor);
+}
+
+static void
+test_bind_quad(struct test_target *t, struct test_scene *s, unsigned quad)
+{
+   const VkDeviceSize offset = quad * TEST_QUAD_SIZE;
+
+   t->CmdBindVertexBuffers(t->cmd, 0, 1, &s->vertices, &offset);
+}
+
+/* Starts a scene on a black image 0 with the dynamic pipeline bound and
+ * full screen viewport and scissor.
+ */
+static void
+test_scene_begin(struct test_target *t, struct test_scene *s)
+{
+   test_begin(t);
+   test_begin_rendering(t,
+      &(VkRenderingAttachmentInfo) {
+         .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+         .imageView = t->views[0],
+         .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+         .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      }, &test_full_area);
+   t->CmdBindPipeline(t->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, s->dynamic);
+   test_viewport(t, 0, 0, TEST_SIZE, TEST_SIZE);
+   test_scissor(t, 0, 0, TEST_SIZE, TEST_SIZE);
+   t->CmdSetCullMode(t->cmd, VK_CULL_MODE_NONE);
+   t->CmdSetFrontFace(t->cmd, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+}
+
+static void
+test_scene_end(struct test_target *t, struct test_result *result)
+{
+   t->CmdEndRendering(t->cmd);
+   test_end(t, 1);
+   result->image_count = 1;
+   result->defined[0] = test_full_area;
+}
+
+/*
+ * State filter tests, with WRAPPER_STATE_FILTER=1.  Each one sets some
+ * state again to the value it already has, which the filter drops, and
+ * around that changes it in ways the filter must not miss.
+ */
+
+#define Q (TEST_SIZE / 2)
+
+static void
+test_filter_viewport(struct test_target *t, struct test_scene *s)
+{
+   /* One quad per quadrant, each viewport set twice. */
+   for (unsigned i = 0; i < 4; i++) {
+      test_viewport(t, (i & 1) * Q, (i >> 1) * Q, Q, Q);
+      test_viewport(t, (i & 1) * Q, (i >> 1) * Q, Q, Q);
+      test_bind_quad(t, s, i);
+      t->CmdDraw(t->cmd, 6, 1, 0, 0);
+   }
+
+   /* Back to the first viewport, which is no longer the current one. */
+   test_viewport(t, 0, 0, Q, Q);
+   test_bind_quad(t, s, 3);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+}
+
+static void
+test_filter_scissor(struct test_target *t, struct test_scene *s)
+{
+   test_bind_quad(t, s, 0);
+   test_scissor(t, 0, 0, Q, TEST_SIZE);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   /* Same scissor in a single call covering a wider range. */
+   const VkRect2D scissors[2] = {
+      { { 0, 0 }, { Q, TEST_SIZE } },
+      { { 0, 0 }, { TEST_SIZE, TEST_SIZE } },
+   };
+   t->CmdSetScissor(t->cmd, 0, 2, scissors);
+   test_bind_quad(t, s, 1);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   test_scissor(t, Q, Q, Q, Q);
+   test_scissor(t, Q, Q, Q, Q);
+   test_bind_quad(t, s, 2);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+}
+
+static void
+test_filter_pipeline(struct test_target *t, struct test_scene *s)
+{
+   test_scissor(t, 0, 0, Q, TEST_SIZE);
+   test_bind_quad(t, s, 0);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   /* The fixed pipeline replaces viewport and scissor with its own... */
+   t->CmdBindPipeline(t->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, s->fixed);
+   test_bind_quad(t, s, 1);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   /* ...so setting the earlier values again after rebinding the dynamic
+    * one is a change, not a repeat.
+    */
+   t->CmdBindPipeline(t->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, s->dynamic);
+   t->CmdBindPipeline(t->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, s->dynamic);
+   test_viewport(t, 0, 0, TEST_SIZE, TEST_SIZE);
+   test_scissor(t, 0, 0, Q, Q);
+   t->CmdSetCullMode(t->cmd, VK_CULL_MODE_NONE);
+   t->CmdSetFrontFace(t->cmd, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+   test_bind_quad(t, s, 2);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+}
+
+static void
+test_filter_vertex_buffers(struct test_target *t, struct test_scene *s)
+{
+   const VkDeviceSize offsets[2] = { 0, TEST_QUAD_SIZE };
+   const VkBuffer buffers[2] = { s->vertices, s->vertices };
+
+   test_viewport(t, 0, 0, Q, TEST_SIZE);
+   test_bind_quad(t, s, 1);
+   test_bind_quad(t, s, 1);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   test_viewport(t, Q, 0, Q, TEST_SIZE);
+   test_bind_quad(t, s, 2);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   /* Binding 0 is unchanged by this, binding 1 is new. */
+   test_viewport(t, 0, Q, TEST_SIZE, Q);
+   t->CmdBindVertexBuffers(t->cmd, 0, 2, buffers, offsets);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+}
+
+static void
+test_filter_index_buffer(struct test_target *t, struct test_scene *s)
+{
+   test_bind_quad(t, s, 0);
+
+   test_viewport(t, 0, 0, Q, TEST_SIZE);
+   t->CmdBindIndexBuffer(t->cmd, s->indices, 0, VK_INDEX_TYPE_UINT16);
+   t->CmdBindIndexBuffer(t->cmd, s->indices, 0, VK_INDEX_TYPE_UINT16);
+   t->CmdDrawIndexed(t->cmd, 6, 1, 0, 0, 0);
+
+   /* Indices 6 to 11 select the second quad. */
+   test_viewport(t, Q, 0, Q, TEST_SIZE);
+   t->CmdBindIndexBuffer(t->cmd, s->indices, 6 * sizeof(uint16_t),
+                         VK_INDEX_TYPE_UINT16);
+   t->CmdDrawIndexed(t->cmd, 6, 1, 0, 0, 0);
+
+   test_viewport(t, Q, Q, Q, Q);
+   t->CmdBindIndexBuffer(t->cmd, s->indices, 0, VK_INDEX_TYPE_UINT16);
+   t->CmdDrawIndexed(t->cmd, 6, 1, 0, 12, 0);
+}
+
+static void
+test_filter_cull(struct test_target *t, struct test_scene *s)
+{
+   /* Quad 0 is counter-clockwise, quad 4 clockwise. */
+   t->CmdSetCullMode(t->cmd, VK_CULL_MODE_BACK_BIT);
+   t->CmdSetCullMode(t->cmd, VK_CULL_MODE_BACK_BIT);
+   test_viewport(t, 0, 0, Q, TEST_SIZE);
+   test_bind_quad(t, s, 4);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+   test_bind_quad(t, s, 0);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   t->CmdSetFrontFace(t->cmd, VK_FRONT_FACE_CLOCKWISE);
+   t->CmdSetFrontFace(t->cmd, VK_FRONT_FACE_CLOCKWISE);
+   test_viewport(t, Q, 0, Q, TEST_SIZE);
+   test_bind_quad(t, s, 4);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+   test_bind_quad(t, s, 1);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+
+   t->CmdSetCullMode(t->cmd, VK_CULL_MODE_NONE);
+   t->CmdSetFrontFace(t->cmd, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+   test_viewport(t, 0, Q, TEST_SIZE, Q);
+   test_bind_quad(t, s, 4);
+   t->CmdDraw(t->cmd, 6, 1, 0, 0);
+}
+
+static const struct {
+   const char *name;
+   void (*record)(struct test_target *t, struct test_scene *s);
+} test_filter_sequences[] = {
+   { "viewport", test_filter_viewport },
+   { "scissor", test_filter_scissor },
+   { "pipeline", test_filter_pipeline },
+   { "vertex_buffers", test_filter_vertex_buffers },
+   { "index_buffer", test_filter_index_buffer },
+   { "cull", test_filter_cull },
+};
+
+/* Records one of the sequences above into a fresh scene. */
+static int
+test_state_filter(struct test_target *t, unsigned sequence,
+                  struct test_result *result)
+{
+   struct test_scene s;
+
+   if (!test_scene_init(t, &s))
+      return 1;
+
+   test_scene_begin(t, &s);
+   test_filter_sequences[sequence].record(t, &s);
+   test_scene_end(t, result);
+
+   test_scene_finish(t, &s);
+   return 0;
+}
+
+#define TEST_STATE_FILTER(n)                                              \
+   static int                                                             \
+   test_state_filter_##n(struct test_target *t, struct test_result *r)    \
+   {                                                                      \
+      return test_state_filter(t, n, r);                                  \
+   }
+TEST_STATE_FILTER(0)
+TEST_STATE_FILTER(1)
+TEST_STATE_FILTER(2)
+TEST_STATE_FILTER(3)
+TEST_STATE_FILTER(4)
+TEST_STATE_FILTER(5)
+#undef TEST_STATE_FILTER
+
+/*
+ * Load/store op tests, with WRAPPER_RECORD_THREADS=1 and
+ * WRAPPER_LOAD_STORE_OPS=1 or WRAPPER_MERGE_RENDERING=1.  Two rendering
+ * instances on the same transient multisampled attachment, separated by
+ * a barrier, each resolve into their own image, which is what gets
+ * compared.
+ */
+
+#define TEST_SAMPLES VK_SAMPLE_COUNT_4_BIT
+
+struct test_msaa {
+   VkImage image;
+   VkImageView view;
+   VkDeviceMemory memory;
+};
+
+static bool
+test_msaa_init(struct test_target *t, struct test_msaa *m)
+{
+   VkMemoryRequirements reqs;
+
+   if (!(t->sample_counts & TEST_SAMPLES))
+      return false;
+
+   t->CreateImage(t->device,
+      &(VkImageCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+         .imageType = VK_IMAGE_TYPE_2D,
+         .format = TEST_FORMAT,
+         .extent = { TEST_SIZE, TEST_SIZE, 1 },
+         .mipLevels = 1,
+         .arrayLayers = 1,
+         .samples = TEST_SAMPLES,
+         .tiling = VK_IMAGE_TILING_OPTIMAL,
+         .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                  VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+      }, NULL, &m->image);
+   t->GetImageMemoryRequirements(t->device, m->image, &reqs);
+   m->memory = test_alloc(t, &reqs, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+   t->BindImageMemory(t->device, m->image, m->memory, 0);
+   t->CreateImageView(t->device,
+      &(VkImageViewCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+         .image = m->image,
+         .viewType = VK_IMAGE_VIEW_TYPE_2D,
+         .format = TEST_FORMAT,
+         .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+      }, NULL, &m->view);
+
+   return true;
+}
+
+static void
+test_msaa_finish(struct test_target *t, struct test_msaa *m)
+{
+   t->QueueWaitIdle(t->queue);
+   t->DestroyImageView(t->device, m->view, NULL);
+   t->DestroyImage(t->device, m->image, NULL);
+   t->FreeMemory(t->device, m->memory, NULL);
+}
+
+static void
+test_msaa_begin(struct test_target *t, struct test_msaa *m)
+{
+   test_begin(t);
+   t->CmdPipelineBarrier(t->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL,
+      1, &(VkImageMemoryBarrier) {
+         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+         .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+         .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+         .image = m->image,
+         .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+      });
+}
+
+/* Renders to the multisampled attachment, resolving into image. */
+static void
+test_msaa_rendering(struct test_target *t, struct test_msaa *m,
+                    unsigned image, VkAttachmentLoadOp load_op,
+                    VkAttachmentStoreOp store_op, float r, float g, float b)
+{
+   test_begin_rendering(t,
+      &(VkRenderingAttachmentInfo) {
+         .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+         .imageView = m->view,
+         .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         .resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT,
+         .resolveImageView = t->views[image],
+         .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+         .loadOp = load_op,
+         .storeOp = store_op,
+         .clearValue.color.float32 = { r, g, b, 1.0f },
+      }, &test_full_area);
+}
+
+static const VkRect2D test_inner_rect = { { 8, 8 }, { 16, 24 } };
+
+/* The first instance's STORE is dead: the second one clears everything
+ * with its first command.
+ */
+static int
+test_store_to_dont_care(struct test_target *t, struct test_result *result)
+{
+   struct test_msaa m;
+
+   if (!test_msaa_init(t, &m))
+      return 77;
+
+   test_msaa_begin(t, &m);
+   test_msaa_rendering(t, &m, 0, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                       VK_ATTACHMENT_STORE_OP_STORE, 1, 0, 0);
+   t->CmdEndRendering(t->cmd);
+   test_attachment_barrier(t);
+   test_msaa_rendering(t, &m, 1, VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                       VK_ATTACHMENT_STORE_OP_DONT_CARE, 0, 0, 0);
+   test_clear_rect(t, &test_full_area, 0, 0, 1);
+   t->CmdEndRendering(t->cmd);
+   test_end(t, 2);
+
+   result->image_count = 2;
+   result->defined[0] = test_full_area;
+   result->defined[1] = test_full_area;
+
+   test_msaa_finish(t, &m);
+   return 0;
+}
+
+/* The second instance's LOAD reads what the first one didn't store, so
+ * only the rectangle it clears is defined.
+ */
+static int
+test_load_to_dont_care(struct test_target *t, struct test_result *result)
+{
+   struct test_msaa m;
+
+   if (!test_msaa_init(t, &m))
+      return 77;
+
+   test_msaa_begin(t, &m);
+   test_msaa_rendering(t, &m, 0, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                       VK_ATTACHMENT_STORE_OP_DONT_CARE, 1, 0, 0);
+   t->CmdEndRendering(t->cmd);
+   test_attachment_barrier(t);
+   test_msaa_rendering(t, &m, 1, VK_ATTACHMENT_LOAD_OP_LOAD,
+                       VK_ATTACHMENT_STORE_OP_STORE, 0, 0, 0);
+   test_clear_rect(t, &test_inner_rect, 0, 1, 0);
+   t->CmdEndRendering(t->cmd);
+   test_end(t, 2);
+
+   result->image_count = 2;
+   result->defined[0] = test_full_area;
+   result->defined[1] = test_inner_rect;
+
+   test_msaa_finish(t, &m);
+   return 0;
+}
+
+/* Both ops are live here; rewriting either would lose the red around the
+ * green rectangle.
+ */
+static int
+test_load_store_kept(struct test_target *t, struct test_result *result)
+{
+   struct test_msaa m;
+
+   if (!test_msaa_init(t, &m))
+      return 77;
+
+   test_msaa_begin(t, &m);
+   test_msaa_rendering(t, &m, 0, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                       VK_ATTACHMENT_STORE_OP_STORE, 1, 0, 0);
+   t->CmdEndRendering(t->cmd);
+   test_attachment_barrier(t);
+   test_msaa_rendering(t, &m, 1, VK_ATTACHMENT_LOAD_OP_LOAD,
+                       VK_ATTACHMENT_STORE_OP_STORE, 0, 0, 0);
+   test_clear_rect(t, &test_inner_rect, 0, 1, 0);
+   t->CmdEndRendering(t->cmd);
+   test_end(t, 2);
+
+   result->image_count = 2;
+   result->defined[0] = test_full_area;
+   result->defined[1] = test_full_area;
+
+   test_msaa_finish(t, &m);
+   return 0;
+}
+
+/* Back to back instances on the same single-sampled attachment, which
+ * WRAPPER_MERGE_RENDERING turns into one.
+ */
+static int
+test_merge_rendering(struct test_target *t, struct test_result *result)
+{
+   VkRenderingAttachmentInfo color = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = t->views[0],
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue.color.float32 = { 1, 0, 0, 1 },
+   };
+
+   test_begin(t);
+   test_begin_rendering(t, &color, &test_full_area);
+   test_clear_rect(t, &test_inner_rect, 0, 1, 0);
+   t->CmdEndRendering(t->cmd);
+
+   color.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+   test_begin_rendering(t, &color, &test_full_area);
+   test_clear_rect(t, &(VkRect2D) { { 16, 16 }, { 32, 40 } }, 0, 0, 1);
+   t->CmdEndRendering(t->cmd);
+   test_end(t, 1);
+
+   result->image_count = 1;
+   result->defined[0] = test_full_area;
+   return 0;
+}
+
+struct test_case {
+   const char *name;
+   /* "NAME=VALUE" */
+   const char *options[TEST_MAX_OPTIONS];
+   /* Returns 0 on success, 77 if the driver can't run it. */
+   int (*run)(struct test_target *t, struct test_result *result);
+};
+
+static const struct test_case test_cases[] = {
+   { "state_filter_viewport", { "WRAPPER_STATE_FILTER=1" },
+     test_state_filter_0 },
+   { "state_filter_scissor", { "WRAPPER_STATE_FILTER=1" },
+     test_state_filter_1 },
+   { "state_filter_pipeline", { "WRAPPER_STATE_FILTER=1" },
+     test_state_filter_2 },
+   { "state_filter_vertex_buffers", { "WRAPPER_STATE_FILTER=1" },
+     test_state_filter_3 },
+   { "state_filter_index_buffer", { "WRAPPER_STATE_FILTER=1" },
+     test_state_filter_4 },
+   { "state_filter_cull", { "WRAPPER_STATE_FILTER=1" },
+     test_state_filter_5 },
+   { "store_to_dont_care",
+     { "WRAPPER_RECORD_THREADS=1", "WRAPPER_LOAD_STORE_OPS=1" },
+     test_store_to_dont_care },
+   { "load_to_dont_care",
+     { "WRAPPER_RECORD_THREADS=1", "WRAPPER_LOAD_STORE_OPS=1" },
+     test_load_to_dont_care },
+   { "load_store_kept",
+     { "WRAPPER_RECORD_THREADS=1", "WRAPPER_LOAD_STORE_OPS=1" },
+     test_load_store_kept },
+   { "merge_rendering",
+     { "WRAPPER_RECORD_THREADS=1", "WRAPPER_MERGE_RENDERING=1" },
+     test_merge_rendering },
+};
+
+/* Runs a test on one target, leaving its pixels in out. */
+static int
+test_run_target(struct test_target *t, const struct test_case *c,
+                struct test_result *result, uint8_t *out)
+{
+   struct test_target tt = {
+      .name = t->name,
+      .gipa = t->gipa,
+      .CreateInstance = t->CreateInstance,
+   };
+   int ret = test_init(&tt);
+
+   if (ret == 0) {
+      ret = c->run(&tt, result);
+      if (ret == 0) {
+         memcpy(out, tt.pixels,
+                result->image_count * TEST_SIZE * TEST_SIZE * 4);
+      } else if (ret != 77) {
+         fprintf(stderr, "%s: %s: could not set up the test\n",
+                 c->name, t->name);
+      }
+      test_finish(&tt);
+   } else if (ret != 77) {
+      fprintf(stderr, "%s: %s: could not create a device\n",
+              c->name, t->name);
+   }
+
+   return ret;
+}
+
+static bool
+test_compare(const struct test_case *c, const struct test_result *result,
+             const uint8_t *expected, const uint8_t *actual)
+{
+   for (unsigned i = 0; i < result->image_count; i++) {
+      const VkRect2D *rect = &result->defined[i];
+
+      for (uint32_t y = 0; y < rect->extent.height; y++) {
+         for (uint32_t x = 0; x < rect->extent.width; x++) {
+            unsigned px = rect->offset.x + x, py = rect->offset.y + y;
+            size_t offset = ((i * TEST_SIZE + py) * TEST_SIZE + px) * 4;
+
+            if (memcmp(expected + offset, actual + offset, 4)) {
+               fprintf(stderr, "%s: image %u pixel (%u, %u): expected "
+                       "%02x%02x%02x%02x, got %02x%02x%02x%02x\n",
+                       c->name, i, px, py,
+                       expected[offset], expected[offset + 1],
+                       expected[offset + 2], expected[offset + 3],
+                       actual[offset], actual[offset + 1],
+                       actual[offset + 2], actual[offset + 3]);
+               return false;
+            }
+         }
+      }
+   }
+
+   return true;
+}
+
+static int
+test_run(struct test_target targets[2], const struct test_case *c)
+{
+   static uint8_t pixels[2][TEST_MAX_IMAGES * TEST_SIZE * TEST_SIZE * 4];
+   struct test_result results[2];
+   char *saved[TEST_MAX_OPTIONS] = { NULL };
+   char names[TEST_MAX_OPTIONS][64];
+   int ret = 0;
+
+   for (unsigned i = 0; i < TEST_MAX_OPTIONS && c->options[i]; i++) {
+      const char *value = strchr(c->options[i], '=');
+
+      snprintf(names[i], sizeof(names[i]), "%.*s",
+               (int)(value - c->options[i]), c->options[i]);
+      if (getenv(names[i]))
+         saved[i] = strdup(getenv(names[i]));
+      setenv(names[i], value + 1, 1);
+   }
+
+   for (unsigned i = 0; i < 2 && !ret; i++)
+      ret = test_run_target(&targets[i], c, &results[i], pixels[i]);
+
+   if (!ret && !test_compare(c, &results[0], pixels[0], pixels[1]))
+      ret = 1;
+
+   for (unsigned i = 0; i < TEST_MAX_OPTIONS && c->options[i]; i++) {
+      if (saved[i])
+         setenv(names[i], saved[i], 1);
+      else
+         unsetenv(names[i]);
+      free(saved[i]);
+   }
+
+   printf("%s: %s\n", c->name,
+          ret == 0 ? "pass" : ret == 77 ? "skip" : "fail");
+   return ret;
+}
+
+static bool
+test_selected(int argc, char **argv, const char *name)
+{
+   if (argc <= 2)
+      return true;
+
+   for (int i = 2; i < argc; i++) {
+      if (!strcmp(argv[i], name))
+         return true;
+   }
+   return false;
+}
+
+int
+main(int argc, char **argv)
+{
+   const char *driver = getenv("WRAPPER_VULKAN_LIBRARY");
+   struct test_target targets[2] = {
+      { .name = "direct" },
+      { .name = "wrapper" },
+   };
+   unsigned passed = 0, failed = 0;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: WRAPPER_VULKAN_LIBRARY=<driver> %s "
+              "<libvulkan_wrapper.so> [test...]\n", argv[0]);
+      return 1;
+   }
+
+   /* Nothing to wrap, so skip rather than fail. */
+   if (!driver) {
+      fprintf(stderr, "WRAPPER_VULKAN_LIBRARY is not set, skipping\n");
+      return 77;
+   }
+
+   if (!test_open(&targets[0], driver) || !test_open(&targets[1], argv[1]))
+      return 1;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(test_cases); i++) {
+      if (!test_selected(argc, argv, test_cases[i].name))
+         continue;
+
+      int ret = test_run(targets, &test_cases[i]);
+      if (ret == 0)
+         passed++;
+      else if (ret != 77)
+         failed++;
+   }
+
+   printf("%u passed, %u failed\n", passed, failed);
+
+   if (failed)
+      return 1;
+   return passed ? 0 : 77;
+}
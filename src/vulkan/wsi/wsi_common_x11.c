@@ -1731,6 +1731,7 @@ x11_manage_fifo_queues(void *state)
    assert(chain->has_present_queue);
 
    u_thread_setname("WSI swapchain queue");
+   util_thread_apply_placement(UTIL_THREAD_ROLE_LATENCY);
 
    while (chain->status >= 0) {
       /* We can block here unconditionally because after an image was sent to